@@ -30,6 +30,10 @@ _nvc () {
       COMPREPLY+=( $( compgen -W 'full compact' -- $cur ) )
       return
       ;;
+    --lib-format)
+      COMPREPLY+=( $( compgen -W 'compressed mapped' -- $cur ) )
+      return
+      ;;
     -f|--files)
       _filedir
       return
@@ -38,9 +42,9 @@ _nvc () {
 
   local global_opts='-L -h --help --messages= --std= -v --version --init --list
                      --install --work= -a -e -r -i --dump --print-deps
-                     --syntax --map= --do'
+                     --syntax --map= --do --lib-format='
   local analyse_opts='-D --define= --error-limit= --relaxed --psl --error-limit=
-                      -f --files'
+                      -f --files -j --jobs='
   local elab_opts='--cover --disable-opt --dump-llvm --dump-vcode --jit --no-save
                    --native -V --verbose'
   local run_opts='--trace --stop-time= --ieee-warnings= --stats= --stop-delta=
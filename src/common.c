@@ -25,6 +25,7 @@
 #include "option.h"
 #include "phase.h"
 #include "scan.h"
+#include "sha1.h"
 #include "thread.h"
 #include "type.h"
 #include "vlog/vlog-phase.h"
@@ -34,6 +35,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 static vhdl_standard_t  current_std  = STD_08;
 static bool             have_set_std = false;
@@ -2408,6 +2411,61 @@ void capture_syntax(text_buf_t *tb)
    syntax_buf = tb;
 }
 
+static void digest_define_cb(const char *name, const char *value, void *ctx)
+{
+   SHA1_CTX *sha = ctx;
+   SHA1Update(sha, (const unsigned char *)name, strlen(name) + 1);
+   SHA1Update(sha, (const unsigned char *)value, strlen(value) + 1);
+}
+
+static bool source_digest(const char *file, unsigned char *digest)
+{
+   // Hash the file contents along with everything else that can change
+   // the result of analysing it other than the units it depends on
+
+   if (strcmp(file, "-") == 0)
+      return false;
+
+   int fd = open(file, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   file_info_t info;
+   if (!get_handle_info(fd, &info) || info.type != FILE_REGULAR) {
+      close(fd);
+      return false;
+   }
+
+   SHA1_CTX sha;
+   SHA1Init(&sha);
+
+   if (info.size > 0) {
+      void *map = map_file(fd, info.size);
+      SHA1Update(&sha, map, info.size);
+      unmap_file(map, info.size);
+   }
+
+   close(fd);
+
+   const int32_t opts[] = {
+      standard(),
+      opt_get_int(OPT_RELAXED),
+      opt_get_int(OPT_PSL_COMMENTS),
+      opt_get_int(OPT_MISSING_BODY),
+      opt_get_int(OPT_BOOTSTRAP),
+      opt_get_int(OPT_NO_COLLAPSE),
+   };
+   SHA1Update(&sha, (const unsigned char *)opts, sizeof(opts));
+
+   SHA1Update(&sha, (const unsigned char *)PACKAGE_VERSION,
+              sizeof(PACKAGE_VERSION));
+
+   pp_defines_iter(digest_define_cb, &sha);
+
+   SHA1Final(digest, &sha);
+   return true;
+}
+
 void analyse_file(const char *file, jit_t *jit, unit_registry_t *ur)
 {
    input_from_file(file);
@@ -2416,6 +2474,12 @@ void analyse_file(const char *file, jit_t *jit, unit_registry_t *ur)
    case SOURCE_VHDL:
       {
          lib_t work = lib_work();
+
+         unsigned char digest[SHA1_LEN];
+         if (source_digest(file, digest)
+             && lib_reuse_source(work, file, digest))
+            break;   // Design units in the library are up-to-date
+
          int base_errors = 0;
          tree_t unit;
          while (base_errors = error_count(), (unit = parse())) {
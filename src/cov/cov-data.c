@@ -228,6 +228,7 @@ const loc_t *get_cover_loc(cover_item_kind_t kind, object_t *obj)
          return tree_loc(tree_value(t));
    }
 
+   object_materialise(obj);
    return &(obj->loc);
 }
 
@@ -98,6 +98,7 @@ static nvc_lock_t  diag_lock   = 0;
 
 static __thread diag_consumer_t  consumer_fn = NULL;
 static __thread void            *consumer_ctx = NULL;
+static __thread ptr_list_t       *defer_list = NULL;
 
 #define MAX_HINT_RECS 4
 static __thread hint_rec_t hint_recs[MAX_HINT_RECS];
@@ -989,7 +990,11 @@ static void diag_format_full(diag_t *d, FILE *f)
 
 void diag_femit(diag_t *d, FILE *f)
 {
-   if (d->suppress)
+   if (defer_list != NULL && !d->suppress && d->level < DIAG_FATAL) {
+      list_add(defer_list, d);   // Emitted again later by the owner
+      return;
+   }
+   else if (d->suppress)
       goto cleanup;
    else if (consumer_fn != NULL && d->level > DIAG_DEBUG)
       (*consumer_fn)(d, consumer_ctx);
@@ -1061,6 +1066,11 @@ void diag_set_consumer(diag_consumer_t fn, void *context)
    consumer_ctx = context;
 }
 
+void diag_defer(ptr_list_t *list)
+{
+   defer_list = list;
+}
+
 const char *diag_get_text(diag_t *d)
 {
    return tb_get(d->msg);
@@ -84,6 +84,10 @@ typedef enum {
 typedef void (*diag_consumer_t)(diag_t *, void *);
 void diag_set_consumer(diag_consumer_t fn, void *);
 
+// Diagnostics emitted on the current thread are appended to the list
+// instead of printed until called again with NULL
+void diag_defer(ptr_list_t *list);
+
 typedef void (*diag_hint_fn_t)(diag_t *, void *);
 void diag_add_hint_fn(diag_hint_fn_t fn, void *context);
 void diag_remove_hint_fn(diag_hint_fn_t fn);
@@ -16,8 +16,10 @@
 //
 
 #include "util.h"
+#include "array.h"
 #include "fbuf.h"
 #include "fastlz.h"
+#include "thread.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -35,8 +37,12 @@
 #define DEFAULT_ZIP FBUF_ZIP_ZSTD
 #define SPILL_SIZE 65536
 #define BLOCK_SIZE (SPILL_SIZE - (SPILL_SIZE / 16))
+#define CHUNK_SIZE (1 << 20)
+#define MAX_BATCH  16
 
 #define FBUF_HEADER_SZ 20
+#define FBUF_VERSION   1
+#define FBUF_ENTRY_SZ  12
 
 #if DEBUG
 #define ASSERT_AVAIL(f, n) do {                                 \
@@ -66,23 +72,49 @@ typedef struct {
    } u;
 } cs_state_t;
 
+// Since version 1 the file is split into chunks that are compressed
+// and checksummed independently so they can be processed in parallel.
+// The compressed chunks are followed by a table giving the compressed
+// size, uncompressed size, and checksum of each chunk and finally the
+// number of chunks.
+
+typedef struct {
+   uint8_t    *data;
+   size_t      size;
+   uint8_t    *zbuf;
+   size_t      zsize;
+   uint32_t    expect;
+   const char *error;
+   cs_state_t  checksum;
+   ZSTD_CCtx  *zstd;
+} fbuf_chunk_t;
+
+typedef struct {
+   uint32_t zsize;
+   uint32_t size;
+   uint32_t checksum;
+} fbuf_block_t;
+
+typedef A(fbuf_block_t) block_list_t;
+
 struct _fbuf {
-   fbuf_mode_t  mode;
-   char        *fname;
-   FILE        *file;
-   uint8_t     *wbuf;
-   size_t       wpend;
-   size_t       wtotal;
-   uint8_t     *rbuf;
-   size_t       rptr;
-   size_t       origsz;
-   fbuf_t      *next;
-   fbuf_t      *prev;
-   cs_state_t   checksum;
-   fbuf_zip_t   zip;
-   ZSTD_CCtx   *zstd;
-   uint8_t     *zbuf;
-   size_t       zbufsz;
+   fbuf_mode_t   mode;
+   char         *fname;
+   FILE         *file;
+   uint8_t      *wbuf;
+   size_t        wbufsz;
+   size_t        wpend;
+   size_t        wtotal;
+   uint8_t      *rbuf;
+   size_t        rptr;
+   size_t        origsz;
+   fbuf_t       *next;
+   fbuf_t       *prev;
+   cs_state_t    checksum;
+   fbuf_zip_t    zip;
+   fbuf_chunk_t  batch[MAX_BATCH];
+   unsigned      nbatch;
+   block_list_t  blocks;
 };
 
 static fbuf_t *open_list = NULL;
@@ -263,6 +295,30 @@ static uint32_t checksum_finish(cs_state_t *state)
    }
 }
 
+static void checksum_combine(cs_state_t *state, const cs_state_t *next,
+                             size_t length)
+{
+   // Update the state as if the bytes summarised by next were appended
+   // to the input of state
+   switch (state->algo) {
+   case FBUF_CS_NONE:
+      break;
+   case FBUF_CS_ADLER32:
+      {
+         const uint64_t s1a = state->u.adler32.s1;
+         const uint64_t s2a = state->u.adler32.s2;
+         const uint64_t s1b = next->u.adler32.s1;
+         const uint64_t s2b = next->u.adler32.s2;
+         const uint64_t rem = length % ADLER_MOD;
+
+         state->u.adler32.s1 = (s1a + s1b + ADLER_MOD - 1) % ADLER_MOD;
+         state->u.adler32.s2 =
+            (s2a + s2b + rem * (s1a + ADLER_MOD - 1)) % ADLER_MOD;
+      }
+      break;
+   }
+}
+
 void fbuf_cleanup(void)
 {
    for (fbuf_t *it = open_list; it != NULL; it = it->next) {
@@ -291,7 +347,7 @@ static void fbuf_write_header(fbuf_t *f)
       f->zip,                 // Compression format
       f->checksum.algo,       // Checksum algorithm
       FBUF_HEADER_SZ,         // Header size
-      0,                      // Unused
+      FBUF_VERSION,           // Container version
       0, 0, 0, 0,             // Decompressed length
       0, 0, 0, 0,             // Checksum
       0, 0, 0, 0,             // Compressed length
@@ -352,6 +408,127 @@ static void fbuf_decompress_zstd(fbuf_t *f, uint8_t *rmap, size_t bufsz)
    checksum_update(&(f->checksum), f->rbuf, f->origsz);
 }
 
+static ZSTD_CCtx *fbuf_zstd_new(void)
+{
+   ZSTD_CCtx *zstd = ZSTD_createCCtx();
+   if (zstd == NULL)
+      fatal_trace("ZSTD_createCCtx() failed");
+
+   size_t rc = ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, 3);
+   if (ZSTD_isError(rc))
+      fatal("failed to set ZSTD compression level: %s",
+            ZSTD_getErrorName(rc));
+
+   return zstd;
+}
+
+static void fbuf_run_chunks(fbuf_t *f, task_fn_t fn, fbuf_chunk_t *chunks,
+                            unsigned count)
+{
+   // Work queues can only be drained from the main thread and not from
+   // within a task it is running such as a lazy JIT compilation
+   if (count > 1 && thread_is_main() && !thread_in_task()) {
+      workq_t *wq = workq_new(f);
+
+      for (unsigned i = 0; i < count; i++)
+         workq_do(wq, fn, &(chunks[i]));
+
+      workq_start(wq);
+      workq_drain(wq);
+      workq_free(wq);
+   }
+   else {
+      for (unsigned i = 0; i < count; i++)
+         (*fn)(f, &(chunks[i]));
+   }
+}
+
+static void fbuf_decompress_task(void *context, void *arg)
+{
+   fbuf_t *f = context;
+   fbuf_chunk_t *c = arg;
+
+   switch (f->zip) {
+   case FBUF_ZIP_FASTLZ:
+      {
+         const int ret =
+            fastlz_decompress(c->zbuf, c->zsize, c->data, c->size);
+         if (ret != c->size)
+            c->error = "invalid compression format";
+      }
+      break;
+   case FBUF_ZIP_NONE:
+      if (c->zsize != c->size)
+         c->error = "invalid compression format";
+      else
+         memcpy(c->data, c->zbuf, c->size);
+      break;
+   case FBUF_ZIP_ZSTD:
+      {
+         const size_t dsize =
+            ZSTD_decompress(c->data, c->size, c->zbuf, c->zsize);
+         if (ZSTD_isError(dsize))
+            c->error = ZSTD_getErrorName(dsize);
+         else if (dsize != c->size)
+            c->error = "inconsistent size";
+      }
+      break;
+   }
+
+   checksum_init(&(c->checksum), f->checksum.algo);
+   checksum_update(&(c->checksum), c->data, c->size);
+}
+
+static void fbuf_decompress_chunks(fbuf_t *f, uint8_t *rmap, size_t bufsz)
+{
+   if (bufsz < sizeof(uint32_t))
+      fatal("file %s has invalid compression format", f->fname);
+
+   const uint32_t nchunks = UNPACK_BE32(rmap + bufsz - sizeof(uint32_t));
+   const uint64_t tablesz =
+      nchunks * (uint64_t)FBUF_ENTRY_SZ + sizeof(uint32_t);
+   if (tablesz > bufsz)
+      fatal("file %s has invalid compression format", f->fname);
+
+   const uint8_t *table = rmap + bufsz - tablesz;
+   const size_t limit = bufsz - tablesz;
+
+   fbuf_chunk_t *chunks LOCAL = xcalloc_array(nchunks, sizeof(fbuf_chunk_t));
+
+   size_t zoff = 0, off = 0;
+   for (unsigned i = 0; i < nchunks; i++) {
+      const uint8_t *entry = table + i * FBUF_ENTRY_SZ;
+
+      fbuf_chunk_t *c = &(chunks[i]);
+      c->zsize  = UNPACK_BE32(entry);
+      c->size   = UNPACK_BE32(entry + 4);
+      c->expect = UNPACK_BE32(entry + 8);
+      c->zbuf   = rmap + zoff;
+      c->data   = f->rbuf + off;
+
+      if ((zoff += c->zsize) > limit || (off += c->size) > f->origsz)
+         fatal("file %s has invalid compression format", f->fname);
+   }
+
+   if (off != f->origsz)
+      fatal("%s inconsistent size %zu vs %zu", f->fname, off, f->origsz);
+
+   fbuf_run_chunks(f, fbuf_decompress_task, chunks, nchunks);
+
+   for (unsigned i = 0; i < nchunks; i++) {
+      fbuf_chunk_t *c = &(chunks[i]);
+      if (c->error != NULL)
+         fatal("decompress failed: %s: %s", f->fname, c->error);
+
+      const uint32_t cs = checksum_finish(&(c->checksum));
+      if (cs != c->expect)
+         fatal("%s: incorrect checksum %08x in block %u, expected %08x",
+               f->fname, cs, i, c->expect);
+
+      checksum_combine(&(f->checksum), &(c->checksum), c->size);
+   }
+}
+
 static void fbuf_decompress(fbuf_t *f)
 {
    uint8_t header[16];
@@ -404,6 +581,24 @@ static void fbuf_decompress(fbuf_t *f)
    uint8_t *payload = rmap + header_sz + userheader;
    const size_t payloadsz = filesz - header_sz - userheader;
 
+   if (header[7] > FBUF_VERSION)
+      fatal("%s: file created with a newer version of NVC", f->fname);
+   else if (header[7] == FBUF_VERSION) {
+      switch ((f->zip = header[4])) {
+      case FBUF_ZIP_FASTLZ:
+      case FBUF_ZIP_NONE:
+      case FBUF_ZIP_ZSTD:
+         fbuf_decompress_chunks(f, payload, payloadsz);
+         break;
+      default:
+         fatal("%s was created with unexpected compression algorithm %c",
+               f->fname, header[4]);
+      }
+
+      unmap_file(rmap, filesz);
+      return;
+   }
+
    switch (header[4]) {
    case FBUF_ZIP_FASTLZ:
       fbuf_decompress_fastlz(f, payload, payloadsz);
@@ -438,21 +633,8 @@ fbuf_t *fbuf_open(const char *file, fbuf_mode_t mode, fbuf_cs_t csum)
 
    checksum_init(&(f->checksum), csum);
 
-   if (f->zip == FBUF_ZIP_ZSTD && mode == FBUF_OUT) {
-      if ((f->zstd = ZSTD_createCCtx()) == NULL)
-         fatal_trace("ZSTD_createCCtx() failed");
-
-      size_t rc = ZSTD_CCtx_setParameter(f->zstd, ZSTD_c_compressionLevel, 3);
-      if (ZSTD_isError(rc))
-         fatal("failed to set ZSTD compression level: %s",
-               ZSTD_getErrorName(rc));
-
-      f->zbufsz = ZSTD_CStreamOutSize();
-      f->zbuf = xmalloc(f->zbufsz);
-   }
-
    if (mode == FBUF_OUT) {
-      f->wbuf = xmalloc(SPILL_SIZE);
+      f->wbuf = xmalloc((f->wbufsz = SPILL_SIZE));
       fbuf_write_header(f);
    }
    else
@@ -474,74 +656,125 @@ int fbuf_file_handle(fbuf_t *f)
    return fileno(f->file);
 }
 
-static void fbuf_compress_fastlz(fbuf_t *f)
+static void fbuf_compress_task(void *context, void *arg)
 {
-   uint8_t out[SPILL_SIZE];
-   const int ret = fastlz_compress_level(2, f->wbuf, f->wpend, out);
+   fbuf_t *f = context;
+   fbuf_chunk_t *c = arg;
 
-   assert((ret > 0) && (ret < SPILL_SIZE));
+   checksum_init(&(c->checksum), f->checksum.algo);
+   checksum_update(&(c->checksum), c->data, c->size);
 
-   const uint8_t blksz[4] = { PACK_BE32(ret) };
-   fbuf_write_raw(f, blksz, 4);
-
-   fbuf_write_raw(f, out, ret);
+   switch (f->zip) {
+   case FBUF_ZIP_FASTLZ:
+      c->zbuf = xmalloc(c->size + c->size / 16 + 66);
+      c->zsize = fastlz_compress_level(2, c->data, c->size, c->zbuf);
+      assert(c->zsize > 0);
+      break;
+   case FBUF_ZIP_NONE:
+      c->zsize = c->size;
+      break;
+   case FBUF_ZIP_ZSTD:
+      {
+         const size_t bound = ZSTD_compressBound(c->size);
+         c->zbuf = xmalloc(bound);
+
+         const size_t rc =
+            ZSTD_compress2(c->zstd, c->zbuf, bound, c->data, c->size);
+         if (ZSTD_isError(rc))
+            c->error = ZSTD_getErrorName(rc);
+         else
+            c->zsize = rc;
+      }
+      break;
+   }
 }
 
-static void fbuf_compress_zstd(fbuf_t *f, bool end)
+static void fbuf_flush_batch(fbuf_t *f)
 {
-   ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
-   ZSTD_inBuffer input = { f->wbuf, f->wpend, 0 };
-   bool finished;
-   do {
-      ZSTD_outBuffer output = { f->zbuf, f->zbufsz, 0 };
-      size_t remaining = ZSTD_compressStream2(f->zstd, &output, &input, mode);
-      if (ZSTD_isError(remaining))
-         fatal("ZSTD compress failed: %s", ZSTD_getErrorName(remaining));
+   fbuf_run_chunks(f, fbuf_compress_task, f->batch, f->nbatch);
 
-      if (output.pos > 0)
-         fbuf_write_raw(f, f->zbuf, output.pos);
+   for (unsigned i = 0; i < f->nbatch; i++) {
+      fbuf_chunk_t *c = &(f->batch[i]);
+      if (c->error != NULL)
+         fatal("compress failed: %s: %s", f->fname, c->error);
 
-      finished = end ? (remaining == 0) : (input.pos == input.size);
-   } while (!finished);
+      fbuf_write_raw(f, c->zbuf ?: c->data, c->zsize);
 
-   assert(input.pos == input.size);
+      const fbuf_block_t b = {
+         .zsize    = c->zsize,
+         .size     = c->size,
+         .checksum = checksum_finish(&(c->checksum)),
+      };
+      APUSH(f->blocks, b);
+
+      checksum_combine(&(f->checksum), &(c->checksum), c->size);
+      f->wtotal += c->size;
+
+      free(c->data);
+      free(c->zbuf);
+      c->data = c->zbuf = NULL;
+   }
+
+   f->nbatch = 0;
 }
 
-static void fbuf_maybe_flush(fbuf_t *f, size_t more, bool end)
+static void fbuf_end_chunk(fbuf_t *f, bool last)
 {
-   assert(more <= BLOCK_SIZE);
-   if (f->wpend + more > BLOCK_SIZE) {
+   if (f->wpend > 0) {
       if (f->zip == FBUF_ZIP_FASTLZ && f->wpend < 16) {
          // Write dummy bytes at end to meet fastlz block size requirement
          memset(f->wbuf + f->wpend, '\0', 16 - f->wpend);
          f->wpend = 16;
       }
 
-      checksum_update(&(f->checksum), f->wbuf, f->wpend);
+      fbuf_chunk_t *c = &(f->batch[f->nbatch++]);
+      c->data = f->wbuf;
+      c->size = f->wpend;
 
-      switch (f->zip) {
-      case FBUF_ZIP_FASTLZ:
-         fbuf_compress_fastlz(f);
-         break;
-      case FBUF_ZIP_NONE:
-         fbuf_write_raw(f, f->wbuf, f->wpend);
-         break;
-      case FBUF_ZIP_ZSTD:
-         fbuf_compress_zstd(f, end);
-         break;
-      default:
-         fatal_trace("unsupported compression algorithm %c", f->zip);
-      }
+      if (f->zip == FBUF_ZIP_ZSTD && c->zstd == NULL)
+         c->zstd = fbuf_zstd_new();
 
-      f->wtotal += f->wpend;
+      f->wbuf  = last ? NULL : xmalloc((f->wbufsz = CHUNK_SIZE));
       f->wpend = 0;
    }
+
+   if (f->nbatch == MAX_BATCH || (last && f->nbatch > 0))
+      fbuf_flush_batch(f);
+}
+
+static void fbuf_write_blocks(fbuf_t *f)
+{
+   for (int i = 0; i < f->blocks.count; i++) {
+      const fbuf_block_t *b = &(f->blocks.items[i]);
+      const uint8_t bytes[FBUF_ENTRY_SZ] = {
+         PACK_BE32(b->zsize),
+         PACK_BE32(b->size),
+         PACK_BE32(b->checksum),
+      };
+      fbuf_write_raw(f, bytes, ARRAY_LEN(bytes));
+   }
+
+   const uint8_t count[4] = { PACK_BE32(f->blocks.count) };
+   fbuf_write_raw(f, count, ARRAY_LEN(count));
+}
+
+static void fbuf_maybe_flush(fbuf_t *f, size_t more)
+{
+   assert(more <= BLOCK_SIZE);
+   if (f->wpend + more > f->wbufsz) {
+      if (f->wbufsz < CHUNK_SIZE)
+         f->wbuf = xrealloc(f->wbuf, (f->wbufsz *= 2));
+      else
+         fbuf_end_chunk(f, false);
+   }
 }
 
 void fbuf_close(fbuf_t *f, uint32_t *checksum)
 {
-   if (f->wbuf != NULL)
-      fbuf_maybe_flush(f, BLOCK_SIZE, true);
+   if (f->mode == FBUF_OUT) {
+      fbuf_end_chunk(f, true);
+      fbuf_write_blocks(f);
+   }
 
    const uint32_t cs = checksum_finish(&(f->checksum));
 
@@ -555,7 +788,7 @@ void fbuf_close(fbuf_t *f, uint32_t *checksum)
    if (f->rbuf != NULL)
       free(f->rbuf);
 
-   if (f->wbuf != NULL) {
+   if (f->mode == FBUF_OUT) {
       fbuf_update_header(f, cs);
       free(f->wbuf);
    }
@@ -577,10 +810,12 @@ void fbuf_close(fbuf_t *f, uint32_t *checksum)
    if (checksum != NULL)
       *checksum = checksum_finish(&(f->checksum));
 
-   if (f->zstd != NULL)
-      ZSTD_freeCCtx(f->zstd);
+   for (int i = 0; i < MAX_BATCH; i++) {
+      if (f->batch[i].zstd != NULL)
+         ZSTD_freeCCtx(f->batch[i].zstd);
+   }
 
-   free(f->zbuf);
+   ACLEAR(f->blocks);
 
    free(f->fname);
    free(f);
@@ -588,7 +823,7 @@ void fbuf_close(fbuf_t *f, uint32_t *checksum)
 
 void fbuf_put_uint(fbuf_t *f, uint64_t val)
 {
-   fbuf_maybe_flush(f, 10, false);
+   fbuf_maybe_flush(f, 10);
 
    do {
       uint8_t enc = val & 0x7f;
@@ -606,7 +841,7 @@ void fbuf_put_int(fbuf_t *f, int64_t val)
 
 void write_u32(uint32_t u, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, 4, false);
+   fbuf_maybe_flush(f, 4);
    *(f->wbuf + f->wpend++) = (u >>  0) & UINT32_C(0xff);
    *(f->wbuf + f->wpend++) = (u >>  8) & UINT32_C(0xff);
    *(f->wbuf + f->wpend++) = (u >> 16) & UINT32_C(0xff);
@@ -615,7 +850,7 @@ void write_u32(uint32_t u, fbuf_t *f)
 
 void write_u64(uint64_t u, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, 8, false);
+   fbuf_maybe_flush(f, 8);
    *(f->wbuf + f->wpend++) = (u >>  0) & UINT64_C(0xff);
    *(f->wbuf + f->wpend++) = (u >>  8) & UINT64_C(0xff);
    *(f->wbuf + f->wpend++) = (u >> 16) & UINT64_C(0xff);
@@ -628,20 +863,20 @@ void write_u64(uint64_t u, fbuf_t *f)
 
 void write_u16(uint16_t s, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, 2, false);
+   fbuf_maybe_flush(f, 2);
    *(f->wbuf + f->wpend++) = (s >> 0) & UINT16_C(0xff);
    *(f->wbuf + f->wpend++) = (s >> 8) & UINT16_C(0xff);
 }
 
 void write_u8(uint8_t u, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, 1, false);
+   fbuf_maybe_flush(f, 1);
    *(f->wbuf + f->wpend++) = u;
 }
 
 void write_raw(const void *buf, size_t len, fbuf_t *f)
 {
-   fbuf_maybe_flush(f, len, false);
+   fbuf_maybe_flush(f, len);
    memcpy(f->wbuf + f->wpend, buf, len);
    f->wpend += len;
 }
@@ -262,6 +262,23 @@ void *shash_get(shash_t *h, const char *key)
    }
 }
 
+bool shash_iter(shash_t *h, hash_iter_t *now, const char **key, void **value)
+{
+   assert(*now != HASH_END);
+
+   while (*now < h->size) {
+      const unsigned old = (*now)++;
+      if (h->keys[old] != NULL) {
+         *key   = h->keys[old];
+         *value = h->values[old];
+         return true;
+      }
+   }
+
+   *now = HASH_END;
+   return false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Hash of unsigned integers to pointers
 
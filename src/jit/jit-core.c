@@ -25,6 +25,7 @@
 #include "jit/jit.h"
 #include "lib.h"
 #include "lower.h"
+#include "mask.h"
 #include "object.h"
 #include "option.h"
 #include "rt/model.h"
@@ -170,8 +171,14 @@ jit_t *jit_new(unit_registry_t *ur)
 
 static void jit_free_func(jit_func_t *f)
 {
+   for (jit_osr_t *it = f->osr, *tmp; it; it = tmp) {
+      tmp = it->next;
+      free(it);
+   }
+
    jit_free_cfg(f);
    mptr_free(f->jit->mspace, &(f->privdata));
+   free(f->decoded);
    free(f->irbuf);
    free(f->linktab);
    if (f->owns_cpool) free(f->cpool);
@@ -224,7 +231,14 @@ void *jit_mspace_alloc(size_t size)
    return mspace_alloc(thread->jit->mspace, size);
 }
 
-static void jit_install(jit_t *j, jit_func_t *f)
+void jit_write_barrier(void *ptr, size_t size)
+{
+   jit_thread_local_t *thread = jit_thread_local();
+   assert(thread->state == JIT_RUNNING);
+   mspace_write_barrier(thread->jit->mspace, ptr, size);
+}
+
+static void jit_install_handle(jit_t *j, jit_func_t *f)
 {
    assert_lock_held(&(j->lock));
 
@@ -246,6 +260,11 @@ static void jit_install(jit_t *j, jit_func_t *f)
 
    // Synchronises with load_acquire in jit_get_func
    store_release(&(list->items[f->handle]), f);
+}
+
+static void jit_install(jit_t *j, jit_func_t *f)
+{
+   jit_install_handle(j, f);
 
    chash_put(j->index, f->name, f);
    if (f->unit) chash_put(j->index, f->unit, f);
@@ -562,13 +581,56 @@ static void jit_emit_trace(diag_t *d, const loc_t *loc, object_t *enclosing,
    }
 }
 
+static jit_ir_t *jit_last_debug(jit_anchor_t *a)
+{
+   // Scan backwards to find the last debug info
+   assert(a->irpos < a->func->nirs);
+   for (jit_ir_t *ir = &(a->func->irbuf[a->irpos]);
+        ir >= a->func->irbuf; ir--) {
+      if (ir->op == J_DEBUG)
+         return ir;
+      else if (ir->target)
+         break;
+   }
+
+   return NULL;
+}
+
+static void jit_fill_frame(jit_frame_t *frame, jit_func_t *f,
+                           const jit_ir_t *debug)
+{
+   frame->object = NULL;
+   if (f->module != NULL)
+      frame->object = object_from_locus(f->module, f->offset,
+                                        lib_load_handler);
+
+   if (debug != NULL)
+      frame->loc = debug->arg1.loc;
+   else
+      frame->loc = frame->object ? frame->object->loc : LOC_INVALID;
+
+   frame->symbol = f->name;
+}
+
 jit_stack_trace_t *jit_stack_trace(void)
 {
    jit_thread_local_t *thread = jit_thread_local();
 
+   // Calls inlined by jit_do_inline are recorded as a run of J_DEBUG
+   // instructions where all but the first name the inlined function
+
    int count = 0;
-   for (jit_anchor_t *a = thread->anchor; a; a = a->caller)
+   for (jit_anchor_t *a = thread->anchor; a; a = a->caller) {
+      jit_fill_irbuf(a->func);
+
+      const jit_ir_t *ir = jit_last_debug(a);
+      for (; ir && ir->arg2.kind == JIT_VALUE_HANDLE; ir--) {
+         count++;
+         if (ir == a->func->irbuf || (ir - 1)->op != J_DEBUG)
+            break;
+      }
       count++;
+   }
 
    jit_stack_trace_t *stack =
       xmalloc_flex(sizeof(jit_stack_trace_t), count, sizeof(jit_frame_t));
@@ -576,27 +638,19 @@ jit_stack_trace_t *jit_stack_trace(void)
 
    jit_frame_t *frame = stack->frames;
    for (jit_anchor_t *a = thread->anchor; a; a = a->caller, frame++) {
-      jit_fill_irbuf(a->func);
-
-      frame->object = NULL;
-      if (a->func->module != NULL)
-         frame->object = object_from_locus(a->func->module, a->func->offset,
-                                           lib_load_handler);
-
-      // Scan backwards to find the last debug info
-      assert(a->irpos < a->func->nirs);
-      frame->loc = frame->object ? frame->object->loc : LOC_INVALID;
-      for (jit_ir_t *ir = &(a->func->irbuf[a->irpos]);
-           ir >= a->func->irbuf; ir--) {
-         if (ir->op == J_DEBUG) {
-            frame->loc = ir->arg1.loc;
+      const jit_ir_t *ir = jit_last_debug(a);
+      for (; ir && ir->arg2.kind == JIT_VALUE_HANDLE; ir--, frame++) {
+         jit_func_t *f = jit_get_func(a->func->jit, ir->arg2.handle);
+         jit_fill_frame(frame, f, ir);
+
+         if (ir == a->func->irbuf || (ir - 1)->op != J_DEBUG) {
+            ir = NULL;
+            frame++;
             break;
          }
-         else if (ir->target)
-            break;
       }
 
-      frame->symbol = a->func->name;
+      jit_fill_frame(frame, a->func, ir);
    }
 
    return stack;
@@ -1029,6 +1083,198 @@ void jit_tier_up(jit_func_t *f)
    f->next_tier = NULL;
 }
 
+bool jit_tier_hot(jit_func_t *f)
+{
+   // True if the function was already compiled by a later tier or has
+   // used at least half its call budget in the interpreter
+   if (f->next_tier == NULL)
+      return f->entry != jit_interp;
+   else
+      return f->hotness <= f->next_tier->threshold / 2;
+}
+
+static jit_ir_t *jit_osr_emit(jit_ir_t *ir, jit_op_t op, jit_cc_t cc,
+                              jit_reg_t result, jit_value_t arg1,
+                              jit_value_t arg2)
+{
+   ir->op     = op;
+   ir->size   = JIT_SZ_UNSPEC;
+   ir->cc     = cc;
+   ir->target = 0;
+   ir->result = result;
+   ir->arg1   = arg1;
+   ir->arg2   = arg2;
+   return ir + 1;
+}
+
+static jit_osr_t *jit_new_osr(jit_func_t *f, jit_label_t label)
+{
+   jit_t *j = f->jit;
+   assert_lock_held(&(j->lock));
+
+   // Compute liveness on a private copy to avoid racing with a code
+   // generator thread that owns the CFG of the original function
+   jit_func_t copy = {
+      .irbuf = f->irbuf,
+      .nirs  = f->nirs,
+      .nregs = f->nregs,
+   };
+
+   jit_cfg_t *cfg = jit_get_cfg(&copy);
+   jit_block_t *bb = jit_block_for(cfg, label);
+   assert(bb->first == label);
+
+   int nlive = 0;
+   for (int i = 0; i < f->nregs; i++)
+      nlive += mask_test(&bb->livein, i);
+
+   jit_osr_t *osr = xcalloc_flex(sizeof(jit_osr_t), nlive, sizeof(jit_reg_t));
+   osr->label = label;
+   osr->frame = f->framesz > 0;
+   osr->flags = mask_test(&bb->livein, f->nregs);
+
+   for (int i = 0; i < f->nregs; i++) {
+      if (mask_test(&bb->livein, i))
+         osr->live[osr->nlive++] = i;
+   }
+
+   jit_free_cfg(&copy);
+
+   if (nlive + osr->frame + osr->flags > JIT_MAX_ARGS)
+      return osr;   // Cannot pass all live registers as arguments
+
+   // The registers live on entry to the loop header, a pointer to the
+   // interpreter's stack frame and the flags are received as arguments
+   // followed by a jump to the loop header in an otherwise unchanged
+   // copy of the function
+   const jit_reg_t fptr = f->nregs, tmp = f->nregs + 1;
+   const int nprologue = nlive + osr->frame + 2 * osr->flags + 1;
+
+   jit_func_t *v = xcalloc(sizeof(jit_func_t));
+   v->name    = f->name;
+   v->state   = JIT_FUNC_READY;
+   v->jit     = j;
+   v->handle  = j->next_handle++;
+   v->entry   = jit_interp;
+   v->cpool   = f->cpool;
+   v->cpoolsz = f->cpoolsz;
+   v->nregs   = f->nregs + 2;
+   v->nvars   = f->nvars;
+   v->nirs    = f->nirs + nprologue;
+   v->spec    = f->spec;
+   v->module  = f->module;
+   v->offset  = f->offset;
+   v->irbuf   = xmalloc_array(v->nirs, sizeof(jit_ir_t));
+
+   const jit_value_t none = { .kind = JIT_VALUE_INVALID };
+
+   int nargs = 0;
+   jit_ir_t *ir = v->irbuf;
+   for (int i = 0; i < nlive; i++) {
+      jit_value_t nth = { .kind = JIT_VALUE_INT64, .int64 = nargs++ };
+      ir = jit_osr_emit(ir, J_RECV, JIT_CC_NONE, osr->live[i], nth,
+                         none);
+   }
+
+   if (osr->frame) {
+      jit_value_t nth = { .kind = JIT_VALUE_INT64, .int64 = nargs++ };
+      ir = jit_osr_emit(ir, J_RECV, JIT_CC_NONE, fptr, nth, none);
+   }
+
+   if (osr->flags) {
+      jit_value_t nth = { .kind = JIT_VALUE_INT64, .int64 = nargs++ };
+      ir = jit_osr_emit(ir, J_RECV, JIT_CC_NONE, tmp, nth, none);
+
+      jit_value_t reg = { .kind = JIT_VALUE_REG, .reg = tmp };
+      jit_value_t one = { .kind = JIT_VALUE_INT64, .int64 = 1 };
+      ir = jit_osr_emit(ir, J_CMP, JIT_CC_EQ, JIT_REG_INVALID, reg, one);
+   }
+
+   jit_value_t target = {
+      .kind  = JIT_VALUE_LABEL,
+      .label = label + nprologue
+   };
+   ir = jit_osr_emit(ir, J_JUMP, JIT_CC_NONE, JIT_REG_INVALID, target, none);
+
+   assert(ir == v->irbuf + nprologue);
+
+   for (int i = 0; i < f->nirs; i++, ir++) {
+      *ir = f->irbuf[i];
+
+      if (ir->arg1.kind == JIT_VALUE_LABEL)
+         ir->arg1.label += nprologue;
+      if (ir->arg2.kind == JIT_VALUE_LABEL)
+         ir->arg2.label += nprologue;
+
+      if (ir->op == MACRO_SALLOC) {
+         // Stack allocations alias the frame of the interpreter
+         jit_value_t addr = {
+            .kind = JIT_ADDR_REG,
+            .reg  = fptr,
+            .disp = ir->arg1.int64
+         };
+         jit_osr_emit(ir, J_LEA, JIT_CC_NONE, ir->result, addr, none);
+      }
+   }
+
+   jit_install_handle(j, v);
+
+   osr->func = v;
+   return osr;
+}
+
+jit_osr_t *jit_tier_osr(jit_func_t *f, jit_label_t label)
+{
+   // Called by the interpreter when a loop in the current activation
+   // has been running for a long time: returns a copy of the function
+   // that can be entered at the loop header or NULL if this will never
+   // be possible
+
+   jit_t *j = f->jit;
+   jit_tier_t *tier = j->tiers;
+
+   if (tier == NULL)
+      return NULL;
+   else if (f->next_tier != NULL) {
+      // Later activations should also use compiled code
+      f->hotness = 0;
+      jit_tier_up(f);
+   }
+
+   // Synchronises with store_release below
+   for (jit_osr_t *it = load_acquire(&f->osr); it; it = it->next) {
+      if (it->label == label)
+         return it->func ? it : NULL;
+   }
+
+   jit_osr_t *osr;
+   {
+      SCOPED_LOCK(j->lock);
+
+      for (osr = f->osr; osr; osr = osr->next) {
+         if (osr->label == label)
+            return osr->func ? osr : NULL;
+      }
+
+      osr = jit_new_osr(f, label);
+      osr->next = f->osr;
+      store_release(&f->osr, osr);
+   }
+
+   if (osr->func == NULL)
+      return NULL;
+
+   if (opt_get_int(OPT_JIT_LOG))
+      debugf("OSR entry for %s at L%d", istr(f->name), label);
+
+   if (opt_get_int(OPT_JIT_ASYNC))
+      async_do(jit_async_cgen, osr->func, tier);
+   else
+      (*tier->plugin.cgen)(j, osr->func->handle, tier->context);
+
+   return osr;
+}
+
 void jit_add_tier(jit_t *j, int threshold, const jit_plugin_t *plugin)
 {
    assert(threshold > 0);
@@ -1134,8 +1380,10 @@ jit_handle_t jit_assemble(jit_t *j, ident_t name, const char *text)
       { "$CASE",   MACRO_CASE,   1, 2 },
       { "$SALLOC", MACRO_SALLOC, 1, 2 },
       { "$LALLOC", MACRO_LALLOC, 1, 1 },
+      { "$GALLOC", MACRO_GALLOC, 1, 1 },
       { "$BZERO",  MACRO_BZERO,  1, 1 },
       { "$MEMSET", MACRO_MEMSET, 1, 2 },
+      { "$BARRIER", MACRO_BARRIER, 0, 2 },
       { "$EXP",    MACRO_EXP,    1, 2 },
       { "$FEXP",   MACRO_FEXP,   1, 2 },
    };
@@ -45,7 +45,7 @@ const char *jit_op_name(jit_op_t op)
       static const char *names[] = {
          "$COPY", "$GALLOC", "$EXIT", "$FEXP", "$EXP", "$BZERO",
          "$GETPRIV", "$PUTPRIV", "$LALLOC", "$SALLOC", "$CASE",
-         "$TRIM", "$MOVE", "$MEMSET", "$REEXEC", "$SADD",
+         "$TRIM", "$MOVE", "$MEMSET", "$REEXEC", "$SADD", "$BARRIER",
       };
       assert(op - __MACRO_BASE < ARRAY_LEN(names));
       return names[op - __MACRO_BASE];
@@ -312,7 +312,8 @@ static int jit_interleaved_cb(int op, void *ctx)
       if (ir->op == J_DEBUG) {
          if (ir->target)
             d->lpend = d->next_ir;
-         if (ir->arg2.vpos.block != block || ir->arg2.vpos.op != op)
+         if (ir->arg2.kind == JIT_VALUE_VPOS
+             && (ir->arg2.vpos.block != block || ir->arg2.vpos.op != op))
             break;
       }
       else {
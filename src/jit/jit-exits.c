@@ -25,6 +25,7 @@
 #include "object.h"
 #include "psl/psl-node.h"
 #include "rt/assert.h"
+#include "rt/model.h"
 #include "rt/mspace.h"
 #include "rt/rt.h"
 #include "rt/structs.h"
@@ -46,6 +47,8 @@
 void x_file_open(int8_t *status, void **_fp, const uint8_t *name_bytes,
                  int32_t name_len, int8_t mode)
 {
+   model_serialise();
+
    FILE **fp = (FILE **)_fp;
 
    char *fname LOCAL = xmalloc(name_len + 1);
@@ -101,6 +104,8 @@ void x_file_open(int8_t *status, void **_fp, const uint8_t *name_bytes,
 
 void x_file_write(void **_fp, uint8_t *data, int64_t len)
 {
+   model_serialise();
+
    FILE **fp = (FILE **)_fp;
 
    if (*fp == NULL)
@@ -111,6 +116,8 @@ void x_file_write(void **_fp, uint8_t *data, int64_t len)
 
 int64_t x_file_read(void **_fp, uint8_t *data, int64_t size, int64_t count)
 {
+   model_serialise();
+
    FILE **fp = (FILE **)_fp;
 
    if (*fp == NULL)
@@ -856,6 +863,8 @@ void __nvc_do_exit(jit_exit_t which, jit_anchor_t *anchor, jit_scalar_t *args,
 
    case JIT_EXIT_DEBUG_OUT:
       {
+         model_serialise();
+
          int64_t value = args[0].integer;
          debugf("DEBUG %"PRIi64, value);
       }
@@ -1136,12 +1145,20 @@ void *__nvc_mspace_alloc(uintptr_t size, jit_anchor_t *anchor)
    else if (size == 0)
       size = 1;   // Never return a NULL pointer
 
-   void *ptr = jit_mspace_alloc(size);
+   // Generated code calls the write barrier before storing a pointer
+   // so the object does not need to be remembered
+   void *ptr = mspace_alloc_barrier(jit_get_mspace(thread->jit), size);
 
    thread->anchor = NULL;
    return ptr;
 }
 
+DLLEXPORT
+void __nvc_write_barrier(void *ptr, uintptr_t size)
+{
+   jit_write_barrier(ptr, size);
+}
+
 DLLEXPORT
 void __nvc_putpriv(jit_handle_t handle, void *data)
 {
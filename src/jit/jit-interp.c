@@ -22,6 +22,7 @@
 #include "jit/jit-exits.h"
 #include "jit/jit-priv.h"
 #include "jit/jit-ffi.h"
+#include "option.h"
 #include "rt/mspace.h"
 #include "tree.h"
 #include "type.h"
@@ -30,6 +31,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,8 +47,14 @@ typedef struct _jit_interp {
    mspace_t      *mspace;
    jit_anchor_t  *anchor;
    tlab_t        *tlab;
+   unsigned       backedges;
 } jit_interp_t;
 
+// Number of backward jumps in one activation before attempting to
+// continue in compiled code and then the interval between retries
+#define OSR_THRESHOLD 10000
+#define OSR_POLL      1000
+
 #ifdef DEBUG
 #define JIT_ASSERT(expr) do {                                      \
       if (unlikely(!(expr))) {                                     \
@@ -802,7 +810,8 @@ static void interp_galloc(jit_interp_t *state, jit_ir_t *ir)
    else if (bytes == 0)
       bytes = 1;   // Never return a NULL pointer
 
-   state->regs[ir->result].pointer = mspace_alloc(state->mspace, bytes);
+   state->regs[ir->result].pointer =
+      mspace_alloc_barrier(state->mspace, bytes);
 
    thread->anchor = NULL;
 }
@@ -884,178 +893,886 @@ static void interp_sadd(jit_interp_t *state, jit_ir_t *ir)
    FOR_EACH_SIZE(ir->size, SADD);
 }
 
+static void interp_barrier(jit_interp_t *state, jit_ir_t *ir)
+{
+   void *ptr = interp_get_pointer(state, ir->arg1);
+   const size_t size = interp_get_int(state, ir->arg2);
+
+   mspace_write_barrier(state->mspace, ptr, size);
+}
+
+static bool interp_backedge(jit_interp_t *state)
+{
+   jit_osr_t *osr = jit_tier_osr(state->func, state->pc);
+   if (osr == NULL) {
+      state->backedges = UINT_MAX;   // Never possible
+      return false;
+   }
+
+   jit_func_t *f = osr->func;
+   jit_entry_fn_t entry = load_acquire(&f->entry);
+   if (entry == jit_interp) {
+      state->backedges = OSR_POLL;   // Still compiling
+      return false;
+   }
+
+   int nargs = 0;
+   for (int i = 0; i < osr->nlive; i++)
+      state->args[nargs++] = state->regs[osr->live[i]];
+
+   if (osr->frame)
+      state->args[nargs++].pointer = state->frame;
+
+   if (osr->flags)
+      state->args[nargs++].integer = state->flags;
+
+   // The compiled code sends any results directly to the caller
+   (*entry)(f, state->anchor->caller, state->args, state->tlab);
+   return true;
+}
+
+__attribute__((always_inline))
+static inline bool interp_step(jit_interp_t *state, jit_ir_t *ir)
+{
+   switch (ir->op) {
+   case J_RECV:
+      interp_recv(state, ir);
+      break;
+   case J_SEND:
+      interp_send(state, ir);
+      break;
+   case J_AND:
+      interp_and(state, ir);
+      break;
+   case J_OR:
+      interp_or(state, ir);
+      break;
+   case J_XOR:
+      interp_xor(state, ir);
+      break;
+   case J_SUB:
+      interp_sub(state, ir);
+      break;
+   case J_FSUB:
+      interp_fsub(state, ir);
+      break;
+   case J_ADD:
+      interp_add(state, ir);
+      break;
+   case J_FADD:
+      interp_fadd(state, ir);
+      break;
+   case J_MUL:
+      interp_mul(state, ir);
+      break;
+   case J_FMUL:
+      interp_fmul(state, ir);
+      break;
+   case J_DIV:
+      interp_div(state, ir);
+      break;
+   case J_FDIV:
+      interp_fdiv(state, ir);
+      break;
+   case J_SHL:
+      interp_shl(state, ir);
+      break;
+   case J_ASR:
+      interp_asr(state, ir);
+      break;
+   case J_RET:
+      return false;
+   case J_STORE:
+      interp_store(state, ir);
+      break;
+   case J_ULOAD:
+      interp_uload(state, ir);
+      break;
+   case J_LOAD:
+      interp_load(state, ir);
+      break;
+   case J_CMP:
+      interp_cmp(state, ir);
+      break;
+   case J_CCMP:
+      interp_ccmp(state, ir);
+      break;
+   case J_FCMP:
+      interp_fcmp(state, ir);
+      break;
+   case J_FCCMP:
+      interp_fccmp(state, ir);
+      break;
+   case J_CSET:
+      interp_cset(state, ir);
+      break;
+   case J_JUMP:
+      interp_jump(state, ir);
+      if (state->pc <= ir - state->func->irbuf
+          && --(state->backedges) == 0 && interp_backedge(state))
+         return false;   // Continued in compiled code
+      break;
+   case J_TRAP:
+      interp_trap(state, ir);
+      break;
+   case J_CALL:
+      interp_call(state, ir);
+      break;
+   case J_MOV:
+      interp_mov(state, ir);
+      break;
+   case J_CSEL:
+      interp_csel(state, ir);
+      break;
+   case J_NEG:
+      interp_neg(state, ir);
+      break;
+   case J_FNEG:
+      interp_fneg(state, ir);
+      break;
+   case J_NOT:
+      interp_not(state, ir);
+      break;
+   case J_SCVTF:
+      interp_scvtf(state, ir);
+      break;
+   case J_FCVTNS:
+      interp_fcvtns(state, ir);
+      break;
+   case J_LEA:
+      interp_lea(state, ir);
+      break;
+   case J_REM:
+      interp_rem(state, ir);
+      break;
+   case J_CLAMP:
+      interp_clamp(state, ir);
+      break;
+   case J_DEBUG:
+   case J_NOP:
+      break;
+   case MACRO_COPY:
+      interp_copy(state, ir);
+      break;
+   case MACRO_MOVE:
+      interp_move(state, ir);
+      break;
+   case MACRO_BZERO:
+      interp_bzero(state, ir);
+      break;
+   case MACRO_MEMSET:
+      interp_memset(state, ir);
+      break;
+   case MACRO_GALLOC:
+      interp_galloc(state, ir);
+      break;
+   case MACRO_LALLOC:
+      interp_lalloc(state, ir);
+      break;
+   case MACRO_SALLOC:
+      interp_salloc(state, ir);
+      break;
+   case MACRO_EXIT:
+      interp_exit(state, ir);
+      break;
+   case MACRO_FEXP:
+      interp_fexp(state, ir);
+      break;
+   case MACRO_EXP:
+      interp_exp(state, ir);
+      break;
+   case MACRO_GETPRIV:
+      interp_getpriv(state, ir);
+      break;
+   case MACRO_PUTPRIV:
+      interp_putpriv(state, ir);
+      break;
+   case MACRO_CASE:
+      interp_case(state, ir);
+      break;
+   case MACRO_TRIM:
+      interp_trim(state, ir);
+      break;
+   case MACRO_REEXEC:
+      interp_reexec(state, ir);
+      return false;
+   case MACRO_SADD:
+      interp_sadd(state, ir);
+      break;
+   case MACRO_BARRIER:
+      interp_barrier(state, ir);
+      break;
+   default:
+      interp_dump(state);
+      fatal_trace("cannot interpret opcode %s", jit_op_name(ir->op));
+   }
+
+   return true;
+}
+
 static void interp_loop(jit_interp_t *state)
 {
    for (;;) {
       JIT_ASSERT(state->pc < state->func->nirs);
       jit_ir_t *ir = &(state->func->irbuf[state->pc++]);
+      if (!interp_step(state, ir))
+         return;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Threaded dispatch over pre-decoded instructions
+
+#define INTERP_OPS(x)                                                   \
+   x(SLOW) x(RET) x(NOP) x(RECV) x(SEND_R) x(SEND_I) x(MOV_R) x(MOV_I)  \
+   x(LEA) x(SALLOC) x(CSET)                                             \
+   x(ADD_RR) x(ADD_RI) x(SUB_RR) x(SUB_RI) x(MUL_RR) x(MUL_RI)          \
+   x(AND_RR) x(AND_RI) x(OR_RR) x(OR_RI) x(XOR_RR) x(XOR_RI)            \
+   x(SHL_RR) x(SHL_RI) x(ASR_RR) x(ASR_RI)                              \
+   x(CMP_EQ_RR) x(CMP_EQ_RI) x(CMP_NE_RR) x(CMP_NE_RI)                  \
+   x(CMP_LT_RR) x(CMP_LT_RI) x(CMP_GT_RR) x(CMP_GT_RI)                  \
+   x(CMP_LE_RR) x(CMP_LE_RI) x(CMP_GE_RR) x(CMP_GE_RI)                  \
+   x(CMPJ_EQ_RR) x(CMPJ_EQ_RI) x(CMPJ_NE_RR) x(CMPJ_NE_RI)              \
+   x(CMPJ_LT_RR) x(CMPJ_LT_RI) x(CMPJ_GT_RR) x(CMPJ_GT_RI)              \
+   x(CMPJ_LE_RR) x(CMPJ_LE_RI) x(CMPJ_GE_RR) x(CMPJ_GE_RI)              \
+   x(JUMP) x(JUMP_T) x(JUMP_F) x(LOOP) x(LOOP_T) x(LOOP_F)              \
+   x(LOAD8) x(LOAD16) x(LOAD32) x(LOAD64)                               \
+   x(ULOAD8) x(ULOAD16) x(ULOAD32) x(ULOAD64)                           \
+   x(STORE8_R) x(STORE8_I) x(STORE16_R) x(STORE16_I)                    \
+   x(STORE32_R) x(STORE32_I) x(STORE64_R) x(STORE64_I)                  \
+   x(LOAD32_ADD) x(LOAD64_ADD) x(CASES) x(CASE_TABLE) x(CASE_BSEARCH)
+
+typedef enum {
+#define INTERP_ENUM(name) I_##name,
+   INTERP_OPS(INTERP_ENUM)
+#undef INTERP_ENUM
+   I_LAST_OP
+} interp_op_t;
+
+STATIC_ASSERT(I_LAST_OP <= UINT8_MAX);
+
+// Each IR instruction is decoded into one of these with the operand
+// kinds already resolved.  Superinstructions that also execute the
+// following IR instruction leave its record in place so it can still
+// be the target of a branch.
+typedef struct {
+   uint8_t   op;
+   uint8_t   sense;
+   uint8_t   back;
+   jit_reg_t result;
+   jit_reg_t r1;
+   jit_reg_t r2;
+   jit_reg_t r3;
+   int32_t   disp;
+   int64_t   imm;
+} interp_insn_t;
+
+STATIC_ASSERT(sizeof(interp_insn_t) == 24);
+
+typedef struct {
+   int64_t     value;
+   jit_label_t target;
+} interp_case_t;
+
+typedef struct _jit_decoded {
+   interp_case_t *cases;
+   interp_insn_t  insns[0];
+} jit_decoded_t;
+
+static inline bool interp_is_imm(jit_value_t value)
+{
+   return value.kind == JIT_VALUE_INT64 || value.kind == JIT_VALUE_DOUBLE;
+}
+
+static int interp_cc_index(jit_cc_t cc)
+{
+   switch (cc) {
+   case JIT_CC_EQ: return 0;
+   case JIT_CC_NE: return 1;
+   case JIT_CC_LT: return 2;
+   case JIT_CC_GT: return 3;
+   case JIT_CC_LE: return 4;
+   case JIT_CC_GE: return 5;
+   default: return -1;
+   }
+}
+
+static void interp_decode_binary(interp_insn_t *insn, jit_ir_t *ir,
+                                 interp_op_t base)
+{
+   if (ir->arg1.kind != JIT_VALUE_REG)
+      return;
+
+   insn->result = ir->result;
+   insn->r1     = ir->arg1.reg;
+
+   if (ir->arg2.kind == JIT_VALUE_REG) {
+      insn->op = base;
+      insn->r2 = ir->arg2.reg;
+   }
+   else if (interp_is_imm(ir->arg2)) {
+      insn->op  = base + 1;
+      insn->imm = ir->arg2.int64;
+   }
+}
+
+static void interp_decode_cmp(interp_insn_t *insn, jit_ir_t *ir,
+                              interp_op_t base)
+{
+   const int index = interp_cc_index(ir->cc);
+   if (index < 0 || ir->arg1.kind != JIT_VALUE_REG)
+      return;
+
+   insn->r1 = ir->arg1.reg;
+
+   if (ir->arg2.kind == JIT_VALUE_REG) {
+      insn->op = base + 2 * index;
+      insn->r2 = ir->arg2.reg;
+   }
+   else if (interp_is_imm(ir->arg2)) {
+      insn->op  = base + 2 * index + 1;
+      insn->imm = ir->arg2.int64;
+   }
+}
+
+static void interp_decode_jump(interp_insn_t *insn, jit_ir_t *ir, int pos)
+{
+   const bool back = ir->arg1.label <= pos;
+   insn->disp = ir->arg1.label;
+
+   switch (ir->cc) {
+   case JIT_CC_NONE:
+      insn->op = back ? I_LOOP : I_JUMP;
+      break;
+   case JIT_CC_T:
+      insn->op = back ? I_LOOP_T : I_JUMP_T;
+      break;
+   case JIT_CC_F:
+      insn->op = back ? I_LOOP_F : I_JUMP_F;
+      break;
+   default:
+      break;
+   }
+}
+
+static void interp_decode_switch(const jit_switch_t *sw, int pos,
+                                 interp_insn_t *insn, interp_case_t *cases)
+{
+   insn->disp = sw->length;
+
+   if (sw->kind == JIT_SWITCH_TABLE) {
+      // Header holds the lowest value and the table size
+      const int size = sw->high - sw->low + 1;
+      insn->op = I_CASE_TABLE;
+      cases[0].value  = sw->low;
+      cases[0].target = size;
+
+      for (int i = 0; i < size; i++)
+         cases[i + 1].target = pos + sw->length;   // Default
+
+      for (int i = 0; i < sw->count; i++) {
+         const int index = sw->cases[i].value - sw->low;
+         cases[index + 1].target = sw->cases[i].label;
+      }
+   }
+   else {
+      // Header holds the number of sorted values that follow
+      insn->op = I_CASE_BSEARCH;
+      cases[0].value = sw->count;
+
+      for (int i = 0; i < sw->count; i++) {
+         cases[i + 1].value  = sw->cases[i].value;
+         cases[i + 1].target = sw->cases[i].label;
+      }
+   }
+}
+
+static jit_decoded_t *interp_decode(jit_func_t *f)
+{
+   int ncases = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      if (f->irbuf[i].op != MACRO_CASE)
+         continue;
+
+      jit_switch_t sw;
+      jit_get_switch(f, i, &sw);
+
+      switch (sw.kind) {
+      case JIT_SWITCH_TABLE:
+         ncases += sw.high - sw.low + 2;
+         i += sw.length - 1;
+         break;
+      case JIT_SWITCH_BSEARCH:
+         ncases += sw.count + 1;
+         i += sw.length - 1;
+         break;
+      default:
+         ncases++;
+         break;
+      }
+
+      free(sw.cases);
+   }
+
+   const size_t insnsz = f->nirs * sizeof(interp_insn_t);
+   jit_decoded_t *d = xcalloc(sizeof(jit_decoded_t) + insnsz
+                              + ncases * sizeof(interp_case_t));
+   d->cases = (interp_case_t *)((char *)d->insns + insnsz);
+
+   for (int i = 0, nextcase = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]), *next = ir + 1;
+      interp_insn_t *insn = &(d->insns[i]);
+
+      insn->op = I_SLOW;
+
       switch (ir->op) {
+      case J_RET:
+         insn->op = I_RET;
+         break;
+      case J_NOP:
+      case J_DEBUG:
+         insn->op = I_NOP;
+         break;
       case J_RECV:
-         interp_recv(state, ir);
+         insn->op     = I_RECV;
+         insn->result = ir->result;
+         insn->imm    = ir->arg1.int64;
          break;
       case J_SEND:
-         interp_send(state, ir);
-         break;
-      case J_AND:
-         interp_and(state, ir);
+         insn->disp = ir->arg1.int64;
+         if (ir->arg2.kind == JIT_VALUE_REG) {
+            insn->op = I_SEND_R;
+            insn->r2 = ir->arg2.reg;
+         }
+         else if (interp_is_imm(ir->arg2)) {
+            insn->op  = I_SEND_I;
+            insn->imm = ir->arg2.int64;
+         }
          break;
-      case J_OR:
-         interp_or(state, ir);
+      case J_MOV:
+         insn->result = ir->result;
+         if (ir->arg1.kind == JIT_VALUE_REG) {
+            insn->op = I_MOV_R;
+            insn->r1 = ir->arg1.reg;
+         }
+         else if (interp_is_imm(ir->arg1)) {
+            insn->op  = I_MOV_I;
+            insn->imm = ir->arg1.int64;
+         }
          break;
-      case J_XOR:
-         interp_xor(state, ir);
+      case J_LEA:
+         if (ir->arg1.kind == JIT_ADDR_REG) {
+            insn->op     = I_LEA;
+            insn->result = ir->result;
+            insn->r1     = ir->arg1.reg;
+            insn->disp   = ir->arg1.disp;
+         }
          break;
-      case J_SUB:
-         interp_sub(state, ir);
+      case MACRO_SALLOC:
+         assert(ir->arg1.int64 + ir->arg2.int64 <= f->framesz);
+         insn->op     = I_SALLOC;
+         insn->result = ir->result;
+         insn->imm    = ir->arg1.int64;
          break;
-      case J_FSUB:
-         interp_fsub(state, ir);
+      case J_CSET:
+         insn->op     = I_CSET;
+         insn->result = ir->result;
          break;
       case J_ADD:
-         interp_add(state, ir);
+         if (ir->cc == JIT_CC_NONE)
+            interp_decode_binary(insn, ir, I_ADD_RR);
          break;
-      case J_FADD:
-         interp_fadd(state, ir);
+      case J_SUB:
+         if (ir->cc == JIT_CC_NONE)
+            interp_decode_binary(insn, ir, I_SUB_RR);
          break;
       case J_MUL:
-         interp_mul(state, ir);
+         if (ir->cc == JIT_CC_NONE)
+            interp_decode_binary(insn, ir, I_MUL_RR);
          break;
-      case J_FMUL:
-         interp_fmul(state, ir);
+      case J_AND:
+         interp_decode_binary(insn, ir, I_AND_RR);
          break;
-      case J_DIV:
-         interp_div(state, ir);
+      case J_OR:
+         interp_decode_binary(insn, ir, I_OR_RR);
          break;
-      case J_FDIV:
-         interp_fdiv(state, ir);
+      case J_XOR:
+         interp_decode_binary(insn, ir, I_XOR_RR);
          break;
       case J_SHL:
-         interp_shl(state, ir);
+         interp_decode_binary(insn, ir, I_SHL_RR);
          break;
       case J_ASR:
-         interp_asr(state, ir);
-         break;
-      case J_RET:
-         return;
-      case J_STORE:
-         interp_store(state, ir);
-         break;
-      case J_ULOAD:
-         interp_uload(state, ir);
-         break;
-      case J_LOAD:
-         interp_load(state, ir);
+         interp_decode_binary(insn, ir, I_ASR_RR);
          break;
       case J_CMP:
-         interp_cmp(state, ir);
-         break;
-      case J_CCMP:
-         interp_ccmp(state, ir);
-         break;
-      case J_FCMP:
-         interp_fcmp(state, ir);
-         break;
-      case J_FCCMP:
-         interp_fccmp(state, ir);
-         break;
-      case J_CSET:
-         interp_cset(state, ir);
+         if (i + 1 < f->nirs && next->op == J_JUMP
+             && (next->cc == JIT_CC_T || next->cc == JIT_CC_F)) {
+            // Compare and branch
+            interp_decode_cmp(insn, ir, I_CMPJ_EQ_RR);
+            if (insn->op != I_SLOW) {
+               insn->sense = (next->cc == JIT_CC_T);
+               insn->back  = next->arg1.label <= i + 1;
+               insn->disp  = next->arg1.label;
+               break;
+            }
+         }
+         interp_decode_cmp(insn, ir, I_CMP_EQ_RR);
          break;
       case J_JUMP:
-         interp_jump(state, ir);
-         break;
-      case J_TRAP:
-         interp_trap(state, ir);
-         break;
-      case J_CALL:
-         interp_call(state, ir);
-         break;
-      case J_MOV:
-         interp_mov(state, ir);
-         break;
-      case J_CSEL:
-         interp_csel(state, ir);
-         break;
-      case J_NEG:
-         interp_neg(state, ir);
-         break;
-      case J_FNEG:
-         interp_fneg(state, ir);
-         break;
-      case J_NOT:
-         interp_not(state, ir);
-         break;
-      case J_SCVTF:
-         interp_scvtf(state, ir);
-         break;
-      case J_FCVTNS:
-         interp_fcvtns(state, ir);
-         break;
-      case J_LEA:
-         interp_lea(state, ir);
-         break;
-      case J_REM:
-         interp_rem(state, ir);
-         break;
-      case J_CLAMP:
-         interp_clamp(state, ir);
-         break;
-      case J_DEBUG:
-      case J_NOP:
-         break;
-      case MACRO_COPY:
-         interp_copy(state, ir);
+         interp_decode_jump(insn, ir, i);
          break;
-      case MACRO_MOVE:
-         interp_move(state, ir);
-         break;
-      case MACRO_BZERO:
-         interp_bzero(state, ir);
-         break;
-      case MACRO_MEMSET:
-         interp_memset(state, ir);
-         break;
-      case MACRO_GALLOC:
-         interp_galloc(state, ir);
-         break;
-      case MACRO_LALLOC:
-         interp_lalloc(state, ir);
-         break;
-      case MACRO_SALLOC:
-         interp_salloc(state, ir);
-         break;
-      case MACRO_EXIT:
-         interp_exit(state, ir);
-         break;
-      case MACRO_FEXP:
-         interp_fexp(state, ir);
-         break;
-      case MACRO_EXP:
-         interp_exp(state, ir);
-         break;
-      case MACRO_GETPRIV:
-         interp_getpriv(state, ir);
+      case J_LOAD:
+      case J_ULOAD:
+         if (ir->arg1.kind != JIT_ADDR_REG || ir->size == JIT_SZ_UNSPEC)
+            break;
+
+         insn->op     = (ir->op == J_LOAD ? I_LOAD8 : I_ULOAD8) + ir->size;
+         insn->result = ir->result;
+         insn->r1     = ir->arg1.reg;
+         insn->disp   = ir->arg1.disp;
+
+         if (ir->op == J_LOAD && ir->size >= JIT_SZ_32 && i + 1 < f->nirs
+             && next->op == J_ADD && next->cc == JIT_CC_NONE
+             && next->arg1.kind == JIT_VALUE_REG
+             && next->arg2.kind == JIT_VALUE_REG) {
+            // Load followed by an add that uses the loaded value
+            if (next->arg1.reg == ir->result) {
+               insn->op = ir->size == JIT_SZ_32 ? I_LOAD32_ADD : I_LOAD64_ADD;
+               insn->r2 = next->arg2.reg;
+               insn->r3 = next->result;
+            }
+            else if (next->arg2.reg == ir->result) {
+               insn->op = ir->size == JIT_SZ_32 ? I_LOAD32_ADD : I_LOAD64_ADD;
+               insn->r2 = next->arg1.reg;
+               insn->r3 = next->result;
+            }
+         }
          break;
-      case MACRO_PUTPRIV:
-         interp_putpriv(state, ir);
+      case J_STORE:
+         if (ir->arg2.kind != JIT_ADDR_REG || ir->size == JIT_SZ_UNSPEC)
+            break;
+
+         insn->r1   = ir->arg2.reg;
+         insn->disp = ir->arg2.disp;
+
+         if (ir->arg1.kind == JIT_VALUE_REG) {
+            insn->op = I_STORE8_R + 2 * ir->size;
+            insn->r2 = ir->arg1.reg;
+         }
+         else if (interp_is_imm(ir->arg1)) {
+            insn->op  = I_STORE8_I + 2 * ir->size;
+            insn->imm = ir->arg1.int64;
+         }
          break;
       case MACRO_CASE:
-         interp_case(state, ir);
-         break;
-      case MACRO_TRIM:
-         interp_trim(state, ir);
-         break;
-      case MACRO_REEXEC:
-         interp_reexec(state, ir);
-         return;
-      case MACRO_SADD:
-         interp_sadd(state, ir);
+         {
+            // Long chains are lowered to a jump table or a binary
+            // search and the rest of the chain is never reached
+            jit_switch_t sw;
+            jit_get_switch(f, i, &sw);
+
+            if (sw.kind != JIT_SWITCH_LINEAR) {
+               insn->result = ir->result;
+               insn->imm    = nextcase;
+
+               interp_decode_switch(&sw, i, insn, d->cases + nextcase);
+
+               if (sw.kind == JIT_SWITCH_TABLE)
+                  nextcase += sw.high - sw.low + 2;
+               else
+                  nextcase += sw.count + 1;
+
+               i += sw.length - 1;
+               free(sw.cases);
+               break;
+            }
+         }
+
+         if (!interp_is_imm(ir->arg1))
+            break;
+
+         insn->op     = I_CASES;
+         insn->result = ir->result;
+
+         if (i > 0 && (insn - 1)->op == I_CASES && !ir->target
+             && (insn - 1)->result == ir->result) {
+            // Remainder of the chain starting at the previous case
+            insn->imm  = (insn - 1)->imm + 1;
+            insn->disp = (insn - 1)->disp - 1;
+         }
+         else {
+            // Scan the whole chain of cases testing the same register
+            // in a single dispatch
+            insn->imm = nextcase;
+            for (jit_ir_t *it = ir; it < f->irbuf + f->nirs; it++) {
+               if (it->op != MACRO_CASE || it->result != ir->result
+                   || !interp_is_imm(it->arg1) || (it != ir && it->target))
+                  break;
+
+               d->cases[nextcase].value  = it->arg1.int64;
+               d->cases[nextcase].target = it->arg2.label;
+               nextcase++;
+            }
+            insn->disp = nextcase - insn->imm;
+         }
          break;
       default:
-         interp_dump(state);
-         fatal_trace("cannot interpret opcode %s", jit_op_name(ir->op));
+         break;
+      }
+   }
+
+   return d;
+}
+
+static jit_decoded_t *interp_get_decoded(jit_func_t *f)
+{
+   jit_decoded_t *d = load_acquire(&f->decoded);
+   if (likely(d != NULL))
+      return d;
+   else if (!opt_get_int(OPT_JIT_DECODE))
+      return NULL;
+
+   d = interp_decode(f);
+
+   if (!atomic_cas(&f->decoded, NULL, d)) {
+      free(d);   // Raced with another thread
+      d = load_acquire(&f->decoded);
+   }
+
+   return d;
+}
+
+static void interp_threaded(jit_interp_t *state, jit_decoded_t *d)
+{
+   static const void *dispatch[] = {
+#define INTERP_LABEL(name) [I_##name] = &&DO_##name,
+      INTERP_OPS(INTERP_LABEL)
+#undef INTERP_LABEL
+   };
+
+   const interp_insn_t *const code = d->insns, *ip;
+   jit_scalar_t *const regs = state->regs;
+
+#define DISPATCH(next) do {                                     \
+      ip = (next);                                              \
+      JIT_ASSERT(ip < code + state->func->nirs);                \
+      goto *dispatch[ip->op];                                   \
+   } while (0)
+#define NEXT() DISPATCH(ip + 1)
+#define BRANCH(label) DISPATCH(code + (label))
+
+   DISPATCH(code + state->pc);
+
+ DO_SLOW:
+   state->pc = ip - code + 1;
+   if (!interp_step(state, &(state->func->irbuf[ip - code])))
+      return;
+   DISPATCH(code + state->pc);
+
+ DO_RET:
+   return;
+
+ DO_NOP:
+   NEXT();
+
+ DO_RECV:
+   regs[ip->result] = state->args[ip->imm];
+   state->nargs = MAX(state->nargs, ip->imm + 1);
+   NEXT();
+
+ DO_SEND_R:
+   state->args[ip->disp] = regs[ip->r2];
+   state->nargs = MAX(state->nargs, ip->disp + 1);
+   NEXT();
+
+ DO_SEND_I:
+   state->args[ip->disp].integer = ip->imm;
+   state->nargs = MAX(state->nargs, ip->disp + 1);
+   NEXT();
+
+ DO_MOV_R:
+   regs[ip->result] = regs[ip->r1];
+   NEXT();
+
+ DO_MOV_I:
+   regs[ip->result].integer = ip->imm;
+   NEXT();
+
+ DO_LEA:
+   regs[ip->result].pointer = regs[ip->r1].pointer + ip->disp;
+   NEXT();
+
+ DO_SALLOC:
+   regs[ip->result].pointer = state->frame + ip->imm;
+   NEXT();
+
+ DO_CSET:
+   regs[ip->result].integer = !!(state->flags);
+   NEXT();
+
+#define BINARY(name, op)                                                \
+ DO_##name##_RR:                                                        \
+   regs[ip->result].integer =                                           \
+      regs[ip->r1].integer op regs[ip->r2].integer;                     \
+   NEXT();                                                              \
+ DO_##name##_RI:                                                        \
+   regs[ip->result].integer = regs[ip->r1].integer op ip->imm;          \
+   NEXT();
+
+   BINARY(ADD, +);
+   BINARY(SUB, -);
+   BINARY(MUL, *);
+   BINARY(AND, &);
+   BINARY(OR, |);
+   BINARY(XOR, ^);
+   BINARY(SHL, <<);
+   BINARY(ASR, >>);
+
+#undef BINARY
+
+#define COMPARE(name, op)                                               \
+ DO_CMP_##name##_RR:                                                    \
+   state->flags = (regs[ip->r1].integer op regs[ip->r2].integer);       \
+   NEXT();                                                              \
+ DO_CMP_##name##_RI:                                                    \
+   state->flags = (regs[ip->r1].integer op ip->imm);                    \
+   NEXT();                                                              \
+ DO_CMPJ_##name##_RR:                                                   \
+   state->flags = (regs[ip->r1].integer op regs[ip->r2].integer);       \
+   goto cmpj;                                                           \
+ DO_CMPJ_##name##_RI:                                                   \
+   state->flags = (regs[ip->r1].integer op ip->imm);                    \
+   goto cmpj;
+
+   COMPARE(EQ, ==);
+   COMPARE(NE, !=);
+   COMPARE(LT, <);
+   COMPARE(GT, >);
+   COMPARE(LE, <=);
+   COMPARE(GE, >=);
+
+#undef COMPARE
+
+ cmpj:
+   if (state->flags != ip->sense)
+      DISPATCH(ip + 2);
+   else if (ip->back)
+      goto backedge;
+   else
+      BRANCH(ip->disp);
+
+ DO_JUMP:
+   BRANCH(ip->disp);
+
+ DO_JUMP_T:
+   if (state->flags)
+      BRANCH(ip->disp);
+   NEXT();
+
+ DO_JUMP_F:
+   if (!state->flags)
+      BRANCH(ip->disp);
+   NEXT();
+
+ DO_LOOP_T:
+   if (!state->flags)
+      NEXT();
+   goto backedge;
+
+ DO_LOOP_F:
+   if (state->flags)
+      NEXT();
+   goto backedge;
+
+ DO_LOOP:
+ backedge:
+   if (unlikely(--(state->backedges) == 0)) {
+      state->pc = ip->disp;
+      if (interp_backedge(state))
+         return;   // Continued in compiled code
+   }
+   BRANCH(ip->disp);
+
+#define LOAD(bits)                                                      \
+ DO_LOAD##bits:                                                         \
+   regs[ip->result].integer =                                           \
+      *(int##bits##_t *)(regs[ip->r1].pointer + ip->disp);              \
+   NEXT();                                                              \
+ DO_ULOAD##bits:                                                        \
+   regs[ip->result].integer =                                           \
+      *(uint##bits##_t *)(regs[ip->r1].pointer + ip->disp);             \
+   NEXT();                                                              \
+ DO_STORE##bits##_R:                                                    \
+   *(uint##bits##_t *)(regs[ip->r1].pointer + ip->disp) =               \
+      regs[ip->r2].integer;                                             \
+   NEXT();                                                              \
+ DO_STORE##bits##_I:                                                    \
+   *(uint##bits##_t *)(regs[ip->r1].pointer + ip->disp) = ip->imm;      \
+   NEXT();
+
+   LOAD(8);
+   LOAD(16);
+   LOAD(32);
+   LOAD(64);
+
+#undef LOAD
+
+#define LOAD_ADD(bits)                                                  \
+ DO_LOAD##bits##_ADD:                                                   \
+   regs[ip->result].integer =                                           \
+      *(int##bits##_t *)(regs[ip->r1].pointer + ip->disp);              \
+   regs[ip->r3].integer =                                               \
+      regs[ip->result].integer + regs[ip->r2].integer;                  \
+   DISPATCH(ip + 2);
+
+   LOAD_ADD(32);
+   LOAD_ADD(64);
+
+#undef LOAD_ADD
+
+ DO_CASES:
+   {
+      const int64_t test = regs[ip->result].integer;
+      const interp_case_t *cases = d->cases + ip->imm;
+      for (int i = 0; i < ip->disp; i++) {
+         if (cases[i].value == test)
+            BRANCH(cases[i].target);
+      }
+      DISPATCH(ip + ip->disp);
+   }
+
+ DO_CASE_TABLE:
+   {
+      const interp_case_t *table = d->cases + ip->imm;
+      const uint64_t index =
+         (uint64_t)regs[ip->result].integer - (uint64_t)table->value;
+      if (index < table->target)
+         BRANCH(table[index + 1].target);
+      else
+         DISPATCH(ip + ip->disp);
+   }
+
+ DO_CASE_BSEARCH:
+   {
+      const int64_t test = regs[ip->result].integer;
+      const interp_case_t *cases = d->cases + ip->imm + 1;
+      int low = 0, high = cases[-1].value - 1;
+      while (low <= high) {
+         const int mid = (low + high) / 2;
+         if (cases[mid].value == test)
+            BRANCH(cases[mid].target);
+         else if (cases[mid].value < test)
+            low = mid + 1;
+         else
+            high = mid - 1;
       }
+      DISPATCH(ip + ip->disp);
    }
+
+#undef DISPATCH
+#undef NEXT
+#undef BRANCH
 }
 
 void jit_interp(jit_func_t *f, jit_anchor_t *caller, jit_scalar_t *args,
@@ -1090,16 +1807,21 @@ void jit_interp(jit_func_t *f, jit_anchor_t *caller, jit_scalar_t *args,
 #endif
 
    jit_interp_t state = {
-      .args     = args,
-      .regs     = regs,
-      .nargs    = 0,
-      .pc       = 0,
-      .func     = f,
-      .frame    = frame,
-      .mspace   = jit_get_mspace(f->jit),
-      .anchor   = &anchor,
-      .tlab     = tlab,
+      .args      = args,
+      .regs      = regs,
+      .nargs     = 0,
+      .pc        = 0,
+      .func      = f,
+      .frame     = frame,
+      .mspace    = jit_get_mspace(f->jit),
+      .anchor    = &anchor,
+      .tlab      = tlab,
+      .backedges = OSR_THRESHOLD,
    };
 
-   interp_loop(&state);
+   jit_decoded_t *d = interp_get_decoded(f);
+   if (likely(d != NULL))
+      interp_threaded(&state, d);
+   else
+      interp_loop(&state);
 }
@@ -694,6 +694,13 @@ static void macro_reexec(jit_irgen_t *g)
    g->flags = VCODE_INVALID_REG;
 }
 
+static void macro_barrier(jit_irgen_t *g, jit_value_t addr, jit_value_t bytes)
+{
+   assert(jit_value_is_addr(addr));
+   irgen_emit_binary(g, MACRO_BARRIER, JIT_SZ_UNSPEC, JIT_CC_NONE,
+                     JIT_REG_INVALID, addr, bytes);
+}
+
 static void macro_sadd(jit_irgen_t *g, jit_size_t sz, jit_value_t addr,
                        jit_value_t addend)
 {
@@ -728,6 +735,39 @@ static int irgen_slots_for_type(vcode_type_t vtype)
    }
 }
 
+static bool irgen_has_pointers(vcode_type_t vtype)
+{
+   // True if a value of this type may hold a pointer into the garbage
+   // collected heap: signals, files, and triggers are allocated by the
+   // runtime elsewhere
+   switch (vtype_kind(vtype)) {
+   case VCODE_TYPE_INT:
+   case VCODE_TYPE_OFFSET:
+   case VCODE_TYPE_REAL:
+   case VCODE_TYPE_SIGNAL:
+   case VCODE_TYPE_FILE:
+   case VCODE_TYPE_TRIGGER:
+   case VCODE_TYPE_DEBUG_LOCUS:
+      return false;
+   case VCODE_TYPE_CARRAY:
+      return irgen_has_pointers(vtype_elem(vtype));
+   case VCODE_TYPE_UARRAY:
+      return vtype_kind(vtype_elem(vtype)) != VCODE_TYPE_SIGNAL;
+   case VCODE_TYPE_RECORD:
+      {
+         const int nfields = vtype_fields(vtype);
+         for (int i = 0; i < nfields; i++) {
+            if (irgen_has_pointers(vtype_field(vtype, i)))
+               return true;
+         }
+
+         return false;
+      }
+   default:
+      return true;
+   }
+}
+
 static int irgen_align_of(vcode_type_t vtype)
 {
    switch (vtype_kind(vtype)) {
@@ -1155,6 +1195,9 @@ static void irgen_op_copy(jit_irgen_t *g, int op)
    jit_value_t dest = jit_addr_from_value(arg0, 0);
    jit_value_t src = jit_addr_from_value(arg1, 0);
 
+   if (irgen_has_pointers(vcode_get_type(op)))
+      macro_barrier(g, dest, bytes);
+
    macro_move(g, dest, src, irgen_as_reg(g, bytes));
 }
 
@@ -1681,11 +1724,14 @@ static void irgen_store_addr(jit_irgen_t *g, vcode_type_t vtype,
       value = irgen_lea(g, value);   // Storing an address
 
    switch (vtype_kind(vtype)) {
-   case VCODE_TYPE_OFFSET:
-   case VCODE_TYPE_INT:
    case VCODE_TYPE_ACCESS:
    case VCODE_TYPE_POINTER:
    case VCODE_TYPE_CONTEXT:
+      if (value.kind == JIT_VALUE_REG)
+         macro_barrier(g, addr, jit_value_from_int64(sizeof(void *)));
+      // Fall-through
+   case VCODE_TYPE_OFFSET:
+   case VCODE_TYPE_INT:
    case VCODE_TYPE_REAL:
    case VCODE_TYPE_FILE:
    case VCODE_TYPE_TRIGGER:
@@ -1696,6 +1742,12 @@ static void irgen_store_addr(jit_irgen_t *g, vcode_type_t vtype,
       {
          const int slots = irgen_slots_for_type(vtype_elem(vtype));
          jit_reg_t base = jit_value_as_reg(value);
+
+         if (irgen_has_pointers(vtype)) {
+            jit_value_t bytes = jit_value_from_int64(slots * sizeof(void *));
+            macro_barrier(g, addr, bytes);
+         }
+
          for (int i = 0; i < slots; i++) {
             j_store(g, JIT_SZ_PTR, jit_value_from_reg(base + i), addr);
             addr = jit_addr_from_value(addr, sizeof(void *));
@@ -2217,6 +2269,7 @@ static void irgen_pcall_suspend(jit_irgen_t *g, jit_value_t state,
                                 irgen_label_t *cont)
 {
    jit_value_t pcall_ptr = irgen_pcall_ptr(g);
+   macro_barrier(g, pcall_ptr, jit_value_from_int64(sizeof(void *)));
    j_store(g, JIT_SZ_PTR, state, pcall_ptr);
 
    j_cmp(g, JIT_CC_EQ, state, jit_null_ptr());
@@ -4247,10 +4300,17 @@ void jit_irgen(jit_func_t *f)
    }
    g->labels = NULL;
 
+   int demoted = 0;
    if (kind != VCODE_UNIT_THUNK) {
+      jit_do_inline(f);
       jit_do_mem2reg(f);
+      if ((demoted = jit_do_escape(f)) > 0)
+         jit_do_mem2reg(f);   // May promote small demoted objects
       jit_do_lvn(f);
+      jit_do_gvn(f);
+      jit_do_licm(f);
       jit_do_cprop(f);
+      jit_do_range(f);
       jit_do_dce(f);
       jit_delete_nops(f);
       jit_free_cfg(f);
@@ -4260,6 +4320,9 @@ void jit_irgen(jit_func_t *f)
    store_release(&(f->state), JIT_FUNC_READY);
 
    if (opt_get_verbose(OPT_JIT_VERBOSE, istr(f->name))) {
+      if (demoted > 0)
+         debugf("%s: %d heap allocations demoted", istr(f->name), demoted);
+
 #ifdef DEBUG
       jit_dump_interleaved(f);
 #else
@@ -24,6 +24,7 @@
 #include "lib.h"
 #include "object.h"
 #include "option.h"
+#include "rt/mspace.h"
 #include "rt/rt.h"
 #include "thread.h"
 
@@ -132,6 +133,8 @@ typedef enum {
    LLVM_PUTPRIV,
    LLVM_MSPACE_ALLOC,
    LLVM_GET_OBJECT,
+   LLVM_WRITE_BARRIER,
+   LLVM_CARD_MARK,
    LLVM_TLAB_ALLOC,
    LLVM_SCHED_WAVEFORM,
    LLVM_TEST_EVENT,
@@ -176,6 +179,7 @@ typedef struct _llvm_obj {
    LLVMTypeRef           fntypes[LLVM_LAST_FN];
    LLVMValueRef          strtab;
    pack_writer_t        *pack_writer;
+   mspace_barrier_t      barrier;
 } llvm_obj_t;
 
 typedef struct _cgen_block {
@@ -234,6 +238,7 @@ typedef enum {
    FUNC_ATTR_OPTNONE,
    FUNC_ATTR_NOALIAS,
    FUNC_ATTR_INLINE,
+   FUNC_ATTR_ALWAYSINLINE,
 
    // Attributes requiring special handling
    FUNC_ATTR_PRESERVE_FP,
@@ -312,7 +317,7 @@ static void llvm_add_func_attr(llvm_obj_t *obj, LLVMValueRef fn,
       const char *names[] = {
          "nounwind", "noreturn", "readonly", "nocapture", "byval",
          "uwtable", "noinline", "writeonly", "nonnull", "cold", "optnone",
-         "noalias", "inlinehint",
+         "noalias", "inlinehint", "alwaysinline",
       };
       assert(attr < ARRAY_LEN(names));
 
@@ -931,6 +936,35 @@ static LLVMValueRef llvm_get_fn(llvm_obj_t *obj, llvm_fn_t which)
       }
       break;
 
+   case LLVM_WRITE_BARRIER:
+      {
+         LLVMTypeRef args[] = {
+            obj->types[LLVM_PTR],
+            obj->types[LLVM_INTPTR]
+         };
+         obj->fntypes[which] = LLVMFunctionType(obj->types[LLVM_VOID], args,
+                                                ARRAY_LEN(args), false);
+         fn = llvm_add_fn(obj, "__nvc_write_barrier", obj->fntypes[which]);
+         llvm_add_func_attr(obj, fn, FUNC_ATTR_NOUNWIND, -1);
+         llvm_add_func_attr(obj, fn, FUNC_ATTR_NOCAPTURE, 1);
+         llvm_add_func_attr(obj, fn, FUNC_ATTR_READONLY, 1);
+      }
+      break;
+
+   case LLVM_CARD_MARK:
+      {
+         LLVMTypeRef args[] = {
+            obj->types[LLVM_PTR],
+            obj->types[LLVM_INTPTR]
+         };
+         obj->fntypes[which] = LLVMFunctionType(obj->types[LLVM_VOID], args,
+                                                ARRAY_LEN(args), false);
+         fn = llvm_add_fn(obj, "card_mark", obj->fntypes[which]);
+         llvm_add_func_attr(obj, fn, FUNC_ATTR_NOUNWIND, -1);
+         llvm_add_func_attr(obj, fn, FUNC_ATTR_ALWAYSINLINE, -1);
+      }
+      break;
+
    case LLVM_TLAB_ALLOC:
       {
          LLVMTypeRef args[] = {
@@ -2322,6 +2356,28 @@ static void cgen_macro_sadd(llvm_obj_t *obj, cgen_block_t *cgb, jit_ir_t *ir)
    LLVMBuildStore(obj->builder, sat, ptr);
 }
 
+static void cgen_macro_barrier(llvm_obj_t *obj, cgen_block_t *cgb,
+                               jit_ir_t *ir)
+{
+   LLVMValueRef args[] = {
+      cgen_coerce_value(obj, cgb, ir->arg1, LLVM_PTR),
+      cgen_coerce_value(obj, cgb, ir->arg2, LLVM_INTPTR),
+   };
+
+   if (cgb->func->mode == CGEN_JIT) {
+      // The card table is at a fixed address for the lifetime of the
+      // heap so the common case can be inlined
+      if (obj->fns[LLVM_CARD_MARK] == NULL) {
+         mspace_t *m = jit_get_mspace(cgb->func->source->jit);
+         mspace_get_barrier(m, &(obj->barrier));
+      }
+
+      llvm_call_fn(obj, LLVM_CARD_MARK, args, ARRAY_LEN(args));
+   }
+   else
+      llvm_call_fn(obj, LLVM_WRITE_BARRIER, args, ARRAY_LEN(args));
+}
+
 static void cgen_ir(llvm_obj_t *obj, cgen_block_t *cgb, jit_ir_t *ir)
 {
    switch (ir->op) {
@@ -2485,6 +2541,9 @@ static void cgen_ir(llvm_obj_t *obj, cgen_block_t *cgb, jit_ir_t *ir)
    case MACRO_SADD:
       cgen_macro_sadd(obj, cgb, ir);
       break;
+   case MACRO_BARRIER:
+      cgen_macro_barrier(obj, cgb, ir);
+      break;
    default:
       cgen_abort(cgb, ir, "cannot generate LLVM for %s", jit_op_name(ir->op));
    }
@@ -2753,6 +2812,7 @@ static void cgen_pointer_mask(cgen_func_t *func)
       case J_ULOAD:
       case MACRO_BZERO:
       case MACRO_SADD:
+      case MACRO_BARRIER:
          cgen_must_be_pointer(func, ir->arg1);
          break;
       case J_STORE:
@@ -3164,6 +3224,101 @@ static void cgen_tlab_alloc_body(llvm_obj_t *obj)
    LLVMBuildRet(obj->builder, slow_ptr);
 }
 
+static void cgen_card_mark_body(llvm_obj_t *obj)
+{
+   LLVMValueRef fn = obj->fns[LLVM_CARD_MARK];
+   LLVMSetLinkage(fn, LLVMPrivateLinkage);
+
+   const mspace_barrier_t *b = &(obj->barrier);
+
+   LLVMBasicBlockRef entry = llvm_append_block(obj, fn, "");
+   LLVMBasicBlockRef old_bb = llvm_append_block(obj, fn, "old");
+   LLVMBasicBlockRef mark_bb = llvm_append_block(obj, fn, "mark");
+   LLVMBasicBlockRef store_bb = llvm_append_block(obj, fn, "store");
+   LLVMBasicBlockRef slow_bb = llvm_append_block(obj, fn, "slow");
+   LLVMBasicBlockRef done_bb = llvm_append_block(obj, fn, "done");
+
+   LLVMPositionBuilderAtEnd(obj->builder, entry);
+
+   LLVMValueRef ptr = LLVMGetParam(fn, 0);
+   LLVMSetValueName(ptr, "ptr");
+
+   LLVMValueRef size = LLVMGetParam(fn, 1);
+   LLVMSetValueName(size, "size");
+
+   LLVMValueRef addr = LLVMBuildPtrToInt(obj->builder, ptr,
+                                         obj->types[LLVM_INTPTR], "");
+   LLVMValueRef off = LLVMBuildSub(obj->builder, addr,
+                                   llvm_intptr(obj, b->base), "off");
+
+   // Pointers outside the heap and into young objects need no card
+   LLVMValueRef inheap = LLVMBuildICmp(obj->builder, LLVMIntULT, off,
+                                       llvm_intptr(obj, b->size), "");
+   LLVMBuildCondBr(obj->builder, inheap, old_bb, done_bb);
+
+   LLVMPositionBuilderAtEnd(obj->builder, old_bb);
+
+   LLVMValueRef line = LLVMBuildLShr(obj->builder, off,
+                                     llvm_intptr(obj, b->line_shift), "line");
+   LLVMValueRef word_index[] = {
+      LLVMBuildLShr(obj->builder, line, llvm_intptr(obj, 6), "")
+   };
+   LLVMValueRef word_ptr =
+      LLVMBuildInBoundsGEP2(obj->builder, obj->types[LLVM_INT64],
+                            llvm_ptr(obj, b->young), word_index,
+                            ARRAY_LEN(word_index), "");
+   LLVMValueRef word = LLVMBuildLoad2(obj->builder, obj->types[LLVM_INT64],
+                                      word_ptr, "");
+   LLVMSetOrdering(word, LLVMAtomicOrderingMonotonic);
+   LLVMSetAlignment(word, sizeof(uint64_t));
+
+   LLVMValueRef bit = LLVMBuildShl(obj->builder, llvm_int64(obj, 1),
+                                   LLVMBuildAnd(obj->builder, line,
+                                                llvm_intptr(obj, 63), ""),
+                                   "");
+   LLVMValueRef young = LLVMBuildICmp(obj->builder, LLVMIntNE,
+                                      LLVMBuildAnd(obj->builder, word, bit, ""),
+                                      llvm_int64(obj, 0), "young");
+   LLVMBuildCondBr(obj->builder, young, done_bb, mark_bb);
+
+   LLVMPositionBuilderAtEnd(obj->builder, mark_bb);
+
+   // Stores spanning more than one card are rare enough to leave to the
+   // runtime
+   LLVMValueRef first = LLVMBuildLShr(obj->builder, off,
+                                      llvm_intptr(obj, b->card_shift), "");
+   LLVMValueRef end = LLVMBuildAdd(obj->builder, off,
+                                   LLVMBuildSub(obj->builder, size,
+                                                llvm_intptr(obj, 1), ""),
+                                   "");
+   LLVMValueRef last = LLVMBuildLShr(obj->builder, end,
+                                     llvm_intptr(obj, b->card_shift), "");
+   LLVMValueRef single = LLVMBuildICmp(obj->builder, LLVMIntEQ, first,
+                                       last, "");
+   LLVMBuildCondBr(obj->builder, single, store_bb, slow_bb);
+
+   LLVMPositionBuilderAtEnd(obj->builder, store_bb);
+
+   LLVMValueRef card_index[] = { first };
+   LLVMValueRef card_ptr =
+      LLVMBuildInBoundsGEP2(obj->builder, obj->types[LLVM_INT8],
+                            llvm_ptr(obj, b->cards), card_index,
+                            ARRAY_LEN(card_index), "");
+   LLVMValueRef store = LLVMBuildStore(obj->builder, llvm_int8(obj, 1),
+                                       card_ptr);
+   LLVMSetOrdering(store, LLVMAtomicOrderingMonotonic);
+   LLVMBuildBr(obj->builder, done_bb);
+
+   LLVMPositionBuilderAtEnd(obj->builder, slow_bb);
+
+   LLVMValueRef args[] = { ptr, size };
+   llvm_call_fn(obj, LLVM_WRITE_BARRIER, args, ARRAY_LEN(args));
+   LLVMBuildBr(obj->builder, done_bb);
+
+   LLVMPositionBuilderAtEnd(obj->builder, done_bb);
+   LLVMBuildRetVoid(obj->builder);
+}
+
 static void cgen_exp_overflow_body(llvm_obj_t *obj, llvm_fn_t which,
                                    jit_size_t sz, llvm_fn_t mulbase)
 {
@@ -3576,6 +3731,9 @@ void llvm_obj_finalise(llvm_obj_t *obj, llvm_opt_level_t olevel)
    if (obj->fns[LLVM_TLAB_ALLOC] != NULL)
       cgen_tlab_alloc_body(obj);
 
+   if (obj->fns[LLVM_CARD_MARK] != NULL)
+      cgen_card_mark_body(obj);
+
    for (jit_size_t sz = JIT_SZ_8; sz <= JIT_SZ_64; sz++) {
       if (obj->fns[LLVM_EXP_OVERFLOW_S8 + sz] != NULL)
          cgen_exp_overflow_body(obj, LLVM_EXP_OVERFLOW_S8 + sz, sz,
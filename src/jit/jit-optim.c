@@ -1152,6 +1152,2283 @@ void jit_delete_nops(jit_func_t *f)
    f->nirs = wptr;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Dominator tree
+
+typedef struct {
+   int *rpo;     // Reachable blocks in reverse postorder
+   int *order;   // Position of each block in RPO or -1 if unreachable
+   int *idom;    // Immediate dominator of each block
+   int  count;   // Number of reachable blocks
+} dom_info_t;
+
+static int dom_intersect(dom_info_t *dom, int a, int b)
+{
+   while (a != b) {
+      while (dom->order[a] > dom->order[b])
+         a = dom->idom[a];
+      while (dom->order[b] > dom->order[a])
+         b = dom->idom[b];
+   }
+
+   return a;
+}
+
+static void dom_compute(jit_cfg_t *cfg, dom_info_t *dom)
+{
+   // Algorithm from "A Simple, Fast Dominance Algorithm" by Cooper,
+   // Harvey, and Kennedy
+
+   const int nb = cfg->nblocks;
+
+   dom->rpo   = xmalloc_array(nb, sizeof(int));
+   dom->order = xmalloc_array(nb, sizeof(int));
+   dom->idom  = xmalloc_array(nb, sizeof(int));
+   dom->count = 0;
+
+   for (int i = 0; i < nb; i++)
+      dom->order[i] = dom->idom[i] = -1;
+
+   int *stack LOCAL = xmalloc_array(nb, sizeof(int));
+   int *nextedge LOCAL = xcalloc_array(nb, sizeof(int));
+
+   int sp = 0;
+   stack[sp++] = 0;
+   dom->order[0] = 0;   // Mark visited
+
+   while (sp > 0) {
+      const int top = stack[sp - 1];
+      jit_block_t *b = &(cfg->blocks[top]);
+      if (nextedge[top] < b->out.count) {
+         const int succ = jit_get_edge(&b->out, nextedge[top]++);
+         if (dom->order[succ] == -1) {
+            dom->order[succ] = 0;
+            stack[sp++] = succ;
+         }
+      }
+      else
+         dom->rpo[dom->count++] = stack[--sp];
+   }
+
+   for (int i = 0; i < dom->count / 2; i++) {
+      const int tmp = dom->rpo[i];
+      dom->rpo[i] = dom->rpo[dom->count - i - 1];
+      dom->rpo[dom->count - i - 1] = tmp;
+   }
+
+   for (int i = 0; i < dom->count; i++)
+      dom->order[dom->rpo[i]] = i;
+
+   dom->idom[0] = 0;
+
+   bool changed;
+   do {
+      changed = false;
+
+      for (int i = 1; i < dom->count; i++) {
+         const int this = dom->rpo[i];
+         jit_block_t *b = &(cfg->blocks[this]);
+
+         int new = -1;
+         for (int j = 0; j < b->in.count; j++) {
+            const int pred = jit_get_edge(&b->in, j);
+            if (dom->idom[pred] == -1)
+               continue;   // Not yet processed or unreachable
+            else if (new == -1)
+               new = pred;
+            else
+               new = dom_intersect(dom, pred, new);
+         }
+
+         if (dom->idom[this] != new) {
+            dom->idom[this] = new;
+            changed = true;
+         }
+      }
+   } while (changed);
+}
+
+static void dom_free(dom_info_t *dom)
+{
+   free(dom->rpo);
+   free(dom->order);
+   free(dom->idom);
+}
+
+static bool dom_dominates(dom_info_t *dom, int a, int b)
+{
+   if (dom->order[a] == -1 || dom->order[b] == -1)
+      return false;
+
+   while (dom->order[b] > dom->order[a])
+      b = dom->idom[b];
+
+   return a == b;
+}
+
+static inline bool dom_strictly_dominates(dom_info_t *dom, int a, int b)
+{
+   return a != b && dom_dominates(dom, a, b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Global value numbering
+
+// The IR is not in SSA form but most registers are assigned exactly
+// once by a definition that dominates all their uses: these are the
+// only registers considered by the global passes below
+
+#define DEF_NONE  -1
+#define DEF_MANY  -2
+
+typedef struct {
+   int      kind;
+   int32_t  disp;
+   int64_t  bits;
+} gvn_operand_t;
+
+typedef struct {
+   unsigned      op;
+   gvn_operand_t args[2];
+} gvn_key_t;
+
+typedef struct {
+   gvn_key_t key;
+   int       pos;
+   int       chain;
+} gvn_entry_t;
+
+typedef struct {
+   jit_func_t *func;
+   jit_cfg_t  *cfg;
+   dom_info_t  dom;
+   int        *blockof;
+   int        *defpos;
+   jit_reg_t  *leader;
+} gvn_state_t;
+
+static inline bool gvn_writes_reg(jit_ir_t *ir)
+{
+   return ir->result != JIT_REG_INVALID && ir->op != MACRO_CASE;
+}
+
+static void gvn_check_use(gvn_state_t *state, jit_reg_t reg, int pos)
+{
+   const int def = state->defpos[reg];
+   if (def < 0)
+      return;
+
+   const int bu = state->blockof[pos], bd = state->blockof[def];
+
+   if (state->dom.order[bu] == -1)
+      return;   // Unreachable
+   else if (bd == bu ? def >= pos : !dom_dominates(&state->dom, bd, bu))
+      state->defpos[reg] = DEF_MANY;
+}
+
+static void gvn_init(jit_func_t *f, gvn_state_t *state)
+{
+   state->func = f;
+   state->cfg  = jit_get_cfg(f);
+
+   dom_compute(state->cfg, &state->dom);
+
+   state->blockof = xmalloc_array(f->nirs, sizeof(int));
+   for (int i = 0; i < state->cfg->nblocks; i++) {
+      jit_block_t *b = &(state->cfg->blocks[i]);
+      for (int j = b->first; j <= b->last; j++)
+         state->blockof[j] = i;
+   }
+
+   state->defpos = xmalloc_array(f->nregs, sizeof(int));
+   state->leader = xmalloc_array(f->nregs, sizeof(jit_reg_t));
+
+   for (int i = 0; i < f->nregs; i++) {
+      state->defpos[i] = DEF_NONE;
+      state->leader[i] = i;
+   }
+
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (gvn_writes_reg(ir)) {
+         int *def = &(state->defpos[ir->result]);
+         *def = (*def == DEF_NONE ? i : DEF_MANY);
+      }
+   }
+
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+
+      jit_reg_t reg1 = cfg_get_reg(ir->arg1);
+      if (reg1 != JIT_REG_INVALID)
+         gvn_check_use(state, reg1, i);
+
+      jit_reg_t reg2 = cfg_get_reg(ir->arg2);
+      if (reg2 != JIT_REG_INVALID)
+         gvn_check_use(state, reg2, i);
+
+      if (cfg_reads_result(ir))
+         gvn_check_use(state, ir->result, i);
+   }
+}
+
+static void gvn_free(gvn_state_t *state)
+{
+   dom_free(&state->dom);
+   free(state->blockof);
+   free(state->defpos);
+   free(state->leader);
+}
+
+static bool gvn_is_pure(jit_ir_t *ir)
+{
+   // Operations without side effects that cannot trap
+   switch (ir->op) {
+   case J_ADD:
+   case J_SUB:
+   case J_MUL:
+   case J_AND:
+   case J_OR:
+   case J_XOR:
+   case J_SHL:
+   case J_ASR:
+   case J_NEG:
+   case J_NOT:
+   case J_FADD:
+   case J_FSUB:
+   case J_FMUL:
+   case J_FDIV:
+   case J_FNEG:
+   case J_SCVTF:
+   case J_LEA:
+   case J_CLAMP:
+      return ir->cc == JIT_CC_NONE;
+   default:
+      return false;
+   }
+}
+
+static inline bool gvn_is_commutative(jit_op_t op)
+{
+   return op == J_ADD || op == J_MUL || op == J_AND || op == J_OR
+      || op == J_XOR || op == J_FADD || op == J_FMUL;
+}
+
+static bool gvn_get_operand(gvn_state_t *state, jit_value_t value,
+                            gvn_operand_t *op)
+{
+   op->kind = value.kind;
+   op->disp = 0;
+   op->bits = 0;
+
+   switch (value.kind) {
+   case JIT_VALUE_INVALID:
+      return true;
+   case JIT_VALUE_INT64:
+   case JIT_VALUE_DOUBLE:
+      op->bits = value.int64;
+      return true;
+   case JIT_ADDR_ABS:
+   case JIT_ADDR_CPOOL:
+      op->bits = value.int64;
+      op->disp = value.disp;
+      return true;
+   case JIT_VALUE_HANDLE:
+      op->bits = value.handle;
+      return true;
+   case JIT_VALUE_REG:
+   case JIT_ADDR_REG:
+      if (state->defpos[value.reg] < 0)
+         return false;
+      op->bits = state->leader[value.reg];
+      op->disp = value.kind == JIT_ADDR_REG ? value.disp : 0;
+      return true;
+   default:
+      return false;
+   }
+}
+
+static inline int gvn_operand_cmp(const gvn_operand_t *a,
+                                  const gvn_operand_t *b)
+{
+   if (a->kind != b->kind)
+      return a->kind < b->kind ? -1 : 1;
+   else if (a->bits != b->bits)
+      return a->bits < b->bits ? -1 : 1;
+   else if (a->disp != b->disp)
+      return a->disp < b->disp ? -1 : 1;
+   else
+      return 0;
+}
+
+static bool gvn_get_key(gvn_state_t *state, int pos, gvn_key_t *key)
+{
+   jit_ir_t *ir = &(state->func->irbuf[pos]);
+
+   if (!gvn_is_pure(ir) || state->defpos[ir->result] != pos)
+      return false;
+   else if (!gvn_get_operand(state, ir->arg1, &(key->args[0])))
+      return false;
+   else if (!gvn_get_operand(state, ir->arg2, &(key->args[1])))
+      return false;
+
+   key->op = ir->op | ir->size << 8;
+
+   if (gvn_is_commutative(ir->op)
+       && gvn_operand_cmp(&(key->args[0]), &(key->args[1])) > 0) {
+      const gvn_operand_t tmp = key->args[0];
+      key->args[0] = key->args[1];
+      key->args[1] = tmp;
+   }
+
+   return true;
+}
+
+static uint32_t gvn_hash_key(const gvn_key_t *key)
+{
+   uint64_t h = key->op;
+   for (int i = 0; i < 2; i++) {
+      h = h * 1093 + key->args[i].kind;
+      h = h * 6037 + key->args[i].bits;
+      h = h * 29 + key->args[i].disp;
+   }
+
+   return mix_bits_64(h);
+}
+
+static void gvn_rename(gvn_state_t *state, jit_value_t *value)
+{
+   if (value->kind == JIT_VALUE_REG || value->kind == JIT_ADDR_REG)
+      value->reg = state->leader[value->reg];
+}
+
+void jit_do_gvn(jit_func_t *f)
+{
+   // Walk the blocks in reverse postorder so an equivalent value in a
+   // dominating block is always seen first
+
+   gvn_state_t state;
+   gvn_init(f, &state);
+
+   const int tabsz = next_power_of_2(f->nirs);
+   int *buckets LOCAL = xmalloc_array(tabsz, sizeof(int));
+   for (int i = 0; i < tabsz; i++)
+      buckets[i] = -1;
+
+   gvn_entry_t *entries LOCAL = xmalloc_array(f->nirs, sizeof(gvn_entry_t));
+   int nentries = 0, nreplaced = 0;
+
+   for (int i = 0; i < state.dom.count; i++) {
+      const int this = state.dom.rpo[i];
+      jit_block_t *b = &(state.cfg->blocks[this]);
+
+      for (int pos = b->first; pos <= b->last; pos++) {
+         gvn_key_t key;
+         if (!gvn_get_key(&state, pos, &key))
+            continue;
+
+         const uint32_t hash = gvn_hash_key(&key) & (tabsz - 1);
+
+         int match = -1;
+         for (int it = buckets[hash]; it != -1; it = entries[it].chain) {
+            gvn_entry_t *e = &(entries[it]);
+            if (e->key.op != key.op
+                || gvn_operand_cmp(&(e->key.args[0]), &(key.args[0]))
+                || gvn_operand_cmp(&(e->key.args[1]), &(key.args[1])))
+               continue;
+
+            const int other = state.blockof[e->pos];
+            if (other == this || dom_dominates(&state.dom, other, this)) {
+               match = e->pos;
+               break;
+            }
+         }
+
+         jit_ir_t *ir = &(f->irbuf[pos]);
+
+         if (match != -1) {
+            state.leader[ir->result] = f->irbuf[match].result;
+            lvn_convert_nop(ir);
+            nreplaced++;
+         }
+         else {
+            gvn_entry_t *e = &(entries[nentries]);
+            e->key   = key;
+            e->pos   = pos;
+            e->chain = buckets[hash];
+            buckets[hash] = nentries++;
+         }
+      }
+   }
+
+   if (nreplaced > 0) {
+      for (jit_ir_t *ir = f->irbuf; ir < f->irbuf + f->nirs; ir++) {
+         gvn_rename(&state, &(ir->arg1));
+         gvn_rename(&state, &(ir->arg2));
+
+         if (cfg_reads_result(ir))
+            ir->result = state.leader[ir->result];
+      }
+
+      jit_free_cfg(f);
+   }
+
+   gvn_free(&state);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loop invariant code motion
+
+typedef struct {
+   int        header;
+   int        size;
+   bit_mask_t body;
+   int       *hoisted;
+   int        nhoisted;
+   int        start;
+   int        check;
+} licm_loop_t;
+
+static bool licm_may_write(jit_ir_t *ir)
+{
+   switch (ir->op) {
+   case J_RECV:
+   case J_SEND:
+   case J_LOAD:
+   case J_ULOAD:
+   case J_JUMP:
+   case J_CMP:
+   case J_FCMP:
+   case J_CCMP:
+   case J_FCCMP:
+   case J_CSET:
+   case J_CSEL:
+   case J_MOV:
+   case J_ADD:
+   case J_SUB:
+   case J_MUL:
+   case J_DIV:
+   case J_REM:
+   case J_AND:
+   case J_OR:
+   case J_XOR:
+   case J_SHL:
+   case J_ASR:
+   case J_NEG:
+   case J_NOT:
+   case J_FADD:
+   case J_FSUB:
+   case J_FMUL:
+   case J_FDIV:
+   case J_FNEG:
+   case J_SCVTF:
+   case J_FCVTNS:
+   case J_LEA:
+   case J_CLAMP:
+   case J_NOP:
+   case J_DEBUG:
+   case MACRO_CASE:
+   case MACRO_EXP:
+   case MACRO_FEXP:
+   case MACRO_SALLOC:
+   case MACRO_GETPRIV:
+      return false;
+   default:
+      return true;
+   }
+}
+
+static int licm_loop_cmp(const void *a, const void *b)
+{
+   // Visit outer loops first
+   return ((const licm_loop_t *)b)->size - ((const licm_loop_t *)a)->size;
+}
+
+static bool licm_is_invariant(gvn_state_t *state, licm_loop_t *loop,
+                              const int *defblock, const int *inloop,
+                              int id, jit_value_t value)
+{
+   switch (value.kind) {
+   case JIT_VALUE_INVALID:
+   case JIT_VALUE_INT64:
+   case JIT_VALUE_DOUBLE:
+   case JIT_VALUE_HANDLE:
+   case JIT_VALUE_EXIT:
+   case JIT_VALUE_LOCUS:
+   case JIT_ADDR_ABS:
+   case JIT_ADDR_CPOOL:
+      return true;
+   case JIT_VALUE_REG:
+   case JIT_ADDR_REG:
+      if (state->defpos[value.reg] < 0)
+         return false;
+      else if (inloop[value.reg] == id)
+         return true;
+      else
+         return dom_strictly_dominates(&state->dom, defblock[value.reg],
+                                       loop->header);
+   default:
+      return false;
+   }
+}
+
+static void licm_find_loops(gvn_state_t *state, licm_loop_t *loops,
+                            int *nloops)
+{
+   jit_cfg_t *cfg = state->cfg;
+   int *loopfor LOCAL = xmalloc_array(cfg->nblocks, sizeof(int));
+   int *worklist LOCAL = xmalloc_array(cfg->nblocks, sizeof(int));
+
+   for (int i = 0; i < cfg->nblocks; i++)
+      loopfor[i] = -1;
+
+   for (int i = 0; i < state->dom.count; i++) {
+      const int this = state->dom.rpo[i];
+      jit_block_t *b = &(cfg->blocks[this]);
+
+      for (int j = 0; j < b->out.count; j++) {
+         const int header = jit_get_edge(&b->out, j);
+         if (header == 0 || !dom_dominates(&state->dom, header, this))
+            continue;
+
+         // Found a back edge: add the blocks of the natural loop
+         licm_loop_t *loop;
+         if (loopfor[header] == -1) {
+            loop = &(loops[(loopfor[header] = (*nloops)++)]);
+            loop->header = header;
+            loop->size   = 1;
+            mask_init(&loop->body, cfg->nblocks);
+            mask_set(&loop->body, header);
+         }
+         else
+            loop = &(loops[loopfor[header]]);
+
+         int nwork = 0;
+         if (!mask_test(&loop->body, this)) {
+            mask_set(&loop->body, this);
+            loop->size++;
+            worklist[nwork++] = this;
+         }
+
+         while (nwork > 0) {
+            jit_block_t *w = &(cfg->blocks[worklist[--nwork]]);
+            for (int k = 0; k < w->in.count; k++) {
+               const int pred = jit_get_edge(&w->in, k);
+               if (state->dom.order[pred] == -1)
+                  continue;
+               else if (!mask_test(&loop->body, pred)) {
+                  mask_set(&loop->body, pred);
+                  loop->size++;
+                  worklist[nwork++] = pred;
+               }
+            }
+         }
+      }
+   }
+}
+
+static bool licm_can_reorder(jit_ir_t *ir)
+{
+   // Operations without side effects that cannot trap and so may be
+   // executed after a check that was originally before them
+   switch (ir->op) {
+   case J_NOP:
+   case J_DEBUG:
+   case J_MOV:
+   case J_CMP:
+   case J_CCMP:
+   case J_FCMP:
+   case J_FCCMP:
+   case J_CSET:
+   case J_CSEL:
+      return true;
+   default:
+      return gvn_is_pure(ir);
+   }
+}
+
+static void licm_hoist_check(gvn_state_t *state, licm_loop_t *loop, int id,
+                             const int *defblock, int *inloop, bool *moved)
+{
+   // A bounds or overflow check in the loop header with invariant
+   // operands either fails on the first iteration or never fails so it
+   // can be moved before the loop if nothing observable happens in the
+   // header before it
+
+   jit_func_t *f = state->func;
+   jit_cfg_t *cfg = state->cfg;
+
+   if (loop->header + 1 >= cfg->nblocks)
+      return;
+
+   jit_block_t *h = &(cfg->blocks[loop->header]);
+   jit_block_t *fail = h + 1;
+
+   jit_ir_t *jump = &(f->irbuf[h->last]);
+   if (jump->op != J_JUMP || jump->cc == JIT_CC_NONE)
+      return;
+   else if (!fail->aborts || fail->in.count != 1)
+      return;
+   else if (jump->arg1.label != fail->last + 1)
+      return;
+
+   int *group LOCAL = xmalloc_array(h->last - h->first + 1, sizeof(int));
+   int ngroup = 0;
+
+   bool flags_in_group = false;
+   for (int pos = h->first; pos < h->last; pos++) {
+      jit_ir_t *ir = &(f->irbuf[pos]);
+      if (moved[pos] || ir->op == J_NOP)
+         continue;
+      else if (!licm_can_reorder(ir))
+         goto restore;
+
+      const bool invariant =
+         licm_is_invariant(state, loop, defblock, inloop, id, ir->arg1)
+         && licm_is_invariant(state, loop, defblock, inloop, id, ir->arg2)
+         && (ir->result == JIT_REG_INVALID
+             || state->defpos[ir->result] == pos);
+
+      // Instructions reading the flags must stay with their writer
+      if (jit_reads_flags(ir) && flags_in_group != invariant)
+         goto restore;
+      else if (jit_writes_flags(ir))
+         flags_in_group = invariant;
+
+      if (invariant) {
+         group[ngroup++] = pos;
+         if (ir->result != JIT_REG_INVALID)
+            inloop[ir->result] = id;
+      }
+   }
+
+   if (!flags_in_group)
+      goto restore;
+
+   for (int pos = fail->first; pos < fail->last; pos++) {
+      jit_ir_t *ir = &(f->irbuf[pos]);
+      if (ir->op != J_SEND && ir->op != J_NOP)
+         goto restore;
+      else if (!licm_is_invariant(state, loop, defblock, inloop,
+                                  id, ir->arg2))
+         goto restore;
+   }
+
+   if (f->irbuf[fail->last].op != MACRO_EXIT)
+      goto restore;
+
+   for (int i = 0; i < ngroup; i++)
+      loop->hoisted[loop->nhoisted++] = group[i];
+
+   loop->check = loop->nhoisted;
+
+   for (int pos = h->last; pos <= fail->last; pos++)
+      loop->hoisted[loop->nhoisted++] = pos;
+
+   for (int i = 0; i < loop->nhoisted; i++)
+      moved[loop->hoisted[i]] = true;
+
+   return;
+
+ restore:
+   for (int i = 0; i < ngroup; i++) {
+      jit_ir_t *ir = &(f->irbuf[group[i]]);
+      if (ir->result != JIT_REG_INVALID)
+         inloop[ir->result] = -1;
+   }
+}
+
+static void licm_hoist(gvn_state_t *state, licm_loop_t *loop, int id,
+                       int *defblock, int *inloop, bool *moved)
+{
+   jit_func_t *f = state->func;
+   jit_cfg_t *cfg = state->cfg;
+
+   // Loads may only be moved if nothing in the loop writes to memory
+   // and they are executed before any exit from the loop
+   bool readonly = true;
+   int *exits LOCAL = xmalloc_array(cfg->nblocks, sizeof(int));
+   int nexits = 0;
+
+   for (int i = 0; i < state->dom.count; i++) {
+      const int this = state->dom.rpo[i];
+      if (!mask_test(&loop->body, this))
+         continue;
+
+      jit_block_t *b = &(cfg->blocks[this]);
+      for (int pos = b->first; pos <= b->last; pos++)
+         readonly &= !licm_may_write(&(f->irbuf[pos]));
+
+      for (int j = 0; j < b->out.count; j++) {
+         if (!mask_test(&loop->body, jit_get_edge(&b->out, j))) {
+            exits[nexits++] = this;
+            break;
+         }
+      }
+   }
+
+   loop->hoisted = xmalloc_array(f->nirs, sizeof(int));
+   loop->nhoisted = 0;
+   loop->check = -1;
+
+   bool changed;
+   do {
+      changed = false;
+
+      for (int i = 0; i < state->dom.count; i++) {
+         const int this = state->dom.rpo[i];
+         if (!mask_test(&loop->body, this))
+            continue;
+
+         jit_block_t *b = &(cfg->blocks[this]);
+         for (int pos = b->first; pos <= b->last; pos++) {
+            jit_ir_t *ir = &(f->irbuf[pos]);
+            if (moved[pos] || ir->result == JIT_REG_INVALID)
+               continue;
+            else if (state->defpos[ir->result] != pos)
+               continue;
+            else if (ir->arg1.kind != JIT_VALUE_REG
+                     && ir->arg1.kind != JIT_ADDR_REG
+                     && ir->arg2.kind != JIT_VALUE_REG)
+               continue;   // Constant folding is done by LVN
+
+            if (ir->op == J_LOAD || ir->op == J_ULOAD) {
+               if (!readonly)
+                  continue;
+
+               bool dominates_exits = true;
+               for (int j = 0; j < nexits; j++)
+                  dominates_exits &= dom_dominates(&state->dom, this, exits[j]);
+
+               if (!dominates_exits)
+                  continue;
+            }
+            else if (!gvn_is_pure(ir))
+               continue;
+
+            if (!licm_is_invariant(state, loop, defblock, inloop, id, ir->arg1)
+                || !licm_is_invariant(state, loop, defblock, inloop,
+                                      id, ir->arg2))
+               continue;
+
+            moved[pos] = true;
+            inloop[ir->result] = id;
+            loop->hoisted[loop->nhoisted++] = pos;
+            changed = true;
+         }
+      }
+   } while (changed);
+
+   licm_hoist_check(state, loop, id, defblock, inloop, moved);
+
+   // The hoisted instructions are placed immediately before the loop
+   // header which is dominated by the header's immediate dominator
+   for (int i = 0; i < loop->nhoisted; i++) {
+      const jit_reg_t reg = f->irbuf[loop->hoisted[i]].result;
+      if (reg != JIT_REG_INVALID)
+         defblock[reg] = state->dom.idom[loop->header];
+   }
+}
+
+static void licm_rebuild(gvn_state_t *state, licm_loop_t *loops, int nloops,
+                         const bool *moved, int nmoved)
+{
+   jit_func_t *f = state->func;
+   jit_cfg_t *cfg = state->cfg;
+
+   licm_loop_t **byfirst LOCAL =
+      xcalloc_array(f->nirs, sizeof(licm_loop_t *));
+   for (int i = 0; i < nloops; i++) {
+      if (loops[i].nhoisted > 0)
+         byfirst[cfg->blocks[loops[i].header].first] = &(loops[i]);
+   }
+
+   const int newsz = f->nirs + nmoved;
+   jit_ir_t *newbuf = xmalloc_array(newsz, sizeof(jit_ir_t));
+   int *map LOCAL = xmalloc_array(f->nirs, sizeof(int));
+   int *from LOCAL = xmalloc_array(newsz, sizeof(int));
+
+   int wptr = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      licm_loop_t *loop = byfirst[i];
+      if (loop != NULL) {
+         loop->start = wptr;
+         for (int j = 0; j < loop->nhoisted; j++) {
+            from[wptr] = -1;
+            newbuf[wptr] = f->irbuf[loop->hoisted[j]];
+            newbuf[wptr++].target = 0;
+         }
+      }
+
+      map[i] = wptr;
+      from[wptr] = i;
+      newbuf[wptr] = f->irbuf[i];
+      if (moved[i])
+         lvn_convert_nop(&(newbuf[wptr]));
+      wptr++;
+   }
+
+   assert(wptr == newsz);
+
+   // A hoisted check continues into the loop header rather than the
+   // block after it as the header may contain instructions that were
+   // not moved
+   for (int i = 0; i < nloops; i++) {
+      if (loops[i].nhoisted == 0 || loops[i].check < 0)
+         continue;
+
+      const int pos = loops[i].start + loops[i].check;
+      assert(newbuf[pos].op == J_JUMP);
+      newbuf[pos].arg1.label = map[cfg->blocks[loops[i].header].first];
+      from[pos] = -2;
+   }
+
+   // Jumps to the loop header from outside the loop now enter through
+   // the hoisted instructions
+   for (int i = 0; i < newsz; i++) {
+      jit_ir_t *ir = &(newbuf[i]);
+      jit_value_t *args[] = { &(ir->arg1), &(ir->arg2) };
+
+      for (int j = 0; j < ARRAY_LEN(args); j++) {
+         if (args[j]->kind != JIT_VALUE_LABEL)
+            continue;
+
+         const jit_label_t old = args[j]->label;
+         licm_loop_t *loop = byfirst[old];
+         if (from[i] == -2)
+            ;   // Already points into the new buffer
+         else if (loop != NULL && (from[i] == -1
+                              || !mask_test(&loop->body,
+                                            state->blockof[from[i]])))
+            args[j]->label = loop->start;
+         else
+            args[j]->label = map[old];
+
+         newbuf[args[j]->label].target = 1;
+      }
+   }
+
+   free(f->irbuf);
+   f->irbuf = newbuf;
+   f->nirs  = newsz;
+}
+
+void jit_do_licm(jit_func_t *f)
+{
+   gvn_state_t state;
+   gvn_init(f, &state);
+
+   jit_cfg_t *cfg = state.cfg;
+
+   licm_loop_t *loops LOCAL = xmalloc_array(cfg->nblocks, sizeof(licm_loop_t));
+   int nloops = 0;
+   licm_find_loops(&state, loops, &nloops);
+
+   qsort(loops, nloops, sizeof(licm_loop_t), licm_loop_cmp);
+
+   int *defblock LOCAL = xmalloc_array(f->nregs, sizeof(int));
+   int *inloop LOCAL = xmalloc_array(f->nregs, sizeof(int));
+   bool *moved LOCAL = xcalloc_array(f->nirs, sizeof(bool));
+
+   for (int i = 0; i < f->nregs; i++) {
+      const int def = state.defpos[i];
+      defblock[i] = def >= 0 ? state.blockof[def] : -1;
+      inloop[i] = -1;
+   }
+
+   int nmoved = 0;
+   for (int i = 0; i < nloops; i++) {
+      licm_hoist(&state, &(loops[i]), i, defblock, inloop, moved);
+      nmoved += loops[i].nhoisted;
+   }
+
+   if (nmoved > 0) {
+      licm_rebuild(&state, loops, nloops, moved, nmoved);
+      jit_free_cfg(f);
+   }
+
+   for (int i = 0; i < nloops; i++) {
+      mask_free(&(loops[i].body));
+      free(loops[i].hoisted);
+   }
+
+   gvn_free(&state);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Range analysis
+
+// Forward interval analysis over the registers that feed into
+// comparisons and overflow checks.  Conditional jumps decided by the
+// computed ranges are folded and the failure path of a bounds or
+// overflow check that can never fire is deleted.  Checks that may fail
+// are left untouched so the error is always reported in the same way.
+
+#define RANGE_MAX_CELLS  (1 << 18)
+#define RANGE_MAX_ROUNDS 100
+#define RANGE_MAX_WIDEN  8
+
+typedef struct {
+   int64_t low;
+   int64_t high;
+} range_t;
+
+typedef enum {
+   FLAGS_UNKNOWN, FLAGS_FALSE, FLAGS_TRUE
+} range_flags_t;
+
+typedef struct {
+   jit_cc_t    cc;
+   jit_value_t lhs;
+   jit_value_t rhs;
+} range_cond_t;
+
+typedef struct {
+   range_flags_t flags;
+   int           writer;
+   int           nconds;
+   range_cond_t  conds[2];
+} range_end_t;
+
+typedef struct {
+   jit_func_t *func;
+   jit_cfg_t  *cfg;
+   dom_info_t  dom;
+   int        *index;
+   int         ntracked;
+   int64_t    *thresholds;
+   int         nthresholds;
+   range_t    *entry;
+   bool       *reached;
+   bool       *dirty;
+   bool       *header;
+   uint8_t    *widened;
+} range_state_t;
+
+static const range_t range_top = { INT64_MIN, INT64_MAX };
+
+static range_t range_get(range_state_t *state, const range_t *regs,
+                         jit_value_t value)
+{
+   if (value.kind == JIT_VALUE_INT64)
+      return (range_t){ value.int64, value.int64 };
+   else if (value.kind == JIT_VALUE_REG && state->index[value.reg] != -1)
+      return regs[state->index[value.reg]];
+   else
+      return range_top;
+}
+
+static void range_put(range_state_t *state, range_t *regs, jit_reg_t reg,
+                      range_t r)
+{
+   if (reg != JIT_REG_INVALID && state->index[reg] != -1)
+      regs[state->index[reg]] = r;
+}
+
+static bool range_arith(jit_op_t op, range_t a, range_t b, range_t *r)
+{
+   // Returns false if the result may not be representable in 64 bits
+   switch (op) {
+   case J_ADD:
+      return !__builtin_add_overflow(a.low, b.low, &r->low)
+         && !__builtin_add_overflow(a.high, b.high, &r->high);
+   case J_SUB:
+      return !__builtin_sub_overflow(a.low, b.high, &r->low)
+         && !__builtin_sub_overflow(a.high, b.low, &r->high);
+   case J_MUL:
+      {
+         int64_t p[4];
+         if (__builtin_mul_overflow(a.low, b.low, &p[0])
+             || __builtin_mul_overflow(a.low, b.high, &p[1])
+             || __builtin_mul_overflow(a.high, b.low, &p[2])
+             || __builtin_mul_overflow(a.high, b.high, &p[3]))
+            return false;
+
+         r->low = MIN(MIN(p[0], p[1]), MIN(p[2], p[3]));
+         r->high = MAX(MAX(p[0], p[1]), MAX(p[2], p[3]));
+         return true;
+      }
+   default:
+      return false;
+   }
+}
+
+static bool range_fits(range_t r, jit_size_t size, jit_cc_t cc)
+{
+   if (cc == JIT_CC_C) {
+      switch (size) {
+      case JIT_SZ_8: return r.low >= 0 && r.high <= UINT8_MAX;
+      case JIT_SZ_16: return r.low >= 0 && r.high <= UINT16_MAX;
+      case JIT_SZ_32: return r.low >= 0 && r.high <= UINT32_MAX;
+      default: return r.low >= 0;
+      }
+   }
+   else {
+      switch (size) {
+      case JIT_SZ_8: return r.low >= INT8_MIN && r.high <= INT8_MAX;
+      case JIT_SZ_16: return r.low >= INT16_MIN && r.high <= INT16_MAX;
+      case JIT_SZ_32: return r.low >= INT32_MIN && r.high <= INT32_MAX;
+      default: return true;
+      }
+   }
+}
+
+static range_t range_for_load(jit_size_t size, bool is_signed)
+{
+   switch (size) {
+   case JIT_SZ_8:
+      return is_signed ? (range_t){ INT8_MIN, INT8_MAX }
+         : (range_t){ 0, UINT8_MAX };
+   case JIT_SZ_16:
+      return is_signed ? (range_t){ INT16_MIN, INT16_MAX }
+         : (range_t){ 0, UINT16_MAX };
+   case JIT_SZ_32:
+      return is_signed ? (range_t){ INT32_MIN, INT32_MAX }
+         : (range_t){ 0, UINT32_MAX };
+   default:
+      return range_top;
+   }
+}
+
+static range_flags_t range_compare(jit_cc_t cc, range_t a, range_t b)
+{
+   switch (cc) {
+   case JIT_CC_EQ:
+      if (a.low == a.high && b.low == b.high && a.low == b.low)
+         return FLAGS_TRUE;
+      else if (a.high < b.low || b.high < a.low)
+         return FLAGS_FALSE;
+      break;
+   case JIT_CC_NE:
+      if (a.low == a.high && b.low == b.high && a.low == b.low)
+         return FLAGS_FALSE;
+      else if (a.high < b.low || b.high < a.low)
+         return FLAGS_TRUE;
+      break;
+   case JIT_CC_LT:
+      if (a.high < b.low)
+         return FLAGS_TRUE;
+      else if (a.low >= b.high)
+         return FLAGS_FALSE;
+      break;
+   case JIT_CC_LE:
+      if (a.high <= b.low)
+         return FLAGS_TRUE;
+      else if (a.low > b.high)
+         return FLAGS_FALSE;
+      break;
+   case JIT_CC_GT:
+      if (a.low > b.high)
+         return FLAGS_TRUE;
+      else if (a.high <= b.low)
+         return FLAGS_FALSE;
+      break;
+   case JIT_CC_GE:
+      if (a.low >= b.high)
+         return FLAGS_TRUE;
+      else if (a.high < b.low)
+         return FLAGS_FALSE;
+      break;
+   default:
+      break;
+   }
+
+   return FLAGS_UNKNOWN;
+}
+
+static jit_cc_t range_negate_cc(jit_cc_t cc)
+{
+   switch (cc) {
+   case JIT_CC_EQ: return JIT_CC_NE;
+   case JIT_CC_NE: return JIT_CC_EQ;
+   case JIT_CC_LT: return JIT_CC_GE;
+   case JIT_CC_GE: return JIT_CC_LT;
+   case JIT_CC_GT: return JIT_CC_LE;
+   case JIT_CC_LE: return JIT_CC_GT;
+   default: return JIT_CC_NONE;
+   }
+}
+
+static jit_cc_t range_swap_cc(jit_cc_t cc)
+{
+   switch (cc) {
+   case JIT_CC_LT: return JIT_CC_GT;
+   case JIT_CC_GT: return JIT_CC_LT;
+   case JIT_CC_LE: return JIT_CC_GE;
+   case JIT_CC_GE: return JIT_CC_LE;
+   default: return cc;
+   }
+}
+
+static bool range_refine(jit_cc_t cc, range_t *a, range_t b)
+{
+   // Narrow A to the values for which "A cc B" may hold and return
+   // false if there are none
+   switch (cc) {
+   case JIT_CC_EQ:
+      a->low = MAX(a->low, b.low);
+      a->high = MIN(a->high, b.high);
+      break;
+   case JIT_CC_NE:
+      if (b.low != b.high)
+         break;
+      else if (a->low == b.low) {
+         if (a->low == INT64_MAX)
+            return false;
+         a->low++;
+      }
+      else if (a->high == b.low) {
+         if (a->high == INT64_MIN)
+            return false;
+         a->high--;
+      }
+      break;
+   case JIT_CC_LT:
+      if (b.high == INT64_MIN)
+         return false;
+      a->high = MIN(a->high, b.high - 1);
+      break;
+   case JIT_CC_LE:
+      a->high = MIN(a->high, b.high);
+      break;
+   case JIT_CC_GT:
+      if (b.low == INT64_MAX)
+         return false;
+      a->low = MAX(a->low, b.low + 1);
+      break;
+   case JIT_CC_GE:
+      a->low = MAX(a->low, b.low);
+      break;
+   default:
+      break;
+   }
+
+   return a->low <= a->high;
+}
+
+static bool range_apply(range_state_t *state, range_t *regs,
+                        const range_cond_t *cond, bool negate)
+{
+   const jit_cc_t cc = negate ? range_negate_cc(cond->cc) : cond->cc;
+
+   range_t lhs = range_get(state, regs, cond->lhs);
+   range_t rhs = range_get(state, regs, cond->rhs);
+
+   if (!range_refine(cc, &lhs, rhs))
+      return false;
+   else if (!range_refine(range_swap_cc(cc), &rhs, lhs))
+      return false;
+
+   if (cond->lhs.kind == JIT_VALUE_REG)
+      range_put(state, regs, cond->lhs.reg, lhs);
+   if (cond->rhs.kind == JIT_VALUE_REG)
+      range_put(state, regs, cond->rhs.reg, rhs);
+
+   return true;
+}
+
+static void range_kill_conds(range_end_t *end, jit_reg_t reg)
+{
+   // The condition no longer says anything about a register that was
+   // overwritten after the comparison
+   for (int i = 0; i < end->nconds; i++) {
+      range_cond_t *c = &(end->conds[i]);
+      if (c->lhs.kind == JIT_VALUE_REG && c->lhs.reg == reg)
+         c->lhs.kind = JIT_VALUE_INVALID;
+      if (c->rhs.kind == JIT_VALUE_REG && c->rhs.reg == reg)
+         c->rhs.kind = JIT_VALUE_INVALID;
+   }
+}
+
+static void range_transfer(range_state_t *state, jit_block_t *bb,
+                           range_t *regs, range_end_t *end)
+{
+   end->flags  = FLAGS_UNKNOWN;
+   end->writer = -1;
+   end->nconds = 0;
+
+   for (int pos = bb->first; pos <= bb->last; pos++) {
+      jit_ir_t *ir = &(state->func->irbuf[pos]);
+
+      const range_t a = range_get(state, regs, ir->arg1);
+      const range_t b = range_get(state, regs, ir->arg2);
+
+      range_t r = range_top;
+      switch (ir->op) {
+      case J_MOV:
+         r = a;
+         break;
+
+      case J_ADD:
+      case J_SUB:
+      case J_MUL:
+         {
+            range_t exact;
+            const bool ok = range_arith(ir->op, a, b, &exact);
+
+            if (ir->cc == JIT_CC_NONE) {
+               if (ok && (ir->size == JIT_SZ_UNSPEC || ir->size == JIT_SZ_64))
+                  r = exact;
+            }
+            else {
+               const bool safe = ok && range_fits(a, ir->size, ir->cc)
+                  && range_fits(b, ir->size, ir->cc)
+                  && range_fits(exact, ir->size, ir->cc);
+
+               if (safe)
+                  r = exact;
+
+               end->flags  = safe ? FLAGS_FALSE : FLAGS_UNKNOWN;
+               end->writer = pos;
+               end->nconds = 0;
+            }
+         }
+         break;
+
+      case J_NEG:
+         if (a.low != INT64_MIN)
+            r = (range_t){ -a.high, -a.low };
+         break;
+
+      case J_AND:
+         if (a.low >= 0 && b.low >= 0)
+            r = (range_t){ 0, MIN(a.high, b.high) };
+         else if (a.low >= 0)
+            r = (range_t){ 0, a.high };
+         else if (b.low >= 0)
+            r = (range_t){ 0, b.high };
+         break;
+
+      case J_ASR:
+         if (b.low == b.high && b.low >= 0 && b.low < 64)
+            r = (range_t){ a.low >> b.low, a.high >> b.low };
+         break;
+
+      case J_CLAMP:
+         r = (range_t){ MAX(a.low, 0), MAX(a.high, 0) };
+         break;
+
+      case J_CSET:
+         if (end->flags == FLAGS_UNKNOWN)
+            r = (range_t){ 0, 1 };
+         else
+            r.low = r.high = (end->flags == FLAGS_TRUE);
+         break;
+
+      case J_CSEL:
+         if (end->flags == FLAGS_TRUE)
+            r = a;
+         else if (end->flags == FLAGS_FALSE)
+            r = b;
+         else
+            r = (range_t){ MIN(a.low, b.low), MAX(a.high, b.high) };
+         break;
+
+      case J_LOAD:
+      case J_ULOAD:
+         r = range_for_load(ir->size, ir->op == J_LOAD);
+         break;
+
+      case J_CMP:
+         end->flags  = range_compare(ir->cc, a, b);
+         end->writer = pos;
+         end->nconds = 1;
+         end->conds[0] = (range_cond_t){ ir->cc, ir->arg1, ir->arg2 };
+         break;
+
+      case J_CCMP:
+         {
+            const range_flags_t this = range_compare(ir->cc, a, b);
+            if (end->flags == FLAGS_TRUE)
+               end->flags = this;
+            else if (end->flags == FLAGS_UNKNOWN && this == FLAGS_FALSE)
+               end->flags = FLAGS_FALSE;
+
+            if (end->nconds == 1)
+               end->conds[end->nconds++] =
+                  (range_cond_t){ ir->cc, ir->arg1, ir->arg2 };
+            else
+               end->nconds = 0;
+         }
+         break;
+
+      default:
+         if (jit_writes_flags(ir)) {
+            end->flags  = FLAGS_UNKNOWN;
+            end->writer = pos;
+            end->nconds = 0;
+         }
+         break;
+      }
+
+      if (cfg_writes_result(ir)) {
+         range_put(state, regs, ir->result, r);
+         range_kill_conds(end, ir->result);
+      }
+   }
+}
+
+static int64_t range_widen_low(range_state_t *state, int64_t value)
+{
+   // Largest threshold not greater than VALUE
+   int64_t result = INT64_MIN;
+   for (int low = 0, high = state->nthresholds - 1; low <= high; ) {
+      const int mid = (low + high) / 2;
+      if (state->thresholds[mid] <= value) {
+         result = state->thresholds[mid];
+         low = mid + 1;
+      }
+      else
+         high = mid - 1;
+   }
+
+   return result;
+}
+
+static int64_t range_widen_high(range_state_t *state, int64_t value)
+{
+   // Smallest threshold not less than VALUE
+   int64_t result = INT64_MAX;
+   for (int low = 0, high = state->nthresholds - 1; low <= high; ) {
+      const int mid = (low + high) / 2;
+      if (state->thresholds[mid] >= value) {
+         result = state->thresholds[mid];
+         high = mid - 1;
+      }
+      else
+         low = mid + 1;
+   }
+
+   return result;
+}
+
+static void range_propagate(range_state_t *state, int to, const range_t *regs)
+{
+   range_t *in = &(state->entry[to * state->ntracked]);
+
+   if (!state->reached[to]) {
+      memcpy(in, regs, state->ntracked * sizeof(range_t));
+      state->reached[to] = state->dirty[to] = true;
+      return;
+   }
+
+   // Widening at loop headers to the constants used in comparisons
+   // and eventually to infinity ensures the analysis terminates
+   const bool widen = state->header[to];
+   uint8_t *count = &(state->widened[to * state->ntracked]);
+
+   for (int i = 0; i < state->ntracked; i++) {
+      const bool give_up = count[i] >= RANGE_MAX_WIDEN;
+      const range_t old = in[i];
+
+      if (regs[i].low < in[i].low) {
+         if (widen && give_up)
+            in[i].low = INT64_MIN;
+         else if (widen)
+            in[i].low = range_widen_low(state, regs[i].low);
+         else
+            in[i].low = regs[i].low;
+      }
+
+      if (regs[i].high > in[i].high) {
+         if (widen && give_up)
+            in[i].high = INT64_MAX;
+         else if (widen)
+            in[i].high = range_widen_high(state, regs[i].high);
+         else
+            in[i].high = regs[i].high;
+      }
+
+      if (in[i].low != old.low || in[i].high != old.high) {
+         state->dirty[to] = true;
+         count[i] += widen;
+      }
+   }
+}
+
+static void range_propagate_edge(range_state_t *state, int to,
+                                 const range_t *regs, const range_end_t *end,
+                                 bool flags, range_t *tmp)
+{
+   // Propagate the state along the edge taken when the flags have the
+   // value FLAGS
+   if (end->flags != FLAGS_UNKNOWN && (end->flags == FLAGS_TRUE) != flags)
+      return;   // Edge is never taken
+
+   memcpy(tmp, regs, state->ntracked * sizeof(range_t));
+
+   if (flags) {
+      for (int i = 0; i < end->nconds; i++) {
+         if (!range_apply(state, tmp, &(end->conds[i]), false))
+            return;
+      }
+   }
+   else if (end->nconds == 1 && !range_apply(state, tmp, end->conds, true))
+      return;
+
+   range_propagate(state, to, tmp);
+}
+
+static void range_select(range_state_t *state)
+{
+   // Track registers compared or checked for overflow and the
+   // registers they are computed from
+   jit_func_t *f = state->func;
+
+   for (int i = 0; i < f->nregs; i++)
+      state->index[i] = -1;
+
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->op == J_CMP || ir->op == J_CCMP
+          || ((ir->op == J_ADD || ir->op == J_SUB || ir->op == J_MUL)
+              && ir->cc != JIT_CC_NONE)) {
+         if (ir->arg1.kind == JIT_VALUE_REG)
+            state->index[ir->arg1.reg] = 0;
+         if (ir->arg2.kind == JIT_VALUE_REG)
+            state->index[ir->arg2.reg] = 0;
+      }
+   }
+
+   bool changed;
+   do {
+      changed = false;
+
+      for (int i = 0; i < f->nirs; i++) {
+         jit_ir_t *ir = &(f->irbuf[i]);
+         if (!cfg_writes_result(ir) || state->index[ir->result] == -1)
+            continue;
+
+         switch (ir->op) {
+         case J_MOV:
+         case J_ADD:
+         case J_SUB:
+         case J_MUL:
+         case J_NEG:
+         case J_AND:
+         case J_ASR:
+         case J_CLAMP:
+         case J_CSEL:
+            break;
+         default:
+            continue;
+         }
+
+         if (ir->arg1.kind == JIT_VALUE_REG && state->index[ir->arg1.reg] == -1)
+            state->index[ir->arg1.reg] = 0, changed = true;
+         if (ir->arg2.kind == JIT_VALUE_REG && state->index[ir->arg2.reg] == -1)
+            state->index[ir->arg2.reg] = 0, changed = true;
+      }
+   } while (changed);
+
+   state->ntracked = 0;
+   for (int i = 0; i < f->nregs; i++) {
+      if (state->index[i] != -1)
+         state->index[i] = state->ntracked++;
+   }
+}
+
+static int range_threshold_cmp(const void *a, const void *b)
+{
+   const int64_t ia = *(const int64_t *)a, ib = *(const int64_t *)b;
+   return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void range_thresholds(range_state_t *state)
+{
+   jit_func_t *f = state->func;
+
+   int max = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->op == J_CMP || ir->op == J_CCMP)
+         max += 6;
+   }
+
+   state->thresholds = xmalloc_array(MAX(max, 1), sizeof(int64_t));
+   state->nthresholds = 0;
+
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->op != J_CMP && ir->op != J_CCMP)
+         continue;
+
+      const jit_value_t args[] = { ir->arg1, ir->arg2 };
+      for (int j = 0; j < ARRAY_LEN(args); j++) {
+         if (args[j].kind != JIT_VALUE_INT64)
+            continue;
+
+         const int64_t c = args[j].int64;
+         state->thresholds[state->nthresholds++] = c;
+         if (c > INT64_MIN)
+            state->thresholds[state->nthresholds++] = c - 1;
+         if (c < INT64_MAX)
+            state->thresholds[state->nthresholds++] = c + 1;
+      }
+   }
+
+   qsort(state->thresholds, state->nthresholds, sizeof(int64_t),
+         range_threshold_cmp);
+}
+
+static bool range_solve(range_state_t *state)
+{
+   const int nt = state->ntracked;
+   range_t *regs LOCAL = xmalloc_array(MAX(nt, 1), sizeof(range_t));
+   range_t *tmp LOCAL = xmalloc_array(MAX(nt, 1), sizeof(range_t));
+
+   for (int i = 0; i < nt; i++)
+      state->entry[i] = range_top;
+
+   state->reached[0] = state->dirty[0] = true;
+
+   for (int round = 0; round < RANGE_MAX_ROUNDS; round++) {
+      bool changed = false;
+
+      for (int i = 0; i < state->dom.count; i++) {
+         const int this = state->dom.rpo[i];
+         if (!state->dirty[this])
+            continue;
+
+         state->dirty[this] = false;
+         changed = true;
+
+         jit_block_t *b = &(state->cfg->blocks[this]);
+         memcpy(regs, &(state->entry[this * nt]), nt * sizeof(range_t));
+
+         range_end_t end;
+         range_transfer(state, b, regs, &end);
+
+         jit_ir_t *last = &(state->func->irbuf[b->last]);
+         if (last->op == J_JUMP && last->cc != JIT_CC_NONE) {
+            jit_block_t *taken = jit_block_for(state->cfg, last->arg1.label);
+            const bool when = (last->cc == JIT_CC_T);
+            range_propagate_edge(state, taken - state->cfg->blocks,
+                                 regs, &end, when, tmp);
+            if (this + 1 < state->cfg->nblocks)
+               range_propagate_edge(state, this + 1, regs, &end,
+                                    !when, tmp);
+         }
+         else {
+            for (int j = 0; j < b->out.count; j++)
+               range_propagate(state, jit_get_edge(&b->out, j), regs);
+         }
+      }
+
+      if (!changed)
+         return true;
+   }
+
+   return false;
+}
+
+static bool range_fold_jump(range_state_t *state, jit_block_t *b,
+                            const range_end_t *end)
+{
+   jit_func_t *f = state->func;
+   jit_ir_t *jump = &(f->irbuf[b->last]);
+
+   if (jump->op != J_JUMP || jump->cc == JIT_CC_NONE)
+      return false;
+   else if (end->flags == FLAGS_UNKNOWN)
+      return false;
+
+   const bool taken = (end->flags == FLAGS_TRUE) == (jump->cc == JIT_CC_T);
+   jit_block_t *next = b + 1;
+
+   if (!taken)
+      lvn_convert_nop(jump);
+   else if (next < state->cfg->blocks + state->cfg->nblocks
+            && next->aborts && next->in.count == 1
+            && jump->arg1.label == next->last + 1) {
+      // Delete the failure path of a check that can never fire
+      for (int pos = b->last; pos <= next->last; pos++)
+         lvn_convert_nop(&(f->irbuf[pos]));
+   }
+   else
+      jump->cc = JIT_CC_NONE;
+
+   if (end->writer < b->first || mask_test(&b->liveout, f->nregs))
+      return true;   // Flags are set or read by another block
+
+   // The instructions which set the flags are now redundant unless
+   // they also compute a result
+   for (int pos = b->last - 1; pos >= end->writer; pos--) {
+      jit_ir_t *ir = &(f->irbuf[pos]);
+      if (ir->op == J_CMP || ir->op == J_CCMP)
+         lvn_convert_nop(ir);
+      else if (pos == end->writer && jit_writes_flags(ir)
+               && ir->op != MACRO_EXP) {
+         ir->cc   = JIT_CC_NONE;
+         ir->size = JIT_SZ_UNSPEC;
+      }
+      else if (ir->op != J_NOP)
+         break;
+   }
+
+   return true;
+}
+
+void jit_do_range(jit_func_t *f)
+{
+   range_state_t state = {
+      .func = f,
+      .cfg  = jit_get_cfg(f),
+   };
+
+   state.index = xmalloc_array(MAX(f->nregs, 1), sizeof(int));
+   range_select(&state);
+
+   const int nb = state.cfg->nblocks;
+   if (state.ntracked == 0 || (int64_t)state.ntracked * nb > RANGE_MAX_CELLS) {
+      free(state.index);
+      return;
+   }
+
+   dom_compute(state.cfg, &state.dom);
+   range_thresholds(&state);
+
+   state.entry   = xmalloc_array(nb * state.ntracked, sizeof(range_t));
+   state.reached = xcalloc_array(nb, sizeof(bool));
+   state.dirty   = xcalloc_array(nb, sizeof(bool));
+   state.header  = xcalloc_array(nb, sizeof(bool));
+   state.widened = xcalloc_array(nb * state.ntracked, sizeof(uint8_t));
+
+   for (int i = 0; i < nb; i++) {
+      jit_block_t *b = &(state.cfg->blocks[i]);
+      for (int j = 0; j < b->in.count; j++) {
+         const int pred = jit_get_edge(&b->in, j);
+         if (state.dom.order[pred] >= state.dom.order[i]
+             && state.dom.order[i] != -1)
+            state.header[i] = true;   // Target of a retreating edge
+      }
+   }
+
+   if (range_solve(&state)) {
+      range_t *regs LOCAL = xmalloc_array(state.ntracked, sizeof(range_t));
+      bool changed = false;
+
+      for (int i = 0; i < state.dom.count; i++) {
+         const int this = state.dom.rpo[i];
+         if (!state.reached[this])
+            continue;
+
+         jit_block_t *b = &(state.cfg->blocks[this]);
+         memcpy(regs, &(state.entry[this * state.ntracked]),
+                state.ntracked * sizeof(range_t));
+
+         range_end_t end;
+         range_transfer(&state, b, regs, &end);
+         changed |= range_fold_jump(&state, b, &end);
+      }
+
+      if (changed)
+         jit_free_cfg(f);
+   }
+
+   dom_free(&state.dom);
+   free(state.index);
+   free(state.thresholds);
+   free(state.entry);
+   free(state.reached);
+   free(state.dirty);
+   free(state.header);
+   free(state.widened);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Inlining
+
+#define INLINE_MAX_SIZE   12     // Budget for callees which are rarely run
+#define INLINE_HOT_SIZE   40     // Budget for callees which are hot
+#define INLINE_MAX_GROWTH 1024   // Instructions added to a single caller
+#define INLINE_MAX_REGS   4096
+#define INLINE_MAX_SLOTS  64
+
+typedef A(jit_ir_t) ir_array_t;
+
+typedef struct {
+   jit_func_t *callee;
+   int         call;      // Position of the J_CALL
+   int         first;     // First instruction which may send an argument
+   int         last;      // Last instruction which receives a result
+   int         debug;     // Debug info for the call site or -1
+   uint64_t    params;    // Argument slots received on entry to the callee
+   uint64_t    results;   // Result slots received by the caller
+   bool        observes;  // Callee may capture a stack trace
+   jit_reg_t   base;      // Callee registers are renumbered from here
+   jit_reg_t   slots[INLINE_MAX_SLOTS];   // Replace the argument array
+} inline_site_t;
+
+static bool inline_clobbers_args(jit_ir_t *ir)
+{
+   // Any instruction that may write the argument array or leaves the
+   // current basic block
+   switch (ir->op) {
+   case J_CALL:
+   case J_JUMP:
+   case J_RET:
+   case J_TRAP:
+   case MACRO_EXIT:
+   case MACRO_CASE:
+   case MACRO_REEXEC:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static bool inline_ends_prologue(jit_ir_t *ir)
+{
+   // Arguments are only received before anything else is sent
+   return ir->op == J_SEND || inline_clobbers_args(ir);
+}
+
+static bool inline_observes(jit_ir_t *ir)
+{
+   // The interpreter records the position of these in the anchor so
+   // they are the only places a stack trace can be captured
+   return ir->op == J_CALL || ir->op == MACRO_EXIT || ir->op == MACRO_GALLOC;
+}
+
+static int inline_find_debug(jit_func_t *f, int pos)
+{
+   for (int i = pos; i >= 0; i--) {
+      if (f->irbuf[i].op == J_DEBUG)
+         return i;
+      else if (f->irbuf[i].target)
+         break;
+   }
+
+   return -1;
+}
+
+static bool inline_is_result(jit_func_t *f, int pos)
+{
+   // Result values are sent immediately before returning
+   for (int i = pos + 1; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->target)
+         return false;
+      else if (ir->op == J_RET)
+         return true;
+      else if (ir->op != J_SEND && ir->op != J_DEBUG && ir->op != J_NOP)
+         return false;
+   }
+
+   return false;
+}
+
+static bool inline_is_argument(jit_func_t *f, int pos)
+{
+   for (int i = pos + 1; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->target)
+         return false;
+      else if (ir->op == J_CALL || ir->op == MACRO_EXIT)
+         return true;
+      else if (inline_clobbers_args(ir))
+         return false;
+   }
+
+   return false;
+}
+
+static bool inline_after_call(jit_func_t *f, int pos)
+{
+   // Results of a nested call are received immediately afterwards
+   for (int i = pos; i > 0; i--) {
+      if (f->irbuf[i].target)
+         return false;
+
+      jit_ir_t *prev = &(f->irbuf[i - 1]);
+      if (prev->op == J_CALL || prev->op == MACRO_EXIT)
+         return true;
+      else if (prev->op != J_RECV && prev->op != J_DEBUG && prev->op != J_NOP)
+         return false;
+   }
+
+   return false;
+}
+
+static bool inline_check_callee(jit_func_t *f, jit_func_t *callee,
+                                inline_site_t *site)
+{
+   if (callee == f)
+      return false;
+   else if (load_acquire(&(callee->state)) != JIT_FUNC_READY)
+      return false;   // Never wait for another thread here
+   else if (callee->irbuf == NULL || callee->framesz > 0)
+      return false;
+   else if (callee->module != f->module && !jit_has_runtime(f->jit))
+      return false;   // Ahead-of-time code must not embed other units
+
+   const int budget = jit_tier_hot(callee) ? INLINE_HOT_SIZE : INLINE_MAX_SIZE;
+
+   int size = 0;
+   bool prologue = true, returns = false;
+   uint64_t results = ~UINT64_C(0);
+   site->params = 0;
+   site->observes = false;
+
+   for (int i = 0; i < callee->nirs; i++) {
+      jit_ir_t *ir = &(callee->irbuf[i]);
+
+      if (ir->target)
+         prologue = false;
+
+      if (ir->arg1.kind == JIT_ADDR_CPOOL || ir->arg2.kind == JIT_ADDR_CPOOL)
+         return false;
+
+      if (inline_observes(ir)) {
+         if (inline_find_debug(callee, i) < 0)
+            return false;
+         site->observes = true;
+      }
+
+      switch (ir->op) {
+      case J_NOP:
+      case J_DEBUG:
+         continue;
+      case J_RECV:
+         if (ir->arg1.int64 >= INLINE_MAX_SLOTS)
+            return false;
+         else if (prologue)
+            site->params |= UINT64_C(1) << ir->arg1.int64;
+         else if (!inline_after_call(callee, i))
+            return false;
+         break;
+      case J_SEND:
+         if (ir->arg1.int64 >= INLINE_MAX_SLOTS)
+            return false;
+         else if (!inline_is_result(callee, i)
+                  && !inline_is_argument(callee, i))
+            return false;
+         break;
+      case J_RET:
+         {
+            uint64_t sent = 0;
+            for (int j = i - 1; j >= 0 && !ir->target; j--) {
+               jit_ir_t *prev = &(callee->irbuf[j]);
+               if (prev->op == J_SEND)
+                  sent |= UINT64_C(1) << prev->arg1.int64;
+               else if (prev->op != J_DEBUG && prev->op != J_NOP)
+                  break;
+
+               if (prev->target)
+                  break;
+            }
+
+            results &= sent;
+            returns = true;
+         }
+         break;
+      case MACRO_EXIT:
+         if (ir->arg1.exit == JIT_EXIT_BIND_FOREIGN)
+            return false;   // Binds to the function in the anchor
+         break;
+      case MACRO_SALLOC:
+      case MACRO_LALLOC:
+      case MACRO_TRIM:
+      case MACRO_REEXEC:
+         return false;
+      default:
+         break;
+      }
+
+      if (inline_ends_prologue(ir))
+         prologue = false;
+
+      if (++size > budget)
+         return false;
+   }
+
+   if ((site->results & ~results) != 0 || !returns)
+      return false;
+
+   site->callee = callee;
+   return true;
+}
+
+static bool inline_check_site(jit_func_t *f, int call, inline_site_t *site)
+{
+   jit_ir_t *ir = &(f->irbuf[call]);
+   if (ir->arg1.kind != JIT_VALUE_HANDLE)
+      return false;
+
+   // Arguments are sent in the same basic block before the call
+   site->call = site->first = call;
+   while (site->first > 0 && !f->irbuf[site->first].target
+          && !inline_clobbers_args(&(f->irbuf[site->first - 1])))
+      site->first--;
+
+   uint64_t sent = 0;
+   for (int i = site->first; i < call; i++) {
+      jit_ir_t *send = &(f->irbuf[i]);
+      if (send->op != J_SEND)
+         continue;
+      else if (send->arg1.int64 >= INLINE_MAX_SLOTS)
+         return false;
+      else
+         sent |= UINT64_C(1) << send->arg1.int64;
+   }
+
+   // Results are received immediately after the call and the argument
+   // array must not be read again before the next call
+   site->last = call;
+   site->results = 0;
+   bool contiguous = true;
+   for (int i = call + 1; i < f->nirs; i++) {
+      jit_ir_t *recv = &(f->irbuf[i]);
+      if (recv->target || inline_clobbers_args(recv))
+         break;
+      else if (recv->op == J_DEBUG || recv->op == J_NOP)
+         continue;
+      else if (recv->op != J_RECV)
+         contiguous = false;
+      else if (!contiguous || recv->arg1.int64 >= INLINE_MAX_SLOTS)
+         return false;
+      else {
+         site->results |= UINT64_C(1) << recv->arg1.int64;
+         site->last = i;
+      }
+   }
+
+   jit_func_t *callee = jit_get_func(f->jit, ir->arg1.handle);
+   if (!inline_check_callee(f, callee, site))
+      return false;
+   else if ((site->params & ~sent) != 0)
+      return false;
+
+   site->debug = inline_find_debug(f, call);
+   if (site->observes && site->debug < 0)
+      return false;   // Cannot reconstruct the caller frame
+
+   return true;
+}
+
+static jit_ir_t *inline_emit(ir_array_t *out)
+{
+   APUSH(*out, (jit_ir_t){});
+   return &(out->items[out->count - 1]);
+}
+
+static jit_reg_t inline_slot_reg(jit_func_t *f, inline_site_t *site, int nth)
+{
+   if (site->slots[nth] == JIT_REG_INVALID)
+      site->slots[nth] = f->nregs++;
+
+   return site->slots[nth];
+}
+
+static void inline_rename(inline_site_t *site, jit_value_t *value)
+{
+   if (value->kind == JIT_VALUE_REG || value->kind == JIT_ADDR_REG)
+      value->reg += site->base;
+}
+
+static void inline_frame(jit_func_t *f, inline_site_t *site,
+                         const loc_t *loc, ir_array_t *out)
+{
+   // Inlined debug info is a run of consecutive J_DEBUG instructions
+   // starting with the outermost frame where each subsequent entry
+   // names the function it belongs to
+
+   int first = site->debug;
+   while (first > 0 && f->irbuf[first].arg2.kind == JIT_VALUE_HANDLE
+          && f->irbuf[first - 1].op == J_DEBUG)
+      first--;
+
+   for (int i = first; i <= site->debug; i++) {
+      jit_ir_t *ir = inline_emit(out);
+      *ir = f->irbuf[i];
+      ir->target = 0;
+      if (i == first)
+         ir->arg2.kind = JIT_VALUE_INVALID;
+   }
+
+   jit_ir_t *ir = inline_emit(out);
+   ir->op          = J_DEBUG;
+   ir->size        = JIT_SZ_UNSPEC;
+   ir->result      = JIT_REG_INVALID;
+   ir->arg1.kind   = JIT_VALUE_LOC;
+   ir->arg1.loc    = *loc;
+   ir->arg2.kind   = JIT_VALUE_HANDLE;
+   ir->arg2.handle = site->callee->handle;
+}
+
+static void inline_body(jit_func_t *f, inline_site_t *site,
+                        ir_array_t *out)
+{
+   jit_func_t *callee = site->callee;
+   const int start = out->count;
+
+   jit_label_t *map LOCAL = xmalloc_array(callee->nirs, sizeof(jit_label_t));
+
+   bool prologue = true;
+   for (int i = 0; i < callee->nirs; i++) {
+      jit_ir_t *src = &(callee->irbuf[i]);
+      map[i] = out->count;
+
+      if (src->target)
+         prologue = false;
+
+      if (src->op == J_NOP)
+         continue;
+      else if (src->op == J_DEBUG) {
+         if (!site->observes)
+            continue;
+         else if (src->arg2.kind != JIT_VALUE_HANDLE) {
+            inline_frame(f, site, &(src->arg1.loc), out);
+            continue;
+         }
+      }
+      else if (src->op == J_RET) {
+         prologue = false;
+         if (i + 1 < callee->nirs) {
+            jit_ir_t *ir = inline_emit(out);
+            ir->op         = J_JUMP;
+            ir->size       = JIT_SZ_UNSPEC;
+            ir->cc         = JIT_CC_NONE;
+            ir->result     = JIT_REG_INVALID;
+            ir->arg1.kind  = JIT_VALUE_LABEL;
+            ir->arg1.label = JIT_LABEL_INVALID;   // Patched below
+         }
+         continue;
+      }
+
+      jit_ir_t *ir = inline_emit(out);
+      *ir = *src;
+      ir->target = 0;
+
+      if (src->op == J_RECV && prologue) {
+         ir->op   = J_MOV;
+         ir->arg1 = LVN_REG(inline_slot_reg(f, site, src->arg1.int64));
+      }
+      else if (src->op == J_SEND && inline_is_result(callee, i)) {
+         const int nth = src->arg1.int64;
+         prologue = false;
+         if (site->results & (UINT64_C(1) << nth)) {
+            ir->op     = J_MOV;
+            ir->result = inline_slot_reg(f, site, nth);
+            ir->arg1   = ir->arg2;
+            ir->arg2.kind = JIT_VALUE_INVALID;
+            inline_rename(site, &(ir->arg1));
+            continue;
+         }
+         else {
+            out->count--;
+            continue;
+         }
+      }
+      else
+         inline_rename(site, &(ir->arg1));
+
+      inline_rename(site, &(ir->arg2));
+
+      if (ir->result != JIT_REG_INVALID)
+         ir->result += site->base;
+
+      if (inline_ends_prologue(src))
+         prologue = false;
+   }
+
+   for (int i = start; i < out->count; i++) {
+      jit_ir_t *ir = &(out->items[i]);
+      jit_value_t *args[] = { &(ir->arg1), &(ir->arg2) };
+      for (int j = 0; j < ARRAY_LEN(args); j++) {
+         if (args[j]->kind != JIT_VALUE_LABEL)
+            continue;
+         else if (args[j]->label == JIT_LABEL_INVALID)
+            args[j]->label = out->count;
+         else
+            args[j]->label = map[args[j]->label];
+      }
+   }
+}
+
+void jit_do_inline(jit_func_t *f)
+{
+   A(inline_site_t) sites = AINIT;
+
+   int growth = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      if (f->irbuf[i].op != J_CALL)
+         continue;
+
+      inline_site_t site;
+      if (!inline_check_site(f, i, &site))
+         continue;
+
+      jit_func_t *callee = site.callee;
+      if (growth + callee->nirs > INLINE_MAX_GROWTH)
+         continue;
+      else if (f->nregs + callee->nregs + INLINE_MAX_SLOTS > INLINE_MAX_REGS)
+         continue;
+
+      site.base = f->nregs;
+      for (int j = 0; j < INLINE_MAX_SLOTS; j++)
+         site.slots[j] = JIT_REG_INVALID;
+
+      f->nregs += callee->nregs;
+      growth += callee->nirs;
+
+      APUSH(sites, site);
+   }
+
+   if (sites.count == 0)
+      return;
+
+   ir_array_t out = AINIT;
+   A(int) patch = AINIT;
+
+   jit_label_t *map LOCAL = xmalloc_array(f->nirs, sizeof(jit_label_t));
+
+   inline_site_t *site = sites.items;
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      map[i] = out.count;
+
+      if (site < sites.items + sites.count && i > site->last)
+         site++;
+
+      if (site < sites.items + sites.count && i >= site->first) {
+         if (i == site->call) {
+            inline_body(f, site, &out);
+            continue;
+         }
+         else if (i < site->call && ir->op == J_SEND) {
+            const int nth = ir->arg1.int64;
+            if (site->params & (UINT64_C(1) << nth)) {
+               jit_ir_t *mov = inline_emit(&out);
+               mov->op     = J_MOV;
+               mov->size   = JIT_SZ_UNSPEC;
+               mov->result = inline_slot_reg(f, site, nth);
+               mov->arg1   = ir->arg2;
+            }
+            continue;   // Callee can never read other slots
+         }
+         else if (i > site->call && ir->op == J_RECV) {
+            jit_ir_t *mov = inline_emit(&out);
+            *mov = *ir;
+            mov->op = J_MOV;
+            mov->arg1 = LVN_REG(site->slots[ir->arg1.int64]);
+            continue;
+         }
+      }
+
+      if (ir->arg1.kind == JIT_VALUE_LABEL || ir->arg2.kind == JIT_VALUE_LABEL)
+         APUSH(patch, out.count);
+
+      *inline_emit(&out) = *ir;
+   }
+
+   for (int i = 0; i < patch.count; i++) {
+      jit_ir_t *ir = &(out.items[patch.items[i]]);
+      if (ir->arg1.kind == JIT_VALUE_LABEL)
+         ir->arg1.label = map[ir->arg1.label];
+      if (ir->arg2.kind == JIT_VALUE_LABEL)
+         ir->arg2.label = map[ir->arg2.label];
+   }
+
+   for (int i = 0; i < out.count; i++)
+      out.items[i].target = 0;
+
+   for (int i = 0; i < out.count; i++) {
+      jit_ir_t *ir = &(out.items[i]);
+      if (ir->arg1.kind == JIT_VALUE_LABEL)
+         out.items[ir->arg1.label].target = 1;
+      if (ir->arg2.kind == JIT_VALUE_LABEL)
+         out.items[ir->arg2.label].target = 1;
+   }
+
+   free(f->irbuf);
+   f->irbuf = out.items;
+   f->nirs  = out.count;
+
+   jit_free_cfg(f);
+
+   ACLEAR(sites);
+   ACLEAR(patch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Case chain lowering
+
+#define SWITCH_MIN_CASES  8
+#define SWITCH_MAX_TABLE  4096
+
+static int switch_case_cmp(const void *a, const void *b)
+{
+   const jit_ir_t *ia = *(const jit_ir_t **)a;
+   const jit_ir_t *ib = *(const jit_ir_t **)b;
+
+   if (ia->arg1.int64 != ib->arg1.int64)
+      return ia->arg1.int64 < ib->arg1.int64 ? -1 : 1;
+   else
+      return ia < ib ? -1 : (ia > ib);   // First match wins
+}
+
+void jit_get_switch(jit_func_t *f, int pos, jit_switch_t *sw)
+{
+   // A VHDL case statement becomes a chain of $CASE macros testing the
+   // same register against constants: decide whether the whole chain
+   // is better lowered as a jump table or a binary search
+
+   jit_ir_t *head = &(f->irbuf[pos]);
+   assert(head->op == MACRO_CASE);
+
+   sw->kind   = JIT_SWITCH_LINEAR;
+   sw->length = 0;
+   sw->count  = 0;
+   sw->cases  = NULL;
+
+   if (head->arg1.kind != JIT_VALUE_INT64)
+      return;
+
+   for (jit_ir_t *it = head; it < f->irbuf + f->nirs; it++) {
+      if (it->op != MACRO_CASE || it->result != head->result)
+         break;
+      else if (it->arg1.kind != JIT_VALUE_INT64)
+         break;
+      else if (it != head && it->target)
+         break;   // Cannot skip over a branch target
+      else
+         sw->length++;
+   }
+
+   if (sw->length < SWITCH_MIN_CASES)
+      return;
+
+   const jit_ir_t **sorted LOCAL =
+      xmalloc_array(sw->length, sizeof(jit_ir_t *));
+   for (int i = 0; i < sw->length; i++)
+      sorted[i] = head + i;
+
+   qsort(sorted, sw->length, sizeof(jit_ir_t *), switch_case_cmp);
+
+   sw->cases = xmalloc_array(sw->length, sizeof(jit_case_t));
+
+   for (int i = 0; i < sw->length; i++) {
+      if (i > 0 && sorted[i]->arg1.int64 == sorted[i - 1]->arg1.int64)
+         continue;
+
+      jit_case_t *c = &(sw->cases[sw->count++]);
+      c->value = sorted[i]->arg1.int64;
+      c->label = sorted[i]->arg2.label;
+   }
+
+   sw->low  = sw->cases[0].value;
+   sw->high = sw->cases[sw->count - 1].value;
+
+   // Use a table if at least half the entries would be occupied
+   const uint64_t range = (uint64_t)sw->high - (uint64_t)sw->low;
+   if (range < SWITCH_MAX_TABLE && range < 2 * sw->count)
+      sw->kind = JIT_SWITCH_TABLE;
+   else
+      sw->kind = JIT_SWITCH_BSEARCH;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Memory to register promotion
 
@@ -1202,12 +3479,20 @@ static bool try_promote_allocation(jit_func_t *f, jit_ir_t *alloc)
          else
             last = i;
       }
+      else if (ir->op == MACRO_BARRIER && get_value_reg(ir->arg1) == reg)
+         continue;   // Removed below
       else if (get_value_reg(ir->arg1) == reg)
          return false;
       else if (get_value_reg(ir->arg2) == reg)
          return false;
    }
 
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->op == MACRO_BARRIER && get_value_reg(ir->arg1) == reg)
+         lvn_convert_nop(ir);
+   }
+
    if (first != -1) {
       for (jit_ir_t *ir = f->irbuf + first; ir <= f->irbuf + last; ir++) {
          if (ir->op == J_STORE && get_value_reg(ir->arg2) == reg) {
@@ -1273,6 +3558,186 @@ void jit_do_mem2reg(jit_func_t *f)
    f->framesz = newsize;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Escape analysis
+
+// An object allocated on the garbage collected heap whose address is
+// never stored to memory, passed to another function, or returned
+// cannot outlive the current activation.  Such allocations are moved
+// to the thread-local allocation buffer, or to the stack frame if the
+// size is fixed and the allocation is executed at most once.
+
+#define ESCAPE_MAX_STACK 256
+
+static bool escape_positive_size(jit_func_t *f, jit_value_t value)
+{
+   // The heap allocator never returns a null pointer or the same
+   // address twice but a zero byte allocation from the TLAB may
+
+   if (value.kind == JIT_VALUE_INT64)
+      return value.int64 > 0;
+   else if (value.kind != JIT_VALUE_REG)
+      return false;
+
+   jit_ir_t *def = NULL;
+   for (int i = 0; i < f->nirs; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (!cfg_writes_result(ir) || ir->result != value.reg)
+         continue;
+      else if (def != NULL)
+         return false;
+      else
+         def = ir;
+   }
+
+   // Array allocations add the size of the header to the body size
+   return def != NULL && def->op == J_ADD && def->cc == JIT_CC_NONE
+      && def->arg2.kind == JIT_VALUE_INT64 && def->arg2.int64 > 0;
+}
+
+static bool escape_in_entry(jit_func_t *f, jit_ir_t *alloc)
+{
+   for (jit_ir_t *ir = f->irbuf; ir <= alloc; ir++) {
+      if (ir->target || (ir < alloc && cfg_is_terminator(f, ir)))
+         return false;
+   }
+
+   return true;
+}
+
+static inline bool escape_test(jit_value_t value, bit_mask_t *mask)
+{
+   const jit_reg_t reg = get_value_reg(value);
+   return reg != JIT_REG_INVALID && mask_test(mask, reg);
+}
+
+static bool escape_analyse(jit_func_t *f, jit_ir_t *alloc, bit_mask_t *mask)
+{
+   // The mask holds every register that may contain a pointer into the
+   // object: this is iterated to a fixed point as copies may flow
+   // backwards around loops
+
+   mask_clearall(mask);
+   mask_set(mask, alloc->result);
+
+   bool changed;
+   do {
+      changed = false;
+
+      for (int i = 0; i < f->nirs; i++) {
+         jit_ir_t *ir = &(f->irbuf[i]);
+         if (ir == alloc)
+            continue;
+
+         const bool arg1 = escape_test(ir->arg1, mask);
+         const bool arg2 = escape_test(ir->arg2, mask);
+         const bool result = cfg_reads_result(ir)
+            && ir->result != JIT_REG_INVALID && mask_test(mask, ir->result);
+
+         if (!arg1 && !arg2 && !result)
+            continue;
+
+         switch (ir->op) {
+         case J_MOV:
+         case J_ADD:
+         case J_SUB:
+         case J_LEA:
+         case J_CSEL:
+            if (!mask_test(mask, ir->result)) {
+               mask_set(mask, ir->result);
+               changed = true;
+            }
+            break;
+         case J_LOAD:
+         case J_CMP:
+         case MACRO_BARRIER:
+            break;
+         case J_STORE:
+            if (arg1)
+               return false;
+            break;
+         case MACRO_COPY:
+         case MACRO_MOVE:
+         case MACRO_BZERO:
+            if (result)
+               return false;
+            break;
+         case MACRO_MEMSET:
+            if (result || arg2)
+               return false;
+            break;
+         default:
+            return false;
+         }
+      }
+   } while (changed);
+
+   return true;
+}
+
+int jit_do_escape(jit_func_t *f)
+{
+   int ngalloc = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      if (f->irbuf[i].op == MACRO_GALLOC)
+         ngalloc++;
+   }
+
+   if (ngalloc == 0)
+      return 0;
+
+   bit_mask_t mask;
+   mask_init(&mask, f->nregs);
+
+   int demoted = 0, nstack = 0;
+   for (int i = 0; i < f->nirs && ngalloc > 0; i++) {
+      jit_ir_t *ir = &(f->irbuf[i]);
+      if (ir->op != MACRO_GALLOC)
+         continue;
+
+      ngalloc--;
+
+      if (!escape_positive_size(f, ir->arg1))
+         continue;
+      else if (!escape_analyse(f, ir, &mask))
+         continue;
+
+      if (ir->arg1.kind == JIT_VALUE_INT64
+          && ir->arg1.int64 <= ESCAPE_MAX_STACK && escape_in_entry(f, ir)) {
+         ir->op   = MACRO_SALLOC;
+         ir->arg2 = ir->arg1;   // Frame offset assigned below
+         nstack++;
+      }
+      else
+         ir->op = MACRO_LALLOC;
+
+      // Stores into a demoted object never need a write barrier
+      for (int j = 0; j < f->nirs; j++) {
+         jit_ir_t *barrier = &(f->irbuf[j]);
+         if (barrier->op == MACRO_BARRIER && escape_test(barrier->arg1, &mask))
+            lvn_convert_nop(barrier);
+      }
+
+      demoted++;
+   }
+
+   mask_free(&mask);
+
+   if (nstack > 0) {
+      // Stack allocations must be in ascending order of frame offset
+      f->framesz = 0;
+      for (int i = 0; i < f->nirs; i++) {
+         jit_ir_t *ir = &(f->irbuf[i]);
+         if (ir->op == MACRO_SALLOC) {
+            ir->arg1.int64 = f->framesz;
+            f->framesz += ALIGN_UP(ir->arg2.int64, 8);
+         }
+      }
+   }
+
+   return demoted;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Register allocation
 
@@ -86,6 +86,7 @@ typedef enum {
    MACRO_MEMSET,
    MACRO_REEXEC,
    MACRO_SADD,
+   MACRO_BARRIER,
 } jit_op_t;
 
 typedef enum {
@@ -232,6 +233,8 @@ STATIC_ASSERT(sizeof(jit_ir_t) == 40);
 
 typedef struct _jit_tier jit_tier_t;
 typedef struct _jit_func jit_func_t;
+typedef struct _jit_osr jit_osr_t;
+typedef struct _jit_decoded jit_decoded_t;
 typedef struct _jit_block jit_block_t;
 typedef struct _jit_anchor jit_anchor_t;
 
@@ -264,6 +267,27 @@ typedef struct {
    jit_block_t blocks[0];
 } jit_cfg_t;
 
+typedef enum {
+   JIT_SWITCH_LINEAR,
+   JIT_SWITCH_TABLE,
+   JIT_SWITCH_BSEARCH,
+} jit_switch_kind_t;
+
+typedef struct {
+   int64_t     value;
+   jit_label_t label;
+} jit_case_t;
+
+// Chain of $CASE macros testing the same register against constants
+typedef struct {
+   jit_switch_kind_t  kind;
+   int                length;   // Number of $CASE macros in the chain
+   int                count;    // Number of distinct values
+   int64_t            low;
+   int64_t            high;
+   jit_case_t        *cases;    // Sorted by value
+} jit_switch_t;
+
 typedef enum {
    JIT_FUNC_PLACEHOLDER,
    JIT_FUNC_COMPILING,
@@ -308,8 +332,22 @@ typedef struct _jit_func {
    ffi_spec_t      spec;
    ident_t         module;
    ptrdiff_t       offset;
+   jit_osr_t      *osr;
+   jit_decoded_t  *decoded;
 } jit_func_t;
 
+// Copy of a function entered part way through at a loop header with
+// the live registers passed as arguments
+typedef struct _jit_osr {
+   jit_osr_t   *next;
+   jit_label_t  label;
+   jit_func_t  *func;
+   bool         frame;
+   bool         flags;
+   unsigned     nlive;
+   jit_reg_t    live[0];
+} jit_osr_t;
+
 // The code generator knows the layout of this struct
 typedef struct _jit_anchor {
    jit_anchor_t *caller;
@@ -375,6 +413,8 @@ void jit_hexdump(const unsigned char *data, size_t sz, int blocksz,
 void **jit_get_privdata_ptr(jit_t *j, jit_func_t *f);
 bool jit_has_runtime(jit_t *j);
 void jit_tier_up(jit_func_t *f);
+bool jit_tier_hot(jit_func_t *f);
+jit_osr_t *jit_tier_osr(jit_func_t *f, jit_label_t label);
 jit_thread_local_t *jit_thread_local(void);
 void jit_fill_irbuf(jit_func_t *f);
 int32_t *jit_get_cover_ptr(jit_t *j, jit_value_t addr);
@@ -396,6 +436,12 @@ void jit_do_cprop(jit_func_t *f);
 void jit_do_dce(jit_func_t *f);
 void jit_delete_nops(jit_func_t *f);
 void jit_do_mem2reg(jit_func_t *f);
+void jit_do_gvn(jit_func_t *f);
+void jit_do_licm(jit_func_t *f);
+void jit_do_range(jit_func_t *f);
+void jit_do_inline(jit_func_t *f);
+int jit_do_escape(jit_func_t *f);
+void jit_get_switch(jit_func_t *f, int pos, jit_switch_t *sw);
 
 typedef unsigned phys_slot_t;
 #define INT_BASE   0
@@ -447,6 +493,7 @@ void jit_bind_foreign(jit_func_t *f, const char *spec, size_t length,
 DLLEXPORT void __nvc_do_exit(jit_exit_t which, jit_anchor_t *anchor,
                              jit_scalar_t *args, tlab_t *tlab);
 DLLEXPORT void *__nvc_mspace_alloc(uintptr_t size, jit_anchor_t *anchor);
+DLLEXPORT void __nvc_write_barrier(void *ptr, uintptr_t size);
 DLLEXPORT void _debug_out(intptr_t val, int32_t reg);
 
 #endif  // _JIT_PRIV_H
@@ -37,6 +37,7 @@ typedef enum {
    DEBUG_STUB,
    TLAB_STUB,
    FEXP_STUB,
+   BARRIER_STUB,
 
    NUM_STUBS
 } jit_x86_stub_t;
@@ -161,6 +162,7 @@ typedef enum {
 typedef enum {
    X86_CMP_O  = 0x00,
    X86_CMP_C  = 0x02,
+   X86_CMP_NC = 0x03,
    X86_CMP_EQ = 0x04,
    X86_CMP_NE = 0x05,
    X86_CMP_BE = 0x06,
@@ -215,7 +217,7 @@ typedef enum {
 #define SETGE(dst) asm_setcc(blob, (dst), X86_CMP_GE)
 #define SETLE(dst) asm_setcc(blob, (dst), X86_CMP_LE)
 #define SETA(dst) asm_setcc(blob, (dst), 0x7)
-#define SETAE(dst) asm_setcc(blob, (dst), 0x3)
+#define SETAE(dst) asm_setcc(blob, (dst), X86_CMP_NC)
 #define SETB(dst) asm_setcc(blob, (dst), 0x2)
 #define SETBE(dst) asm_setcc(blob, (dst), 0x6)
 #define TEST(src1, src2, size) asm_test(blob, (src1), (src2), (size))
@@ -226,6 +228,7 @@ typedef enum {
 #define JNZ(addr) asm_jcc(blob, (addr), X86_CMP_NE)
 #define JLT(addr) asm_jcc(blob, (addr), X86_CMP_LT)
 #define JB(addr) asm_jcc(blob, (addr), X86_CMP_C)
+#define JAE(addr) asm_jcc(blob, (addr), X86_CMP_NC)
 #define JBE(addr) asm_jcc(blob, (addr), X86_CMP_BE)
 #define MULSD(dst, src) asm_mulsd(blob, (dst), (src))
 #define DIVSD(dst, src) asm_divsd(blob, (dst), (src))
@@ -761,6 +764,13 @@ static void asm_call(code_blob_t *blob, x86_operand_t addr)
    }
 }
 
+static void asm_disp32(code_blob_t *blob)
+{
+   // Placeholder for a 32-bit displacement filled in later by
+   // jit_x86_patch which reads the operand size from the last byte
+   __(0x00, 0x00, 0x00, 32);
+}
+
 static void asm_jmp(code_blob_t *blob, x86_operand_t addr)
 {
    switch (addr.kind) {
@@ -1445,6 +1455,15 @@ static void jit_x86_fmul(code_blob_t *blob, jit_ir_t *ir,
    jit_x86_put(blob, ir->result, __XMM0, slots);
 }
 
+static void jit_x86_macro_barrier(code_blob_t *blob, jit_x86_state_t *state,
+                                  jit_ir_t *ir, const phys_slot_t *slots)
+{
+   jit_x86_get_copy(blob, __EAX, ir->arg1, slots);
+   jit_x86_get_copy(blob, __ECX, ir->arg2, slots);
+
+   CALL(PTR(state->stubs[BARRIER_STUB]));
+}
+
 static void jit_x86_fdiv(code_blob_t *blob, jit_ir_t *ir,
                          const phys_slot_t *slots)
 {
@@ -1693,6 +1712,118 @@ static void jit_x86_macro_case(code_blob_t *blob, jit_ir_t *ir,
    code_blob_patch(blob, ir->arg2.label, jit_x86_patch);
 }
 
+static void jit_x86_case_tree(code_blob_t *blob, const jit_case_t *cases,
+                              int count, uint8_t **fixups, int *nfixups)
+{
+   // Binary search over the sorted values with the test value in RCX
+   // and a short linear scan at the leaves
+
+   if (count <= 3) {
+      for (int i = 0; i < count; i++) {
+         MOV(__EAX, IMM(cases[i].value), __QWORD);
+         CMP(__ECX, __EAX, __QWORD);
+         JZ(PATCH(INT32_MAX));
+         code_blob_patch(blob, cases[i].label, jit_x86_patch);
+      }
+
+      JMP(PATCH(INT32_MAX));
+      fixups[(*nfixups)++] = blob->wptr;
+      return;
+   }
+
+   const int mid = count / 2;
+
+   MOV(__EAX, IMM(cases[mid].value), __QWORD);
+   CMP(__ECX, __EAX, __QWORD);
+   JZ(PATCH(INT32_MAX));
+   code_blob_patch(blob, cases[mid].label, jit_x86_patch);
+   JLT(PATCH(INT32_MAX));
+
+   uint8_t *left = blob->wptr;
+
+   jit_x86_case_tree(blob, cases + mid + 1, count - mid - 1, fixups, nfixups);
+
+   if (!blob->overflow)
+      jit_x86_patch(blob, JIT_LABEL_INVALID, left, blob->wptr);
+
+   jit_x86_case_tree(blob, cases, mid, fixups, nfixups);
+}
+
+static int jit_x86_macro_switch(code_blob_t *blob, jit_ir_t *ir,
+                                const phys_slot_t *slots)
+{
+   // Lower a long chain of $CASE macros testing the same register as a
+   // single jump table or binary search and return the number of
+   // instructions consumed
+
+   jit_func_t *f = blob->func;
+
+   jit_switch_t sw;
+   jit_get_switch(f, ir - f->irbuf, &sw);
+
+   if (sw.kind == JIT_SWITCH_LINEAR)
+      return 0;
+
+   // All jumps use 32-bit displacements as the code size is not
+   // proportional to the number of instructions
+   jit_x86_get_reg(blob, __ECX, ir->result, slots);
+
+   if (sw.kind == JIT_SWITCH_TABLE) {
+      const int size = sw.high - sw.low + 1;
+
+      MOV(__EDX, __ECX, __QWORD);
+      MOV(__EAX, IMM(sw.low), __QWORD);
+      SUB(__EDX, __EAX, __QWORD);
+      MOV(__EAX, IMM(size), __QWORD);
+      CMP(__EDX, __EAX, __QWORD);
+      JAE(PATCH(INT32_MAX));
+
+      uint8_t *range = blob->wptr;
+
+      __(0x48, 0x8d, 0x05, __IMM32(14));     // LEA RAX, [RIP + 14]
+      __(0x48, 0x63, 0x34, 0x90);            // MOVSXD RSI, [RAX + RDX*4]
+      __(0x48, 0x8d, 0x44, 0x90, 0x04);      // LEA RAX, [RAX + RDX*4 + 4]
+      __(0x48, 0x01, 0xf0);                  // ADD RAX, RSI
+      __(0xff, 0xe0);                        // JMP RAX
+
+      // Each entry is the displacement of the target from the end of
+      // the entry itself
+      uint8_t **holes LOCAL = xmalloc_array(size, sizeof(uint8_t *));
+      for (int i = 0, next = 0; i < size; i++) {
+         asm_disp32(blob);
+         if (next < sw.count && sw.cases[next].value - sw.low == i)
+            code_blob_patch(blob, sw.cases[next++].label, jit_x86_patch);
+         else
+            holes[i] = blob->wptr;
+      }
+
+      if (!blob->overflow) {
+         jit_x86_patch(blob, JIT_LABEL_INVALID, range, blob->wptr);
+
+         for (int i = 0, next = 0; i < size; i++) {
+            if (next < sw.count && sw.cases[next].value - sw.low == i)
+               next++;
+            else
+               jit_x86_patch(blob, JIT_LABEL_INVALID, holes[i], blob->wptr);
+         }
+      }
+   }
+   else {
+      uint8_t **fixups LOCAL = xmalloc_array(sw.count, sizeof(uint8_t *));
+      int nfixups = 0;
+
+      jit_x86_case_tree(blob, sw.cases, sw.count, fixups, &nfixups);
+
+      if (!blob->overflow) {
+         for (int i = 0; i < nfixups; i++)
+            jit_x86_patch(blob, JIT_LABEL_INVALID, fixups[i], blob->wptr);
+      }
+   }
+
+   free(sw.cases);
+   return sw.length;
+}
+
 static void jit_x86_macro_exp(code_blob_t *blob, jit_ir_t *ir,
                               const phys_slot_t *slots)
 {
@@ -1887,6 +2018,9 @@ static void jit_x86_op(code_blob_t *blob, jit_x86_state_t *state, jit_ir_t *ir,
    case MACRO_TRIM:
       jit_x86_macro_trim(blob, ir);
       break;
+   case MACRO_BARRIER:
+      jit_x86_macro_barrier(blob, state, ir, slots);
+      break;
    default:
       jit_dump_with_mark(blob->func, ir - blob->func->irbuf, false);
       fatal_trace("unhandled opcode %s in x86 backend", jit_op_name(ir->op));
@@ -1980,11 +2114,16 @@ static void jit_x86_cgen(jit_t *j, jit_handle_t handle, void *context)
 
    STATIC_ASSERT(ANCHOR_OFFSET == -24);
 
-   for (int i = 0; i < f->nirs; i++) {
+   for (int i = 0, skip; i < f->nirs; i++) {
       if (f->irbuf[i].target)
          code_blob_mark(blob, i);
       code_blob_print_ir(blob, &(f->irbuf[i]));
-      jit_x86_op(blob, state, &(f->irbuf[i]), slots);
+
+      if (f->irbuf[i].op == MACRO_CASE
+          && (skip = jit_x86_macro_switch(blob, &(f->irbuf[i]), slots)))
+         i += skip - 1;
+      else
+         jit_x86_op(blob, state, &(f->irbuf[i]), slots);
    }
 
    code_blob_mark(blob, JIT_LABEL_INVALID);
@@ -2168,6 +2307,29 @@ static void jit_x86_gen_fexp_stub(jit_x86_state_t *state)
    code_blob_finalise(blob, &(state->stubs[FEXP_STUB]));
 }
 
+static void jit_x86_gen_barrier_stub(jit_x86_state_t *state)
+{
+   ident_t name = ident_new("barrier stub");
+   code_blob_t *blob = code_blob_new(state->code, name, 0);
+
+   SUB(__ESP, IMM(8), __QWORD);   // Ensure stack aligned
+
+   jit_x86_push_call_clobbered(blob);
+
+   MOV(CARG1_REG, __ECX, __QWORD);    // Size
+   MOV(CARG0_REG, __EAX, __QWORD);    // Address
+
+   MOV(__EAX, PTR(__nvc_write_barrier), __QWORD);
+   CALL(__EAX);
+
+   jit_x86_pop_call_clobbered(blob);
+
+   ADD(__ESP, IMM(8), __QWORD);
+   RET();
+
+   code_blob_finalise(blob, &(state->stubs[BARRIER_STUB]));
+}
+
 static void *jit_x86_init(jit_t *jit)
 {
    jit_x86_state_t *state = xcalloc(sizeof(jit_x86_state_t));
@@ -2179,6 +2341,7 @@ static void *jit_x86_init(jit_t *jit)
    jit_x86_gen_alloc_stub(state);
    jit_x86_gen_tlab_stub(state);
    jit_x86_gen_fexp_stub(state);
+   jit_x86_gen_barrier_stub(state);
    DEBUG_ONLY(jit_x86_gen_debug_stub(state));
 
    return state;
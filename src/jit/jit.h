@@ -74,6 +74,7 @@ void jit_reset(jit_t *j);
 int32_t *jit_get_cover_mem(jit_t *j, int mintags);
 
 void *jit_mspace_alloc(size_t size) RETURNS_NONNULL;
+void jit_write_barrier(void *ptr, size_t size);
 jit_stack_trace_t *jit_stack_trace(void);
 jit_t *jit_for_thread(void);
 
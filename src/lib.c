@@ -16,6 +16,7 @@
 //
 
 #include "util.h"
+#include "array.h"
 #include "common.h"
 #include "diag.h"
 #include "fbuf.h"
@@ -24,6 +25,8 @@
 #include "lib.h"
 #include "object.h"
 #include "option.h"
+#include "sha1.h"
+#include "thread.h"
 #include "tree.h"
 #include "vlog/vlog-node.h"
 
@@ -40,13 +43,17 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <utime.h>
 
 typedef struct _search_path search_path_t;
 typedef struct _lib_index   lib_index_t;
 typedef struct _lib_list    lib_list_t;
 typedef struct _lib_unit    lib_unit_t;
+typedef struct _lib_source  lib_source_t;
 
-#define INDEX_FILE_MAGIC 0x55225511
+#define INDEX_FILE_MAGIC   0x55225513
+#define SOURCES_FILE_MAGIC 0x55225611
+#define INDEX_MIN_JOURNAL  256
 
 struct _lib_unit {
    object_t     *object;
@@ -61,17 +68,79 @@ struct _lib_unit {
 struct _lib_index {
    ident_t      name;
    tree_kind_t  kind;
+   uint32_t     checksum;
+   bool         pending;
    lib_index_t *next;
 };
 
+// The index file starts with an open addressing hash table keyed by
+// unit name which is mapped into memory and probed directly.  Updates
+// are appended as a journal of records following the table, each of
+// which supersedes any earlier entry for the same unit.  The table is
+// rewritten with the journal merged in once the journal grows larger
+// than the table.
+
+typedef struct {
+   uint32_t magic;
+   uint32_t generation;
+   uint32_t nbuckets;
+   uint32_t count;
+   uint32_t strsize;
+   uint32_t __pad;
+} index_header_t;
+
+typedef struct {
+   uint32_t hash;
+   uint32_t name;   // Offset into string table plus one or zero if empty
+   uint32_t checksum;
+   uint16_t kind;
+   uint16_t __pad;
+} index_bucket_t;
+
+typedef struct {
+   uint32_t check;
+   uint32_t checksum;
+   uint16_t kind;
+   uint16_t namelen;
+   char     name[0];
+} index_record_t;
+
+typedef struct {
+   ident_t  name;
+   uint32_t checksum;
+} unit_checksum_t;
+
+typedef A(unit_checksum_t) checksum_list_t;
+
+struct _lib_source {
+   ident_t          path;
+   unsigned char    digest[SHA1_LEN];
+   checksum_list_t  units;
+   checksum_list_t  deps;
+   lib_source_t    *next;
+};
+
 struct _lib {
    char         *path;
    ident_t       name;
    hash_t       *lookup;
    lib_unit_t   *units;
    lib_index_t  *index;
+   hash_t       *index_map;
+   bool          index_sorted;
+   bool          index_loaded;
+   void         *index_base;
+   uint32_t      index_generation;
+   unsigned      index_count;
+   unsigned      index_records;
+   size_t        index_offset;
    uint64_t      index_mtime;
    off_t         index_size;
+   lib_source_t *sources;
+   hash_t       *source_map;
+   uint64_t      sources_mtime;
+   off_t         sources_size;
+   lib_source_t *pending;
    int           lock_fd;
    bool          readonly;
 };
@@ -118,77 +187,565 @@ static ident_t upcase_name(const char *name)
    return ident_new(name_up);
 }
 
-static void lib_add_to_index(lib_t lib, ident_t name, tree_kind_t kind)
+static uint32_t lib_hash_name(const char *str)
+{
+   // FNV-1a hash which is stored in the index so must not change
+   uint32_t hash = UINT32_C(2166136261);
+   for (const char *p = str; *p; p++)
+      hash = (hash ^ (unsigned char)*p) * UINT32_C(16777619);
+
+   return hash;
+}
+
+static uint32_t lib_hash_record(const index_record_t *r)
+{
+   return lib_hash_name(r->name) ^ r->checksum ^ (r->kind << 16) ^ r->namelen;
+}
+
+static lib_index_t *lib_put_index(lib_t lib, ident_t name, tree_kind_t kind,
+                                  uint32_t checksum)
+{
+   lib_index_t *it = hash_get(lib->index_map, name);
+   if (it == NULL) {
+      it = xmalloc(sizeof(lib_index_t));
+      it->name = name;
+      it->next = lib->index;
+
+      lib->index = it;
+      lib->index_sorted = (it->next == NULL);
+
+      hash_put(lib->index_map, name, it);
+   }
+
+   it->kind     = kind;
+   it->checksum = checksum;
+   it->pending  = false;
+
+   return it;
+}
+
+static const index_bucket_t *lib_probe_index(lib_t lib, const char *str)
+{
+   if (lib->index_base == NULL)
+      return NULL;
+
+   const index_header_t *hdr = lib->index_base;
+   const index_bucket_t *buckets = (const index_bucket_t *)(hdr + 1);
+   const char *strtab = (const char *)(buckets + hdr->nbuckets);
+
+   const uint32_t hash = lib_hash_name(str);
+   const uint32_t mask = hdr->nbuckets - 1;
+
+   for (uint32_t i = 0, pos = hash & mask; i < hdr->nbuckets; i++) {
+      const index_bucket_t *b = &(buckets[pos]);
+      if (b->name == 0)
+         return NULL;
+      else if (b->hash == hash && strcmp(strtab + b->name - 1, str) == 0)
+         return b;
+
+      pos = (pos + 1) & mask;
+   }
+
+   return NULL;
+}
+
+static lib_index_t *lib_find_in_index(lib_t lib, ident_t name)
+{
+   lib_index_t *it = hash_get(lib->index_map, name);
+   if (it != NULL)
+      return it;
+
+   const index_bucket_t *b = lib_probe_index(lib, istr(name));
+   if (b == NULL)
+      return NULL;
+
+   return lib_put_index(lib, name, b->kind, b->checksum);
+}
+
+static void lib_load_index(lib_t lib)
+{
+   // Copy every entry in the mapped table into memory
+   if (lib->index_loaded || lib->index_base == NULL)
+      return;
+
+   const index_header_t *hdr = lib->index_base;
+   const index_bucket_t *buckets = (const index_bucket_t *)(hdr + 1);
+   const char *strtab = (const char *)(buckets + hdr->nbuckets);
+
+   for (unsigned i = 0; i < hdr->nbuckets; i++) {
+      if (buckets[i].name == 0)
+         continue;
+
+      ident_t name = ident_new(strtab + buckets[i].name - 1);
+      if (hash_get(lib->index_map, name) == NULL)
+         lib_put_index(lib, name, buckets[i].kind, buckets[i].checksum);
+   }
+
+   lib->index_loaded = true;
+}
+
+static int lib_index_cmp(const void *a, const void *b)
+{
+   const lib_index_t *ia = *(const lib_index_t **)a;
+   const lib_index_t *ib = *(const lib_index_t **)b;
+   return ident_compare(ia->name, ib->name);
+}
+
+static void lib_sort_index(lib_t lib)
 {
    // Keep the index in sorted order to make library builds reproducible
-   lib_index_t **it;
-   for (it = &(lib->index);
-        *it != NULL && ident_compare((*it)->name, name) < 0;
-        it = &((*it)->next))
-      ;
+   if (lib->index_sorted)
+      return;
+
+   unsigned count = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next)
+      count++;
+
+   lib_index_t **sorted LOCAL = xmalloc_array(count, sizeof(lib_index_t *));
+
+   unsigned n = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next)
+      sorted[n++] = it;
 
-   if (*it != NULL && (*it)->name == name) {
-      // Already in the index
-      (*it)->kind = kind;
+   qsort(sorted, count, sizeof(lib_index_t *), lib_index_cmp);
+
+   lib_index_t **link = &(lib->index);
+   for (unsigned i = 0; i < count; i++) {
+      *link = sorted[i];
+      link = &(sorted[i]->next);
    }
-   else {
-      lib_index_t *new = xmalloc(sizeof(lib_index_t));
-      new->name = name;
-      new->kind = kind;
-      new->next = *it;
+   *link = NULL;
+
+   lib->index_sorted = true;
+}
 
-      *it = new;
+static void lib_add_to_index(lib_t lib, ident_t name, tree_kind_t kind,
+                             uint32_t checksum)
+{
+   lib_index_t *it = lib_find_in_index(lib, name);
+   if (it == NULL || it->kind != kind || it->checksum != checksum) {
+      it = lib_put_index(lib, name, kind, checksum);
+      it->pending = true;
    }
 }
 
+static void lib_forget_index(lib_t lib)
+{
+   // Discard cached entries from a table that has since been rewritten
+   for (lib_index_t **it = &(lib->index); *it; ) {
+      lib_index_t *tmp = *it;
+      if (tmp->pending)
+         it = &(tmp->next);
+      else {
+         hash_delete(lib->index_map, tmp->name);
+         *it = tmp->next;
+         free(tmp);
+      }
+   }
+
+   lib->index_loaded = false;
+}
+
+static void lib_unmap_index(lib_t lib)
+{
+   if (lib->index_base != NULL) {
+      unmap_file(lib->index_base, lib->index_size);
+      lib->index_base = NULL;
+   }
+}
+
+static void lib_read_journal(lib_t lib)
+{
+   const char *base = lib->index_base;
+   size_t pos = lib->index_offset;
+
+   while (pos + sizeof(index_record_t) <= lib->index_size) {
+      const index_record_t *r = (const index_record_t *)(base + pos);
+      const size_t len =
+         ALIGN_UP(sizeof(index_record_t) + r->namelen + 1, sizeof(uint32_t));
+
+      if (pos + len > lib->index_size || r->name[r->namelen] != '\0')
+         break;   // Partially written record from a process that crashed
+      else if (r->check != lib_hash_record(r))
+         break;
+
+      assert(r->kind <= T_LAST_TREE_KIND);
+      lib_put_index(lib, ident_new(r->name), r->kind, r->checksum);
+
+      lib->index_records++;
+      pos += len;
+   }
+
+   lib->index_offset = pos;
+}
+
+static size_t lib_index_table_size(const index_header_t *hdr)
+{
+   const size_t size = sizeof(index_header_t)
+      + hdr->nbuckets * sizeof(index_bucket_t) + hdr->strsize;
+   return ALIGN_UP(size, sizeof(uint32_t));
+}
+
 static void lib_read_index(lib_t lib)
 {
-   fbuf_t *f = lib_fbuf_open(lib, "_index", FBUF_IN, FBUF_CS_NONE);
-   if (f != NULL) {
-      file_info_t info;
-      if (!get_handle_info(fbuf_file_handle(f), &info))
-         fatal_errno("%s", fbuf_file_name(f));
+   if (lib->path == NULL)
+      return;   // Temporary library for unit test
 
-      const uint32_t magic = read_u32(f);
-      if (magic != INDEX_FILE_MAGIC) {
-         warnf("ignoring library index %s from an old version of " PACKAGE,
-               fbuf_file_name(f));
-         return;
-      }
+   LOCAL_TEXT_BUF path = lib_file_path(lib, "_index");
 
-      lib->index_mtime = info.mtime;
-      lib->index_size  = info.size;
+#ifdef __MINGW32__
+   const int fd = open(tb_get(path), O_RDONLY | O_BINARY);
+#else
+   const int fd = open(tb_get(path), O_RDONLY);
+#endif
+   if (fd == -1)
+      return;
 
-      ident_rd_ctx_t ictx = ident_read_begin(f);
-      lib_index_t **insert = &(lib->index);
+   file_info_t info;
+   if (!get_handle_info(fd, &info))
+      fatal_errno("%s", tb_get(path));
 
-      const int entries = read_u32(f);
-      for (int i = 0; i < entries; i++) {
-         ident_t name = ident_read(ictx);
-         tree_kind_t kind = read_u16(f);
-         assert(kind <= T_LAST_TREE_KIND);
+   lib_unmap_index(lib);
 
-         while (*insert && ident_compare((*insert)->name, name) < 0)
-            insert = &((*insert)->next);
+   lib->index_mtime = info.mtime;
+   lib->index_size  = info.size;
 
-         if (*insert && (*insert)->name == name) {
-            (*insert)->kind = kind;
-            insert = &((*insert)->next);
-         }
-         else {
-            lib_index_t *new = xmalloc(sizeof(lib_index_t));
-            new->name = name;
-            new->kind = kind;
-            new->next = *insert;
+   if (info.size < sizeof(index_header_t)) {
+      close(fd);
+      return;
+   }
 
-            *insert = new;
-            insert = &(new->next);
-         }
+   const index_header_t *hdr = map_file(fd, info.size);
+   close(fd);
+
+   if (hdr->magic != INDEX_FILE_MAGIC || !is_power_of_2(hdr->nbuckets)
+       || hdr->nbuckets == 0 || lib_index_table_size(hdr) > info.size) {
+      warnf("ignoring library index %s from an old version of " PACKAGE,
+            tb_get(path));
+      unmap_file((void *)hdr, info.size);
+      return;
+   }
+
+   const size_t table_size = lib_index_table_size(hdr);
+
+   if (hdr->generation != lib->index_generation
+       || lib->index_offset < table_size
+       || lib->index_offset > info.size) {
+      // The table was rewritten by another process
+      lib_forget_index(lib);
+      lib->index_generation = hdr->generation;
+      lib->index_offset     = table_size;
+      lib->index_records    = 0;
+   }
+
+   lib->index_base   = (void *)hdr;
+   lib->index_count  = hdr->count;
+   lib->index_loaded = false;
+
+   lib_read_journal(lib);
+}
+
+static void lib_refresh_index(lib_t lib)
+{
+   LOCAL_TEXT_BUF index_path = lib_file_path(lib, "_index");
+   file_info_t info;
+   if (get_file_info(tb_get(index_path), &info)) {
+      if (info.mtime != lib->index_mtime || info.size != lib->index_size) {
+         // Library was updated concurrently: the caller must hold the
+         // lock while the index is re-read
+         lib_read_index(lib);
       }
+   }
+}
+
+static void lib_write_index(lib_t lib)
+{
+   // Rewrite the whole table including any pending entries: the caller
+   // must hold the write lock
+   lib_load_index(lib);
+   lib_sort_index(lib);
+
+   unsigned count = 0;
+   size_t strsize = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next) {
+      strsize += ident_len(it->name) + 1;
+      count++;
+   }
+
+   const index_header_t hdr = {
+      .magic      = INDEX_FILE_MAGIC,
+      .generation = lib->index_generation + 1,
+      .nbuckets   = next_power_of_2(MAX(16, count * 2)),
+      .count      = count,
+      .strsize    = strsize,
+   };
+
+   if (opt_get_verbose(OPT_LIB_VERBOSE, istr(lib->name)))
+      debugf("rewriting index for %s with %u units", istr(lib->name), count);
+
+   const size_t size = lib_index_table_size(&hdr);
+   char *buf LOCAL = xcalloc(size);
+
+   index_bucket_t *buckets = (index_bucket_t *)(buf + sizeof(index_header_t));
+   char *strtab = (char *)(buckets + hdr.nbuckets);
+   const uint32_t mask = hdr.nbuckets - 1;
+
+   memcpy(buf, &hdr, sizeof(index_header_t));
+
+   size_t stroff = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next) {
+      const char *str = istr(it->name);
+      const uint32_t hash = lib_hash_name(str);
+
+      uint32_t pos = hash & mask;
+      while (buckets[pos].name != 0)
+         pos = (pos + 1) & mask;
+
+      buckets[pos].hash     = hash;
+      buckets[pos].name     = stroff + 1;
+      buckets[pos].checksum = it->checksum;
+      buckets[pos].kind     = it->kind;
+
+      const size_t len = strlen(str) + 1;
+      memcpy(strtab + stroff, str, len);
+      stroff += len;
+
+      it->pending = false;
+   }
+
+   // Replace the file atomically so readers never see a partial table
+   LOCAL_TEXT_BUF path = lib_file_path(lib, "_index");
+   LOCAL_TEXT_BUF tmp = tb_new();
+   tb_printf(tmp, "%s.%d.%d", tb_get(path), getpid(), thread_id());
+
+   FILE *f = fopen(tb_get(tmp), "wb");
+   if (f == NULL)
+      fatal_errno("failed to create library %s index", istr(lib->name));
+
+   if (fwrite(buf, size, 1, f) != 1)
+      fatal_errno("fwrite: %s", tb_get(tmp));
+
+   fclose(f);
+
+#ifdef __MINGW32__
+   remove(tb_get(path));
+#endif
+
+   if (rename(tb_get(tmp), tb_get(path)) != 0)
+      fatal_errno("rename: %s", tb_get(path));
+
+   // Entries already in memory are consistent with the new table
+   lib->index_generation = hdr.generation;
+   lib->index_offset     = size;
+   lib->index_records    = 0;
+
+   lib_read_index(lib);
+}
+
+static void lib_append_index(lib_t lib)
+{
+   // Append records for pending entries to the journal: the caller
+   // must hold the write lock
+   size_t size = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next) {
+      if (it->pending)
+         size += ALIGN_UP(sizeof(index_record_t) + ident_len(it->name) + 1,
+                          sizeof(uint32_t));
+   }
+
+   char *buf LOCAL = xcalloc(size);
+
+   size_t pos = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next) {
+      if (!it->pending)
+         continue;
+
+      index_record_t *r = (index_record_t *)(buf + pos);
+      r->checksum = it->checksum;
+      r->kind     = it->kind;
+      r->namelen  = ident_len(it->name);
+      memcpy(r->name, istr(it->name), r->namelen + 1);
+      r->check    = lib_hash_record(r);
+
+      pos += ALIGN_UP(sizeof(index_record_t) + r->namelen + 1,
+                      sizeof(uint32_t));
+   }
+
+   assert(pos == size);
+
+   LOCAL_TEXT_BUF path = lib_file_path(lib, "_index");
+
+#ifdef __MINGW32__
+   const int fd = open(tb_get(path), O_WRONLY | O_APPEND | O_BINARY);
+#else
+   const int fd = open(tb_get(path), O_WRONLY | O_APPEND);
+#endif
+   if (fd == -1)
+      fatal_errno("open: %s", tb_get(path));
+
+   // Discard any partial record left by a process that crashed
+   if (lib->index_offset < lib->index_size
+       && ftruncate(fd, lib->index_offset) != 0)
+      fatal_errno("ftruncate: %s", tb_get(path));
+
+   for (size_t done = 0; done < size; ) {
+      const ssize_t nw = write(fd, buf + done, size - done);
+      if (nw < 0)
+         fatal_errno("write: %s", tb_get(path));
+      done += nw;
+   }
+
+   close(fd);
+
+   // Reading back our own records clears the pending flags
+   lib_read_index(lib);
+}
+
+static void lib_free_source(lib_source_t *src)
+{
+   ACLEAR(src->units);
+   ACLEAR(src->deps);
+   free(src);
+}
+
+static void lib_replace_source(lib_t lib, lib_source_t *src)
+{
+   lib_source_t **it;
+   for (it = &(lib->sources); *it && (*it)->path != src->path;
+        it = &((*it)->next))
+      ;
+
+   if (*it != NULL) {
+      src->next = (*it)->next;
+      lib_free_source(*it);
+   }
+   else
+      src->next = NULL;
+
+   *it = src;
+   hash_put(lib->source_map, src->path, src);
+}
+
+static void lib_read_checksums(fbuf_t *f, ident_rd_ctx_t ictx,
+                               checksum_list_t *list)
+{
+   const int count = read_u32(f);
+   ARESERVE(*list, count);
+
+   for (int i = 0; i < count; i++) {
+      unit_checksum_t uc = {
+         .name     = ident_read(ictx),
+         .checksum = read_u32(f),
+      };
+      APUSH(*list, uc);
+   }
+}
+
+static void lib_read_sources(lib_t lib)
+{
+   // The source file records are only used to skip analysis of files
+   // that have not changed so it is always safe to ignore them
+
+   fbuf_t *f = lib_fbuf_open(lib, "_sources", FBUF_IN, FBUF_CS_NONE);
+   if (f == NULL)
+      return;
+
+   file_info_t info;
+   if (!get_handle_info(fbuf_file_handle(f), &info))
+      fatal_errno("%s", fbuf_file_name(f));
 
-      ident_read_end(ictx);
+   if (info.mtime == lib->sources_mtime && info.size == lib->sources_size) {
       fbuf_close(f, NULL);
+      return;
+   }
+
+   lib->sources_mtime = info.mtime;
+   lib->sources_size  = info.size;
+
+   if (read_u32(f) != SOURCES_FILE_MAGIC) {
+      fbuf_close(f, NULL);
+      return;
+   }
+
+   ident_rd_ctx_t ictx = ident_read_begin(f);
+
+   const int entries = read_u32(f);
+   for (int i = 0; i < entries; i++) {
+      lib_source_t *src = xcalloc(sizeof(lib_source_t));
+      src->path = ident_read(ictx);
+      read_raw(src->digest, SHA1_LEN, f);
+
+      lib_read_checksums(f, ictx, &src->units);
+      lib_read_checksums(f, ictx, &src->deps);
+
+      lib_replace_source(lib, src);
+   }
+
+   ident_read_end(ictx);
+   fbuf_close(f, NULL);
+}
+
+static void lib_write_checksums(fbuf_t *f, ident_wr_ctx_t ictx,
+                                const checksum_list_t *list)
+{
+   write_u32(list->count, f);
+   for (unsigned i = 0; i < list->count; i++) {
+      ident_write(list->items[i].name, ictx);
+      write_u32(list->items[i].checksum, f);
+   }
+}
+
+static void lib_write_sources(lib_t lib)
+{
+   fbuf_t *f = lib_fbuf_open(lib, "_sources", FBUF_OUT, FBUF_CS_NONE);
+   if (f == NULL)
+      fatal_errno("failed to create library %s source list",
+                  istr(lib->name));
+
+   write_u32(SOURCES_FILE_MAGIC, f);
+
+   ident_wr_ctx_t ictx = ident_write_begin(f);
+
+   unsigned count = 0;
+   for (lib_source_t *it = lib->sources; it; it = it->next)
+      count++;
+
+   write_u32(count, f);
+   for (lib_source_t *it = lib->sources; it; it = it->next) {
+      ident_write(it->path, ictx);
+      write_raw(it->digest, SHA1_LEN, f);
+
+      lib_write_checksums(f, ictx, &it->units);
+      lib_write_checksums(f, ictx, &it->deps);
    }
+
+   ident_write_end(ictx);
+   fbuf_close(f, NULL);
+
+   LOCAL_TEXT_BUF path = lib_file_path(lib, "_sources");
+   file_info_t info;
+   if (!get_file_info(tb_get(path), &info))
+      fatal_errno("%s", tb_get(path));
+
+   lib->sources_mtime = info.mtime;
+   lib->sources_size  = info.size;
+}
+
+static void lib_open_lock(lib_t lib)
+{
+   LOCAL_TEXT_BUF lock_path = lib_file_path(lib, "_NVC_LIB");
+
+   // Try to open the lock file read-write as this is required for
+   // exlusive locking on some NFS implementations
+   if ((lib->lock_fd = open(tb_get(lock_path), O_RDWR)) < 0
+       && (errno == EACCES || errno == EPERM || errno == EROFS)) {
+      // Try again in read-only mode
+      lib->lock_fd = open(tb_get(lock_path), O_RDONLY);
+      lib->readonly = true;
+   }
+
+   if (lib->lock_fd < 0)
+      fatal_errno("open: %s", tb_get(lock_path));
 }
 
 static lib_t lib_init(const char *name, const char *rpath, int lock_fd)
@@ -200,6 +757,10 @@ static lib_t lib_init(const char *name, const char *rpath, int lock_fd)
    l->readonly = false;
    l->lookup   = hash_new(128);
 
+   l->index_map = hash_new(128);
+
+   l->source_map = hash_new(16);
+
    char abspath[PATH_MAX];
    if (rpath == NULL)
       l->path = NULL;
@@ -218,20 +779,7 @@ static lib_t lib_init(const char *name, const char *rpath, int lock_fd)
       debugf("library %s at %s", istr(l->name), l->path);
 
    if (l->lock_fd == -1 && rpath != NULL) {
-      LOCAL_TEXT_BUF lock_path = lib_file_path(l, "_NVC_LIB");
-
-      // Try to open the lock file read-write as this is required for
-      // exlusive locking on some NFS implementations
-      if ((l->lock_fd = open(tb_get(lock_path), O_RDWR)) < 0
-          && (errno == EACCES || errno == EPERM || errno == EROFS)) {
-         // Try again in read-only mode
-         l->lock_fd = open(tb_get(lock_path), O_RDONLY);
-         l->readonly = true;
-      }
-
-      if (l->lock_fd < 0)
-         fatal_errno("open: %s", tb_get(lock_path));
-
+      lib_open_lock(l);
       file_read_lock(l->lock_fd);
    }
 
@@ -243,17 +791,6 @@ static lib_t lib_init(const char *name, const char *rpath, int lock_fd)
    return l;
 }
 
-static lib_index_t *lib_find_in_index(lib_t lib, ident_t name)
-{
-   lib_index_t *it;
-   for (it = lib->index;
-        (it != NULL) && (it->name != name);
-        it = it->next)
-      ;
-
-   return it;
-}
-
 static lib_unit_t *lib_put_aux(lib_t lib, object_t *object, bool dirty,
                                bool error, timestamp_t mtime, vcode_unit_t vu)
 {
@@ -299,7 +836,9 @@ static lib_unit_t *lib_put_aux(lib_t lib, object_t *object, bool dirty,
       *it = where;
    }
 
-   lib_add_to_index(lib, name, where->kind);
+   const uint32_t checksum =
+      dirty ? 0 : arena_checksum(object_arena(object));
+   lib_add_to_index(lib, name, where->kind, checksum);
 
    hash_put(lib->lookup, name, where);
    hash_put(lib->lookup, object, where);
@@ -653,6 +1192,8 @@ void lib_free(lib_t lib)
       free(lib->index);
       lib->index = tmp;
    }
+   hash_free(lib->index_map);
+   lib_unmap_index(lib);
 
    for (lib_unit_t *lu = lib->units, *tmp; lu; lu = tmp) {
       tmp = lu->next;
@@ -660,6 +1201,17 @@ void lib_free(lib_t lib)
    }
    hash_free(lib->lookup);
 
+   for (lib_source_t *it = lib->sources, *tmp; it; it = tmp) {
+      tmp = it->next;
+      lib_free_source(it);
+   }
+   hash_free(lib->source_map);
+
+   for (lib_source_t *it = lib->pending, *tmp; it; it = tmp) {
+      tmp = it->next;
+      lib_free_source(it);
+   }
+
    free(lib->path);
    free(lib);
 }
@@ -697,6 +1249,20 @@ void lib_destroy(lib_t lib)
       fatal_errno("rmdir");
 }
 
+void lib_reopen_locks(void)
+{
+   // A forked child shares the open file description of each lock file
+   // with its parent and siblings and so must reopen it for flock to
+   // exclude those processes
+   for (lib_list_t *it = loaded; it != NULL; it = it->next) {
+      lib_t lib = it->item;
+      if (lib->lock_fd != -1 && lib->path != NULL) {
+         close(lib->lock_fd);
+         lib_open_lock(lib);
+      }
+   }
+}
+
 lib_t lib_work(void)
 {
    assert(work != NULL);
@@ -752,11 +1318,45 @@ static void lib_encode_file_name(ident_t id, text_buf_t *tb)
    }
 }
 
+static lib_unit_t *lib_map_unit(lib_t lib, const char *name)
+{
+   if (lib->path == NULL)
+      return NULL;   // Temporary library for unit test
+
+   LOCAL_TEXT_BUF path = lib_file_path(lib, name);
+
+#ifdef __MINGW32__
+   const int fd = open(tb_get(path), O_RDONLY | O_BINARY);
+#else
+   const int fd = open(tb_get(path), O_RDONLY);
+#endif
+   if (fd == -1)
+      return NULL;
+
+   file_info_t info;
+   if (!get_handle_info(fd, &info))
+      fatal_errno("%s", tb_get(path));
+
+   lib_unit_t *lu = NULL;
+   if (object_is_image(fd, info.size)) {
+      object_t *obj = object_map_image(fd, info.size, tb_get(path),
+                                       lib_load_handler);
+      lu = lib_put_aux(lib, obj, false, false, info.mtime, NULL);
+   }
+
+   close(fd);
+   return lu;
+}
+
 static lib_unit_t *lib_read_unit(lib_t lib, ident_t id)
 {
    LOCAL_TEXT_BUF tb = tb_new();
    lib_encode_file_name(id, tb);
 
+   lib_unit_t *lu = lib_map_unit(lib, tb_get(tb));
+   if (lu != NULL)
+      return lu;
+
    fbuf_t *f = lib_fbuf_open(lib, tb_get(tb), FBUF_IN, FBUF_CS_ADLER32);
    if (f == NULL)
       return NULL;
@@ -957,23 +1557,56 @@ ident_t lib_name(lib_t lib)
    return lib->name;
 }
 
-static void lib_save_unit(lib_t lib, lib_unit_t *unit)
+static uint32_t lib_save_image(lib_t lib, const char *name, object_t *obj)
 {
-   LOCAL_TEXT_BUF tb = tb_new();
-   lib_encode_file_name(unit->name, tb);
+   if (lib->path == NULL)
+      fatal("failed to create %s in library %s", name, istr(lib->name));
 
-   fbuf_t *f = lib_fbuf_open(lib, tb_get(tb), FBUF_OUT, FBUF_CS_ADLER32);
+   size_t size;
+   uint32_t checksum;
+   void *image LOCAL = object_write_image(obj, &size, &checksum);
+
+   // Write to a temporary file and then rename it so that processes
+   // which still have the previous version mapped are not disturbed
+   LOCAL_TEXT_BUF path = lib_file_path(lib, name);
+   LOCAL_TEXT_BUF tmp = tb_new();
+   tb_printf(tmp, "%s.%d.%d", tb_get(path), getpid(), thread_id());
+
+   FILE *f = fopen(tb_get(tmp), "wb");
    if (f == NULL)
-      fatal("failed to create %s in library %s", tb_get(tb), istr(lib->name));
+      fatal_errno("%s", tb_get(tmp));
+
+   if (fwrite(image, size, 1, f) != 1)
+      fatal_errno("fwrite: %s", tb_get(tmp));
+
+   fclose(f);
+
+#ifdef __MINGW32__
+   remove(tb_get(path));
+#endif
+
+   if (rename(tb_get(tmp), tb_get(path)) != 0)
+      fatal_errno("rename: %s", tb_get(path));
+
+   return checksum;
+}
+
+static uint32_t lib_save_fbuf(lib_t lib, const char *name, object_t *obj)
+{
+   // Unlink any existing mapped image rather than truncating it
+   if (lib->path != NULL)
+      lib_delete(lib, name);
+
+   fbuf_t *f = lib_fbuf_open(lib, name, FBUF_OUT, FBUF_CS_ADLER32);
+   if (f == NULL)
+      fatal("failed to create %s in library %s", name, istr(lib->name));
 
    write_u8('T', f);
 
    ident_wr_ctx_t ident_ctx = ident_write_begin(f);
    loc_wr_ctx_t *loc_ctx = loc_write_begin(f);
 
-   object_arena_t *arena = object_arena(unit->object);
-
-   object_write(unit->object, f, ident_ctx, loc_ctx);
+   object_write(obj, f, ident_ctx, loc_ctx);
 
    write_u8('\0', f);
 
@@ -983,12 +1616,129 @@ static void lib_save_unit(lib_t lib, lib_unit_t *unit)
    uint32_t checksum;
    fbuf_close(f, &checksum);
 
+   return checksum;
+}
+
+static void lib_save_unit(lib_t lib, lib_unit_t *unit)
+{
+   LOCAL_TEXT_BUF tb = tb_new();
+   lib_encode_file_name(unit->name, tb);
+
+   object_arena_t *arena = object_arena(unit->object);
+
+   uint32_t checksum;
+   if (opt_get_int(OPT_LIB_MAPPED))
+      checksum = lib_save_image(lib, tb_get(tb), unit->object);
+   else
+      checksum = lib_save_fbuf(lib, tb_get(tb), unit->object);
+
    arena_set_checksum(arena, checksum);
+   lib_add_to_index(lib, unit->name, unit->kind, checksum);
 
    assert(unit->dirty);
    unit->dirty = false;
 }
 
+static bool lib_unit_checksum(ident_t name, uint32_t *checksum)
+{
+   lib_t lib = lib_find(ident_until(name, '.'));
+   if (lib == NULL)
+      return false;
+
+   lib_unit_t *lu = hash_get(lib->lookup, name);
+   if (lu != NULL) {
+      if (lu->dirty || lu->error)
+         return false;
+
+      *checksum = arena_checksum(object_arena(lu->object));
+      return true;
+   }
+
+   lib_index_t *it = lib_find_in_index(lib, name);
+   if (it == NULL || it->checksum == 0)
+      return false;   // Not known until the unit is loaded or saved
+
+   *checksum = it->checksum;
+   return true;
+}
+
+static void lib_source_dep_cb(ident_t name, void *ctx)
+{
+   lib_source_t *src = ctx;
+
+   for (unsigned i = 0; i < src->units.count; i++) {
+      if (src->units.items[i].name == name)
+         return;
+   }
+
+   for (unsigned i = 0; i < src->deps.count; i++) {
+      if (src->deps.items[i].name == name)
+         return;
+   }
+
+   unit_checksum_t uc = { .name = name };
+   APUSH(src->deps, uc);
+}
+
+static bool lib_fill_source(lib_source_t *src, lib_unit_t **saved,
+                            unsigned nsaved)
+{
+   const char *file = istr(src->path);
+
+   for (unsigned i = 0; i < nsaved; i++) {
+      if (strcmp(loc_file_str(&(saved[i]->object->loc)), file) == 0) {
+         object_arena_t *arena = object_arena(saved[i]->object);
+         unit_checksum_t uc = {
+            .name     = saved[i]->name,
+            .checksum = arena_checksum(arena),
+         };
+         APUSH(src->units, uc);
+      }
+   }
+
+   if (src->units.count == 0)
+      return false;
+
+   // Dependencies on other units in the same file are already covered
+   // by the checksums of those units
+   for (unsigned i = 0; i < nsaved; i++) {
+      if (strcmp(loc_file_str(&(saved[i]->object->loc)), file) == 0)
+         object_arena_walk_deps(object_arena(saved[i]->object),
+                                lib_source_dep_cb, src);
+   }
+
+   for (unsigned i = 0; i < src->deps.count; i++) {
+      if (!lib_unit_checksum(src->deps.items[i].name,
+                             &(src->deps.items[i].checksum)))
+         return false;
+   }
+
+   return true;
+}
+
+static void lib_save_sources(lib_t lib, lib_unit_t **saved, unsigned nsaved)
+{
+   // Merge with any records written concurrently by another process
+   lib_read_sources(lib);
+
+   for (lib_source_t *it = lib->pending, *tmp; it; it = tmp) {
+      tmp = it->next;
+
+      char rpath[PATH_MAX];
+      if (lib_fill_source(it, saved, nsaved)
+          && realpath(istr(it->path), rpath) != NULL) {
+         it->path = ident_new(rpath);
+         lib_replace_source(lib, it);
+      }
+      else
+         lib_free_source(it);
+   }
+
+   lib->pending = NULL;
+
+   lib_write_sources(lib);
+}
+
 void lib_save(lib_t lib)
 {
    assert(lib != NULL);
@@ -999,60 +1749,132 @@ void lib_save(lib_t lib)
 
    freeze_global_arena();
 
+   SCOPED_A(lib_unit_t *) saved = AINIT;
+
    for (lib_unit_t *lu = lib->units; lu; lu = lu->next) {
       if (lu->dirty) {
          if (lu->error)
             fatal_trace("attempting to save unit %s with errors",
                         istr(lu->name));
-         else
+         else {
             lib_save_unit(lib, lu);
+            APUSH(saved, lu);
+         }
       }
    }
 
-   LOCAL_TEXT_BUF index_path = lib_file_path(lib, "_index");
-   file_info_t info;
-   if (get_file_info(tb_get(index_path), &info)) {
-      if (info.mtime != lib->index_mtime || info.size != lib->index_size) {
-         // Library was updated concurrently: re-read the index while we
-         // have the lock
-         lib_read_index(lib);
-      }
+   lib_refresh_index(lib);
+
+   // Re-reading the index replaces the checksums of any units saved above
+   for (unsigned i = 0; i < saved.count; i++) {
+      object_arena_t *arena = object_arena(saved.items[i]->object);
+      lib_add_to_index(lib, saved.items[i]->name, saved.items[i]->kind,
+                       arena_checksum(arena));
    }
 
-   int index_sz = lib_index_size(lib);
+   unsigned npending = 0;
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next)
+      npending += it->pending;
+
+   const unsigned max_journal = MAX(INDEX_MIN_JOURNAL, lib->index_count);
 
-   fbuf_t *f = lib_fbuf_open(lib, "_index", FBUF_OUT, FBUF_CS_NONE);
-   if (f == NULL)
-      fatal_errno("failed to create library %s index", istr(lib->name));
+   if (lib->index_base == NULL
+       || lib->index_records + npending > max_journal)
+      lib_write_index(lib);
+   else if (npending > 0)
+      lib_append_index(lib);
 
-   write_u32(INDEX_FILE_MAGIC, f);
+   if (lib->pending != NULL)
+      lib_save_sources(lib, saved.items, saved.count);
 
-   ident_wr_ctx_t ictx = ident_write_begin(f);
+   file_unlock(lib->lock_fd);
+}
 
-   write_u32(index_sz, f);
-   for (lib_index_t *it = lib->index; it != NULL; it = it->next) {
-      ident_write(it->name, ictx);
-      write_u16(it->kind, f);
+static bool lib_source_unchanged(lib_t lib, const char *file,
+                                 const unsigned char *digest)
+{
+   char rpath[PATH_MAX];
+   if (realpath(file, rpath) == NULL)
+      return false;
+
+   file_read_lock(lib->lock_fd);
+   lib_refresh_index(lib);
+   lib_read_sources(lib);
+   file_unlock(lib->lock_fd);
+
+   lib_source_t *src = hash_get(lib->source_map, ident_new(rpath));
+   if (src == NULL || memcmp(src->digest, digest, SHA1_LEN) != 0)
+      return false;
+
+   const checksum_list_t *lists[] = { &(src->units), &(src->deps) };
+   for (size_t i = 0; i < ARRAY_LEN(lists); i++) {
+      for (unsigned j = 0; j < lists[i]->count; j++) {
+         uint32_t checksum;
+         if (!lib_unit_checksum(lists[i]->items[j].name, &checksum))
+            return false;
+         else if (checksum != lists[i]->items[j].checksum)
+            return false;
+      }
    }
 
-   ident_write_end(ictx);
-   fbuf_close(f, NULL);
+   // The source file may have been touched without changing its
+   // contents so make sure the design units do not appear stale
+   file_info_t info;
+   if (get_file_info(file, &info)) {
+      for (unsigned i = 0; i < src->units.count; i++) {
+         LOCAL_TEXT_BUF tb = tb_new();
+         lib_encode_file_name(src->units.items[i].name, tb);
 
-   if (!get_file_info(tb_get(index_path), &info))
-      fatal_errno("%s", tb_get(index_path));
+         LOCAL_TEXT_BUF path = lib_file_path(lib, tb_get(tb));
 
-   lib->index_mtime = info.mtime;
-   lib->index_size  = info.size;
+         file_info_t uinfo;
+         if (get_file_info(tb_get(path), &uinfo) && uinfo.mtime < info.mtime
+             && utime(tb_get(path), NULL) != 0)
+            fatal_errno("utime: %s", tb_get(path));
+      }
+   }
 
-   file_unlock(lib->lock_fd);
+   if (opt_get_verbose(OPT_LIB_VERBOSE, istr(lib->name)))
+      debugf("reusing %u design units from %s", src->units.count, file);
+
+   return true;
+}
+
+bool lib_reuse_source(lib_t lib, const char *file,
+                      const unsigned char *digest)
+{
+   assert(lib != NULL);
+
+   if (lib->path != NULL && !lib->readonly
+       && lib_source_unchanged(lib, file, digest))
+      return true;
+
+   // Remember the digest so the next call to lib_save can record which
+   // design units were analysed from this file
+   ident_t path = ident_new(file);
+
+   lib_source_t **it;
+   for (it = &(lib->pending); *it && (*it)->path != path;
+        it = &((*it)->next))
+      ;
+
+   if (*it == NULL) {
+      *it = xcalloc(sizeof(lib_source_t));
+      (*it)->path = path;
+   }
+
+   memcpy((*it)->digest, digest, SHA1_LEN);
+   return false;
 }
 
 void lib_walk_index(lib_t lib, lib_index_fn_t fn, void *context)
 {
    assert(lib != NULL);
 
-   lib_index_t *it;
-   for (it = lib->index; it != NULL; it = it->next)
+   lib_load_index(lib);
+   lib_sort_index(lib);
+
+   for (lib_index_t *it = lib->index; it != NULL; it = it->next)
       (*fn)(lib, it->name, it->kind, context);
 }
 
@@ -1068,6 +1890,8 @@ unsigned lib_index_size(lib_t lib)
 {
    assert(lib != NULL);
 
+   lib_load_index(lib);
+
    unsigned n = 0;
    for (lib_index_t *it = lib->index; it != NULL; it = it->next)
       n++;
@@ -37,8 +37,11 @@ fbuf_t *lib_fbuf_open(lib_t lib, const char *name,
 const char *lib_path(lib_t lib);
 void lib_realpath(lib_t lib, const char *name, char *buf, size_t buflen);
 void lib_destroy(lib_t lib);
+void lib_reopen_locks(void);
 ident_t lib_name(lib_t lib);
 void lib_save(lib_t lib);
+bool lib_reuse_source(lib_t lib, const char *file,
+                      const unsigned char *digest);
 void lib_add_search_path(const char *path);
 void lib_add_map(const char *name, const char *path);
 void lib_delete(lib_t lib, const char *name);
@@ -123,6 +123,39 @@ void mask_set_range(bit_mask_t *m, int start, int count)
    }
 }
 
+bool mask_test_and_set(bit_mask_t *m, int bit)
+{
+   // Safe to call concurrently with other atomic updates to the mask
+   assert(bit < m->size);
+
+   uint64_t *word = m->size > 64 ? &(m->ptr[bit / 64]) : &(m->bits);
+   const uint64_t flag = UINT64_C(1) << (bit % 64);
+
+   if (__atomic_load_n(word, __ATOMIC_RELAXED) & flag)
+      return true;
+
+   return !!(__atomic_fetch_or(word, flag, __ATOMIC_RELAXED) & flag);
+}
+
+void mask_set_range_atomic(bit_mask_t *m, int start, int count)
+{
+   if (m->size <= 64) {
+      __atomic_fetch_or(&(m->bits), mask_for_range(start, start + count - 1),
+                        __ATOMIC_RELAXED);
+      return;
+   }
+
+   while (count > 0) {
+      const int low = start % 64;
+      const int high = MIN(low + count - 1, 63);
+      const int nbits = high - low + 1;
+      __atomic_fetch_or(&(m->ptr[start / 64]), mask_for_range(low, high),
+                        __ATOMIC_RELAXED);
+      start += nbits;
+      count -= nbits;
+   }
+}
+
 bool mask_test_range(bit_mask_t *m, int start, int count)
 {
    if (m->size <= 64)
@@ -63,6 +63,8 @@ void mask_free(bit_mask_t *m);
 void mask_clear_range(bit_mask_t *m, int start, int count);
 void mask_set_range(bit_mask_t *m, int start, int count);
 bool mask_test_range(bit_mask_t *m, int start, int count);
+bool mask_test_and_set(bit_mask_t *m, int bit);
+void mask_set_range_atomic(bit_mask_t *m, int start, int count);
 int mask_popcount(bit_mask_t *m);
 void mask_setall(bit_mask_t *m);
 void mask_clearall(bit_mask_t *m);
@@ -16,10 +16,12 @@
 //
 
 #include "util.h"
+#include "array.h"
 #include "common.h"
 #include "cov/cov-api.h"
 #include "diag.h"
 #include "eval.h"
+#include "hash.h"
 #include "jit/jit-llvm.h"
 #include "jit/jit.h"
 #include "lib.h"
@@ -43,12 +45,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <time.h>
 
+#ifndef __MINGW32__
+#include <sys/wait.h>
+#endif
+
 #if HAVE_GIT_SHA
 #include "gitsha.h"
 #define GIT_SHA_ONLY(x) x
@@ -68,6 +76,28 @@ typedef struct {
    bool             user_set_std;
 } cmd_state_t;
 
+typedef A(char *) source_list_t;
+typedef A(int) job_list_t;
+typedef A(ident_t) ident_list_t;
+
+typedef enum {
+   JOB_WAITING, JOB_RUNNING, JOB_DONE, JOB_FAILED
+} job_state_t;
+
+typedef struct {
+   const char  *file;
+   job_state_t  state;
+   pid_t        pid;
+   FILE        *out;
+   FILE        *err;
+   job_list_t   deps;
+} analysis_job_t;
+
+typedef struct {
+   int        last_decl;
+   job_list_t readers;
+} unit_deps_t;
+
 const char copy_string[] =
    "Copyright (C) 2011-2024  Nick Gasson\n"
    "This program comes with ABSOLUTELY NO WARRANTY. This is free software, "
@@ -141,7 +171,7 @@ static void parse_pp_define(char *optarg)
    pp_defines_add(optarg, eq + 1);
 }
 
-static void do_file_list(const char *file, jit_t *jit, unit_registry_t *ur)
+static void do_file_list(const char *file, source_list_t *files)
 {
    FILE *f;
    if (strcmp(file, "-") == 0)
@@ -162,13 +192,329 @@ static void do_file_list(const char *file, jit_t *jit, unit_registry_t *ur)
       if (strlen(line) == 0)
          continue;
 
-      analyse_file(line, jit, ur);
+      APUSH(*files, xstrdup(line));
    }
 
    free(line);
    fclose(f);
 }
 
+#ifndef __MINGW32__
+static void ignore_diag(diag_t *d, void *context)
+{
+}
+
+static bool scan_design_units(const char *file, ident_t wname,
+                              ident_list_t *decls, ident_list_t *refs)
+{
+   // Find the names of the library units a file declares and the units
+   // in the work library it references using only the lexer: returns
+   // false if the dependencies cannot be determined this way
+
+   file_info_t info;
+   if (!get_file_info(file, &info) || info.type != FILE_REGULAR)
+      return false;
+
+   input_from_file(file);
+
+   if (source_kind() != SOURCE_VHDL)
+      return false;
+
+   extern yylval_t yylval;
+
+   ident_t work_i = well_known(W_WORK);
+
+   token_t tok[5] = {};
+   ident_t id[5] = {};
+   bool complete = true;
+
+   for (;;) {
+      for (int i = ARRAY_LEN(tok) - 1; i > 0; i--) {
+         tok[i] = tok[i - 1];
+         id[i] = id[i - 1];
+      }
+
+      if ((tok[0] = processed_yylex()) == tEOF)
+         return complete;
+
+      id[0] = tok[0] == tID ? yylval.ident : NULL;
+      free_token(tok[0], &yylval);
+
+      if (tok[0] == tIS && tok[1] == tID) {
+         if (tok[2] == tENTITY || tok[2] == tPACKAGE || tok[2] == tCONTEXT)
+            APUSH(*decls, id[1]);
+         else if (tok[2] == tBODY && tok[3] == tPACKAGE) {
+            APUSH(*refs, id[1]);
+            APUSH(*decls, ident_prefix(id[1], well_known(W_BODY), '-'));
+         }
+         else if (tok[2] == tOF && tok[3] == tID) {
+            if (tok[4] == tARCHITECTURE) {
+               APUSH(*refs, id[1]);
+               APUSH(*decls, ident_prefix(id[1], id[3], '-'));
+            }
+            else if (tok[4] == tCONFIGURATION) {
+               APUSH(*refs, id[1]);
+               APUSH(*decls, id[3]);
+            }
+         }
+      }
+      else if (tok[1] == tDOT && tok[2] == tID
+               && (id[2] == work_i || id[2] == wname)) {
+         if (tok[0] == tID)
+            APUSH(*refs, id[0]);
+         else
+            complete = false;   // Depends on every unit in the library
+      }
+   }
+}
+
+static unit_deps_t *get_unit_deps(hash_t *h, ident_t name)
+{
+   unit_deps_t *ud = hash_get(h, name);
+   if (ud == NULL) {
+      ud = xcalloc(sizeof(unit_deps_t));
+      ud->last_decl = -1;
+      hash_put(h, name, ud);
+   }
+
+   return ud;
+}
+
+static void build_job_graph(analysis_job_t *jobs, int njobs)
+{
+   // Each file depends on the earlier files that declare a unit it
+   // references or redeclares, and on the earlier readers of a unit it
+   // redeclares, so that every unit is seen in the same state as a
+   // sequential analysis.  A file whose dependencies are not known
+   // waits for all earlier files and all later files wait for it.
+
+   hash_t *h = hash_new(njobs * 2);
+   ident_t wname = lib_name(lib_work());
+   int barrier = -1;
+
+   diag_set_consumer(ignore_diag, NULL);
+
+   for (int i = 0; i < njobs; i++) {
+      analysis_job_t *job = &(jobs[i]);
+
+      ident_list_t decls = AINIT, refs = AINIT;
+      if (!scan_design_units(job->file, wname, &decls, &refs)) {
+         for (int j = barrier + 1; j < i; j++)
+            APUSH(job->deps, j);
+
+         barrier = i;
+      }
+      else if (barrier >= 0)
+         APUSH(job->deps, barrier);
+
+      for (int j = 0; j < refs.count; j++) {
+         unit_deps_t *ud = get_unit_deps(h, refs.items[j]);
+         if (ud->last_decl >= 0)
+            APUSH(job->deps, ud->last_decl);
+         APUSH(ud->readers, i);
+      }
+
+      for (int j = 0; j < decls.count; j++) {
+         unit_deps_t *ud = get_unit_deps(h, decls.items[j]);
+         if (ud->last_decl >= 0)
+            APUSH(job->deps, ud->last_decl);
+         for (int k = 0; k < ud->readers.count; k++) {
+            if (ud->readers.items[k] != i)
+               APUSH(job->deps, ud->readers.items[k]);
+         }
+
+         ud->last_decl = i;
+         ACLEAR(ud->readers);
+      }
+
+      ACLEAR(decls);
+      ACLEAR(refs);
+   }
+
+   diag_set_consumer(NULL, NULL);
+   reset_error_count();   // Errors are reported again during analysis
+
+   const void *key;
+   void *value;
+   for (hash_iter_t it = HASH_BEGIN; hash_iter(h, &it, &key, &value); ) {
+      unit_deps_t *ud = value;
+      ACLEAR(ud->readers);
+      free(ud);
+   }
+
+   hash_free(h);
+}
+
+static bool job_ready(analysis_job_t *jobs, analysis_job_t *job)
+{
+   for (int i = 0; i < job->deps.count; i++) {
+      if (jobs[job->deps.items[i]].state != JOB_DONE)
+         return false;
+   }
+
+   return true;
+}
+
+static bool same_output_file(void)
+{
+   struct stat out, err;
+   if (fstat(STDOUT_FILENO, &out) != 0 || fstat(STDERR_FILENO, &err) != 0)
+      return false;
+
+   return out.st_dev == err.st_dev && out.st_ino == err.st_ino;
+}
+
+static void start_job(analysis_job_t *job, bool combined, unit_registry_t *ur)
+{
+   if ((job->out = tmpfile()) == NULL)
+      fatal_errno("tmpfile");
+   else if (!combined && (job->err = tmpfile()) == NULL)
+      fatal_errno("tmpfile");
+
+   fflush(stdout);
+   fflush(stderr);
+
+   const pid_t pid = fork();
+   if (pid == 0) {
+      dup2(fileno(job->out), STDOUT_FILENO);
+      dup2(fileno(job->err ?: job->out), STDERR_FILENO);
+
+      lib_reopen_locks();
+
+      jit_t *jit = jit_new(ur);
+      analyse_file(job->file, jit, ur);
+      jit_free(jit);
+
+      if (error_count() == 0)
+         lib_save(lib_work());
+
+      fflush(stdout);
+      fflush(stderr);
+
+      // Skip exit handlers which belong to the parent process
+      _exit(error_count() > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+   }
+   else if (pid < 0)
+      fatal_errno("fork");
+
+   job->pid   = pid;
+   job->state = JOB_RUNNING;
+}
+
+static void replay_output(FILE **from, FILE *to)
+{
+   if (*from == NULL)
+      return;
+
+   rewind(*from);
+
+   char buf[4096];
+   size_t nbytes;
+   while ((nbytes = fread(buf, 1, sizeof(buf), *from)) > 0)
+      fwrite(buf, 1, nbytes, to);
+
+   fflush(to);
+   fclose(*from);
+   *from = NULL;
+}
+
+static int analyse_parallel(analysis_job_t *jobs, int njobs, int maxjobs,
+                            unit_registry_t *ur)
+{
+   // Each file is analysed in a separate process which saves its units
+   // to the work library for later files to read.  The output of each
+   // process is buffered and printed in the original file order.
+   // Returns the index of the first file that did not analyse cleanly
+   // after which the remaining files must be analysed sequentially.
+
+   build_job_graph(jobs, njobs);
+
+   const bool combined = same_output_file();
+
+   int running = 0, next_print = 0;
+   bool failed = false;
+   for (;;) {
+      for (int i = 0; i < njobs && running < maxjobs && !failed; i++) {
+         if (jobs[i].state == JOB_WAITING && job_ready(jobs, &(jobs[i]))) {
+            start_job(&(jobs[i]), combined, ur);
+            running++;
+         }
+      }
+
+      if (running == 0)
+         break;
+
+      int status;
+      const pid_t pid = waitpid(-1, &status, 0);
+      if (pid < 0 && errno == EINTR)
+         continue;
+      else if (pid < 0)
+         fatal_errno("waitpid");
+
+      for (int i = 0; i < njobs; i++) {
+         if (jobs[i].state != JOB_RUNNING || jobs[i].pid != pid)
+            continue;
+         else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            jobs[i].state = JOB_DONE;
+         else {
+            jobs[i].state = JOB_FAILED;
+            failed = true;
+         }
+
+         running--;
+         break;
+      }
+
+      for (; next_print < njobs && jobs[next_print].state == JOB_DONE;
+           next_print++) {
+         replay_output(&(jobs[next_print].out), stdout);
+         replay_output(&(jobs[next_print].err), stderr);
+      }
+   }
+
+   for (int i = next_print; i < njobs; i++) {
+      // Discard the output of files that will be analysed again
+      if (jobs[i].out != NULL)
+         fclose(jobs[i].out);
+      if (jobs[i].err != NULL)
+         fclose(jobs[i].err);
+   }
+
+   return next_print;
+}
+#endif  // __MINGW32__
+
+static void analyse_files(char **files, int nfiles, int maxjobs,
+                          unit_registry_t *ur)
+{
+   int first = 0;
+
+#ifndef __MINGW32__
+   if (maxjobs > 1 && nfiles > 1) {
+      analysis_job_t *jobs = xcalloc_array(nfiles, sizeof(analysis_job_t));
+      for (int i = 0; i < nfiles; i++)
+         jobs[i].file = files[i];
+
+      first = analyse_parallel(jobs, nfiles, maxjobs, ur);
+
+      for (int i = 0; i < nfiles; i++)
+         ACLEAR(jobs[i].deps);
+      free(jobs);
+   }
+#endif
+
+   if (first == nfiles)
+      return;
+
+   // Units saved by a parallel analysis are read back from the library
+   jit_t *jit = jit_new(ur);
+
+   for (int i = first; i < nfiles; i++)
+      analyse_file(files[i], jit, ur);
+
+   jit_free(jit);
+}
+
 static int analyse(int argc, char **argv, cmd_state_t *state)
 {
    static struct option long_options[] = {
@@ -180,13 +526,14 @@ static int analyse(int argc, char **argv, cmd_state_t *state)
       { "relaxed",         no_argument,       0, 'R' },
       { "define",          required_argument, 0, 'D' },
       { "files",           required_argument, 0, 'f' },
+      { "jobs",            required_argument, 0, 'j' },
       { 0, 0, 0, 0 }
    };
 
    const int next_cmd = scan_cmd(2, argc, argv);
-   int c, index = 0, error_limit = 20;
+   int c, index = 0, error_limit = 20, jobs = 1;
    const char *file_list = NULL;
-   const char *spec = ":D:f:";
+   const char *spec = ":D:f:j:";
 
    while ((c = getopt_long(next_cmd, argv, spec, long_options, &index)) != -1) {
       switch (c) {
@@ -223,6 +570,10 @@ static int analyse(int argc, char **argv, cmd_state_t *state)
       case 'f':
          file_list = optarg;
          break;
+      case 'j':
+         if ((jobs = parse_int(optarg)) < 1)
+            fatal("number of jobs must be greater than zero");
+         break;
       default:
          abort();
       }
@@ -234,19 +585,25 @@ static int analyse(int argc, char **argv, cmd_state_t *state)
       state->registry = unit_registry_new();
 
    lib_t work = lib_work();
-   jit_t *jit = jit_new(state->registry);
+
+   source_list_t files = AINIT;
 
    if (file_list != NULL)
-      do_file_list(file_list, jit, state->registry);
+      do_file_list(file_list, &files);
 
    for (int i = optind; i < next_cmd; i++) {
       if (argv[i][0] == '@')
-         do_file_list(argv[i] + 1, jit, state->registry);
+         do_file_list(argv[i] + 1, &files);
       else
-         analyse_file(argv[i], jit, state->registry);
+         APUSH(files, xstrdup(argv[i]));
    }
 
-   jit_free(jit);
+   analyse_files(files.items, files.count, jobs, state->registry);
+
+   for (int i = 0; i < files.count; i++)
+      free(files.items[i]);
+   ACLEAR(files);
+
    set_error_limit(0);
 
    if (error_count() > 0)
@@ -644,7 +1001,7 @@ static int run_cmd(int argc, char **argv, cmd_state_t *state)
 {
    static struct option long_options[] = {
       { "trace",         no_argument,       0, 't' },
-      { "profile",       no_argument,       0, 'p' },
+      { "profile",       optional_argument, 0, 'p' },
       { "stop-time",     required_argument, 0, 's' },
       { "stats",         no_argument,       0, 'S' },
       { "wave",          optional_argument, 0, 'w' },
@@ -660,6 +1017,7 @@ static int run_cmd(int argc, char **argv, cmd_state_t *state)
       { "vhpi-trace",    no_argument,       0, 'T' },
       { "gtkw",          optional_argument, 0, 'g' },
       { "shuffle",       no_argument,       0, 'H' },
+      { "parallel",      no_argument,       0, 'P' },
       { 0, 0, 0, 0 }
    };
 
@@ -693,6 +1051,8 @@ static int run_cmd(int argc, char **argv, cmd_state_t *state)
          break;
       case 'p':
          opt_set_int(OPT_RT_PROFILE, 1);
+         if (optarg != NULL)
+            opt_set_str(OPT_PROFILE_FILE, optarg);
          break;
       case 'T':
          opt_set_str(OPT_VHPI_TRACE, "1");
@@ -754,6 +1114,9 @@ static int run_cmd(int argc, char **argv, cmd_state_t *state)
                "as non-deterministic behaviour");
          opt_set_int(OPT_SHUFFLE_PROCS, 1);
          break;
+      case 'P':
+         opt_set_int(OPT_RT_PARALLEL, 1);
+         break;
       default:
          abort();
       }
@@ -1712,6 +2075,8 @@ static void usage(void)
           " -H SIZE\t\tSet the maximum heap size to SIZE bytes\n"
           "     --ignore-time\tSkip source file timestamp check\n"
           " -L PATH\t\tAdd PATH to library search paths\n"
+          "     --lib-format=FMT\tWrite design units in compressed or mapped "
+          "format\n"
           " -M SIZE\t\tLimit design unit heap space to SIZE bytes\n"
           "     --map=LIB:PATH\tMap library LIB to PATH\n"
           "     --messages=STYLE\tSelect full or compact message format\n"
@@ -1726,6 +2091,7 @@ static void usage(void)
           " -D, --define NAME=VAL\tSet preprocessor symbol NAME to VAL\n"
           "     --error-limit=NUM\tStop after NUM errors\n"
           " -f, --files=LIST\tRead files to analyse from LIST\n"
+          " -j, --jobs=NUM\t\tAnalyse up to NUM files in parallel\n"
           "     --psl\t\tEnable parsing of PSL directives in comments\n"
           "     --relaxed\t\tDisable certain pedantic rule checks\n"
           "\n"
@@ -1757,7 +2123,8 @@ static void usage(void)
           "     \t\t\tfrom IEEE packages\n"
           "     --include=GLOB\tInclude signals matching GLOB in wave dump\n"
           "     --load=PLUGIN\tLoad VHPI plugin at startup\n"
-          "     --profile\t\tDisplay detailed statistics at end of run\n"
+          "     --profile[=FILE]\tDisplay per-process and per-signal profile at\n"
+          "     \t\t\tend of run; also write JSON report to FILE\n"
           "     --shuffle\t\tRun processes in random order\n"
           "     --stats\t\tPrint time and memory usage at end of run\n"
           "     --stop-delta=N\tStop after N delta cycles (default %d)\n"
@@ -1851,6 +2218,17 @@ static message_style_t parse_message_style(const char *str)
    fatal("invalid message style '%s' (allowed are 'full' and 'compact')", str);
 }
 
+static bool parse_lib_format(const char *str)
+{
+   if (strcmp(str, "compressed") == 0)
+      return false;
+   else if (strcmp(str, "mapped") == 0)
+      return true;
+
+   fatal("invalid library format '%s' (allowed are 'compressed' and "
+         "'mapped')", str);
+}
+
 static size_t parse_size(const char *str)
 {
    char *eptr;
@@ -1982,6 +2360,7 @@ int main(int argc, char **argv)
       { "ignore-time", no_argument,       0, 'i' },
       { "force-init",  no_argument,       0, 'f' },   // DEPRECATED 1.7
       { "stderr",      required_argument, 0, 'E' },
+      { "lib-format",  required_argument, 0, 'F' },
       { 0, 0, 0, 0 }
    };
 
@@ -2043,6 +2422,9 @@ int main(int argc, char **argv)
       case 'E':
          set_stderr_severity(parse_severity(optarg));
          break;
+      case 'F':
+         opt_set_int(OPT_LIB_MAPPED, parse_lib_format(optarg));
+         break;
       case '?':
          bad_option("global", argv);
       case ':':
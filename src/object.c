@@ -23,12 +23,14 @@
 #include "lib.h"
 #include "object.h"
 #include "option.h"
+#include "sha1.h"
 #include "thread.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <unistd.h>
 
 typedef uint64_t mark_mask_t;
 
@@ -37,6 +39,44 @@ typedef A(object_t **) object_ptr_array_t;
 
 typedef enum { OBJ_DISK, OBJ_FRESH } obj_src_t;
 
+#define IMAGE_MAGIC 0x4e56494d
+
+// An image is an arena written out verbatim followed by a data section
+// holding arrays and strings and then a trailer at the end of the file.
+// Object references, identifiers, and file names are replaced with
+// position-independent encodings which are swizzled back to pointers
+// the first time each object is accessed after the file is mapped.
+
+typedef struct {
+   uint64_t name;
+   uint32_t std;
+   uint32_t checksum;
+} image_dep_t;
+
+typedef struct {
+   uint32_t magic;
+   uint32_t format;
+   uint32_t std;
+   uint32_t flags;
+   uint32_t checksum;
+   uint32_t ndeps;
+   uint32_t nidents;
+   uint32_t nfiles;
+   uint64_t name;
+   uint64_t objsize;
+   uint64_t deps;
+   uint64_t idents;
+   uint64_t files;
+} image_trailer_t;
+
+typedef struct {
+   const uint64_t *idents;
+   ident_t        *ident_cache;
+   unsigned        nidents;
+   loc_file_ref_t *file_map;
+   unsigned        nfiles;
+} image_t;
+
 typedef struct _object_arena {
    void           *base;
    void           *alloc;
@@ -57,6 +97,7 @@ typedef struct _object_arena {
    generation_t    copygen;
    bool            frozen;
    bool            has_locus;
+   image_t        *image;
 } object_arena_t;
 
 #ifndef __SANITIZE_ADDRESS__
@@ -102,6 +143,10 @@ static generation_t    next_generation = 1;
 static arena_array_t   all_arenas;
 static object_arena_t *global_arena = NULL;
 static chash_t        *arena_lookup;
+static chash_t        *image_pages;
+static nvc_lock_t      image_lock;
+
+bool object_images_mapped = false;
 
 static inline bool object_in_arena_p(object_arena_t *arena, object_t *object)
 {
@@ -110,6 +155,7 @@ static inline bool object_in_arena_p(object_arena_t *arena, object_t *object)
 
 static inline object_arena_t *__object_arena(object_t *object)
 {
+   object_materialise(object);
    assert(object->arena < all_arenas.count);
    assert(object->arena != 0);
    return all_arenas.items[object->arena];
@@ -188,6 +234,11 @@ void arena_set_checksum(object_arena_t *arena, uint32_t checksum)
    arena->checksum = checksum;
 }
 
+uint32_t arena_checksum(object_arena_t *arena)
+{
+   return arena->checksum;
+}
+
 object_t *arena_root(object_arena_t *arena)
 {
    return arena->root ?: (object_t *)arena->base;
@@ -423,6 +474,7 @@ static void object_one_time_init(void)
          add_fault_handler(check_frozen_object_fault, NULL);
 
          arena_lookup = chash_new(64);
+         image_pages = chash_new(64);
       });
 }
 
@@ -513,8 +565,12 @@ static void gc_forward_pointers(object_t *object, object_arena_t *arena,
    }
 }
 
-static void gc_mark_from_root(object_t *root, generation_t generation)
+static void gc_mark_from_root(object_t *root, object_arena_t *arena,
+                              generation_t generation)
 {
+   // Objects in other arenas were frozen before this arena was created
+   // and so cannot refer back to it: skipping them avoids touching
+   // every object reachable in mapped dependencies
    object_visit_ctx_t ctx = {
       .count      = 0,
       .postorder  = NULL,
@@ -522,7 +578,8 @@ static void gc_mark_from_root(object_t *root, generation_t generation)
       .context    = NULL,
       .kind       = T_LAST_TREE_KIND,
       .generation = generation,
-      .deep       = true
+      .deep       = true,
+      .arena      = arena,
    };
 
    object_visit(root, &ctx);
@@ -560,7 +617,7 @@ void object_arena_gc(object_arena_t *arena)
       const object_class_t *class = classes[object->tag];
 
       if (is_gc_root(class, object->kind))
-         gc_mark_from_root(object, generation);
+         gc_mark_from_root(object, arena, generation);
 
       const size_t size =
          ALIGN_UP(class->object_size[object->kind], OBJECT_ALIGN);
@@ -649,6 +706,8 @@ void object_visit(object_t *object, object_visit_ctx_t *ctx)
 
    if (object == NULL)
       return;
+   else if (ctx->arena != NULL && !object_in_arena_p(ctx->arena, object))
+      return;
    else if (object_marked_p(object, ctx->generation))
       return;
 
@@ -946,20 +1005,8 @@ static object_t *object_read_ref(fbuf_t *f, const arena_key_t *key_map)
    return (object_t *)((char *)arena->base + offset);
 }
 
-object_t *object_read(fbuf_t *f, object_load_fn_t loader_fn,
-                      ident_rd_ctx_t ident_ctx, loc_rd_ctx_t *loc_ctx)
+static void object_check_standard(const char *file, vhdl_standard_t std)
 {
-   object_one_time_init();
-
-   const uint32_t ver = read_u32(f);
-   if (ver != format_digest)
-      fatal("%s: serialised format digest is %x expected %x. This design "
-            "unit uses a library format from an earlier version of "
-            PACKAGE_NAME " and should be reanalysed.",
-            fbuf_file_name(f), ver, format_digest);
-
-   const vhdl_standard_t std = fbuf_get_uint(f);
-
    // If this is the first design unit we've loaded then allow it to set
    // the default standard
    if (all_arenas.count == 0)
@@ -968,7 +1015,67 @@ object_t *object_read(fbuf_t *f, object_load_fn_t loader_fn,
    if (std > standard())
       fatal("%s: design unit was analysed using standard revision %s which "
             "is more recent that the currently selected standard %s",
-            fbuf_file_name(f), standard_text(std), standard_text(standard()));
+            file, standard_text(std), standard_text(standard()));
+}
+
+static void object_check_format(const char *file, uint32_t ver)
+{
+   if (ver != format_digest)
+      fatal("%s: serialised format digest is %x expected %x. This design "
+            "unit uses a library format from an earlier version of "
+            PACKAGE_NAME " and should be reanalysed.",
+            file, ver, format_digest);
+}
+
+static object_arena_t *object_resolve_dep(const char *file, ident_t name,
+                                          ident_t dep, vhdl_standard_t dstd,
+                                          uint32_t checksum,
+                                          object_load_fn_t loader_fn)
+{
+   object_arena_t *a = NULL;
+   for (unsigned j = 1; a == NULL && j < all_arenas.count; j++) {
+      if (dep == object_arena_name(all_arenas.items[j]))
+         a = all_arenas.items[j];
+   }
+
+   if (a == NULL) {
+      object_t *droot = NULL;
+      if (loader_fn) droot = (*loader_fn)(dep);
+
+      if (droot == NULL)
+         fatal("%s depends on %s which cannot be found", file, istr(dep));
+
+      a = __object_arena(droot);
+   }
+
+   if (a->std != dstd)
+      fatal("%s: design unit depends on %s version of %s but conflicting "
+            "%s version has been loaded", file, standard_text(dstd),
+            istr(dep), standard_text(a->std));
+   else if (a->checksum != checksum) {
+      diag_t *d = diag_new(DIAG_FATAL, NULL);
+      diag_suppress(d, false);
+      diag_printf(d, "%s: design unit depends on %s with checksum %08x "
+                  "but the current version in the library has checksum %08x",
+                  file, istr(dep), checksum, a->checksum);
+      diag_hint(d, NULL, "this usually means %s is outdated and needs to "
+                "be reanalysed", istr(name));
+      diag_emit(d);
+      fatal_exit(EXIT_FAILURE);
+   }
+
+   return a;
+}
+
+object_t *object_read(fbuf_t *f, object_load_fn_t loader_fn,
+                      ident_rd_ctx_t ident_ctx, loc_rd_ctx_t *loc_ctx)
+{
+   object_one_time_init();
+
+   object_check_format(fbuf_file_name(f), read_u32(f));
+
+   const vhdl_standard_t std = fbuf_get_uint(f);
+   object_check_standard(fbuf_file_name(f), std);
 
    const unsigned size = fbuf_get_uint(f);
    if (size & OBJECT_PAGE_MASK)
@@ -993,39 +1100,8 @@ object_t *object_read(fbuf_t *f, object_load_fn_t loader_fn,
       uint32_t checksum = fbuf_get_uint(f);
       ident_t dep = ident_read(ident_ctx);
 
-      object_arena_t *a = NULL;
-      for (unsigned j = 1; a == NULL && j < all_arenas.count; j++) {
-         if (dep == object_arena_name(all_arenas.items[j]))
-            a = all_arenas.items[j];
-      }
-
-      if (a == NULL) {
-         object_t *droot = NULL;
-         if (loader_fn) droot = (*loader_fn)(dep);
-
-         if (droot == NULL)
-            fatal("%s depends on %s which cannot be found",
-                  fbuf_file_name(f), istr(dep));
-
-         a = __object_arena(droot);
-      }
-
-      if (a->std != dstd)
-         fatal("%s: design unit depends on %s version of %s but conflicting "
-               "%s version has been loaded", fbuf_file_name(f),
-               standard_text(dstd), istr(dep), standard_text(a->std));
-      else if (a->checksum != checksum) {
-         diag_t *d = diag_new(DIAG_FATAL, NULL);
-         diag_suppress(d, false);
-         diag_printf(d, "%s: design unit depends on %s with checksum %08x "
-                     "but the current version in the library has checksum %08x",
-                     fbuf_file_name(f), istr(dep), checksum, a->checksum);
-         diag_hint(d, NULL, "this usually means %s is outdated and needs to "
-                   "be reanalysed", istr(name));
-         diag_emit(d);
-         fatal_exit(EXIT_FAILURE);
-      }
-
+      object_arena_t *a = object_resolve_dep(fbuf_file_name(f), name, dep,
+                                             dstd, checksum, loader_fn);
       APUSH(arena->deps, a);
 
       assert(dkey <= max_key);
@@ -1278,13 +1354,14 @@ size_t object_arena_default_size(void)
    return ALIGN_UP(opt_get_size(OPT_ARENA_SIZE), OBJECT_PAGE_SZ);
 }
 
-object_arena_t *object_arena_new(size_t size, unsigned std)
+static object_arena_t *object_arena_init(void *base, size_t size,
+                                         unsigned std)
 {
    if (all_arenas.count == 0)
       APUSH(all_arenas, NULL);   // Dummy null arena
 
    object_arena_t *arena = xcalloc(sizeof(object_arena_t));
-   arena->base   = nvc_memalign(OBJECT_PAGE_SZ, size);
+   arena->base   = base;
    arena->alloc  = arena->base;
    arena->limit  = (char *)arena->base + size;
    arena->key    = all_arenas.count;
@@ -1299,6 +1376,12 @@ object_arena_t *object_arena_new(size_t size, unsigned std)
    return arena;
 }
 
+object_arena_t *object_arena_new(size_t size, unsigned std)
+{
+   void *base = nvc_memalign(OBJECT_PAGE_SZ, size);
+   return object_arena_init(base, size, std);
+}
+
 void object_arena_freeze(object_arena_t *arena)
 {
    ident_t name = object_arena_name(arena);
@@ -1332,6 +1415,429 @@ void object_arena_freeze(object_arena_t *arena)
    arena->frozen = true;
 }
 
+#define IMAGE_REF_BITS 48
+#define IMAGE_REF_MASK ((UINT64_C(1) << IMAGE_REF_BITS) - 1)
+
+typedef struct {
+   uint8_t          *data;
+   size_t            len;
+   size_t            limit;
+   object_arena_t   *arena;
+   hash_t           *ident_map;
+   A(uint64_t)       idents;
+   A(uint64_t)       files;
+   A(loc_file_ref_t) file_refs;
+   unsigned          last_file;
+} image_wr_ctx_t;
+
+static uint64_t image_append(image_wr_ctx_t *ctx, const void *data, size_t len)
+{
+   const size_t offset = ALIGN_UP(ctx->len, sizeof(uint64_t));
+
+   if (offset + len > ctx->limit) {
+      ctx->limit = MAX(ctx->limit * 2, offset + len);
+      ctx->data = xrealloc(ctx->data, ctx->limit);
+   }
+
+   memset(ctx->data + ctx->len, '\0', offset - ctx->len);
+   if (len > 0)
+      memcpy(ctx->data + offset, data, len);
+
+   ctx->len = offset + len;
+   return offset;
+}
+
+static uint64_t image_put_string(image_wr_ctx_t *ctx, const char *str)
+{
+   if (str == NULL)
+      return 0;
+   else
+      return image_append(ctx, str, strlen(str) + 1);
+}
+
+static uint64_t image_put_ident(image_wr_ctx_t *ctx, ident_t id)
+{
+   if (id == NULL)
+      return 0;
+
+   void *index = hash_get(ctx->ident_map, id);
+   if (index != NULL)
+      return (uintptr_t)index;
+
+   APUSH(ctx->idents, image_put_string(ctx, istr(id)));
+   hash_put(ctx->ident_map, id, (void *)(uintptr_t)ctx->idents.count);
+
+   return ctx->idents.count;
+}
+
+static loc_file_ref_t image_put_file(image_wr_ctx_t *ctx, const loc_t *loc)
+{
+   if (loc->file_ref == FILE_INVALID)
+      return FILE_INVALID;
+
+   // Consecutive objects almost always come from the same file
+   if (ctx->last_file < ctx->file_refs.count
+       && ctx->file_refs.items[ctx->last_file] == loc->file_ref)
+      return ctx->last_file;
+
+   for (unsigned i = 0; i < ctx->file_refs.count; i++) {
+      if (ctx->file_refs.items[i] == loc->file_ref)
+         return (ctx->last_file = i);
+   }
+
+   APUSH(ctx->file_refs, loc->file_ref);
+   APUSH(ctx->files, image_put_string(ctx, loc_file_str(loc)));
+
+   return (ctx->last_file = ctx->file_refs.count - 1);
+}
+
+static uint64_t image_put_ref(image_wr_ctx_t *ctx, object_t *object)
+{
+   if (object == NULL)
+      return 0;
+
+   // References are encoded as the byte offset in the arena in the
+   // low bits and the dependency index in the high bits where one
+   // indicates the arena being written
+   object_arena_t *arena = __object_arena(object);
+
+   uint64_t which = 0;
+   if (arena == ctx->arena)
+      which = 1;
+   else {
+      for (unsigned i = 0; which == 0 && i < ctx->arena->deps.count; i++) {
+         if (ctx->arena->deps.items[i] == arena)
+            which = i + 2;
+      }
+
+      if (which == 0)
+         fatal_trace("arena %s has reference to %s which is not a "
+                     "dependency", istr(object_arena_name(ctx->arena)),
+                     istr(object_arena_name(arena)));
+   }
+
+   const uint64_t offset = (void *)object - arena->base;
+   assert(offset <= IMAGE_REF_MASK);
+
+   return (which << IMAGE_REF_BITS) | offset;
+}
+
+static uint64_t image_put_array(image_wr_ctx_t *ctx, const obj_array_t *a)
+{
+   if (a == NULL || a->count == 0)
+      return 0;
+
+   const size_t size = sizeof(obj_array_t) + a->count * sizeof(object_t *);
+   const uint64_t offset = image_append(ctx, a, size);
+
+   obj_array_t *copy = (obj_array_t *)(ctx->data + offset);
+   copy->limit = copy->count;
+
+   for (unsigned i = 0; i < a->count; i++)
+      copy->items[i] = (object_t *)(uintptr_t)image_put_ref(ctx, a->items[i]);
+
+   return offset;
+}
+
+void *object_write_image(object_t *root, size_t *size, uint32_t *checksum)
+{
+   object_arena_t *arena = __object_arena(root);
+
+   if (root != arena_root(arena))
+      fatal_trace("must write root object first");
+   else if (arena->source == OBJ_DISK)
+      fatal_trace("writing arena %s originally read from disk",
+                  istr(object_arena_name(arena)));
+   else if (!arena->frozen)
+      fatal_trace("arena %s must be frozen before writing to disk",
+                  istr(object_arena_name(arena)));
+
+   const size_t objsize = arena->alloc - arena->base;
+
+   image_wr_ctx_t ctx = {
+      .arena     = arena,
+      .ident_map = hash_new(256),
+   };
+
+   image_append(&ctx, arena->base, objsize);
+
+   for (size_t offset = 0; offset < objsize; ) {
+      const object_t *object = arena->base + offset;
+      const object_class_t *class = classes[object->tag];
+
+      const loc_file_ref_t file_ref = image_put_file(&ctx, &object->loc);
+
+      const imask_t has = class->has_map[object->kind];
+      const int nitems = __builtin_popcountll(has);
+      imask_t mask = 1;
+      for (int n = 0; n < nitems; mask <<= 1) {
+         if (has & mask) {
+            const item_t *item = &(object->items[n]);
+            int64_t encoded = item->ival;
+            if (ITEM_IDENT & mask)
+               encoded = image_put_ident(&ctx, item->ident);
+            else if (ITEM_OBJECT & mask)
+               encoded = image_put_ref(&ctx, item->object);
+            else if (ITEM_OBJ_ARRAY & mask)
+               encoded = image_put_array(&ctx, item->obj_array);
+            else if (ITEM_TEXT & mask)
+               encoded = image_put_string(&ctx, item->text);
+            else if (ITEM_NUMBER & mask) {
+               // Big numbers point to a separate heap allocation
+               if (item->number.common.tag == TAG_BIGNUM)
+                  fatal("cannot write %s to library: arbitrary width "
+                        "numbers are not supported",
+                        istr(object_arena_name(arena)));
+            }
+            else if (!(mask & (ITEM_INT64 | ITEM_INT32 | ITEM_DOUBLE)))
+               item_without_type(mask);
+
+            // The buffer may have been reallocated
+            object_t *copy = (object_t *)(ctx.data + offset);
+            copy->items[n].ival = encoded;
+            n++;
+         }
+      }
+
+      const size_t size =
+         ALIGN_UP(class->object_size[object->kind], OBJECT_ALIGN);
+
+      object_t *copy = (object_t *)(ctx.data + offset);
+      copy->arena = 0;
+      copy->lazy  = 1;
+      copy->loc.file_ref = file_ref;
+
+      // Clear any stale items left behind by object_change_kind
+      void *end = &(copy->items[nitems]);
+      memset(end, '\0', (void *)copy + size - end);
+
+      offset += size;
+   }
+
+   image_trailer_t trailer = {
+      .magic   = IMAGE_MAGIC,
+      .format  = format_digest,
+      .std     = arena->std,
+      .flags   = arena->flags,
+      .ndeps   = arena->deps.count,
+      .nidents = ctx.idents.count,
+      .nfiles  = ctx.files.count,
+      .objsize = objsize,
+   };
+
+   trailer.name = image_put_string(&ctx, istr(object_arena_name(arena)));
+
+   image_dep_t *deps LOCAL =
+      xcalloc_array(arena->deps.count, sizeof(image_dep_t));
+   for (unsigned i = 0; i < arena->deps.count; i++) {
+      object_arena_t *a = arena->deps.items[i];
+      deps[i].name = image_put_string(&ctx, istr(object_arena_name(a)));
+      deps[i].std = a->std;
+      deps[i].checksum = a->checksum;
+   }
+
+   trailer.deps = image_append(&ctx, deps,
+                               arena->deps.count * sizeof(image_dep_t));
+   trailer.idents = image_append(&ctx, ctx.idents.items,
+                                 ctx.idents.count * sizeof(uint64_t));
+   trailer.files = image_append(&ctx, ctx.files.items,
+                                ctx.files.count * sizeof(uint64_t));
+
+   const uint64_t toffset = image_append(&ctx, &trailer, sizeof(trailer));
+
+   SHA1_CTX sha;
+   SHA1Init(&sha);
+   SHA1Update(&sha, ctx.data, ctx.len);
+
+   unsigned char digest[SHA1_LEN];
+   SHA1Final(digest, &sha);
+
+   trailer.checksum = digest[0] << 24 | digest[1] << 16
+      | digest[2] << 8 | digest[3];
+   memcpy(ctx.data + toffset, &trailer, sizeof(trailer));
+
+   hash_free(ctx.ident_map);
+   ACLEAR(ctx.idents);
+   ACLEAR(ctx.files);
+   ACLEAR(ctx.file_refs);
+
+   *size = ctx.len;
+   *checksum = trailer.checksum;
+   return ctx.data;
+}
+
+bool object_is_image(int fd, size_t size)
+{
+   if (size < sizeof(image_trailer_t))
+      return false;
+   else if (lseek(fd, size - sizeof(image_trailer_t), SEEK_SET) < 0)
+      return false;
+
+   uint32_t magic;
+   if (read(fd, &magic, sizeof(magic)) != sizeof(magic))
+      return false;
+
+   return magic == IMAGE_MAGIC;
+}
+
+object_t *object_map_image(int fd, size_t size, const char *file,
+                           object_load_fn_t loader_fn)
+{
+   object_one_time_init();
+
+   assert(size >= sizeof(image_trailer_t));
+
+   // Like every other arena the image is never freed so it stays mapped
+   // for the life of the process
+   void *base = map_file_aligned(fd, size, OBJECT_PAGE_SZ);
+   const image_trailer_t *trailer = base + size - sizeof(image_trailer_t);
+
+   object_check_format(file, trailer->format);
+
+   const size_t tables = size - sizeof(image_trailer_t);
+   if (trailer->magic != IMAGE_MAGIC
+       || trailer->objsize == 0
+       || trailer->objsize > tables
+       || (trailer->objsize & (OBJECT_ALIGN - 1))
+       || trailer->deps + trailer->ndeps * sizeof(image_dep_t) > tables
+       || trailer->idents + trailer->nidents * sizeof(uint64_t) > tables
+       || trailer->files + trailer->nfiles * sizeof(uint64_t) > tables)
+      fatal("%s: library image is corrupt", file);
+
+   object_check_standard(file, trailer->std);
+
+   const size_t mapsz = ALIGN_UP(size, OBJECT_PAGE_SZ);
+   object_arena_t *arena = object_arena_init(base, mapsz, trailer->std);
+   arena->source   = OBJ_DISK;
+   arena->flags    = trailer->flags;
+   arena->checksum = trailer->checksum;
+
+   ident_t name = ident_new(base + trailer->name);
+
+   const image_dep_t *deps = base + trailer->deps;
+   for (unsigned i = 0; i < trailer->ndeps; i++) {
+      ident_t dep = ident_new(base + deps[i].name);
+      object_arena_t *a = object_resolve_dep(file, name, dep, deps[i].std,
+                                             deps[i].checksum, loader_fn);
+      APUSH(arena->deps, a);
+   }
+
+   image_t *image = xcalloc(sizeof(image_t));
+   image->idents      = base + trailer->idents;
+   image->nidents     = trailer->nidents;
+   image->ident_cache = xcalloc_array(trailer->nidents, sizeof(ident_t));
+   image->nfiles      = trailer->nfiles;
+   image->file_map    = xmalloc_array(trailer->nfiles, sizeof(loc_file_ref_t));
+
+   const uint64_t *files = base + trailer->files;
+   for (unsigned i = 0; i < trailer->nfiles; i++)
+      image->file_map[i] = loc_file_ref(base + files[i], NULL);
+
+   arena->image = image;
+   arena->alloc = arena->limit = base + trailer->objsize;
+
+   for (void *p = base; p < arena->limit; p += OBJECT_PAGE_SZ)
+      chash_put(image_pages, p, arena);
+
+   // Objects in this image are not reachable by any other thread until
+   // it is returned so a plain store is sufficient here
+   object_images_mapped = true;
+
+   object_materialise((object_t *)base);
+
+   if (opt_get_verbose(OPT_OBJECT_VERBOSE, NULL))
+      debugf("arena %s mapped (%d bytes)", istr(name),
+             (int)trailer->objsize);
+
+   chash_put(arena_lookup, name, arena);
+
+   arena->frozen = true;
+
+   return (object_t *)base;
+}
+
+static ident_t image_get_ident(object_arena_t *arena, uint64_t encoded)
+{
+   if (encoded == 0)
+      return NULL;
+
+   image_t *image = arena->image;
+   assert(encoded <= image->nidents);
+
+   ident_t *cache = &(image->ident_cache[encoded - 1]);
+   if (*cache == NULL)
+      *cache = ident_new(arena->base + image->idents[encoded - 1]);
+
+   return *cache;
+}
+
+static object_t *image_get_object(object_arena_t *arena, uint64_t encoded)
+{
+   if (encoded == 0)
+      return NULL;
+
+   const unsigned which = encoded >> IMAGE_REF_BITS;
+   assert(which > 0 && which < arena->deps.count + 2);
+
+   object_arena_t *target = which == 1 ? arena : arena->deps.items[which - 2];
+   return target->base + (encoded & IMAGE_REF_MASK);
+}
+
+void __object_materialise(object_t *object)
+{
+   const uintptr_t page = (uintptr_t)object & ~OBJECT_PAGE_MASK;
+
+   object_arena_t *arena = chash_get(image_pages, (void *)page);
+   if (arena == NULL)
+      fatal_trace("object %p is not in a mapped arena", object);
+
+   SCOPED_LOCK(image_lock);
+
+   if (object->lazy == 0)
+      return;   // Another thread got here first
+
+   image_t *image = arena->image;
+
+   if (object->loc.file_ref != FILE_INVALID) {
+      assert(object->loc.file_ref < image->nfiles);
+      object->loc.file_ref = image->file_map[object->loc.file_ref];
+   }
+
+   const object_class_t *class = classes[object->tag];
+
+   const imask_t has = class->has_map[object->kind];
+   const int nitems = __builtin_popcountll(has);
+   imask_t mask = 1;
+   for (int n = 0; n < nitems; mask <<= 1) {
+      if (has & mask) {
+         item_t *item = &(object->items[n]);
+         const uint64_t encoded = item->ival;
+         if (ITEM_IDENT & mask)
+            item->ident = image_get_ident(arena, encoded);
+         else if (ITEM_OBJECT & mask)
+            item->object = image_get_object(arena, encoded);
+         else if (ITEM_OBJ_ARRAY & mask) {
+            if (encoded != 0) {
+               obj_array_t *a = item->obj_array = arena->base + encoded;
+               for (unsigned i = 0; i < a->count; i++) {
+                  const uintptr_t ref = (uintptr_t)a->items[i];
+                  a->items[i] = image_get_object(arena, ref);
+               }
+            }
+            else
+               item->obj_array = NULL;
+         }
+         else if (ITEM_TEXT & mask)
+            item->text = encoded ? arena->base + encoded : NULL;
+         n++;
+      }
+   }
+
+   object->arena = arena->key;
+
+   store_release(&object->lazy, 0);
+}
+
 void object_arena_walk_deps(object_arena_t *arena, object_arena_deps_fn_t fn,
                             void *context)
 {
@@ -1401,7 +1907,10 @@ object_t *object_from_locus(ident_t module, ptrdiff_t offset,
    if (obj->tag >= OBJECT_TAG_COUNT)
       fatal_trace("invalid tag %d for object locus %s%+"PRIiPTR, obj->tag,
                   istr(module), offset);
-   else if (obj->arena != arena->key)
+
+   object_materialise(obj);
+
+   if (obj->arena != arena->key)
       fatal_trace("invalid arena key %d != %d for object locus %s%+"PRIiPTR,
                   obj->arena, arena->key, istr(module), offset);
 
@@ -110,6 +110,8 @@ STATIC_ASSERT(OBJECT_ALIGN >= sizeof(double));
          assert((t) != NULL);                                           \
          assert((mask & (mask - 1)) == 0);                              \
                                                                         \
+         object_materialise(&(t)->object);                              \
+                                                                        \
          const imask_t __has = has_map[(t)->object.kind];               \
                                                                         \
          if (unlikely((__has & (mask)) == 0))                           \
@@ -159,7 +161,7 @@ struct _object {
    uint8_t      kind;
    uint8_t      tag;
    arena_key_t  arena;
-   uint16_t     __pad;
+   uint16_t     lazy;
    loc_t        loc;
    item_t       items[0];
 };
@@ -204,6 +206,7 @@ typedef struct {
    int                tag;
    unsigned           generation;
    bool               deep;
+   object_arena_t    *arena;
 } object_visit_ctx_t;
 
 typedef int change_allowed_t[2];
@@ -238,6 +241,7 @@ object_arena_t *object_arena(object_t *object);
 size_t object_arena_default_size(void);
 object_t *arena_root(object_arena_t *arena);
 void arena_set_checksum(object_arena_t *arena, uint32_t checksum);
+uint32_t arena_checksum(object_arena_t *arena);
 bool arena_frozen(object_arena_t *arena);
 uint32_t arena_flags(object_arena_t *arena);
 void arena_set_flags(object_arena_t *arena, uint32_t flags);
@@ -246,6 +250,22 @@ void object_write(object_t *object, fbuf_t *f, ident_wr_ctx_t ident_ctx,
                   loc_wr_ctx_t *loc_ctx);
 object_t *object_read(fbuf_t *f, object_load_fn_t loader,
                       ident_rd_ctx_t ident_ctx, loc_rd_ctx_t *loc_ctx);
+void *object_write_image(object_t *root, size_t *size, uint32_t *checksum);
+bool object_is_image(int fd, size_t size);
+object_t *object_map_image(int fd, size_t size, const char *file,
+                           object_load_fn_t loader);
+
+// Objects can only be lazy once an image has been mapped so skip the
+// check on every item access until then
+extern bool object_images_mapped;
+
+#define object_materialise(o) do {                                      \
+      if (unlikely(object_images_mapped)                                \
+          && unlikely(__atomic_load_n(&(o)->lazy, __ATOMIC_ACQUIRE)))  \
+         __object_materialise((o));                                     \
+   } while (0)
+
+void __object_materialise(object_t *object);
 
 #define object_write_barrier(lhs, rhs) do {                     \
       uintptr_t __lp = (uintptr_t)(lhs) & ~OBJECT_PAGE_MASK;    \
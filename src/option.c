@@ -174,4 +174,8 @@ void set_default_options(void)
    opt_set_int(OPT_VHPI_DEBUG, 0);
    opt_set_int(OPT_SERVER_PORT, 8888);
    opt_set_int(OPT_STDERR_LEVEL, DIAG_DEBUG);
+   opt_set_int(OPT_RT_PARALLEL, get_int_env("NVC_RT_PARALLEL", 0));
+   opt_set_str(OPT_PROFILE_FILE, NULL);
+   opt_set_int(OPT_JIT_DECODE, get_int_env("NVC_JIT_DECODE", 1));
+   opt_set_int(OPT_LIB_MAPPED, 0);
 }
@@ -69,6 +69,10 @@ typedef enum {
    OPT_VHPI_DEBUG,
    OPT_SERVER_PORT,
    OPT_STDERR_LEVEL,
+   OPT_RT_PARALLEL,
+   OPT_PROFILE_FILE,
+   OPT_JIT_DECODE,
+   OPT_LIB_MAPPED,
 
    OPT_LAST_NAME
 } opt_name_t;
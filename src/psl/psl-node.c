@@ -174,6 +174,7 @@ const char *psl_kind_str(psl_kind_t kind)
 const loc_t *psl_loc(psl_node_t p)
 {
    assert(p != NULL);
+   object_materialise(&(p->object));
    return &(p->object.loc);
 }
 
@@ -26,6 +26,7 @@
 #include "rt/model.h"
 #include "rt/rt.h"
 #include "rt/structs.h"
+#include "thread.h"
 #include "tree.h"
 
 #include <string.h>
@@ -516,6 +517,18 @@ void clear_vhdl_assert(void)
       counts[i] = 0;
 }
 
+void save_vhdl_assert(unsigned *saved)
+{
+   for (int i = SEVERITY_NOTE; i <= SEVERITY_FAILURE; i++)
+      saved[i] = relaxed_load(&counts[i]);
+}
+
+void restore_vhdl_assert(const unsigned *saved)
+{
+   for (int i = SEVERITY_NOTE; i <= SEVERITY_FAILURE; i++)
+      relaxed_store(&counts[i], saved[i]);
+}
+
 void set_vhdl_assert_enable(vhdl_severity_t severity, bool enable)
 {
    assert(severity <= SEVERITY_FAILURE);
@@ -36,6 +36,8 @@ void set_stderr_severity(vhdl_severity_t severity);
 
 int64_t get_vhdl_assert_count(vhdl_severity_t severity);
 void clear_vhdl_assert(void);
+void save_vhdl_assert(unsigned *saved);
+void restore_vhdl_assert(const unsigned *saved);
 void set_vhdl_assert_enable(vhdl_severity_t severity, bool enable);
 bool get_vhdl_assert_enable(vhdl_severity_t severity);
 int get_vhdl_assert_exit_status(void);
@@ -19,6 +19,7 @@
 #include "jit/jit.h"
 #include "jit/jit-exits.h"
 #include "jit/jit-ffi.h"
+#include "rt/model.h"
 #include "rt/rt.h"
 
 #include <assert.h>
@@ -59,6 +60,8 @@ typedef enum {
 DLLEXPORT
 void __nvc_file_close(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[2].pointer;
 
    if (*fp != NULL) {
@@ -70,6 +73,8 @@ void __nvc_file_close(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_endfile(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
 
    if (*fp == NULL)
@@ -87,6 +92,8 @@ void __nvc_endfile(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_flush(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[2].pointer;
 
    if (*fp == NULL)
@@ -98,6 +105,8 @@ void __nvc_flush(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_rewind(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[2].pointer;
 
    if (*fp == NULL)
@@ -109,6 +118,8 @@ void __nvc_rewind(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_seek(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[2].pointer;
    off_t offset = args[3].integer;
    int8_t origin = args[4].integer;
@@ -126,6 +137,8 @@ void __nvc_seek(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_truncate(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[2].pointer;
    int64_t size = args[3].integer;
    int8_t origin = args[4].integer;
@@ -181,6 +194,8 @@ void __nvc_truncate(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_file_state(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
 
    args[0].integer = (*fp == NULL ? STATE_CLOSED : STATE_OPEN);
@@ -189,6 +204,8 @@ void __nvc_file_state(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_file_mode(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
 
    if (*fp == NULL)
@@ -208,6 +225,8 @@ void __nvc_file_mode(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_file_position(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
    int8_t origin = args[2].integer;
 
@@ -239,6 +258,8 @@ void __nvc_file_position(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_file_size(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
 
    if (*fp == NULL)
@@ -256,6 +277,8 @@ void __nvc_file_size(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_file_canseek(jit_scalar_t *args)
 {
+   model_serialise();
+
    FILE **fp = args[1].pointer;
 
    if (*fp == NULL)
@@ -28,9 +28,10 @@
 #include "option.h"
 #include "psl/psl-node.h"
 #include "rt/assert.h"
-#include "rt/heap.h"
 #include "rt/model.h"
+#include "rt/profile.h"
 #include "rt/structs.h"
+#include "rt/wheel.h"
 #include "thread.h"
 #include "tree.h"
 #include "type.h"
@@ -41,8 +42,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if HAVE_AVX2 || HAVE_SSE41
+#include <x86intrin.h>
+#endif
+
 typedef struct _rt_callback rt_callback_t;
 typedef struct _memblock memblock_t;
+typedef struct _stage_op stage_op_t;
+typedef struct _stage_chunk stage_chunk_t;
 
 typedef struct _rt_callback {
    rt_event_fn_t  fn;
@@ -58,21 +65,77 @@ typedef enum {
 
 #define MEMBLOCK_LINE_SZ 64
 #define MEMBLOCK_PAGE_SZ 0x800000
+#define SPARSE_MIN       0x100000
+#define SPARSE_PAGE_SZ   0x1000
 #define TRIGGER_TAB_SIZE 64
+#define MAX_RANK         UINT8_MAX
+#define PARALLEL_MIN     16
+#define STAGE_CHUNK_SZ   0x10000
+#define RESOLVE_MIN      64
+#define RESOLVE_CHUNK    16
 
 typedef struct _memblock {
    memblock_t *chain;
    unsigned    free;
-   unsigned    pagesz;
+   size_t      pagesz;
    char       *ptr;
 } memblock_t;
 
+typedef enum {
+   STAGE_WAVEFORM,
+   STAGE_DISCONNECT,
+   STAGE_EVENT,
+   STAGE_CLEAR_EVENT,
+   STAGE_PROCESS,
+   STAGE_FORCE,
+   STAGE_RELEASE,
+   STAGE_DEPOSIT,
+} stage_kind_t;
+
+typedef struct _stage_op {
+   stage_op_t   *next;
+   stage_kind_t  kind;
+   int32_t       count;
+   rt_signal_t  *signal;
+   uint32_t      offset;
+   int64_t       after;
+   int64_t       reject;
+   uint8_t       values[0];
+} stage_op_t;
+
+typedef struct _stage_chunk {
+   stage_chunk_t *next;
+   size_t         alloc;
+   size_t         limit;
+   char           data[0];
+} stage_chunk_t;
+
+typedef struct {
+   rt_proc_t   *proc;
+   stage_op_t  *ops;
+   stage_op_t **tail;
+   bool         direct;
+   int          done;
+} par_task_t;
+
+typedef struct {
+   par_task_t *tasks;
+   unsigned    count;
+   unsigned    max;
+   unsigned    next;
+   unsigned    merged;
+   bool        active;
+} par_batch_t;
+
 typedef struct {
    waveform_t    *free_waveforms;
+   rt_sens_t     *free_sens;
    tlab_t         tlab;
    tlab_t         spare_tlab;
    rt_wakeable_t *active_obj;
    rt_scope_t    *active_scope;
+   par_task_t    *task;
+   stage_chunk_t *stage;
 } __attribute__((aligned(64))) model_thread_t;
 
 typedef void (*defer_fn_t)(rt_model_t *, void *);
@@ -88,6 +151,31 @@ typedef struct {
    unsigned      max;
 } deferq_t;
 
+typedef struct {
+   rt_nexus_t **items;
+   unsigned     count;
+   unsigned     max;
+} rank_batch_t;
+
+typedef struct {
+   rank_batch_t batch[MAX_RANK + 1];
+   uint64_t     bitmap[(MAX_RANK + 1) / 64];
+   unsigned     count;
+   unsigned     key;
+   unsigned     next;
+} rankq_t;
+
+typedef struct {
+   rt_nexus_t **items;
+   unsigned     count;
+   unsigned     next;
+   size_t      *offsets;
+   ptr_list_t  *diags;
+   unsigned     maxitems;
+   uint8_t     *values;
+   size_t       maxvalues;
+} resolve_batch_t;
+
 typedef struct _rt_model {
    tree_t             top;
    hash_t            *scopes;
@@ -103,7 +191,7 @@ typedef struct _rt_model {
    bool               next_is_delta;
    bool               force_stop;
    unsigned           n_signals;
-   heap_t            *eventq_heap;
+   wheel_t           *eventq;
    ihash_t           *res_memo;
    rt_watch_t        *watches;
    deferq_t           procq;
@@ -112,8 +200,9 @@ typedef struct _rt_model {
    deferq_t           delta_driverq;
    deferq_t           postponedq;
    deferq_t           implicitq;
-   heap_t            *driving_heap;
-   heap_t            *effective_heap;
+   rankq_t            driving;
+   rankq_t            effective;
+   resolve_batch_t    resolve;
    rt_callback_t     *global_cbs[RT_LAST_EVENT];
    cover_data_t      *cover;
    nvc_rusage_t       ready_rusage;
@@ -123,14 +212,23 @@ typedef struct _rt_model {
    ptr_list_t         eventsigs;
    bool               shuffle;
    rt_trigger_t      *triggertab[TRIGGER_TAB_SIZE];
+   workq_t           *workq;
+   int                nworkers;
+   par_batch_t        batch;
+   rt_profile_t      *profile;
 } rt_model_t;
 
 #define FMT_VALUES_SZ   128
 #define NEXUS_INDEX_MIN 8
+#define INDEX_BITS      6
+#define INDEX_FANOUT    (1 << INDEX_BITS)
+#define DRIVER_INDEX_MIN 4
 #define TRACE_SIGNALS   1
 #define WAVEFORM_CHUNK  256
 #define PENDING_MIN     4
-#define MAX_RANK        UINT8_MAX
+#define SENS_CHUNK      256
+#define WAKE_BULK_MIN   32
+#define PROFILE_TOP     10
 
 #define TRACE(...) do {                                 \
       if (unlikely(__trace_on))                         \
@@ -152,6 +250,9 @@ static bool __trace_on = false;
 static void *source_value(rt_nexus_t *nexus, rt_source_t *src);
 static void free_value(rt_nexus_t *n, rt_value_t v);
 static rt_nexus_t *clone_nexus(rt_model_t *m, rt_nexus_t *old, int offset);
+static rt_sens_t *find_sens(rt_wakeable_t *obj, rt_nexus_t *n);
+static rt_sens_t *copy_sens(rt_model_t *m, rt_sens_t *s, rt_nexus_t *new);
+static void free_index(rt_index_t *index);
 static void update_implicit_signal(rt_model_t *m, rt_implicit_t *imp);
 static void async_run_process(rt_model_t *m, void *arg);
 static void async_update_property(rt_model_t *m, void *arg);
@@ -161,6 +262,7 @@ static void async_fast_all_drivers(rt_model_t *m, void *arg);
 static void async_force_release(rt_model_t *m, void *arg);
 static void async_deposit(rt_model_t *m, void *arg);
 static void async_transfer_signal(rt_model_t *m, void *arg);
+static void take_turn(rt_model_t *m);
 
 static int fmt_time_r(char *buf, size_t len, int64_t t, const char *sep)
 {
@@ -262,6 +364,10 @@ static void model_diag_cb(diag_t *d, void *arg)
 {
    rt_model_t *m = arg;
 
+   // Diagnostics from parallel processes must appear in the same
+   // order as a sequential run
+   take_turn(m);
+
    if (m->iteration < 0)
       diag_printf(d, "(init): ");
    else  {
@@ -391,6 +497,76 @@ static void deferq_run(rt_model_t *m, deferq_t *dq)
    dq->count = 0;
 }
 
+__attribute__((cold, noinline))
+static void rank_batch_grow(rank_batch_t *b)
+{
+   b->max = MAX(b->max * 2, 16);
+   b->items = xrealloc_array(b->items, b->max, sizeof(rt_nexus_t *));
+}
+
+static inline void rankq_insert(rankq_t *rq, unsigned key, rt_nexus_t *n)
+{
+   // Nexuses are processed in order of increasing key and any nexus
+   // enqueued after processing has started must not have a lower key
+   assert(key <= MAX_RANK);
+   assert(rq->count == 0 || key >= rq->key || rq->next == 0);
+
+   rank_batch_t *b = &(rq->batch[key]);
+
+   if (unlikely(b->count == b->max))
+      rank_batch_grow(b);
+
+   if (b->count++ == 0)
+      rq->bitmap[key / 64] |= UINT64_C(1) << (key % 64);
+
+   b->items[b->count - 1] = n;
+
+   if (rq->count++ == 0 || key < rq->key) {
+      rq->key = key;
+      rq->next = 0;
+   }
+}
+
+static rank_batch_t *rankq_head(rankq_t *rq)
+{
+   assert(rq->count > 0);
+
+   rank_batch_t *b = &(rq->batch[rq->key]);
+   if (likely(rq->next < b->count))
+      return b;
+
+   // Skip directly to the next non-empty level using the bitmap
+   b->count = 0;
+   rq->bitmap[rq->key / 64] &= ~(UINT64_C(1) << (rq->key % 64));
+   rq->next = 0;
+
+   for (int i = rq->key / 64; i < ARRAY_LEN(rq->bitmap); i++) {
+      if (rq->bitmap[i] != 0) {
+         rq->key = i * 64 + __builtin_ctzll(rq->bitmap[i]);
+         return &(rq->batch[rq->key]);
+      }
+   }
+
+   fatal_trace("rank queue count %u but all levels empty", rq->count);
+}
+
+static rt_nexus_t *rankq_pop(rankq_t *rq)
+{
+   if (rq->count == 0)
+      return NULL;
+
+   rank_batch_t *b = rankq_head(rq);
+   rt_nexus_t *n = b->items[rq->next++];
+
+   if (--rq->count == 0) {
+      b->count = 0;
+      rq->bitmap[rq->key / 64] &= ~(UINT64_C(1) << (rq->key % 64));
+      rq->key = rq->next = 0;
+   }
+
+   return n;
+}
+
 static void *static_alloc(rt_model_t *m, size_t size)
 {
    const int nlines = ALIGN_UP(size, MEMBLOCK_LINE_SZ) / MEMBLOCK_LINE_SZ;
@@ -415,6 +591,41 @@ static void *static_alloc(rt_model_t *m, size_t size)
    return ptr;
 }
 
+static void *sparse_alloc(rt_model_t *m, size_t size)
+{
+   // Large signals and driver values get their own mapping without huge
+   // pages so memory is only committed for the pages actually written
+   memblock_t *mb = xmalloc(sizeof(memblock_t));
+   mb->pagesz = ALIGN_UP(size, SPARSE_PAGE_SZ);
+   mb->free   = 0;
+   mb->ptr    = nvc_memalign(SPARSE_PAGE_SZ, mb->pagesz);
+
+   RT_LOCK(m->memlock);
+
+   // Insert after the head so static_alloc keeps using the current block
+   if (m->memblocks == NULL) {
+      mb->chain = NULL;
+      m->memblocks = mb;
+   }
+   else {
+      mb->chain = m->memblocks->chain;
+      m->memblocks->chain = mb;
+   }
+
+   return mb->ptr;
+}
+
+static void copy_sparse(void *dst, const void *src, size_t size)
+{
+   // Skip writing pages that already hold the same data so memory for
+   // the untouched parts of large signals is never committed
+   for (size_t off = 0; off < size; off += SPARSE_PAGE_SZ) {
+      const size_t chunk = MIN(SPARSE_PAGE_SZ, size - off);
+      if (memcmp((char *)dst + off, (const char *)src + off, chunk) != 0)
+         memcpy((char *)dst + off, (const char *)src + off, chunk);
+   }
+}
+
 static void global_event(rt_model_t *m, rt_event_t kind)
 {
    rt_callback_t *list = m->global_cbs[kind];
@@ -427,6 +638,42 @@ static void global_event(rt_model_t *m, rt_event_t kind)
    }
 }
 
+static void shared_access_cb(tree_t t, void *ctx)
+{
+   bool *shared = ctx;
+
+   switch (tree_kind(t)) {
+   case T_REF:
+      if (tree_has_ref(t)) {
+         tree_t decl = tree_ref(t);
+         if (tree_kind(decl) == T_VAR_DECL
+             && (tree_flags(decl) & TREE_F_SHARED))
+            *shared = true;
+      }
+      break;
+   case T_FCALL:
+   case T_PCALL:
+      if (tree_has_ref(t) && (tree_flags(tree_ref(t)) & TREE_F_IMPURE_SHARED))
+         *shared = true;
+      break;
+   case T_PROT_FCALL:
+   case T_PROT_PCALL:
+      *shared = true;
+      break;
+   default:
+      break;
+   }
+}
+
+static bool process_is_serial(tree_t proc)
+{
+   // Processes which may access shared variables must run in the same
+   // order as a sequential simulation even in parallel mode
+   bool shared = false;
+   tree_visit(proc, shared_access_cb, &shared);
+   return shared;
+}
+
 static void scope_for_block(rt_model_t *m, tree_t block, rt_scope_t *parent)
 {
    rt_scope_t *s = xcalloc(sizeof(rt_scope_t));
@@ -482,6 +729,10 @@ static void scope_for_block(rt_model_t *m, tree_t block, rt_scope_t *parent)
             p->wakeable.pending   = false;
             p->wakeable.postponed = false;
             p->wakeable.delayed   = false;
+            p->wakeable.serial    = true;
+
+            if (m->profile != NULL)
+               p->prof_id = profile_add(m->profile, PROF_PROCESS, p->name);
 
             list_add(&s->procs, p);
          }
@@ -503,6 +754,11 @@ static void scope_for_block(rt_model_t *m, tree_t block, rt_scope_t *parent)
             p->wakeable.pending   = false;
             p->wakeable.postponed = !!(tree_flags(t) & TREE_F_POSTPONED);
             p->wakeable.delayed   = false;
+            p->wakeable.serial    =
+               opt_get_int(OPT_RT_PARALLEL) && process_is_serial(t);
+
+            if (m->profile != NULL)
+               p->prof_id = profile_add(m->profile, PROF_PROCESS, p->name);
 
             list_add(&s->procs, p);
          }
@@ -550,15 +806,15 @@ rt_model_t *model_new(tree_t top, jit_t *jit)
    m->nexus_tail  = &(m->nexuses);
    m->iteration   = -1;
    m->stop_delta  = opt_get_int(OPT_STOP_DELTA);
-   m->eventq_heap = heap_new(512);
+   m->eventq = wheel_new();
    m->res_memo    = ihash_new(128);
    m->shuffle     = opt_get_int(OPT_SHUFFLE_PROCS);
 
-   m->driving_heap   = heap_new(64);
-   m->effective_heap = heap_new(64);
-
    m->can_create_delta = true;
 
+   if (opt_get_int(OPT_RT_PROFILE))
+      m->profile = profile_new();
+
    m->root = xcalloc(sizeof(rt_scope_t));
    m->root->kind     = SCOPE_ROOT;
    m->root->where    = top;
@@ -605,6 +861,13 @@ rt_proc_t *get_active_proc(void)
    return container_of(obj, rt_proc_t, wakeable);
 }
 
+void model_serialise(void)
+{
+   // Called before any operation with side effects visible outside
+   // the current process when processes may be running in parallel
+   take_turn(__model);
+}
+
 static void free_waveform(rt_model_t *m, waveform_t *w)
 {
    model_thread_t *thread = model_thread(m);
@@ -652,7 +915,7 @@ static void cleanup_signal(rt_model_t *m, rt_signal_t *s)
       cleanup_nexus(m, n);
    }
 
-   free(s->index);
+   free_index(s->index);
 }
 
 static void cleanup_scope(rt_model_t *m, rt_scope_t *scope)
@@ -660,6 +923,7 @@ static void cleanup_scope(rt_model_t *m, rt_scope_t *scope)
    list_foreach(rt_proc_t *, it, scope->procs) {
       mptr_free(m->mspace, &(it->privdata));
       tlab_release(&(it->tlab));
+      ihash_free(it->drivers);
       free(it);
    }
    list_free(&scope->procs);
@@ -696,16 +960,26 @@ void model_free(rt_model_t *m)
       nvc_rusage_t ru;
       nvc_rusage(&ru);
 
-      unsigned mem = 0;
+      size_t mem = 0;
       for (memblock_t *mb = m->memblocks; mb; mb = mb->chain)
          mem += mb->pagesz - (MEMBLOCK_LINE_SZ * mb->free);
 
-      notef("setup:%ums run:%ums user:%ums sys:%ums maxrss:%ukB static:%ukB",
+      notef("setup:%ums run:%ums user:%ums sys:%ums maxrss:%ukB static:%zukB",
             m->ready_rusage.ms, ru.ms, ru.user, ru.sys, ru.rss, mem / 1024);
    }
 
-   while (heap_size(m->eventq_heap) > 0) {
-      void *e = heap_extract_min(m->eventq_heap);
+   if (m->profile != NULL) {
+      profile_report(m->profile, PROFILE_TOP);
+
+      const char *json = opt_get_str(OPT_PROFILE_FILE);
+      if (json != NULL)
+         profile_write_json(m->profile, json);
+
+      profile_free(m->profile);
+   }
+
+   while (wheel_size(m->eventq) > 0) {
+      void *e = wheel_extract_min(m->eventq);
       if (pointer_tag(e) == EVENT_TIMEOUT)
          free(untag_pointer(e, rt_callback_t));
    }
@@ -716,10 +990,21 @@ void model_free(rt_model_t *m)
       model_thread_t *thread = m->threads[i];
       if (thread != NULL) {
          tlab_release(&thread->tlab);
+
+         for (stage_chunk_t *it = thread->stage, *tmp; it; it = tmp) {
+            tmp = it->next;
+            free(it);
+         }
+
          free(thread);
       }
    }
 
+   if (m->workq != NULL)
+      workq_free(m->workq);
+
+   free(m->batch.tasks);
+
    free(m->procq.tasks);
    free(m->delta_procq.tasks);
    free(m->postponedq.tasks);
@@ -741,13 +1026,19 @@ void model_free(rt_model_t *m)
 
    for (memblock_t *mb = m->memblocks, *tmp; mb; mb = tmp) {
       tmp = mb->chain;
-      nvc_munmap(mb->ptr, MEMBLOCK_PAGE_SZ);
+      nvc_munmap(mb->ptr, mb->pagesz);
       free(mb);
    }
 
-   heap_free(m->effective_heap);
-   heap_free(m->driving_heap);
-   heap_free(m->eventq_heap);
+   for (int i = 0; i <= MAX_RANK; i++) {
+      free(m->driving.batch[i].items);
+      free(m->effective.batch[i].items);
+   }
+
+   free(m->resolve.offsets);
+   free(m->resolve.diags);
+   free(m->resolve.values);
+   wheel_free(m->eventq);
    hash_free(m->scopes);
    ihash_free(m->res_memo);
    list_free(&m->eventsigs);
@@ -797,7 +1088,10 @@ rt_watch_t *find_watch(rt_nexus_t *n, sig_event_fn_t fn)
       rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
 
       for (int i = 0; i < p->count; i++) {
-         rt_wakeable_t *obj = untag_pointer(p->wake[i], rt_wakeable_t);
+         if (p->sens[i] == NULL)
+            continue;
+
+         rt_wakeable_t *obj = p->sens[i]->wake;
          if (obj->kind == W_WATCH) {
             rt_watch_t *w = container_of(obj, rt_watch_t, wakeable);
             if (w->fn == fn)
@@ -883,7 +1177,7 @@ static void deltaq_insert_proc(rt_model_t *m, uint64_t delta, rt_proc_t *proc)
       proc->wakeable.delayed = true;
 
       void *e = tag_pointer(proc, EVENT_PROCESS);
-      heap_insert(m->eventq_heap, m->now + delta, e);
+      wheel_insert(m->eventq, m->now + delta, e);
    }
 }
 
@@ -896,7 +1190,7 @@ static void deltaq_insert_driver(rt_model_t *m, uint64_t delta,
    }
    else {
       void *e = tag_pointer(source, EVENT_DRIVER);
-      heap_insert(m->eventq_heap, m->now + delta, e);
+      wheel_insert(m->eventq, m->now + delta, e);
    }
 }
 
@@ -1013,9 +1307,16 @@ static void run_process(rt_model_t *m, rt_proc_t *proc)
       .pointer = *mptr_get(proc->scope->privdata)
    };
 
+   // Use CPU time of this thread so processes executing in parallel or
+   // while the host is busy are not charged for time spent waiting
+   const uint64_t start = m->profile ? get_thread_cpu_ns() : 0;
+
    if (!jit_fastcall(m->jit, proc->handle, &result, state, context, tlab))
       m->force_stop = true;
 
+   if (m->profile != NULL)
+      profile_run(m->profile, proc->prof_id, get_thread_cpu_ns() - start);
+
    thread->active_obj = NULL;
    thread->active_scope = NULL;
 
@@ -1082,6 +1383,150 @@ static void reset_scope(rt_model_t *m, rt_scope_t *s)
       reset_property(m, p);
 }
 
+static void map_resolution_scalar(const res_memo_t *r, int8_t *out,
+                                  const int8_t *in, int width)
+{
+   for (int j = 0; j < width; j++)
+      out[j] = r->tab1[(int)in[j]];
+}
+
+static void fold_resolution_scalar(const res_memo_t *r, int8_t *acc,
+                                   const int8_t *in, int width)
+{
+   for (int j = 0; j < width; j++)
+      acc[j] = r->tab2[(int)acc[j]][(int)in[j]];
+}
+
+#ifdef HAVE_SSE41
+__attribute__((target("sse4.1")))
+static void map_resolution_sse41(const res_memo_t *r, int8_t *out,
+                                 const int8_t *in, int width)
+{
+   const __m128i lookup = _mm_loadu_si128((const __m128i *)r->tab1);
+
+   int j = 0;
+   for (; j + 15 < width; j += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(in + j));
+      _mm_storeu_si128((__m128i *)(out + j), _mm_shuffle_epi8(lookup, x));
+   }
+
+   map_resolution_scalar(r, out + j, in + j, width - j);
+}
+
+__attribute__((target("sse4.1")))
+static void fold_resolution_sse41(const res_memo_t *r, int8_t *acc,
+                                  const int8_t *in, int width)
+{
+   // Each row of the table is a sixteen entry pshufb lookup indexed by
+   // the incoming driver value and selected by the accumulated value
+
+   int j = 0;
+   for (; j + 15 < width; j += 16) {
+      const __m128i a = _mm_loadu_si128((const __m128i *)(acc + j));
+      const __m128i b = _mm_loadu_si128((const __m128i *)(in + j));
+
+      __m128i result = _mm_setzero_si128();
+      for (int i = 0; i < r->nlits; i++) {
+         const __m128i row = _mm_loadu_si128((const __m128i *)r->tab2[i]);
+         const __m128i sel = _mm_cmpeq_epi8(a, _mm_set1_epi8(i));
+         result = _mm_blendv_epi8(result, _mm_shuffle_epi8(row, b), sel);
+      }
+
+      _mm_storeu_si128((__m128i *)(acc + j), result);
+   }
+
+   fold_resolution_scalar(r, acc + j, in + j, width - j);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static void fold_resolution_avx2(const res_memo_t *r, int8_t *acc,
+                                 const int8_t *in, int width)
+{
+   int j = 0;
+   for (; j + 31 < width; j += 32) {
+      const __m256i a = _mm256_loadu_si256((const __m256i *)(acc + j));
+      const __m256i b = _mm256_loadu_si256((const __m256i *)(in + j));
+
+      __m256i result = _mm256_setzero_si256();
+      for (int i = 0; i < r->nlits; i++) {
+         const __m128i row = _mm_loadu_si128((const __m128i *)r->tab2[i]);
+         const __m256i row2 = _mm256_broadcastsi128_si256(row);
+         const __m256i sel = _mm256_cmpeq_epi8(a, _mm256_set1_epi8(i));
+         result = _mm256_blendv_epi8(result, _mm256_shuffle_epi8(row2, b),
+                                     sel);
+      }
+
+      _mm256_storeu_si256((__m256i *)(acc + j), result);
+   }
+
+   fold_resolution_scalar(r, acc + j, in + j, width - j);
+}
+#endif
+
+static tree_t resolution_decl(type_t type)
+{
+   for (type_t t = type; type_kind(t) == T_SUBTYPE; t = type_base(t)) {
+      if (type_has_resolution(t)) {
+         tree_t r = type_resolution(t);
+         while (tree_kind(r) == T_ELEM_RESOLUTION)
+            r = tree_value(tree_assoc(r, 0));
+         return tree_ref(r);
+      }
+   }
+
+   if (type_is_array(type))
+      return resolution_decl(type_elem(type));
+   else
+      return NULL;
+}
+
+static bool is_fold_resolution(rt_signal_t *signal, ident_t name)
+{
+   // The probe calls only show the function agrees with its two value
+   // table for up to three drivers so folding over more is limited to
+   // the standard resolution function for STD_LOGIC which is defined
+   // as exactly such a fold
+
+   if (!tree_has_type(signal->where))
+      return false;
+
+   tree_t decl = resolution_decl(tree_type(signal->where));
+   if (decl == NULL || tree_ident2(decl) != name)
+      return false;
+
+   // Checking the parameter type first avoids loading the IEEE library
+   // for designs that do not use it
+   type_t elem = type_elem(type_param(tree_type(decl), 0));
+   if (is_well_known(type_ident(elem)) != W_IEEE_ULOGIC)
+      return false;
+
+   type_t std_logic = ieee_type(IEEE_STD_LOGIC);
+   return decl == tree_ref(type_resolution(std_logic));
+}
+
+static void select_resolution_kernel(res_memo_t *memo)
+{
+   memo->map  = map_resolution_scalar;
+   memo->fold = fold_resolution_scalar;
+
+   if (!opt_get_int(OPT_JIT_INTRINSICS) || !opt_get_int(OPT_VECTOR_INTRINSICS))
+      return;
+
+#ifdef HAVE_SSE41
+   if (__builtin_cpu_supports("sse4.1")) {
+      memo->map  = map_resolution_sse41;
+      memo->fold = fold_resolution_sse41;
+   }
+#endif
+
+#ifdef HAVE_AVX2
+   if (__builtin_cpu_supports("avx2"))
+      memo->fold = fold_resolution_avx2;
+#endif
+}
+
 static res_memo_t *memo_resolution_fn(rt_model_t *m, rt_signal_t *signal,
                                       ffi_closure_t closure, int64_t ileft,
                                       int32_t nlits, res_flags_t flags)
@@ -1104,6 +1549,11 @@ static res_memo_t *memo_resolution_fn(rt_model_t *m, rt_signal_t *signal,
 
    const vhdl_severity_t old_severity = set_exit_severity(SEVERITY_NOTE);
 
+   // Reports from the probe calls below must not be visible to the user
+   // or change the exit status of the simulation
+   unsigned saved_counts[SEVERITY_FAILURE + 1];
+   save_vhdl_assert(saved_counts);
+
    jit_set_silent(m->jit, true);
 
    // Memoise the function for all two value cases
@@ -1138,6 +1588,45 @@ static res_memo_t *memo_resolution_fn(rt_model_t *m, rt_signal_t *signal,
       memo->flags |= R_MEMO;
       if (identity)
          memo->flags |= R_IDENT;
+
+      memo->nlits = nlits;
+      select_resolution_kernel(memo);
+
+      // The table can be folded over three drivers if it is associative
+      // and agrees with the function for all three driver inputs
+
+      bool fold = true;
+      for (int i = 0; fold && i < nlits; i++) {
+         for (int j = 0; fold && j < nlits; j++) {
+            for (int k = 0; fold && k < nlits; k++) {
+               const int8_t left = memo->tab2[(int)memo->tab2[i][j]][k];
+               const int8_t right = memo->tab2[i][(int)memo->tab2[j][k]];
+
+               int8_t args[3] = { i, j, k };
+               jit_scalar_t result;
+               if (left != right)
+                  fold = false;
+               else if (!jit_try_call(m->jit, memo->closure.handle, &result,
+                                      memo->closure.context, args,
+                                      memo->ileft, 3))
+                  fold = false;
+               else
+                  fold = (result.integer == left);
+            }
+         }
+      }
+
+      // Agreement for three drivers says nothing about larger numbers
+      // of drivers unless the function is known to be a fold of its two
+      // value table
+      memo->maxfold = 2;
+      if (fold && model_exit_status(m) == 0) {
+         ident_t name = jit_get_name(m->jit, closure.handle);
+         if (is_fold_resolution(signal, name))
+            memo->maxfold = INT_MAX;
+         else
+            memo->maxfold = 3;
+      }
    }
 
    TRACE("memoised resolution function %s for type %s",
@@ -1147,6 +1636,7 @@ static res_memo_t *memo_resolution_fn(rt_model_t *m, rt_signal_t *signal,
    jit_set_silent(m->jit, false);
    jit_reset_exit_status(m->jit);
 
+   restore_vhdl_assert(saved_counts);
    set_exit_severity(old_severity);
 
    return memo;
@@ -1177,6 +1667,8 @@ static rt_value_t alloc_value(rt_model_t *m, rt_nexus_t *n)
          result.ext = n->free_value;
          n->free_value = *(void **)result.ext;
       }
+      else if (valuesz >= SPARSE_MIN)
+         result.ext = sparse_alloc(m, valuesz);
       else
          result.ext = static_alloc(m, valuesz);
    }
@@ -1373,110 +1865,109 @@ static rt_source_t *add_source(rt_model_t *m, rt_nexus_t *n, source_kind_t kind)
    return src;
 }
 
-static inline int map_index(rt_index_t *index, unsigned offset)
+static void free_index_node(rt_index_node_t *node, int level)
 {
-   if (likely(index->how >= 0))
-      return offset >> index->how;
-   else
-      return offset / -(index->how);
-}
+   if (level > 0) {
+      for (uint64_t mask = node->mask; mask != 0; mask &= mask - 1)
+         free_index_node(node->child[__builtin_ctzll(mask)], level - 1);
+   }
 
-static inline int unmap_index(rt_index_t *index, unsigned key)
-{
-   if (likely(index->how >= 0))
-      return key << index->how;
-   else
-      return key * -(index->how);
+   free(node);
 }
 
-static inline bool index_valid(rt_index_t *index, unsigned offset)
+static void free_index(rt_index_t *index)
 {
-   if (likely(index->how >= 0))
-      return (offset >> index->how) << index->how == offset;
-   else
-      return offset % -(index->how) == 0;
+   if (index != NULL) {
+      free_index_node(index->root, index->levels - 1);
+      free(index);
+   }
 }
 
-static void build_index(rt_signal_t *signal)
+static void index_insert(rt_index_t *index, unsigned key, rt_nexus_t *n)
 {
-   const unsigned signal_w = signal->shared.size / signal->nexus.size;
-
-   int shift = INT_MAX, gcd = 0;
-   rt_nexus_t *n = &(signal->nexus);
-   for (int i = 0, offset = 0; i < signal->n_nexus;
-        i++, offset += n->width, n = n->chain) {
-      if (offset > 0) {
-         const int tzc = __builtin_ctz(offset);
-         shift = MIN(shift, tzc);
+   rt_index_node_t *node = index->root;
+   for (int level = index->levels - 1; level > 0; level--) {
+      const int digit = (key >> (level * INDEX_BITS)) & (INDEX_FANOUT - 1);
+      const uint64_t bit = UINT64_C(1) << digit;
+      if (!(node->mask & bit)) {
+         node->child[digit] = xcalloc(sizeof(rt_index_node_t));
+         node->mask |= bit;
       }
 
-      // Compute greatest common divisor
-      for (int b = offset; b > 0;) {
-         int temp = b;
-         b = gcd % b;
-         gcd = temp;
-      }
+      node = node->child[digit];
    }
 
-   const int how = gcd > 1 && gcd > (1 << shift) && gcd > 1 ? -gcd : shift;
-   const int count =
-      how < 0 ? (signal_w - how - 1) / -how : (signal_w >> shift) + 1;
+   const int digit = key & (INDEX_FANOUT - 1);
+   node->child[digit] = n;
+   node->mask |= UINT64_C(1) << digit;
+}
+
+static rt_nexus_t *index_last(rt_index_node_t *node, int level)
+{
+   for (; level > 0; level--)
+      node = node->child[63 - __builtin_clzll(node->mask)];
 
-   TRACE("create index for signal %s how=%d count=%d",
-         istr(tree_ident(signal->where)), how, count);
+   return node->child[63 - __builtin_clzll(node->mask)];
+}
 
-   rt_index_t *index = xcalloc_flex(sizeof(rt_index_t), count,
-                                    sizeof(rt_nexus_t *));
-   index->how = how;
+static rt_nexus_t *index_find(rt_index_node_t *node, int level, unsigned key)
+{
+   // Find the nexus with the greatest offset less than or equal to key
+   const int digit = (key >> (level * INDEX_BITS)) & (INDEX_FANOUT - 1);
+   const uint64_t bit = UINT64_C(1) << digit;
 
-   n = &(signal->nexus);
-   for (int i = 0, offset = 0; i < signal->n_nexus;
-        i++, offset += n->width, n = n->chain) {
-      index->nexus[map_index(index, offset)] = n;
+   if (node->mask & bit) {
+      if (level == 0)
+         return node->child[digit];
+
+      rt_nexus_t *n = index_find(node->child[digit], level - 1, key);
+      if (n != NULL)
+         return n;
    }
 
-   free(signal->index);
-   signal->index = index;
+   const uint64_t below = node->mask & (bit - 1);
+   if (below == 0)
+      return NULL;
+
+   void *prev = node->child[63 - __builtin_clzll(below)];
+   return level == 0 ? prev : index_last(prev, level - 1);
 }
 
-static void update_index(rt_signal_t *s, rt_nexus_t *n)
+static void build_index(rt_signal_t *signal)
 {
-   const unsigned offset = n->offset / n->size;
+   const unsigned signal_w = signal->shared.size / signal->nexus.size;
 
-   if (!index_valid(s->index, offset)) {
-      TRACE("rebuild index for %s offset=%d how=%d",
-            istr(tree_ident(s->where)), offset, s->index->how);
-      build_index(s);
-      assert(s->index->nexus[map_index(s->index, offset)] == n);
-   }
-   else {
-      const int elt = map_index(s->index, offset);
-      assert(s->index->nexus[elt] == NULL);
-      s->index->nexus[elt] = n;
-   }
+   int levels = 1;
+   while (levels * INDEX_BITS < 32 && (signal_w - 1) >> (levels * INDEX_BITS))
+      levels++;
+
+   TRACE("create index for signal %s levels=%d nexuses=%d",
+         istr(tree_ident(signal->where)), levels, signal->n_nexus);
+
+   rt_index_t *index = xmalloc(sizeof(rt_index_t));
+   index->levels = levels;
+   index->root   = xcalloc(sizeof(rt_index_node_t));
+
+   rt_nexus_t *n = &(signal->nexus);
+   for (int i = 0, offset = 0; i < signal->n_nexus;
+        i++, offset += n->width, n = n->chain)
+      index_insert(index, offset, n);
+
+   free_index(signal->index);
+   signal->index = index;
 }
 
 static rt_nexus_t *lookup_index(rt_signal_t *s, int *offset)
 {
-   if (likely(offset == 0 || s->index == NULL))
+   if (likely(*offset == 0 || s->index == NULL))
       return &(s->nexus);
-   else if (!index_valid(s->index, *offset)) {
-      TRACE("invalid index for %s offset=%d how=%d", istr(tree_ident(s->where)),
-            *offset, s->index->how);
-      free(s->index);
-      s->index = NULL;
-      return &(s->nexus);
-   }
    else {
-      const int key = map_index(s->index, *offset);
-      for (int k = key; k >= 0; k--) {
-         rt_nexus_t *n = s->index->nexus[k];
-         if (n != NULL) {
-            *offset = unmap_index(s->index, key - k);
-            return n;
-         }
-      }
-      return &(s->nexus);
+      rt_index_t *index = s->index;
+      rt_nexus_t *n = index_find(index->root, index->levels - 1, *offset);
+      assert(n != NULL);
+
+      *offset -= n->offset / n->size;
+      return n;
    }
 }
 
@@ -1646,17 +2137,25 @@ static rt_nexus_t *clone_nexus(rt_model_t *m, rt_nexus_t *old, int offset)
 
    if (old->pending == NULL)
       new->pending = NULL;
-   else if (pointer_tag(old->pending) == 1)
+   else if (pointer_tag(old->pending) == 1) {
+      rt_wakeable_t *obj = untag_pointer(old->pending, rt_wakeable_t);
       new->pending = old->pending;
+      copy_sens(m, find_sens(obj, old), new);
+   }
    else {
       rt_pending_t *old_p = untag_pointer(old->pending, rt_pending_t);
       rt_pending_t *new_p = xmalloc_flex(sizeof(rt_pending_t), old_p->count,
-                                         sizeof(rt_wakeable_t *));
+                                         sizeof(rt_sens_t *));
 
       new_p->count = new_p->max = old_p->count;
+      new_p->holes = old_p->holes;
 
-      for (int i = 0; i < old_p->count; i++)
-         new_p->wake[i] = old_p->wake[i];
+      for (int i = 0; i < old_p->count; i++) {
+         if (old_p->sens[i] == NULL)
+            new_p->sens[i] = NULL;
+         else
+            new_p->sens[i] = copy_sens(m, old_p->sens[i], new);
+      }
 
       new->pending = tag_pointer(new_p, 0);
    }
@@ -1704,7 +2203,7 @@ static rt_nexus_t *clone_nexus(rt_model_t *m, rt_nexus_t *old, int offset)
    if (signal->index == NULL && signal->n_nexus >= NEXUS_INDEX_MIN)
       build_index(signal);
    else if (signal->index != NULL)
-      update_index(signal, new);
+      index_insert(signal->index, new->offset / new->size, new);
 
    return new;
 }
@@ -1745,6 +2244,37 @@ static rt_nexus_t *split_nexus(rt_model_t *m, rt_signal_t *s,
    return result;
 }
 
+static void scope_path_name(text_buf_t *tb, rt_scope_t *scope)
+{
+   switch (scope->kind) {
+   case SCOPE_INSTANCE:
+      {
+         tree_t hier = tree_decl(scope->where, 0);
+         assert(tree_kind(hier) == T_HIER);
+         instance_name_to_path(tb, istr(tree_ident(hier)));
+      }
+      break;
+   case SCOPE_SIGNAL:
+      scope_path_name(tb, scope->parent);
+      tb_printf(tb, "%c%s", scope->parent->kind == SCOPE_SIGNAL ? '.' : ':',
+                istr(tree_ident(scope->where)));
+      break;
+   default:
+      tb_printf(tb, ":%s", istr(scope->name));
+      break;
+   }
+}
+
+static ident_t signal_path_name(rt_signal_t *s)
+{
+   LOCAL_TEXT_BUF tb = tb_new();
+   scope_path_name(tb, s->parent);
+   tb_printf(tb, "%c%s", s->parent->kind == SCOPE_SIGNAL ? '.' : ':',
+             istr(tree_ident(s->where)));
+   tb_downcase(tb);
+   return ident_new(tb_get(tb));
+}
+
 static void setup_signal(rt_model_t *m, rt_signal_t *s, tree_t where,
                          unsigned count, unsigned size, sig_flags_t flags,
                          unsigned offset)
@@ -1761,6 +2291,9 @@ static void setup_signal(rt_model_t *m, rt_signal_t *s, tree_t where,
 
    list_add(&parent->signals, s);
 
+   if (m->profile != NULL)
+      s->prof_id = profile_add(m->profile, PROF_SIGNAL, signal_path_name(s));
+
    s->nexus.width        = count;
    s->nexus.size         = size;
    s->nexus.n_sources    = 0;
@@ -1901,27 +2434,21 @@ static void *call_resolution(rt_nexus_t *nexus, res_memo_t *r, int nonnull)
       // Resolution function has been memoised so do a table lookup
 
       void *resolved = local_alloc(nexus->width * nexus->size);
-
-      for (int j = 0; j < nexus->width; j++) {
-         const int index = ((uint8_t *)p0)[j];
-         ((int8_t *)resolved)[j] = r->tab1[index];
-      }
-
+      (*r->map)(r, resolved, (int8_t *)p0, nexus->width);
       return resolved;
    }
-   else if ((r->flags & R_MEMO) && nonnull == 2) {
-      // Resolution function has been memoised so do a table lookup
+   else if ((r->flags & R_MEMO) && nonnull > 0 && nonnull <= r->maxfold) {
+      // Resolution function has been memoised so fold the table over
+      // the whole range of each driver in turn
 
       void *resolved = local_alloc(nexus->width * nexus->size);
+      memcpy(resolved, p0, nexus->width);
 
-      char *p1 = NULL;
-      for (rt_source_t *s1 = s0->chain_input;
-           s1 && (p1 = source_value(nexus, s1)) == NULL;
-           s1 = s1->chain_input)
-         ;
-
-      for (int j = 0; j < nexus->width; j++)
-         ((int8_t *)resolved)[j] = r->tab2[(int)p0[j]][(int)p1[j]];
+      for (rt_source_t *s = s0->chain_input; s; s = s->chain_input) {
+         const void *data = source_value(nexus, s);
+         if (data != NULL)
+            (*r->fold)(r, resolved, data, nexus->width);
+      }
 
       return resolved;
    }
@@ -2124,7 +2651,7 @@ static void calculate_initial_value(rt_model_t *m, rt_nexus_t *n)
       void *driving = nexus_driving(n);
       memcpy(driving, calculate_driving_value(m, n), n->width * n->size);
 
-      heap_insert(m->effective_heap, MAX_RANK - n->rank, n);
+      rankq_insert(&m->effective, MAX_RANK - n->rank, n);
 
       TRACE("%s initial driving value %s",
             istr(tree_ident(n->signal->where)), fmt_nexus(n, driving));
@@ -2137,8 +2664,14 @@ static void calculate_initial_value(rt_model_t *m, rt_nexus_t *n)
 
       const size_t valuesz = n->size * n->width;
 
-      memcpy(nexus_last_value(n), initial, valuesz);
-      memcpy(nexus_effective(n), initial, valuesz);
+      if (valuesz >= SPARSE_MIN) {
+         copy_sparse(nexus_last_value(n), initial, valuesz);
+         copy_sparse(nexus_effective(n), initial, valuesz);
+      }
+      else {
+         memcpy(nexus_last_value(n), initial, valuesz);
+         memcpy(nexus_effective(n), initial, valuesz);
+      }
 
       TRACE("%s initial value %s", istr(tree_ident(n->signal->where)),
             fmt_nexus(n, initial));
@@ -2391,8 +2924,14 @@ void model_reset(rt_model_t *m)
    for (rt_nexus_t *n = m->nexuses; n != NULL; n = n->chain) {
       // The initial value of each driver is the default value of the signal
       if (n->n_sources > 0) {
+         const size_t valuesz = n->size * n->width;
          for (rt_source_t *s = &(n->sources); s; s = s->chain_input) {
-            if (s->tag == SOURCE_DRIVER)
+            if (s->tag != SOURCE_DRIVER)
+               continue;
+            else if (valuesz >= SPARSE_MIN)
+               copy_sparse(s->u.driver.waveforms.value.ext,
+                           nexus_effective(n), valuesz);
+            else
                copy_value_ptr(n, &(s->u.driver.waveforms.value),
                               nexus_effective(n));
          }
@@ -2403,23 +2942,20 @@ void model_reset(rt_model_t *m)
          fatal_at(tree_loc(n->signal->where), "signal rank %d is greater "
                   "than the maximum supported %d", rank, MAX_RANK);
       else if (rank > 0 || n->n_sources > 1)
-         heap_insert(m->driving_heap, rank, n);
+         rankq_insert(&m->driving, rank, n);
       else {
          calculate_initial_value(m, n);
          check_undriven_std_logic(n);
       }
    }
 
-   while (heap_size(m->driving_heap) > 0) {
-      rt_nexus_t *n = heap_extract_min(m->driving_heap);
+   for (rt_nexus_t *n; (n = rankq_pop(&m->driving)); ) {
       calculate_initial_value(m, n);
       check_undriven_std_logic(n);
    }
 
    // Update effective values after all initial driving values calculated
-   while (heap_size(m->effective_heap) > 0) {
-      rt_nexus_t *n = heap_extract_min(m->effective_heap);
-
+   for (rt_nexus_t *n; (n = rankq_pop(&m->effective)); ) {
       const void *initial = calculate_effective_value(n);
       propagate_nexus(m, n, initial);
 
@@ -2429,6 +2965,23 @@ void model_reset(rt_model_t *m)
 
    tlab_reset(thread->tlab);   // No allocations can be live past here
 
+   if (opt_get_int(OPT_RT_PARALLEL)) {
+#if !RT_MULTITHREADED
+      warnf("parallel process execution requires the runtime to be built "
+            "with RT_MULTITHREADED enabled");
+#elif defined USE_EMUTLS
+      warnf("parallel process execution is not supported on this platform");
+#else
+      if (m->cover != NULL)
+         warnf("parallel process execution is disabled when coverage "
+               "collection is enabled");
+      else {
+         m->workq = workq_new(m);
+         m->nworkers = MIN(nvc_nprocs(), MAX_THREADS);
+      }
+#endif
+   }
+
    global_event(m, RT_END_OF_INITIALISATION);
 }
 
@@ -2468,55 +3021,200 @@ static void update_property(rt_model_t *m, rt_prop_t *prop)
    mask_copy(&prop->state, &prop->newstate);
 }
 
-static void sched_event(rt_model_t *m, rt_nexus_t *n, rt_wakeable_t *obj)
+static rt_sens_t *alloc_sens(rt_model_t *m)
 {
-   if (n->pending == NULL)
-      n->pending = tag_pointer(obj, 1);
-   else if (pointer_tag(n->pending) == 1) {
-      rt_pending_t *p = xmalloc_flex(sizeof(rt_pending_t), PENDING_MIN,
-                                     sizeof(rt_wakeable_t *));
-      p->max = PENDING_MIN;
-      p->count = 2;
-      p->wake[0] = untag_pointer(n->pending, rt_wakeable_t);
-      p->wake[1] = obj;
+   model_thread_t *thread = model_thread(m);
 
-      n->pending = tag_pointer(p, 0);
+   if (thread->free_sens == NULL) {
+      rt_sens_t *mem = static_alloc(m, SENS_CHUNK * sizeof(rt_sens_t));
+      for (int i = 1; i < SENS_CHUNK; i++) {
+         mem[i].next = thread->free_sens;
+         thread->free_sens = &(mem[i]);
+      }
+
+      return mem;
    }
    else {
-      rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
+      rt_sens_t *s = thread->free_sens;
+      thread->free_sens = s->next;
+      return s;
+   }
+}
 
-      for (int i = 0; i < p->count; i++) {
-         if (p->wake[i] == NULL || p->wake[i] == obj) {
-            p->wake[i] = obj;
+static void free_all_sens(rt_model_t *m, rt_wakeable_t *obj)
+{
+   model_thread_t *thread = model_thread(m);
+
+   for (rt_sens_t *s = obj->sens, *next; s; s = next) {
+      next = s->next;
+      s->next = thread->free_sens;
+      thread->free_sens = s;
+   }
+
+   obj->sens = obj->last_sens = NULL;
+}
+
+static rt_sens_t *find_sens(rt_wakeable_t *obj, rt_nexus_t *n)
+{
+   // Processes usually arm and clear the same nexuses in the same order
+   // each time they wait so start searching after the previous match
+   rt_sens_t *start = obj->last_sens ? obj->last_sens->next : NULL;
+
+   for (rt_sens_t *s = start; s; s = s->next) {
+      if (s->nexus == n)
+         return (obj->last_sens = s);
+   }
+
+   for (rt_sens_t *s = obj->sens; s != start; s = s->next) {
+      if (s->nexus == n)
+         return (obj->last_sens = s);
+   }
+
+   return NULL;
+}
+
+static rt_sens_t *add_sens(rt_model_t *m, rt_wakeable_t *obj,
+                           rt_nexus_t *n, unsigned slot)
+{
+   rt_sens_t *s = alloc_sens(m);
+   s->nexus = n;
+   s->wake  = obj;
+   s->slot  = slot;
+
+   // Keep the list in the order nexuses are armed
+   if (obj->last_sens == NULL) {
+      s->next = obj->sens;
+      obj->sens = s;
+   }
+   else {
+      s->next = obj->last_sens->next;
+      obj->last_sens->next = s;
+   }
+
+   obj->last_sens = s;
+   return s;
+}
+
+static rt_sens_t *copy_sens(rt_model_t *m, rt_sens_t *s, rt_nexus_t *new)
+{
+   // A nexus created by splitting inherits the pending list of the
+   // original so each wakeable occupies the same slot in both
+   assert(s != NULL);
+
+   rt_wakeable_t *obj = s->wake;
+   rt_sens_t *save = obj->last_sens;
+   rt_sens_t *copy = add_sens(m, obj, new, s->slot);
+   obj->last_sens = save;
+
+   return copy;
+}
+
+static void compact_pending(rt_pending_t *p)
+{
+   // Entries in the pending list point back at their slot record so
+   // moving one does not need to search the wakeable's records
+   unsigned wptr = 0;
+   for (unsigned i = 0; i < p->count; i++) {
+      rt_sens_t *s = p->sens[i];
+      if (s == NULL)
+         continue;
+
+      assert(s->slot == i);
+      s->slot = wptr;
+      p->sens[wptr++] = s;
+   }
+
+   assert(p->count - wptr == p->holes);
+   p->count = wptr;
+   p->holes = 0;
+}
+
+static void sched_event(rt_model_t *m, rt_nexus_t *n, rt_wakeable_t *obj)
+{
+   // Each wakeable remembers its slot in the pending list of every
+   // nexus it has waited on so arming and clearing do not need to scan
+   // the list which may be very long for clocks and resets
+   rt_sens_t *s = find_sens(obj, n);
+
+   if (n->pending == NULL) {
+      n->pending = tag_pointer(obj, 1);
+
+      if (s == NULL)
+         add_sens(m, obj, n, 0);
+      else
+         s->slot = 0;
+   }
+   else if (pointer_tag(n->pending) == 1) {
+      rt_wakeable_t *first = untag_pointer(n->pending, rt_wakeable_t);
+      if (first == obj)
+         return;
+
+      rt_sens_t *s0 = find_sens(first, n);
+      assert(s0 != NULL && s0->slot == 0);
+
+      if (s == NULL)
+         s = add_sens(m, obj, n, 1);
+      else
+         s->slot = 1;
+
+      rt_pending_t *p = xmalloc_flex(sizeof(rt_pending_t), PENDING_MIN,
+                                     sizeof(rt_sens_t *));
+      p->max = PENDING_MIN;
+      p->count = 2;
+      p->holes = 0;
+      p->sens[0] = s0;
+      p->sens[1] = s;
+
+      n->pending = tag_pointer(p, 0);
+   }
+   else {
+      rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
+
+      if (s != NULL && s->slot < p->count) {
+         if (p->sens[s->slot] == s)
+            return;   // Already armed
+         else if (p->sens[s->slot] == NULL) {
+            p->sens[s->slot] = s;
+            p->holes--;
             return;
          }
       }
 
       if (p->count == p->max) {
-         p->max = MAX(PENDING_MIN, p->max * 2);
-         p = xrealloc_flex(p, sizeof(rt_pending_t), p->max,
-                           sizeof(rt_wakeable_t *));
-         n->pending = tag_pointer(p, 0);
+         if (p->holes > p->count / 2)
+            compact_pending(p);
+         else {
+            p->max = MAX(PENDING_MIN, p->max * 2);
+            p = xrealloc_flex(p, sizeof(rt_pending_t), p->max,
+                              sizeof(rt_sens_t *));
+            n->pending = tag_pointer(p, 0);
+         }
       }
 
-      p->wake[p->count++] = obj;
+      if (s == NULL)
+         s = add_sens(m, obj, n, p->count);
+      else
+         s->slot = p->count;
+
+      p->sens[p->count++] = s;
    }
 }
 
 static void clear_event(rt_model_t *m, rt_nexus_t *n, rt_wakeable_t *obj)
 {
-   if (pointer_tag(n->pending) == 1) {
+   rt_sens_t *s = find_sens(obj, n);
+   if (s == NULL)
+      return;   // Never armed
+   else if (pointer_tag(n->pending) == 1) {
       rt_wakeable_t *wake = untag_pointer(n->pending, rt_wakeable_t);
       if (wake == obj)
          n->pending = NULL;
    }
    else if (n->pending != NULL) {
       rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
-      for (int i = 0; i < p->count; i++) {
-         if (p->wake[i] == obj) {
-            p->wake[i] = NULL;
-            return;
-         }
+      if (s->slot < p->count && p->sens[s->slot] == s) {
+         p->sens[s->slot] = NULL;
+         p->holes++;
       }
    }
 }
@@ -2532,6 +3230,38 @@ static rt_source_t *find_driver(rt_nexus_t *nexus, rt_proc_t *proc)
    return NULL;
 }
 
+static void index_driver(rt_proc_t *proc, rt_nexus_t *nexus, rt_source_t *d)
+{
+   if (proc->drivers == NULL)
+      proc->drivers = ihash_new(16);
+
+   ihash_put(proc->drivers, (uintptr_t)nexus, d);
+   proc->last_driver = d;
+}
+
+static rt_source_t *lookup_driver(rt_nexus_t *nexus, rt_proc_t *proc)
+{
+   // Each process remembers its driver for nexuses with many sources to
+   // avoid searching the sources of busses with many drivers
+   if (nexus->n_sources < DRIVER_INDEX_MIN || proc == NULL)
+      return find_driver(nexus, proc);
+
+   // Processes usually assign the same nexus many times in a row
+   rt_source_t *d = proc->last_driver;
+   if (d != NULL && d->u.driver.nexus == nexus)
+      return d;
+
+   if (proc->drivers != NULL
+       && (d = ihash_get(proc->drivers, (uintptr_t)nexus)) != NULL)
+      return (proc->last_driver = d);
+
+   // Created by a split or gained sources after x_drive_signal
+   if ((d = find_driver(nexus, proc)) != NULL)
+      index_driver(proc, nexus, d);
+
+   return d;
+}
+
 static inline bool insert_transaction(rt_model_t *m, rt_nexus_t *nexus,
                                       rt_source_t *source, waveform_t *w,
                                       uint64_t when, uint64_t reject)
@@ -2608,7 +3338,7 @@ static void sched_driver(rt_model_t *m, rt_nexus_t *nexus, uint64_t after,
       copy_value_ptr(nexus, &w->value, value);
    }
    else {
-      rt_source_t *d = find_driver(nexus, proc);
+      rt_source_t *d = lookup_driver(nexus, proc);
       assert(d != NULL);
 
       if ((nexus->flags & NET_F_FAST_DRIVER) && d->fastqueued) {
@@ -2642,7 +3372,7 @@ static void sched_driver(rt_model_t *m, rt_nexus_t *nexus, uint64_t after,
 static void sched_disconnect(rt_model_t *m, rt_nexus_t *nexus, uint64_t after,
                              uint64_t reject, rt_proc_t *proc)
 {
-   rt_source_t *d = find_driver(nexus, proc);
+   rt_source_t *d = lookup_driver(nexus, proc);
    assert(d != NULL);
 
    const uint64_t when = m->now + after;
@@ -2791,7 +3521,7 @@ static void wakeup_one(rt_model_t *m, rt_wakeable_t *obj)
          if (proc->wakeable.delayed) {
             // This process was already scheduled to run at a later
             // time so we need to delete it from the simulation queue
-            heap_delete(m->eventq_heap, heap_delete_proc_cb, proc);
+            wheel_delete(m->eventq, heap_delete_proc_cb, proc);
             proc->wakeable.delayed = false;
          }
       }
@@ -2837,6 +3567,36 @@ static void wakeup_one(rt_model_t *m, rt_wakeable_t *obj)
    set_pending(obj);
 }
 
+static void wakeup_all(rt_model_t *m, rt_pending_t *p)
+{
+   // Fast path for clocks and resets with a large fan-out: reserve space
+   // in the process queue up front and skip the checks in wakeup_one
+   // for ordinary processes without a trigger
+   deferq_t *dq = &m->procq;
+   if (dq->count + p->count > dq->max) {
+      dq->max = MAX(dq->max * 2, dq->count + p->count);
+      dq->tasks = xrealloc_array(dq->tasks, dq->max, sizeof(defer_task_t));
+   }
+
+   for (int i = 0; i < p->count; i++) {
+      if (p->sens[i] == NULL)
+         continue;
+
+      rt_wakeable_t *obj = p->sens[i]->wake;
+      if (obj->pending)
+         continue;
+      else if (obj->kind == W_PROC && obj->trigger == NULL
+               && !obj->postponed && !obj->delayed) {
+         rt_proc_t *proc = container_of(obj, rt_proc_t, wakeable);
+         TRACE("wakeup process %s", istr(proc->name));
+         dq->tasks[dq->count++] = (defer_task_t){ async_run_process, proc };
+         obj->pending = true;
+      }
+      else
+         wakeup_one(m, obj);
+   }
+}
+
 static void notify_event(rt_model_t *m, rt_nexus_t *n)
 {
    // Must only be called once per cycle
@@ -2845,6 +3605,18 @@ static void notify_event(rt_model_t *m, rt_nexus_t *n)
    n->last_event = m->now;
    n->event_delta = m->iteration;
 
+   if (m->profile != NULL) {
+      unsigned nwake = 0;
+      if (pointer_tag(n->pending) == 1)
+         nwake = 1;
+      else if (n->pending != NULL) {
+         rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
+         nwake = p->count - p->holes;
+      }
+
+      profile_event(m->profile, n->signal->prof_id, nwake);
+   }
+
    if (n->flags & NET_F_CACHE_EVENT)
       n->signal->shared.flags |= SIG_F_EVENT_FLAG;
 
@@ -2854,9 +3626,13 @@ static void notify_event(rt_model_t *m, rt_nexus_t *n)
    }
    else if (n->pending != NULL) {
       rt_pending_t *p = untag_pointer(n->pending, rt_pending_t);
-      for (int i = 0; i < p->count; i++) {
-         if (p->wake[i] != NULL)
-            wakeup_one(m, p->wake[i]);
+      if (p->count - p->holes >= WAKE_BULK_MIN)
+         wakeup_all(m, p);
+      else {
+         for (int i = 0; i < p->count; i++) {
+            if (p->sens[i] != NULL)
+               wakeup_one(m, p->sens[i]->wake);
+         }
       }
    }
 }
@@ -2878,7 +3654,7 @@ static void enqueue_effective(rt_model_t *m, rt_nexus_t *n)
       return;
 
    n->flags |= NET_F_PENDING;
-   heap_insert(m->effective_heap, MAX_RANK - n->rank, n);
+   rankq_insert(&m->effective, MAX_RANK - n->rank, n);
 }
 
 static void update_effective(rt_model_t *m, rt_nexus_t *n)
@@ -2890,6 +3666,9 @@ static void update_effective(rt_model_t *m, rt_nexus_t *n)
    n->active_delta = m->iteration;
    n->flags &= ~NET_F_PENDING;
 
+   if (m->profile != NULL)
+      profile_active(m->profile, n->signal->prof_id);
+
    if (is_event(n, value)) {
       propagate_nexus(m, n, value);
       notify_event(m, n);
@@ -2912,47 +3691,187 @@ static void update_effective(rt_model_t *m, rt_nexus_t *n)
    }
 }
 
-static void update_driving(rt_model_t *m, rt_nexus_t *n, bool safe)
+static void update_driving(rt_model_t *m, rt_nexus_t *n, bool safe);
+
+static void apply_driving(rt_model_t *m, rt_nexus_t *n, const void *value)
 {
-   if (n->n_sources == 1 || safe) {
-      const void *value = calculate_driving_value(m, n);
+   TRACE("update %s driving value %s", trace_nexus(n), fmt_nexus(n, value));
 
-      TRACE("update %s driving value %s", trace_nexus(n), fmt_nexus(n, value));
+   n->active_delta = m->iteration;
+   n->flags &= ~NET_F_PENDING;
 
-      n->active_delta = m->iteration;
-      n->flags &= ~NET_F_PENDING;
+   if (m->profile != NULL)
+      profile_active(m->profile, n->signal->prof_id);
 
-      bool update_outputs = false;
-      if (n->flags & NET_F_EFFECTIVE) {
-         // The active and event flags will be set when we update the
-         // effective value later
-         update_outputs = true;
+   bool update_outputs = false;
+   if (n->flags & NET_F_EFFECTIVE) {
+      // The active and event flags will be set when we update the
+      // effective value later
+      update_outputs = true;
 
-         memcpy(nexus_driving(n), value, n->size * n->width);
+      memcpy(nexus_driving(n), value, n->size * n->width);
 
-         n->flags |= NET_F_PENDING;
-         heap_insert(m->effective_heap, MAX_RANK - n->rank, n);
-      }
-      else if (is_event(n, value)) {
-         propagate_nexus(m, n, value);
-         notify_event(m, n);
-         update_outputs = true;
-      }
+      n->flags |= NET_F_PENDING;
+      rankq_insert(&m->effective, MAX_RANK - n->rank, n);
+   }
+   else if (is_event(n, value)) {
+      propagate_nexus(m, n, value);
+      notify_event(m, n);
+      update_outputs = true;
+   }
 
-      if (update_outputs) {
-         for (rt_source_t *o = n->outputs; o; o = o->chain_output) {
-            assert(o->tag == SOURCE_PORT);
-            update_driving(m, o->u.port.output, false);
-         }
+   if (update_outputs) {
+      for (rt_source_t *o = n->outputs; o; o = o->chain_output) {
+         assert(o->tag == SOURCE_PORT);
+         update_driving(m, o->u.port.output, false);
       }
    }
+}
+
+static void update_driving(rt_model_t *m, rt_nexus_t *n, bool safe)
+{
+   if (n->n_sources == 1 || safe)
+      apply_driving(m, n, calculate_driving_value(m, n));
    else if (!(n->flags & NET_F_PENDING)) {
       TRACE("defer %s driving value update", trace_nexus(n));
-      heap_insert(m->driving_heap, n->rank, n);
+      rankq_insert(&m->driving, n->rank, n);
       n->flags |= NET_F_PENDING;
    }
 }
 
+static bool can_resolve_in_parallel(rt_nexus_t *n)
+{
+   // Forcing, deposits, and conversion functions all modify state
+   // shared with other nexuses
+   if (n->flags & (NET_F_FORCED | NET_F_DEPOSIT))
+      return false;
+   else if (n->signal->resolution == NULL)
+      return false;   // Not worth the overhead
+
+   for (rt_source_t *s = &(n->sources); s; s = s->chain_input) {
+      if (s->tag == SOURCE_PORT && s->u.port.conv_func != NULL)
+         return false;
+   }
+
+   return true;
+}
+
+static void resolve_worker(void *context, void *arg)
+{
+   rt_model_t *m = context;
+   resolve_batch_t *rb = arg;
+
+   MODEL_ENTRY(m);
+
+   model_thread_t *thread = model_thread(m);
+
+   if (!tlab_valid(thread->tlab))
+      tlab_acquire(m->mspace, &thread->tlab);
+
+   for (;;) {
+      const unsigned first = atomic_fetch_add(&rb->next, RESOLVE_CHUNK);
+      if (first >= rb->count)
+         break;
+
+      const unsigned last = MIN(first + RESOLVE_CHUNK, rb->count);
+      for (unsigned i = first; i < last; i++) {
+         if (rb->offsets[i] == SIZE_MAX)
+            continue;
+
+         // Diagnostics from the resolution function are printed when
+         // the value is applied so they appear in the sequential order
+         diag_defer(&(rb->diags[i]));
+
+         rt_nexus_t *n = rb->items[i];
+         const void *value = calculate_driving_value(m, n);
+         memcpy(rb->values + rb->offsets[i], value, n->size * n->width);
+
+         diag_defer(NULL);
+
+         tlab_reset(thread->tlab);   // No allocations can be live past here
+      }
+   }
+}
+
+static void resolve_parallel(rt_model_t *m, rt_nexus_t **items, int count)
+{
+   resolve_batch_t *rb = &(m->resolve);
+
+   if (count > rb->maxitems) {
+      rb->maxitems = MAX(count, rb->maxitems * 2);
+      rb->offsets = xrealloc_array(rb->offsets, rb->maxitems, sizeof(size_t));
+      rb->diags = xrealloc_array(rb->diags, rb->maxitems, sizeof(ptr_list_t));
+   }
+
+   // The resolved values are copied out of the thread-local allocation
+   // buffer as they must survive until the batch is applied in order
+   size_t total = 0;
+   for (int i = 0; i < count; i++) {
+      rb->diags[i] = NULL;
+
+      if (can_resolve_in_parallel(items[i])) {
+         rb->offsets[i] = total;
+         total += ALIGN_UP(items[i]->size * items[i]->width, sizeof(double));
+      }
+      else
+         rb->offsets[i] = SIZE_MAX;
+   }
+
+   if (total > rb->maxvalues) {
+      rb->maxvalues = MAX(total, rb->maxvalues * 2);
+      rb->values = xrealloc(rb->values, rb->maxvalues);
+   }
+
+   rb->items = items;
+   rb->count = count;
+   rb->next  = 0;
+
+   TRACE("resolve %d nexuses in parallel", count);
+
+   const int nhelpers = MIN(count / RESOLVE_MIN, m->nworkers);
+   for (int i = 0; i < nhelpers; i++)
+      workq_do(m->workq, resolve_worker, rb);
+
+   workq_start(m->workq);
+   resolve_worker(m, rb);
+   workq_drain(m->workq);
+}
+
+static void update_all_driving(rt_model_t *m)
+{
+   rankq_t *rq = &(m->driving);
+
+   // Nexuses with the same rank cannot depend on each other so their
+   // driving values can be calculated in parallel and then applied in
+   // order
+   while (rq->count > 0) {
+      rank_batch_t *b = rankq_head(rq);
+
+      const unsigned first = rq->next, count = b->count - first;
+      if (m->workq != NULL && count >= RESOLVE_MIN) {
+         resolve_batch_t *rb = &(m->resolve);
+         resolve_parallel(m, b->items + first, count);
+
+         for (unsigned i = 0; i < count; i++) {
+            rt_nexus_t *n = rankq_pop(rq);
+            assert(n == rb->items[i]);
+
+            if (rb->offsets[i] == SIZE_MAX)
+               update_driving(m, n, true);
+            else {
+               for (int j = 0; j < list_size(rb->diags[i]); j++)
+                  diag_emit(list_get(rb->diags[i], j));
+               list_free(&(rb->diags[i]));
+
+               apply_driving(m, n, rb->values + rb->offsets[i]);
+            }
+         }
+      }
+      else
+         update_driving(m, rankq_pop(rq), true);
+   }
+}
+
 static void update_driver(rt_model_t *m, rt_nexus_t *n, rt_source_t *source)
 {
    model_thread_t *thread = model_thread(m);
@@ -3065,6 +3984,14 @@ static void async_deposit(rt_model_t *m, void *arg)
    update_driving(m, deposit->nexus, false);
 }
 
+static void profile_sched(rt_model_t *m, rt_signal_t *s, rt_proc_t *proc)
+{
+   profile_transaction(m->profile, s->prof_id);
+
+   if (proc != NULL)
+      profile_transaction(m->profile, proc->prof_id);
+}
+
 static void async_transfer_signal(rt_model_t *m, void *arg)
 {
    rt_transfer_t *t = arg;
@@ -3072,6 +3999,9 @@ static void async_transfer_signal(rt_model_t *m, void *arg)
    assert(t->wakeable.pending);
    t->wakeable.pending = false;
 
+   if (m->profile != NULL)
+      profile_sched(m, t->target->signal, t->proc);
+
    rt_nexus_t *n = t->target;
    char *vptr = nexus_effective(t->source);
    for (int count = t->count; count > 0; n = n->chain) {
@@ -3098,6 +4028,9 @@ static void update_implicit_signal(rt_model_t *m, rt_implicit_t *imp)
 
    n0->active_delta = m->iteration;
 
+   if (m->profile != NULL)
+      profile_active(m->profile, imp->signal.prof_id);
+
    if (*(int8_t *)nexus_effective(n0) != result.integer) {
       propagate_nexus(m, n0, &result.integer);
       notify_event(m, n0);
@@ -3185,6 +4118,300 @@ static void swap_deferq(deferq_t *a, deferq_t *b)
    *b = tmp;
 }
 
+static void sched_waveform(rt_model_t *m, rt_signal_t *s, uint32_t offset,
+                           const void *values, int32_t count, int64_t after,
+                           int64_t reject, rt_proc_t *proc)
+{
+   if (m->profile != NULL)
+      profile_sched(m, s, proc);
+
+   rt_nexus_t *n = split_nexus(m, s, offset, count);
+   const char *vptr = values;
+   for (; count > 0; n = n->chain) {
+      count -= n->width;
+      assert(count >= 0);
+
+      sched_driver(m, n, after, reject, vptr, proc);
+      vptr += n->width * n->size;
+   }
+}
+
+static void disconnect_signal(rt_model_t *m, rt_signal_t *s, uint32_t offset,
+                              int32_t count, int64_t after, int64_t reject,
+                              rt_proc_t *proc)
+{
+   rt_nexus_t *n = split_nexus(m, s, offset, count);
+   for (; count > 0; n = n->chain) {
+      count -= n->width;
+      assert(count >= 0);
+
+      sched_disconnect(m, n, after, reject, proc);
+   }
+}
+
+static void sched_signal_event(rt_model_t *m, rt_signal_t *s, uint32_t offset,
+                               int32_t count, rt_wakeable_t *obj)
+{
+   rt_nexus_t *n = split_nexus(m, s, offset, count);
+   for (; count > 0; n = n->chain) {
+      sched_event(m, n, obj);
+
+      count -= n->width;
+      assert(count >= 0);
+   }
+}
+
+static void clear_signal_event(rt_model_t *m, rt_signal_t *s, uint32_t offset,
+                               int32_t count, rt_wakeable_t *obj)
+{
+   rt_nexus_t *n = split_nexus(m, s, offset, count);
+   for (; count > 0; n = n->chain) {
+      clear_event(m, n, obj);
+
+      count -= n->width;
+      assert(count >= 0);
+   }
+}
+
+static void *stage_alloc(model_thread_t *thread, size_t size)
+{
+   size = ALIGN_UP(size, sizeof(int64_t));
+
+   stage_chunk_t *c = thread->stage;
+   if (c == NULL || c->alloc + size > c->limit) {
+      const size_t limit = MAX(STAGE_CHUNK_SZ, size);
+      c = xmalloc_flex(sizeof(stage_chunk_t), limit, 1);
+      c->next  = thread->stage;
+      c->alloc = 0;
+      c->limit = limit;
+
+      thread->stage = c;
+   }
+
+   void *ptr = c->data + c->alloc;
+   c->alloc += size;
+   return ptr;
+}
+
+static void stage_reset(model_thread_t *thread)
+{
+   stage_chunk_t *c = thread->stage;
+   if (c == NULL)
+      return;
+
+   for (stage_chunk_t *it = c->next, *tmp; it; it = tmp) {
+      tmp = it->next;
+      free(it);
+   }
+
+   c->next  = NULL;
+   c->alloc = 0;
+}
+
+static stage_op_t *stage_op(rt_model_t *m, stage_kind_t kind, size_t extra)
+{
+   // When a process is running in parallel with others any update to
+   // the model is recorded and replayed later in process order
+   if (likely(!m->batch.active))
+      return NULL;
+
+   model_thread_t *thread = model_thread(m);
+
+   par_task_t *t = thread->task;
+   if (t == NULL || t->direct)
+      return NULL;
+
+   stage_op_t *op = stage_alloc(thread, sizeof(stage_op_t) + extra);
+   op->next = NULL;
+   op->kind = kind;
+
+   *(t->tail) = op;
+   t->tail = &(op->next);
+
+   return op;
+}
+
+static void replay_staged(rt_model_t *m, par_task_t *t)
+{
+   rt_proc_t *proc = t->proc;
+
+   for (stage_op_t *op = t->ops; op; op = op->next) {
+      switch (op->kind) {
+      case STAGE_WAVEFORM:
+         sched_waveform(m, op->signal, op->offset, op->values, op->count,
+                        op->after, op->reject, proc);
+         break;
+      case STAGE_DISCONNECT:
+         disconnect_signal(m, op->signal, op->offset, op->count,
+                           op->after, op->reject, proc);
+         break;
+      case STAGE_EVENT:
+         sched_signal_event(m, op->signal, op->offset, op->count,
+                            &(proc->wakeable));
+         break;
+      case STAGE_CLEAR_EVENT:
+         clear_signal_event(m, op->signal, op->offset, op->count,
+                            &(proc->wakeable));
+         break;
+      case STAGE_PROCESS:
+         deltaq_insert_proc(m, op->after, proc);
+         break;
+      case STAGE_FORCE:
+         force_signal(m, op->signal, op->values, op->offset, op->count);
+         break;
+      case STAGE_RELEASE:
+         release_signal(m, op->signal, op->offset, op->count);
+         break;
+      case STAGE_DEPOSIT:
+         deposit_signal(m, op->signal, op->values, op->offset, op->count);
+         break;
+      }
+   }
+
+   t->ops = NULL;
+   t->tail = &(t->ops);
+}
+
+static void take_turn(rt_model_t *m)
+{
+   if (likely(m == NULL || !m->batch.active))
+      return;
+
+   model_thread_t *thread = model_thread(m);
+
+   par_task_t *t = thread->task;
+   if (t == NULL || t->direct)
+      return;
+
+   // Wait for every earlier process in the batch to finish and then
+   // apply their updates: after this the current process has exclusive
+   // access to the model until it suspends
+   par_batch_t *b = &(m->batch);
+   const unsigned index = t - b->tasks;
+
+   for (unsigned i = relaxed_load(&b->merged); i < index; i++) {
+      while (!load_acquire(&(b->tasks[i].done)))
+         spin_wait();
+   }
+
+   for (unsigned i = relaxed_load(&b->merged); i < index; i++)
+      replay_staged(m, &(b->tasks[i]));
+
+   replay_staged(m, t);
+
+   relaxed_store(&b->merged, index);
+   t->direct = true;
+}
+
+static void parallel_worker(void *context, void *arg)
+{
+   rt_model_t *m = context;
+   par_batch_t *b = arg;
+
+   MODEL_ENTRY(m);
+
+   model_thread_t *thread = model_thread(m);
+
+   for (;;) {
+      // Processes are claimed in order so a process waiting for its
+      // turn only ever depends on ones already running
+      const unsigned index = atomic_fetch_add(&b->next, 1);
+      if (index >= b->count)
+         break;
+
+      par_task_t *t = &(b->tasks[index]);
+
+      thread->task = t;
+
+      if (t->proc->wakeable.serial)
+         take_turn(m);
+
+      async_run_process(m, t->proc);
+      thread->task = NULL;
+
+      if (t->direct)
+         relaxed_store(&b->merged, index + 1);
+
+      store_release(&t->done, 1);
+   }
+}
+
+static void run_parallel(rt_model_t *m, const defer_task_t *tasks, int count)
+{
+   par_batch_t *b = &(m->batch);
+
+   if (count > b->max) {
+      b->max = MAX(count, b->max * 2);
+      b->tasks = xrealloc_array(b->tasks, b->max, sizeof(par_task_t));
+   }
+
+   for (int i = 0; i < count; i++) {
+      assert(tasks[i].fn == async_run_process);
+
+      par_task_t *t = &(b->tasks[i]);
+      t->proc   = tasks[i].arg;
+      t->ops    = NULL;
+      t->tail   = &(t->ops);
+      t->direct = false;
+      t->done   = 0;
+   }
+
+   b->count  = count;
+   b->next   = 0;
+   b->merged = 0;
+
+   TRACE("run %d processes in parallel", count);
+
+   store_release(&b->active, true);
+
+   const int nhelpers = MIN(count / PARALLEL_MIN, m->nworkers);
+   for (int i = 0; i < nhelpers; i++)
+      workq_do(m->workq, parallel_worker, b);
+
+   workq_start(m->workq);
+   parallel_worker(m, b);
+   workq_drain(m->workq);
+
+   store_release(&b->active, false);
+
+   for (unsigned i = b->merged; i < count; i++)
+      replay_staged(m, &(b->tasks[i]));
+
+   for (int i = 0; i < MAX_THREADS; i++) {
+      if (m->threads[i] != NULL)
+         stage_reset(m->threads[i]);
+   }
+}
+
+static void deferq_run_parallel(rt_model_t *m, deferq_t *dq)
+{
+   const defer_task_t *tasks = dq->tasks;
+   const int count = dq->count;
+
+   for (int i = 0; i < count;) {
+      // Only consecutive runs of processes are executed in parallel,
+      // anything else such as event callbacks acts as a barrier
+      int nprocs = 0;
+      while (i + nprocs < count && tasks[i + nprocs].fn == async_run_process)
+         nprocs++;
+
+      if (nprocs >= 2 * PARALLEL_MIN) {
+         run_parallel(m, tasks + i, nprocs);
+         i += nprocs;
+      }
+      else {
+         const int end = i + MAX(nprocs, 1);
+         for (; i < end; i++)
+            (*tasks[i].fn)(m, tasks[i].arg);
+      }
+   }
+
+   assert(dq->tasks == tasks);
+   assert(dq->count == count);
+
+   dq->count = 0;
+}
+
 static void model_cycle(rt_model_t *m)
 {
    // Simulation cycle is described in LRM 93 section 12.6.4
@@ -3195,10 +4422,13 @@ static void model_cycle(rt_model_t *m)
    if (is_delta_cycle)
       m->iteration = m->iteration + 1;
    else {
-      m->now = heap_min_key(m->eventq_heap);
+      m->now = wheel_min_key(m->eventq);
       m->iteration = 0;
    }
 
+   if (m->profile != NULL)
+      profile_next_cycle(m->profile, is_delta_cycle);
+
    TRACE("begin cycle");
 
 #if TRACE_DELTAQ > 0
@@ -3216,7 +4446,7 @@ static void model_cycle(rt_model_t *m)
 
    if (!is_delta_cycle) {
       for (;;) {
-         void *e = heap_extract_min(m->eventq_heap);
+         void *e = wheel_extract_min(m->eventq);
          switch (pointer_tag(e)) {
          case EVENT_PROCESS:
             {
@@ -3241,24 +4471,19 @@ static void model_cycle(rt_model_t *m)
             break;
          }
 
-         if (heap_size(m->eventq_heap) == 0)
+         if (wheel_size(m->eventq) == 0)
             break;
-         else if (heap_min_key(m->eventq_heap) > m->now)
+         else if (wheel_min_key(m->eventq) > m->now)
             break;
       }
    }
 
    deferq_run(m, &m->driverq);
 
-   while (heap_size(m->driving_heap) > 0) {
-      rt_nexus_t *n = heap_extract_min(m->driving_heap);
-      update_driving(m, n, true);
-   }
+   update_all_driving(m);
 
-   while (heap_size(m->effective_heap) > 0) {
-      rt_nexus_t *n = heap_extract_min(m->effective_heap);
+   for (rt_nexus_t *n; (n = rankq_pop(&m->effective)); )
       update_effective(m, n);
-   }
 
    // Update implicit signals
    deferq_run(m, &m->implicitq);
@@ -3274,7 +4499,10 @@ static void model_cycle(rt_model_t *m)
       deferq_shuffle(&m->procq);
 
    // Run all non-postponed processes and event callbacks
-   deferq_run(m, &m->procq);
+   if (m->workq != NULL)
+      deferq_run_parallel(m, &m->procq);
+   else
+      deferq_run(m, &m->procq);
 
    global_event(m, RT_END_OF_PROCESSES);
 
@@ -3305,10 +4533,10 @@ static bool should_stop_now(rt_model_t *m, uint64_t stop_time)
    }
    else if (m->next_is_delta)
       return false;
-   else if (heap_size(m->eventq_heap) == 0)
+   else if (wheel_size(m->eventq) == 0)
       return true;
    else
-      return heap_min_key(m->eventq_heap) > stop_time;
+      return wheel_min_key(m->eventq) > stop_time;
 }
 
 void model_run(rt_model_t *m, uint64_t stop_time)
@@ -3455,10 +4683,10 @@ int64_t model_now(rt_model_t *m, unsigned *deltas)
 
 int64_t model_next_time(rt_model_t *m)
 {
-   if (heap_size(m->eventq_heap) == 0)
+   if (wheel_size(m->eventq) == 0)
       return TIME_HIGH;
    else
-      return heap_min_key(m->eventq_heap);
+      return wheel_min_key(m->eventq);
 }
 
 void model_stop(rt_model_t *m)
@@ -3494,7 +4722,7 @@ void model_set_timeout_cb(rt_model_t *m, uint64_t when, rt_event_fn_t fn,
    assert(when > m->now);   // TODO: delta timeouts?
 
    void *e = tag_pointer(cb, EVENT_TIMEOUT);
-   heap_insert(m->eventq_heap, when, e);
+   wheel_insert(m->eventq, when, e);
 }
 
 rt_watch_t *model_set_event_cb(rt_model_t *m, rt_signal_t *s, sig_event_fn_t fn,
@@ -3526,6 +4754,8 @@ void model_clear_event_cb(rt_model_t *m, rt_watch_t *w)
    for (int i = 0; i < w->signal->n_nexus; i++, n = n->chain)
       clear_event(m, n, &(w->wakeable));
 
+   free_all_sens(m, &(w->wakeable));
+
    rt_watch_t **last = &m->watches;
    for (rt_watch_t *it = *last; it;
         last = &(it->chain_all), it = it->chain_all) {
@@ -3647,6 +4877,8 @@ static rt_trigger_t *new_trigger(rt_model_t *m, trigger_kind_t kind,
                                  uint64_t hash, jit_handle_t handle,
                                  unsigned nargs, const jit_scalar_t *args)
 {
+   take_turn(m);
+
    rt_trigger_t **bucket = &(m->triggertab[hash % TRIGGER_TAB_SIZE]);
 
    for (rt_trigger_t *exist = *bucket; exist; exist = exist->chain) {
@@ -3693,13 +4925,26 @@ sig_shared_t *x_init_signal(int64_t count, uint32_t size, jit_scalar_t value,
               istr(tree_ident(where)), count, INT32_MAX);
 
    const size_t datasz = MAX(3 * count * size, 8);
-   rt_signal_t *s = static_alloc(m, sizeof(rt_signal_t) + datasz);
+   const bool sparse = datasz >= SPARSE_MIN;
+
+   rt_signal_t *s;
+   if (sparse)
+      s = sparse_alloc(m, sizeof(rt_signal_t) + datasz);
+   else
+      s = static_alloc(m, sizeof(rt_signal_t) + datasz);
+
    setup_signal(m, s, where, count, size, flags, offset);
 
    // The driving value area is also used to save the default value
    void *driving = s->shared.data + 2*s->shared.size;
 
-   if (scalar) {
+   if (sparse && scalar && value.integer == 0)
+      ;   // Freshly mapped memory is already zero
+   else if (sparse && !scalar) {
+      copy_sparse(s->shared.data, value.pointer, s->shared.size);
+      copy_sparse(driving, value.pointer, s->shared.size);
+   }
+   else if (scalar) {
 #define COPY_SCALAR(type) do {                  \
          type *pi = (type *)s->shared.data;     \
          type *pd = (type *)driving;            \
@@ -3726,19 +4971,18 @@ void x_drive_signal(sig_shared_t *ss, uint32_t offset, int32_t count)
          offset, count);
 
    rt_model_t *m = get_model();
+   take_turn(m);
    rt_proc_t *proc = get_active_proc();
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
-      rt_source_t *s;
-      for (s = &(n->sources); s; s = s->chain_input) {
-         if (s->tag == SOURCE_DRIVER && s->u.driver.proc == proc)
-            break;
-      }
-
-      if (s == NULL) {
-         s = add_source(m, n, SOURCE_DRIVER);
-         s->u.driver.waveforms.value = alloc_value(m, n);
-         s->u.driver.proc = proc;
+      rt_source_t *src = lookup_driver(n, proc);
+      if (src == NULL) {
+         src = add_source(m, n, SOURCE_DRIVER);
+         src->u.driver.waveforms.value = alloc_value(m, n);
+         src->u.driver.proc = proc;
+
+         if (proc != NULL && n->n_sources >= DRIVER_INDEX_MIN)
+            index_driver(proc, n, src);
       }
 
       count -= n->width;
@@ -3753,7 +4997,14 @@ void x_sched_process(int64_t delay)
    TRACE("schedule process %s delay=%s", istr(proc->name), trace_time(delay));
 
    check_delay(delay);
-   deltaq_insert_proc(get_model(), delay, proc);
+
+   rt_model_t *m = get_model();
+
+   stage_op_t *op = stage_op(m, STAGE_PROCESS, 0);
+   if (op != NULL)
+      op->after = delay;
+   else
+      deltaq_insert_proc(m, delay, proc);
 }
 
 void x_sched_waveform_s(sig_shared_t *ss, uint32_t offset, uint64_t scalar,
@@ -3773,6 +5024,21 @@ void x_sched_waveform_s(sig_shared_t *ss, uint32_t offset, uint64_t scalar,
    check_reject_limit(s, after, reject);
 
    rt_model_t *m = get_model();
+
+   stage_op_t *op = stage_op(m, STAGE_WAVEFORM, sizeof(uint64_t));
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = 1;
+      op->after  = after;
+      op->reject = reject;
+      memcpy(op->values, &scalar, sizeof(uint64_t));
+      return;
+   }
+
+   if (m->profile != NULL)
+      profile_sched(m, s, proc);
+
    rt_nexus_t *n = split_nexus(m, s, offset, 1);
 
    sched_driver(m, n, after, reject, &scalar, proc);
@@ -3795,15 +5061,19 @@ void x_sched_waveform(sig_shared_t *ss, uint32_t offset, void *values,
    check_reject_limit(s, after, reject);
 
    rt_model_t *m = get_model();
-   rt_nexus_t *n = split_nexus(m, s, offset, count);
-   char *vptr = values;
-   for (; count > 0; n = n->chain) {
-      count -= n->width;
-      assert(count >= 0);
 
-      sched_driver(m, n, after, reject, vptr, proc);
-      vptr += n->width * n->size;
+   const size_t valuesz = count * s->nexus.size;
+   stage_op_t *op = stage_op(m, STAGE_WAVEFORM, valuesz);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
+      op->after  = after;
+      op->reject = reject;
+      memcpy(op->values, values, valuesz);
    }
+   else
+      sched_waveform(m, s, offset, values, count, after, reject, proc);
 }
 
 void x_transfer_signal(sig_shared_t *target_ss, uint32_t toffset,
@@ -3824,6 +5094,7 @@ void x_transfer_signal(sig_shared_t *target_ss, uint32_t toffset,
    check_reject_limit(target, after, reject);
 
    rt_model_t *m = get_model();
+   take_turn(m);
 
    rt_transfer_t *t = static_alloc(m, sizeof(rt_transfer_t));
    t->proc   = proc;
@@ -3862,6 +5133,8 @@ int32_t x_test_net_event(sig_shared_t *ss, uint32_t offset, int32_t count)
 
    int32_t result = 0;
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
       if (n->last_event == m->now && n->event_delta == m->iteration) {
@@ -3892,6 +5165,8 @@ int32_t x_test_net_active(sig_shared_t *ss, uint32_t offset, int32_t count)
          istr(tree_ident(s->where)), offset, count);
 
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
       if (nexus_active(m, n))
@@ -3913,15 +5188,16 @@ void x_sched_event(sig_shared_t *ss, uint32_t offset, int32_t count)
          offset, count);
 
    rt_wakeable_t *obj = get_active_wakeable();
-
    rt_model_t *m = get_model();
-   rt_nexus_t *n = split_nexus(m, s, offset, count);
-   for (; count > 0; n = n->chain) {
-      sched_event(m, n, obj);
 
-      count -= n->width;
-      assert(count >= 0);
+   stage_op_t *op = stage_op(m, STAGE_EVENT, 0);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
    }
+   else
+      sched_signal_event(m, s, offset, count, obj);
 }
 
 void x_implicit_event(sig_shared_t *ss, uint32_t offset, int32_t count,
@@ -3957,13 +5233,15 @@ void x_clear_event(sig_shared_t *ss, uint32_t offset, int32_t count)
 
    rt_model_t *m = get_model();
    rt_proc_t *proc = get_active_proc();
-   rt_nexus_t *n = split_nexus(m, s, offset, count);
-   for (; count > 0; n = n->chain) {
-      clear_event(m, n, &(proc->wakeable));
 
-      count -= n->width;
-      assert(count >= 0);
+   stage_op_t *op = stage_op(m, STAGE_CLEAR_EVENT, 0);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
    }
+   else
+      clear_signal_event(m, s, offset, count, &(proc->wakeable));
 }
 
 void x_enter_state(int32_t state)
@@ -4002,6 +5280,8 @@ int64_t x_last_event(sig_shared_t *ss, uint32_t offset, int32_t count)
    int64_t last = TIME_HIGH;
 
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
       if (n->last_event <= m->now)
@@ -4025,6 +5305,8 @@ int64_t x_last_active(sig_shared_t *ss, uint32_t offset, int32_t count)
    int64_t last = TIME_HIGH;
 
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
       last = MIN(last, nexus_last_active(m, n));
@@ -4167,11 +5449,13 @@ bool x_driving(sig_shared_t *ss, uint32_t offset, int32_t count)
    int ntotal = 0, ndriving = 0;
    bool found = false;
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_proc_t *proc = get_active_proc();
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
       if (n->n_sources > 0) {
-         rt_source_t *src = find_driver(n, proc);
+         rt_source_t *src = lookup_driver(n, proc);
          if (src != NULL) {
             if (!src->disconnected) ndriving++;
             found = true;
@@ -4202,10 +5486,12 @@ void *x_driving_value(sig_shared_t *ss, uint32_t offset, int32_t count)
 
    uint8_t *p = result;
    rt_model_t *m = get_model();
+   take_turn(m);
+
    rt_proc_t *proc = get_active_proc();
    rt_nexus_t *n = split_nexus(m, s, offset, count);
    for (; count > 0; n = n->chain) {
-      rt_source_t *src = find_driver(n, proc);
+      rt_source_t *src = lookup_driver(n, proc);
       if (src == NULL)
          jit_msg(NULL, DIAG_FATAL, "process %s does not contain a driver "
                  "for %s", istr(proc->name), istr(tree_ident(s->where)));
@@ -4282,13 +5568,17 @@ void x_disconnect(sig_shared_t *ss, uint32_t offset, int32_t count,
    check_reject_limit(s, after, reject);
 
    rt_model_t *m = get_model();
-   rt_nexus_t *n = split_nexus(m, s, offset, count);
-   for (; count > 0; n = n->chain) {
-      count -= n->width;
-      assert(count >= 0);
 
-      sched_disconnect(m, n, after, reject, proc);
+   stage_op_t *op = stage_op(m, STAGE_DISCONNECT, 0);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
+      op->after  = after;
+      op->reject = reject;
    }
+   else
+      disconnect_signal(m, s, offset, count, after, reject, proc);
 }
 
 void x_force(sig_shared_t *ss, uint32_t offset, int32_t count, void *values)
@@ -4303,7 +5593,16 @@ void x_force(sig_shared_t *ss, uint32_t offset, int32_t count, void *values)
 
    check_postponed(0, proc);
 
-   force_signal(m, s, values, offset, count);
+   const size_t valuesz = count * s->nexus.size;
+   stage_op_t *op = stage_op(m, STAGE_FORCE, valuesz);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
+      memcpy(op->values, values, valuesz);
+   }
+   else
+      force_signal(m, s, values, offset, count);
 }
 
 void x_release(sig_shared_t *ss, uint32_t offset, int32_t count)
@@ -4318,7 +5617,14 @@ void x_release(sig_shared_t *ss, uint32_t offset, int32_t count)
 
    check_postponed(0, proc);
 
-   release_signal(m, s, offset, count);
+   stage_op_t *op = stage_op(m, STAGE_RELEASE, 0);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
+   }
+   else
+      release_signal(m, s, offset, count);
 }
 
 void x_deposit_signal(sig_shared_t *ss, uint32_t offset, int32_t count,
@@ -4334,7 +5640,16 @@ void x_deposit_signal(sig_shared_t *ss, uint32_t offset, int32_t count,
 
    check_postponed(0, proc);
 
-   deposit_signal(m, s, values, offset, count);
+   const size_t valuesz = count * s->nexus.size;
+   stage_op_t *op = stage_op(m, STAGE_DEPOSIT, valuesz);
+   if (op != NULL) {
+      op->signal = s;
+      op->offset = offset;
+      op->count  = count;
+      memcpy(op->values, values, valuesz);
+   }
+   else
+      deposit_signal(m, s, values, offset, count);
 }
 
 void x_resolve_signal(sig_shared_t *ss, jit_handle_t handle, void *context,
@@ -39,8 +39,13 @@
 #define MSPACE_UNPOISON(addr, size)
 #endif
 
-#define LINE_SIZE  32
-#define LINE_WORDS (LINE_SIZE / sizeof(intptr_t))
+#define LINE_SIZE     32
+#define LINE_WORDS    (LINE_SIZE / sizeof(intptr_t))
+#define ROOT_CHUNK    4096
+#define PUBLISH_LIMIT 64
+#define CARD_SHIFT    9
+#define CARD_SIZE     (1 << CARD_SHIFT)
+#define SMALL_OBJECT  8192
 
 typedef A(uint64_t)     work_list_t;
 
@@ -54,8 +59,31 @@ struct _mptr {
 };
 
 typedef struct {
+   intptr_t *start;
+   intptr_t *end;
+   int       thread;
+} root_range_t;
+
+typedef A(root_range_t) root_list_t;
+
+// Each marking thread pops objects from its private work list and
+// moves surplus work to the shared list where it can be stolen
+typedef struct {
+   work_list_t  local;
+   nvc_lock_t   lock;
+   int          nshared;
+   work_list_t  shared;
+} __attribute__((aligned(64))) mark_stack_t;
+
+typedef struct {
+   mspace_t         *mspace;
+   bool              minor;
    bit_mask_t        markmask;
-   work_list_t       worklist;
+   root_list_t       roots;
+   int               nextroot;
+   int               idle;
+   int               nmarkers;
+   mark_stack_t      stacks[MAX_THREADS];
    struct cpu_state  cpu[MAX_THREADS];
 #if __SANITIZE_ADDRESS__
    void             *fake_stack[MAX_THREADS];
@@ -70,12 +98,30 @@ struct _free_list {
    size_t       size;
 };
 
+// Small objects are bump allocated from the nursery, a region carved
+// out of the free list whose holes are refilled after each minor
+// collection.  Objects allocated since the last collection are young
+// and a minor collection only traces and sweeps those: old objects
+// are assumed live and the roots are extended with the dirty cards
+// and every remembered object.  Nothing is ever moved.
+
 struct _mspace {
    nvc_lock_t       lock;
    size_t           maxsize;
    unsigned         maxlines;
    char            *space;
    bit_mask_t       headmask;
+   bit_mask_t       youngmask;
+   bit_mask_t       remembered;
+   uint8_t         *cards;
+   unsigned         ncards;
+   char            *nursery;
+   char            *nursery_end;
+   size_t           nurserysz;
+   char            *bumpptr;
+   char            *bumplimit;
+   free_list_t     *holes;
+   unsigned         promoted;
    mptr_t           roots;
    mptr_t           free_mptrs;
    mspace_oom_fn_t  oomfn;
@@ -83,6 +129,7 @@ struct _mspace {
    uint64_t         create_us;
    unsigned         total_gc;
    unsigned         num_cycles;
+   unsigned         num_minor;
 #ifdef DEBUG
    bool             stress;
 #endif
@@ -90,8 +137,9 @@ struct _mspace {
 
 static intptr_t *stack_limit[MAX_THREADS];
 
-static void mspace_gc(mspace_t *m);
+static bool mspace_gc(mspace_t *m, bool minor);
 static bool is_mspace_ptr(mspace_t *m, char *p);
+static void mspace_new_nursery(mspace_t *m);
 
 mspace_t *mspace_new(size_t size)
 {
@@ -108,6 +156,12 @@ mspace_t *mspace_new(size_t size)
    mask_init(&(m->headmask), m->maxlines);
    mask_setall(&(m->headmask));
 
+   mask_init(&(m->youngmask), m->maxlines);
+   mask_init(&(m->remembered), m->maxlines);
+
+   m->ncards = (m->maxsize + CARD_SIZE - 1) / CARD_SIZE;
+   m->cards  = xcalloc(m->ncards);
+
    free_list_t *f = xmalloc(sizeof(free_list_t));
    f->next = NULL;
    f->ptr  = m->space;
@@ -115,6 +169,9 @@ mspace_t *mspace_new(size_t size)
 
    m->free_list = f;
 
+   m->nurserysz = (m->maxlines / 8) * LINE_SIZE;
+   mspace_new_nursery(m);
+
    m->create_us = get_timestamp_us();
    return m;
 }
@@ -134,8 +191,9 @@ void mspace_destroy(mspace_t *m)
    if (opt_get_verbose(OPT_GC_VERBOSE, NULL) && m->num_cycles > 0) {
       const uint64_t destroy_us = get_timestamp_us();
       const double gc_frac = m->total_gc / (double)(destroy_us - m->create_us);
-      debugf("GC: %d collection cycles; %d us total; %.1f%% of overall "
-             "run time", m->num_cycles, m->total_gc, gc_frac * 100.0);
+      debugf("GC: %d collection cycles (%d minor); %d us total; %.1f%% of "
+             "overall run time", m->num_cycles, m->num_minor, m->total_gc,
+             gc_frac * 100.0);
    }
 
    for (free_list_t *it = m->free_list, *tmp; it; it = tmp) {
@@ -143,12 +201,20 @@ void mspace_destroy(mspace_t *m)
       free(it);
    }
 
+   for (free_list_t *it = m->holes, *tmp; it; it = tmp) {
+      tmp = it->next;
+      free(it);
+   }
+
    for (mptr_t p = m->free_mptrs, tmp; p; p = tmp) {
       tmp = p->next;
       free(p);
    }
 
    mask_free(&(m->headmask));
+   mask_free(&(m->youngmask));
+   mask_free(&(m->remembered));
+   free(m->cards);
    nvc_munmap(m->space, m->maxsize);
    free(m);
 }
@@ -159,27 +225,102 @@ void mspace_stack_limit(void *limit)
    atomic_store(&(stack_limit[thread_id()]), limit);
 }
 
-static void *mspace_try_alloc(mspace_t *m, size_t size)
+static void mspace_add_free(mspace_t *m, char *ptr, size_t size)
 {
-   // Add one to size before rounding up to LINE_SIZE to allow a valid
-   // pointer to point at one element past the end of an array
-   const int nlines = (size + LINE_SIZE) / LINE_SIZE;
-   const size_t asize = nlines * LINE_SIZE;
+   free_list_t **tail;
+   for (tail = &(m->free_list); *tail; tail = &((*tail)->next)) {
+      if ((*tail)->ptr + (*tail)->size == ptr) {
+         // Coalese after this block
+         (*tail)->size += size;
+         return;
+      }
+      else if (ptr + size == (*tail)->ptr) {
+         // Coalese before this block
+         (*tail)->ptr = ptr;
+         (*tail)->size += size;
+         return;
+      }
+   }
 
-   SCOPED_LOCK(m->lock);
+   free_list_t *f = xmalloc(sizeof(free_list_t));
+   f->next = NULL;
+   f->size = size;
+   f->ptr  = ptr;
+
+   *tail = f;
+}
+
+static void mspace_new_nursery(mspace_t *m)
+{
+   assert(m->nursery == NULL);
+   assert(m->holes == NULL);
+
+   // Take the nursery from the start of the largest free block
+   free_list_t **best = NULL;
+   for (free_list_t **it = &(m->free_list); *it; it = &((*it)->next)) {
+      if (best == NULL || (*it)->size > (*best)->size)
+         best = it;
+   }
+
+   if (best == NULL || (*best)->size < m->nurserysz / 4 || m->nurserysz == 0)
+      return;   // Allocate small objects from the free list until next GC
+
+   const size_t size = MIN((*best)->size, m->nurserysz);
+   char *base = (*best)->ptr;
+
+   if ((*best)->size == size) {
+      free_list_t *next = (*best)->next;
+      free(*best);
+      *best = next;
+   }
+   else {
+      (*best)->size -= size;
+      (*best)->ptr += size;
+   }
+
+   m->nursery     = base;
+   m->nursery_end = base + size;
+   m->bumpptr     = base;
+   m->bumplimit   = base + size;
+}
+
+static char *mspace_bump_alloc(mspace_t *m, size_t asize)
+{
+   while (m->bumpptr + asize > m->bumplimit) {
+      if (m->bumpptr < m->bumplimit) {
+         // The rest of this hole is reclaimed by the next minor GC
+         const int line = (m->bumpptr - m->space) / LINE_SIZE;
+         const int nlines = (m->bumplimit - m->bumpptr) / LINE_SIZE;
+         mask_set_range(&(m->youngmask), line, nlines);
+      }
+
+      free_list_t *h = m->holes;
+      if (h == NULL) {
+         m->bumpptr = m->bumplimit = NULL;
+         return NULL;
+      }
 
+      m->bumpptr   = h->ptr;
+      m->bumplimit = h->ptr + h->size;
+      m->holes     = h->next;
+      free(h);
+   }
+
+   char *base = m->bumpptr;
+   m->bumpptr += asize;
+
+   const int line = (base - m->space) / LINE_SIZE;
+   mask_set_range(&(m->youngmask), line, asize / LINE_SIZE);
+
+   return base;
+}
+
+static char *mspace_free_list_alloc(mspace_t *m, size_t asize)
+{
    for (free_list_t **it = &(m->free_list); *it; it = &((*it)->next)) {
       assert((*it)->size % LINE_SIZE == 0);
       if ((*it)->size >= asize) {
          char *base = (*it)->ptr;
-         assert((uintptr_t)base % LINE_SIZE == 0);
-
-         MSPACE_UNPOISON(base, size);
-
-         const int line = (base - m->space) / LINE_SIZE;
-         mask_set(&(m->headmask), line);
-         if (nlines > 1)
-            mask_clear_range(&(m->headmask), line + 1, nlines - 1);
 
          if ((*it)->size == asize) {
             free_list_t *next = (*it)->next;
@@ -191,10 +332,6 @@ static void *mspace_try_alloc(mspace_t *m, size_t size)
             (*it)->ptr += asize;
          }
 
-         // Make sure the first fault to the page is a write to
-         // allocate THP on Linux
-         *(volatile char *)base = 0;
-
          return base;
       }
    }
@@ -202,7 +339,46 @@ static void *mspace_try_alloc(mspace_t *m, size_t size)
    return NULL;
 }
 
-void *mspace_alloc(mspace_t *m, size_t size)
+static void *mspace_try_alloc(mspace_t *m, size_t size, bool remember,
+                              bool fallback)
+{
+   // Add one to size before rounding up to LINE_SIZE to allow a valid
+   // pointer to point at one element past the end of an array
+   const int nlines = (size + LINE_SIZE) / LINE_SIZE;
+   const size_t asize = nlines * LINE_SIZE;
+
+   SCOPED_LOCK(m->lock);
+
+   char *base = NULL;
+   if (m->nursery != NULL && asize <= SMALL_OBJECT)
+      base = mspace_bump_alloc(m, asize);
+
+   if (base == NULL && (m->nursery == NULL || asize > SMALL_OBJECT || fallback))
+      base = mspace_free_list_alloc(m, asize);
+
+   if (base == NULL)
+      return NULL;
+
+   assert((uintptr_t)base % LINE_SIZE == 0);
+
+   MSPACE_UNPOISON(base, size);
+
+   const int line = (base - m->space) / LINE_SIZE;
+   mask_set(&(m->headmask), line);
+   if (nlines > 1)
+      mask_clear_range(&(m->headmask), line + 1, nlines - 1);
+
+   if (remember)
+      mask_set(&(m->remembered), line);
+
+   // Make sure the first fault to the page is a write to
+   // allocate THP on Linux
+   *(volatile char *)base = 0;
+
+   return base;
+}
+
+static void *mspace_do_alloc(mspace_t *m, size_t size, bool remember)
 {
    if (size == 0)
       return NULL;
@@ -211,19 +387,24 @@ void *mspace_alloc(mspace_t *m, size_t size)
    if (stack_limit[thread_id()] == NULL)
       fatal_trace("cannot allocate without setting stack limit");
    else if (m->stress)
-      mspace_gc(m);
+      mspace_gc(m, true);
 #endif
 
-   int retry = 1;
-   do {
-      void *ptr = mspace_try_alloc(m, size);
-      if (ptr != NULL)
-         return ptr;
-
-      mspace_gc(m);
-   } while (retry--);
+   void *ptr = mspace_try_alloc(m, size, remember, false);
+   if (ptr == NULL) {
+      // Collecting the nursery is usually enough to satisfy a small
+      // allocation but fall back to a full collection if not
+      const bool minor = mspace_gc(m, size < SMALL_OBJECT);
+      if ((ptr = mspace_try_alloc(m, size, remember, !minor)) == NULL
+          && minor) {
+         mspace_gc(m, false);
+         ptr = mspace_try_alloc(m, size, remember, true);
+      }
+   }
 
-   if (m->oomfn) {
+   if (ptr != NULL)
+      return ptr;
+   else if (m->oomfn) {
       (*m->oomfn)(m, size);
       return NULL;
    }
@@ -231,6 +412,18 @@ void *mspace_alloc(mspace_t *m, size_t size)
       fatal_trace("out of memory attempting to allocate %zu byte object", size);
 }
 
+void *mspace_alloc(mspace_t *m, size_t size)
+{
+   // Stores into this object are not tracked so it is scanned by every
+   // minor collection for the rest of its lifetime
+   return mspace_do_alloc(m, size, true);
+}
+
+void *mspace_alloc_barrier(mspace_t *m, size_t size)
+{
+   return mspace_do_alloc(m, size, false);
+}
+
 static void mspace_return_memory(mspace_t *m, char *ptr, size_t size)
 {
    assert(is_mspace_ptr(m, ptr));
@@ -240,34 +433,18 @@ static void mspace_return_memory(mspace_t *m, char *ptr, size_t size)
    const int nlines = (size + LINE_SIZE) / LINE_SIZE;
    const size_t asize = nlines * LINE_SIZE;
 
-   free_list_t **tail;
-   for (tail = &(m->free_list); *tail; tail = &((*tail)->next)) {
-      if ((*tail)->ptr + (*tail)->size == ptr) {
-         // Coalese after this block
-         (*tail)->size += asize;
-         break;
-      }
-      else if (ptr + asize == (*tail)->ptr) {
-         // Coalese before this block
-         (*tail)->ptr = ptr;
-         (*tail)->size += asize;
-         break;
-      }
-   }
+   SCOPED_LOCK(m->lock);
 
-   if (*tail == NULL) {
-      free_list_t *f = xmalloc(sizeof(free_list_t));
-      f->next = NULL;
-      f->size = asize;
-      f->ptr  = ptr;
+   int line = (ptr - m->space) / LINE_SIZE;
+   if (mask_test(&(m->youngmask), line))
+      return;   // Swept by the next minor collection
 
-      *tail = f;
-   }
+   mspace_add_free(m, ptr, asize);
 
    MSPACE_POISON(ptr, asize);
 
-   int line = (ptr - m->space) / LINE_SIZE;
    mask_set_range(&(m->headmask), line, nlines);
+   mask_clear(&(m->remembered), line);
 }
 
 void *mspace_alloc_array(mspace_t *m, int nelems, size_t size)
@@ -353,7 +530,8 @@ void tlab_acquire(mspace_t *m, tlab_t *t)
    t->alloc  = 0;
    t->mptr   = mptr_new(m, "tlab");
 
-   // This ensures the TLAB is kept alive over GCs
+   // This ensures the TLAB is kept alive over GCs: it is also always
+   // remembered as stores into demoted allocations have no barrier
    *mptr_get(t->mptr) = t->base;
 }
 
@@ -389,124 +567,281 @@ static bool is_mspace_ptr(mspace_t *m, char *p)
    return p >= m->space && p < m->space + m->maxsize;
 }
 
-static void mspace_mark_root(mspace_t *m, intptr_t p, gc_state_t *state)
+void mspace_write_barrier(mspace_t *m, void *ptr, size_t size)
+{
+   // Must be called before the store: a young object that is only
+   // reachable from the value being stored is then still held in a
+   // register if a collection happens in between
+
+   if (!is_mspace_ptr(m, ptr) || size == 0)
+      return;
+
+   const int line = ((char *)ptr - m->space) / LINE_SIZE;
+   if (mask_test(&(m->youngmask), line))
+      return;   // Young objects are always traced
+
+   const int first = ((char *)ptr - m->space) >> CARD_SHIFT;
+   const int last = MIN(((char *)ptr + size - 1 - m->space) >> CARD_SHIFT,
+                        m->ncards - 1);
+
+   for (int i = first; i <= last; i++) {
+      if (relaxed_load(&(m->cards[i])) == 0)
+         relaxed_store(&(m->cards[i]), 1);
+   }
+}
+
+void mspace_get_barrier(mspace_t *m, mspace_barrier_t *b)
+{
+   STATIC_ASSERT(LINE_SIZE == 1 << 5);
+
+   b->base       = (uintptr_t)m->space;
+   b->size       = m->maxsize;
+   b->cards      = m->cards;
+   b->card_shift = CARD_SHIFT;
+   b->line_shift = 5;
+
+   if (m->youngmask.size > 64)
+      b->young = m->youngmask.ptr;
+   else
+      b->young = &(m->youngmask.bits);
+}
+
+__attribute__((no_sanitize_address))
+static void mspace_mark_root(mspace_t *m, intptr_t p, gc_state_t *state,
+                             mark_stack_t *ms)
 {
    if (is_mspace_ptr(m, (char *)p)) {
       int line = ((char *)p - m->space) / LINE_SIZE;
 
+      if (state->minor && !mask_test(&(m->youngmask), line))
+         return;   // Old objects are assumed live
+
       // Scan backwards to the start of the object
       line = mask_scan_backwards(&(m->headmask), line);
       assert(line != -1);
 
-      int objlen = 1;
-      if (line + 1 < m->maxlines)
-         objlen += mask_count_clear(&(m->headmask), line + 1);
+      // Setting the mark bit on the first line claims the object for
+      // this thread: the other lines are only read by the sweep
+      if (!mask_test_and_set(&(state->markmask), line)) {
+         int objlen = 1;
+         if (line + 1 < m->maxlines)
+            objlen += mask_count_clear(&(m->headmask), line + 1);
 
-      if (!mask_test(&(state->markmask), line)) {
-         mask_set_range(&(state->markmask), line, objlen);
+         if (objlen > 1)
+            mask_set_range_atomic(&(state->markmask), line + 1, objlen - 1);
 
          uint64_t enc = ((uint64_t)line << 32) | objlen;
-         APUSH(state->worklist, enc);
+         APUSH(ms->local, enc);
       }
    }
 }
 
-static void mspace_suspend_cb(int thread_id, struct cpu_state *cpu, void *arg)
+static void mspace_publish(mark_stack_t *ms)
 {
-   gc_state_t *state = arg;
-   assert(thread_id < MAX_THREADS);
-   state->cpu[thread_id] = *cpu;
-#if __SANITIZE_ADDRESS__
-   state->fake_stack[thread_id] = __asan_get_current_fake_stack();
-#endif
+   // Move the oldest half of the private list, which is likely to lead
+   // to the largest amount of further work, to the shared list
+   const int half = ms->local.count / 2;
+
+   SCOPED_LOCK(ms->lock);
+
+   for (int i = 0; i < half; i++)
+      APUSH(ms->shared, ms->local.items[i]);
+
+   memmove(ms->local.items, ms->local.items + half,
+           (ms->local.count - half) * sizeof(uint64_t));
+   ms->local.count -= half;
+
+   relaxed_store(&ms->nshared, ms->shared.count);
 }
 
-__attribute__((no_sanitize_address, noinline))
-static void mspace_gc(mspace_t *m)
+static bool mspace_steal(mark_stack_t *ms, mark_stack_t *victim, bool all)
 {
-   const uint64_t start_ticks = get_timestamp_us();
+   if (relaxed_load(&victim->nshared) == 0)
+      return false;
 
-#ifdef DEBUG
-   if (stack_limit[thread_id()] == NULL)
-      fatal_trace("GC requested without setting stack limit");
-#endif
+   SCOPED_LOCK(victim->lock);
 
-#if defined __SANITIZE_THREAD__ && !defined __APPLE__
-   return;   // Cannot reliably suspend threads with tsan
-#endif
+   const int count = victim->shared.count;
+   const int ntake = all ? count : (count + 1) / 2;
+   if (ntake == 0)
+      return false;
 
-   gc_state_t state = {};
-   mask_init(&(state.markmask), m->maxlines);
+   for (int i = 0; i < ntake; i++)
+      APUSH(ms->local, APOP(victim->shared));
 
-   SCOPED_LOCK(m->lock);
+   relaxed_store(&victim->nshared, victim->shared.count);
+   return true;
+}
 
-   stop_world(mspace_suspend_cb, &state);
+__attribute__((no_sanitize_address))
+static void mspace_drain(mspace_t *m, gc_state_t *state, mark_stack_t *ms)
+{
+   while (ms->local.count > 0) {
+      const uint64_t enc = APOP(ms->local);
+      const int line = enc >> 32;
+      const int objlen = enc & 0xffffffff;
 
-   for (int i = 0; i < MAX_THREADS; i++) {
-      if (get_thread(i) == NULL)
-         continue;
+      for (int i = 0; i < objlen; i++) {
+         intptr_t *words = (intptr_t *)(m->space + (line + i) * LINE_SIZE);
+         for (int j = 0; j < LINE_WORDS; j++)
+            mspace_mark_root(m, words[j], state, ms);
+      }
 
-      intptr_t *limit = atomic_load(&(stack_limit[i]));
-      if (limit == NULL)
-         continue;
+      if (ms->local.count > PUBLISH_LIMIT && relaxed_load(&ms->nshared) == 0)
+         mspace_publish(ms);
+   }
+}
+
+static bool mspace_find_work(gc_state_t *state, int id, int count)
+{
+   mark_stack_t *ms = &(state->stacks[id]);
 
-      for (int j = 0; j < MAX_CPU_REGS; j++)
-         mspace_mark_root(m, state.cpu[i].regs[j], &state);
+   if (mspace_steal(ms, ms, true))
+      return true;
 
-      intptr_t *stack_top = (intptr_t *)state.cpu[i].sp;
-      assert(stack_top <= limit);   // Stack must grow down
+   for (int i = 1; i < count; i++) {
+      if (mspace_steal(ms, &(state->stacks[(id + i) % count]), false))
+         return true;
+   }
+
+   // Marking is complete once every thread is idle: only the owner
+   // adds to a shared list and it empties its own before going idle
+   atomic_add(&state->idle, 1);
+
+   while (atomic_load(&state->idle) < count) {
+      for (int i = 0; i < count; i++) {
+         if (relaxed_load(&(state->stacks[i].nshared)) > 0) {
+            atomic_add(&state->idle, -1);
+            return true;
+         }
+      }
+
+      progressive_backoff();
+   }
+
+   return false;
+}
+
+__attribute__((no_sanitize_address))
+static void mspace_mark_task(int id, int count, void *arg)
+{
+   gc_state_t *state = arg;
+   mspace_t *m = state->mspace;
+   mark_stack_t *ms = &(state->stacks[id]);
 
-      for (intptr_t *p = stack_top; p < limit; p++) {
-         mspace_mark_root(m, *p, &state);
+   if (id == 0)
+      state->nmarkers = count;
+
+   const int nroots = state->roots.count;
+   for (int n; (n = relaxed_fetch_add(&state->nextroot, 1)) < nroots;) {
+      const root_range_t *r = &(state->roots.items[n]);
+      for (intptr_t *p = r->start; p < r->end; p++) {
+         mspace_mark_root(m, *p, state, ms);
 
 #if __SANITIZE_ADDRESS__
          // Address sanitiser relocates possibly-escaping stack
          // allocations to a "fake stack" on the heap which we also need
          // to scan to find roots
-         if (state.fake_stack[i] != NULL) {
+         if (r->thread != -1 && state->fake_stack[r->thread] != NULL) {
             void *beg, *end;
-            if (__asan_addr_is_in_fake_stack(state.fake_stack[i], (void *)*p,
+            void *fake_stack = state->fake_stack[r->thread];
+            if (__asan_addr_is_in_fake_stack(fake_stack, (void *)*p,
                                              &beg, &end)) {
                for (intptr_t *p2 = beg; p2 < (intptr_t *)end; p2++)
-                  mspace_mark_root(m, *p2, &state);
+                  mspace_mark_root(m, *p2, state, ms);
             }
          }
 #endif
       }
+
+      mspace_drain(m, state, ms);
    }
 
-   for (mptr_t p = m->roots; p; p = p->next)
-      mspace_mark_root(m, (intptr_t)p->ptr, &state);
+   do {
+      mspace_drain(m, state, ms);
+   } while (mspace_find_work(state, id, count));
 
-   while (state.worklist.count > 0) {
-      const uint64_t enc = APOP(state.worklist);
-      const int line = enc >> 32;
-      const int objlen = enc & 0xffffffff;
+   assert(ms->local.count == 0);
+}
 
-      for (int i = 0; i < objlen; i++) {
-         intptr_t *words = (intptr_t *)(m->space + (line + i) * LINE_SIZE);
-         for (int j = 0; j < LINE_WORDS; j++)
-            mspace_mark_root(m, words[j], &state);
+static void mspace_suspend_cb(int thread_id, struct cpu_state *cpu, void *arg)
+{
+   gc_state_t *state = arg;
+   assert(thread_id < MAX_THREADS);
+   state->cpu[thread_id] = *cpu;
+#if __SANITIZE_ADDRESS__
+   state->fake_stack[thread_id] = __asan_get_current_fake_stack();
+#endif
+}
+
+static void mspace_add_root(gc_state_t *state, intptr_t *start,
+                            intptr_t *end, int thread)
+{
+   // Split large ranges so they can be scanned by multiple threads
+   for (intptr_t *p = start; p < end; p += ROOT_CHUNK) {
+      const root_range_t chunk = {
+         .start  = p,
+         .end    = MIN(p + ROOT_CHUNK, end),
+         .thread = thread,
+      };
+      APUSH(state->roots, chunk);
+   }
+}
+
+static void mspace_old_roots(mspace_t *m, gc_state_t *state)
+{
+   // Old objects written since the last collection may point at young
+   // objects as can any remembered object
+
+   for (int i = 0; i < m->ncards;) {
+      if (m->cards[i] == 0) {
+         i++;
+         continue;
       }
+
+      int end = i + 1;
+      while (end < m->ncards && m->cards[end] != 0)
+         end++;
+
+      intptr_t *start = (intptr_t *)(m->space + i * CARD_SIZE);
+      intptr_t *limit = (intptr_t *)(m->space + MIN(end * CARD_SIZE,
+                                                    m->maxsize));
+      mspace_add_root(state, start, limit, -1);
+
+      i = end;
    }
 
-#if __SANITIZE_ADDRESS__
-   for (int i = 0; i < m->maxlines; i++) {
-      if (!mask_test(&(state.markmask), i))
-         MSPACE_POISON(m->space + i * LINE_SIZE, LINE_SIZE);
+   for (int line = -1; mask_iter(&(m->remembered), &line);) {
+      if (mask_test(&(m->youngmask), line))
+         continue;   // Traced anyway if reachable
+
+      int objlen = 1;
+      if (line + 1 < m->maxlines)
+         objlen += mask_count_clear(&(m->headmask), line + 1);
+
+      intptr_t *start = (intptr_t *)(m->space + line * LINE_SIZE);
+      mspace_add_root(state, start, start + objlen * LINE_WORDS, -1);
    }
-#endif
+}
 
+static void mspace_sweep_major(mspace_t *m, gc_state_t *state,
+                               int *freefrags, int *freelines)
+{
    for (free_list_t *it = m->free_list, *tmp; it; it = tmp) {
       tmp = it->next;
       free(it);
    }
    m->free_list = NULL;
 
-   int freefrags = 0, freelines = 0;
+   for (free_list_t *it = m->holes, *tmp; it; it = tmp) {
+      tmp = it->next;
+      free(it);
+   }
+   m->holes = NULL;
+
    free_list_t **tail = &(m->free_list);
    for (int line = 0; line < m->maxlines;) {
-      const int clear = mask_count_clear(&(state.markmask), line);
+      const int clear = mask_count_clear(&(state->markmask), line);
       if (clear == 0)
          line++;
       else {
@@ -519,30 +854,212 @@ static void mspace_gc(mspace_t *m)
          tail = &(f->next);
 
          mask_set_range(&(m->headmask), line, clear);
+         mask_clear_range(&(m->remembered), line, clear);
 
-         freefrags++;
-         freelines += clear;
+         (*freefrags)++;
+         (*freelines) += clear;
 
          line += clear;
       }
    }
 
+   mask_clearall(&(m->youngmask));
+
+   m->nursery = m->nursery_end = NULL;
+   m->bumpptr = m->bumplimit = NULL;
+   m->promoted = 0;
+
+   mspace_new_nursery(m);
+}
+
+static void mspace_sweep_minor(mspace_t *m, gc_state_t *state,
+                               int *freefrags, int *freelines)
+{
+   // The unallocated parts of the nursery are swept like dead young
+   // objects so the holes can be rebuilt from the young mask
+
+   if (m->bumpptr < m->bumplimit) {
+      const int line = (m->bumpptr - m->space) / LINE_SIZE;
+      const int nlines = (m->bumplimit - m->bumpptr) / LINE_SIZE;
+      mask_set_range(&(m->youngmask), line, nlines);
+   }
+
+   for (free_list_t *it = m->holes, *tmp; it; it = tmp) {
+      const int line = (it->ptr - m->space) / LINE_SIZE;
+      mask_set_range(&(m->youngmask), line, it->size / LINE_SIZE);
+
+      tmp = it->next;
+      free(it);
+   }
+   m->holes = NULL;
+
+   const int first = (m->nursery - m->space) / LINE_SIZE;
+   const int last = (m->nursery_end - m->space) / LINE_SIZE;
+
+   free_list_t **tail = &(m->holes);
+   for (int line = first; line < last;) {
+      if (!mask_test(&(m->youngmask), line))
+         line++;   // Promoted by an earlier minor collection
+      else if (mask_test(&(state->markmask), line)) {
+         m->promoted++;
+         line++;
+      }
+      else {
+         int end = line + 1;
+         while (end < last && mask_test(&(m->youngmask), end)
+                && !mask_test(&(state->markmask), end))
+            end++;
+
+         const int clear = end - line;
+
+         free_list_t *f = xmalloc(sizeof(free_list_t));
+         f->next = NULL;
+         f->ptr  = m->space + line * LINE_SIZE;
+         f->size = clear * LINE_SIZE;
+
+         *tail = f;
+         tail = &(f->next);
+
+         MSPACE_POISON(f->ptr, f->size);
+
+         mask_set_range(&(m->headmask), line, clear);
+         mask_clear_range(&(m->remembered), line, clear);
+
+         (*freefrags)++;
+         (*freelines) += clear;
+
+         line = end;
+      }
+   }
+
+   mask_clear_range(&(m->youngmask), first, last - first);
+
+   m->bumpptr = m->bumplimit = NULL;
+
+   if (*freelines < (last - first) / 4) {
+      // Too many survivors: return the holes and start a new nursery
+      for (free_list_t *it = m->holes, *tmp; it; it = tmp) {
+         mspace_add_free(m, it->ptr, it->size);
+         tmp = it->next;
+         free(it);
+      }
+      m->holes = NULL;
+
+      m->nursery = m->nursery_end = NULL;
+      mspace_new_nursery(m);
+   }
+}
+
+__attribute__((no_sanitize_address, noinline))
+static bool mspace_gc(mspace_t *m, bool minor)
+{
+   const uint64_t start_ticks = get_timestamp_us();
+
+#ifdef DEBUG
+   if (stack_limit[thread_id()] == NULL)
+      fatal_trace("GC requested without setting stack limit");
+#endif
+
+#if defined __SANITIZE_THREAD__ && !defined __APPLE__
+   return false;   // Cannot reliably suspend threads with tsan
+#endif
+
+   gc_state_t state = { .mspace = m };
+   mask_init(&(state.markmask), m->maxlines);
+
+   SCOPED_LOCK(m->lock);
+
+   // Everything promoted since the last full collection is assumed
+   // live so do a full collection once that becomes significant
+   state.minor = minor && m->nursery != NULL
+      && m->promoted < m->maxlines / 4;
+
+   stop_world(mspace_suspend_cb, &state);
+
+   for (int i = 0; i < MAX_THREADS; i++) {
+      if (get_thread(i) == NULL)
+         continue;
+
+      intptr_t *limit = atomic_load(&(stack_limit[i]));
+      if (limit == NULL)
+         continue;
+
+      const root_range_t regs = {
+         .start  = (intptr_t *)state.cpu[i].regs,
+         .end    = (intptr_t *)state.cpu[i].regs + MAX_CPU_REGS,
+         .thread = -1,
+      };
+      APUSH(state.roots, regs);
+
+      intptr_t *stack_top = (intptr_t *)state.cpu[i].sp;
+      assert(stack_top <= limit);   // Stack must grow down
+
+      mspace_add_root(&state, stack_top, limit, i);
+   }
+
+   SCOPED_A(intptr_t) mptrs = AINIT;
+   for (mptr_t p = m->roots; p; p = p->next)
+      APUSH(mptrs, (intptr_t)p->ptr);
+
+   const root_range_t mroots = {
+      .start  = mptrs.items,
+      .end    = mptrs.items + mptrs.count,
+      .thread = -1,
+   };
+   APUSH(state.roots, mroots);
+
+   if (state.minor)
+      mspace_old_roots(m, &state);
+
+   world_parallel_do(mspace_mark_task, &state);
+
+   int freefrags = 0, freelines = 0;
+   if (state.minor)
+      mspace_sweep_minor(m, &state, &freefrags, &freelines);
+   else {
+#if __SANITIZE_ADDRESS__
+      for (int i = 0; i < m->maxlines; i++) {
+         if (!mask_test(&(state.markmask), i))
+            MSPACE_POISON(m->space + i * LINE_SIZE, LINE_SIZE);
+      }
+#endif
+
+      mspace_sweep_major(m, &state, &freefrags, &freelines);
+   }
+
+   // Every surviving object is now old
+   memset(m->cards, '\0', m->ncards);
+
    start_world();
 
    if (opt_get_verbose(OPT_GC_VERBOSE, NULL)) {
       const int ticks = get_timestamp_us() - start_ticks;
-      debugf("GC: allocated %d/%zu; fragmentation %.2g%% [%d us]",
+      debugf("GC: %s collection; %s %d/%zu; fragmentation %.2g%%; "
+             "%d marking thread%s [%d us]", state.minor ? "minor" : "major",
+             state.minor ? "promoted" : "allocated",
              mask_popcount(&(state.markmask)) * LINE_SIZE, m->maxsize,
-             ((double)(freefrags - 1) / (double)freelines) * 100.0, ticks);
+             ((double)(freefrags - 1) / (double)freelines) * 100.0,
+             state.nmarkers, state.nmarkers > 1 ? "s" : "", ticks);
 
       m->total_gc += ticks;
       m->num_cycles++;
+
+      if (state.minor)
+         m->num_minor++;
    }
 
    mask_free(&(state.markmask));
 
-   assert(state.worklist.count == 0);
-   ACLEAR(state.worklist);
+   for (int i = 0; i < state.nmarkers; i++) {
+      assert(state.stacks[i].local.count == 0);
+      assert(state.stacks[i].shared.count == 0);
+      ACLEAR(state.stacks[i].local);
+      ACLEAR(state.stacks[i].shared);
+   }
+
+   ACLEAR(state.roots);
+
+   return state.minor;
 }
 
 void *mspace_find(mspace_t *m, void *ptr, size_t *size)
@@ -36,6 +36,18 @@ typedef struct _tlab {
    mptr_t    mptr;
 } tlab_t;
 
+// Lets a code generator inline the common case of the write barrier:
+// the card for address P is cards[(P - base) >> card_shift] and it only
+// needs marking if bit (P - base) >> line_shift of young is clear
+typedef struct {
+   uintptr_t  base;
+   size_t     size;
+   uint8_t   *cards;
+   uint64_t  *young;
+   unsigned   card_shift;
+   unsigned   line_shift;
+} mspace_barrier_t;
+
 #define tlab_valid(t) ((t).base != NULL)
 
 #define tlab_move(from, to) do {                \
@@ -52,10 +64,13 @@ typedef struct _tlab {
 mspace_t *mspace_new(size_t size);
 void mspace_destroy(mspace_t *m);
 void *mspace_alloc(mspace_t *m, size_t size);
+void *mspace_alloc_barrier(mspace_t *m, size_t size);
 void *mspace_alloc_array(mspace_t *m, int nelems, size_t size);
 void *mspace_alloc_flex(mspace_t *m, size_t fixed, int nelems, size_t size);
 void mspace_set_oom_handler(mspace_t *m, mspace_oom_fn_t fn);
 void *mspace_find(mspace_t *m, void *ptr, size_t *size);
+void mspace_write_barrier(mspace_t *m, void *ptr, size_t size);
+void mspace_get_barrier(mspace_t *m, mspace_barrier_t *b);
 
 void tlab_acquire(mspace_t *m, tlab_t *t);
 void tlab_release(tlab_t *t);
@@ -0,0 +1,287 @@
+//
+//  Copyright (C) 2024  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "ident.h"
+#include "rt/profile.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHUNK_BITS 10
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+
+typedef struct {
+   ident_t     name;
+   prof_kind_t kind;
+   uint64_t    time;
+   uint64_t    wakeups;
+   uint64_t    deltas;
+   uint64_t    transactions;
+   uint64_t    events;
+   uint64_t    last_active;
+   uint64_t    last_event;
+} prof_entry_t;
+
+struct _rt_profile {
+   prof_entry_t **chunks;
+   unsigned       nchunks;
+   uint32_t       count;
+   uint64_t       cycle;
+   bool           delta;
+   uint64_t       total_time;
+   uint64_t       total_cycles;
+   uint64_t       total_deltas;
+};
+
+static inline prof_entry_t *profile_get(rt_profile_t *p, uint32_t id)
+{
+   assert(id < p->count);
+   return &(p->chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)]);
+}
+
+rt_profile_t *profile_new(void)
+{
+   rt_profile_t *p = xcalloc(sizeof(rt_profile_t));
+   p->cycle = 1;
+   return p;
+}
+
+void profile_free(rt_profile_t *p)
+{
+   for (unsigned i = 0; i < p->nchunks; i++)
+      free(p->chunks[i]);
+
+   free(p->chunks);
+   free(p);
+}
+
+uint32_t profile_add(rt_profile_t *p, prof_kind_t kind, ident_t name)
+{
+   // Entries are only added during elaboration and reset so the chunk
+   // table does not need to be protected against concurrent readers
+
+   if (p->count == p->nchunks * CHUNK_SIZE) {
+      p->chunks = xrealloc_array(p->chunks, ++p->nchunks,
+                                 sizeof(prof_entry_t *));
+      p->chunks[p->nchunks - 1] = xcalloc_array(CHUNK_SIZE,
+                                                sizeof(prof_entry_t));
+   }
+
+   const uint32_t id = p->count++;
+
+   prof_entry_t *e = profile_get(p, id);
+   e->name = name;
+   e->kind = kind;
+
+   return id;
+}
+
+void profile_next_cycle(rt_profile_t *p, bool delta)
+{
+   p->cycle++;
+   p->delta = delta;
+   p->total_cycles++;
+
+   if (delta)
+      p->total_deltas++;
+}
+
+void profile_run(rt_profile_t *p, uint32_t id, uint64_t ns)
+{
+   prof_entry_t *e = profile_get(p, id);
+   assert(e->kind == PROF_PROCESS);
+
+   relaxed_add(&e->time, ns);
+   relaxed_add(&e->wakeups, 1);
+   relaxed_add(&p->total_time, ns);
+
+   if (p->delta)
+      relaxed_add(&e->deltas, 1);
+}
+
+void profile_transaction(rt_profile_t *p, uint32_t id)
+{
+   prof_entry_t *e = profile_get(p, id);
+   relaxed_add(&e->transactions, 1);
+}
+
+void profile_active(rt_profile_t *p, uint32_t id)
+{
+   // Count each delta cycle only once even when several nexuses of the
+   // same signal are updated, possibly on different threads
+
+   prof_entry_t *e = profile_get(p, id);
+   assert(e->kind == PROF_SIGNAL);
+
+   if (p->delta && atomic_xchg(&e->last_active, p->cycle) != p->cycle)
+      relaxed_add(&e->deltas, 1);
+}
+
+void profile_event(rt_profile_t *p, uint32_t id, unsigned wakeups)
+{
+   prof_entry_t *e = profile_get(p, id);
+   assert(e->kind == PROF_SIGNAL);
+
+   if (atomic_xchg(&e->last_event, p->cycle) != p->cycle)
+      relaxed_add(&e->events, 1);
+
+   relaxed_add(&e->wakeups, wakeups);
+}
+
+static int process_cmp(const void *a, const void *b)
+{
+   const prof_entry_t *ea = *(const prof_entry_t **)a;
+   const prof_entry_t *eb = *(const prof_entry_t **)b;
+
+   if (ea->time != eb->time)
+      return ea->time < eb->time ? 1 : -1;
+   else if (ea->wakeups != eb->wakeups)
+      return ea->wakeups < eb->wakeups ? 1 : -1;
+   else
+      return 0;
+}
+
+static int signal_cmp(const void *a, const void *b)
+{
+   const prof_entry_t *ea = *(const prof_entry_t **)a;
+   const prof_entry_t *eb = *(const prof_entry_t **)b;
+
+   const uint64_t wa = ea->transactions + ea->events + ea->wakeups;
+   const uint64_t wb = eb->transactions + eb->events + eb->wakeups;
+
+   if (wa != wb)
+      return wa < wb ? 1 : -1;
+   else
+      return 0;
+}
+
+static prof_entry_t **profile_sorted(rt_profile_t *p, prof_kind_t kind,
+                                     unsigned *count)
+{
+   prof_entry_t **list = xmalloc_array(p->count, sizeof(prof_entry_t *));
+
+   unsigned n = 0;
+   for (uint32_t i = 0; i < p->count; i++) {
+      prof_entry_t *e = profile_get(p, i);
+      if (e->kind == kind)
+         list[n++] = e;
+   }
+
+   qsort(list, n, sizeof(prof_entry_t *),
+         kind == PROF_PROCESS ? process_cmp : signal_cmp);
+
+   *count = n;
+   return list;
+}
+
+void profile_report(rt_profile_t *p, int top)
+{
+   unsigned nprocs, nsignals;
+   prof_entry_t **procs = profile_sorted(p, PROF_PROCESS, &nprocs);
+   prof_entry_t **signals = profile_sorted(p, PROF_SIGNAL, &nsignals);
+
+   color_printf("\n$bold$Simulation profile$$ (%"PRIu64" cycles, %"PRIu64
+                " delta cycles, %"PRIu64" ms in processes)\n\n",
+                p->total_cycles, p->total_deltas, p->total_time / 1000000);
+
+   color_printf("$bold$%10s %6s %10s %10s %12s  %s$$\n", "Time (ms)", "%",
+                "Wakeups", "Deltas", "Transactions", "Process");
+
+   for (unsigned i = 0; i < nprocs && i < (unsigned)top; i++) {
+      const prof_entry_t *e = procs[i];
+      const double pct =
+         p->total_time ? (100.0 * e->time) / p->total_time : 0.0;
+      printf("%10.1f %6.1f %10"PRIu64" %10"PRIu64" %12"PRIu64"  %s\n",
+             e->time / 1e6, pct, e->wakeups, e->deltas, e->transactions,
+             istr(e->name));
+   }
+
+   color_printf("\n$bold$%10s %10s %10s %12s  %s$$\n", "Events", "Wakeups",
+                "Deltas", "Transactions", "Signal");
+
+   for (unsigned i = 0; i < nsignals && i < (unsigned)top; i++) {
+      const prof_entry_t *e = signals[i];
+      printf("%10"PRIu64" %10"PRIu64" %10"PRIu64" %12"PRIu64"  %s\n",
+             e->events, e->wakeups, e->deltas, e->transactions,
+             istr(e->name));
+   }
+
+   printf("\n");
+   fflush(stdout);
+
+   free(procs);
+   free(signals);
+}
+
+static void json_string(FILE *f, const char *str)
+{
+   fputc('"', f);
+   for (const char *p = str; *p; p++) {
+      if (*p == '"' || *p == '\\')
+         fprintf(f, "\\%c", *p);
+      else if ((unsigned char)*p < 0x20)
+         fprintf(f, "\\u%04x", *p);
+      else
+         fputc(*p, f);
+   }
+   fputc('"', f);
+}
+
+void profile_write_json(rt_profile_t *p, const char *file)
+{
+   FILE *f = fopen(file, "w");
+   if (f == NULL)
+      fatal_errno("%s", file);
+
+   unsigned nprocs, nsignals;
+   prof_entry_t **procs = profile_sorted(p, PROF_PROCESS, &nprocs);
+   prof_entry_t **signals = profile_sorted(p, PROF_SIGNAL, &nsignals);
+
+   fprintf(f, "{\n  \"cycles\": %"PRIu64",\n  \"deltas\": %"PRIu64",\n"
+           "  \"time_ns\": %"PRIu64",\n  \"processes\": [",
+           p->total_cycles, p->total_deltas, p->total_time);
+
+   for (unsigned i = 0; i < nprocs; i++) {
+      const prof_entry_t *e = procs[i];
+      fprintf(f, "%s\n    { \"name\": ", i > 0 ? "," : "");
+      json_string(f, istr(e->name));
+      fprintf(f, ", \"time_ns\": %"PRIu64", \"wakeups\": %"PRIu64
+              ", \"deltas\": %"PRIu64", \"transactions\": %"PRIu64" }",
+              e->time, e->wakeups, e->deltas, e->transactions);
+   }
+
+   fprintf(f, "\n  ],\n  \"signals\": [");
+
+   for (unsigned i = 0; i < nsignals; i++) {
+      const prof_entry_t *e = signals[i];
+      fprintf(f, "%s\n    { \"name\": ", i > 0 ? "," : "");
+      json_string(f, istr(e->name));
+      fprintf(f, ", \"events\": %"PRIu64", \"wakeups\": %"PRIu64
+              ", \"deltas\": %"PRIu64", \"transactions\": %"PRIu64" }",
+              e->events, e->wakeups, e->deltas, e->transactions);
+   }
+
+   fprintf(f, "\n  ]\n}\n");
+   fclose(f);
+
+   free(procs);
+   free(signals);
+}
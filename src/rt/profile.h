@@ -0,0 +1,43 @@
+//
+//  Copyright (C) 2024  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _RT_PROFILE_H
+#define _RT_PROFILE_H
+
+#include "prim.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _rt_profile rt_profile_t;
+
+typedef enum {
+   PROF_PROCESS, PROF_SIGNAL
+} prof_kind_t;
+
+rt_profile_t *profile_new(void);
+void profile_free(rt_profile_t *p);
+uint32_t profile_add(rt_profile_t *p, prof_kind_t kind, ident_t name);
+void profile_next_cycle(rt_profile_t *p, bool delta);
+void profile_run(rt_profile_t *p, uint32_t id, uint64_t ns);
+void profile_transaction(rt_profile_t *p, uint32_t id);
+void profile_active(rt_profile_t *p, uint32_t id);
+void profile_event(rt_profile_t *p, uint32_t id, unsigned wakeups);
+void profile_report(rt_profile_t *p, int top);
+void profile_write_json(rt_profile_t *p, const char *file);
+
+#endif  // _RT_PROFILE_H
@@ -783,6 +783,7 @@ static subtype_mirror *get_subtype_mirror(void *context, type_t type,
             memcpy(tmp, cache->f_subtype_cache,
                    cache->f_max_subtypes * sizeof(cache_elem_t));
 
+         jit_write_barrier(&(cache->f_subtype_cache), sizeof(void *));
          cache->f_subtype_cache = tmp;
          cache->f_max_subtypes = new_max;
       }
@@ -533,6 +533,7 @@ void _std_env_dir_open(const uint8_t *path_ptr, int64_t path_len,
    rewinddir(d);
 
    void *mem = jit_mspace_alloc(memsz), *next = mem;
+   jit_write_barrier(dir, sizeof(directory_t));
    dir->items = next;
    dir->items->dims[0].left = 0;
    dir->items->dims[0].length = count;
@@ -614,7 +615,10 @@ void _std_env_file_name(ffi_uarray_t **ptr)
 
    const char *file = loc_file_str(&(stack->frames[1].loc));
    const char *sep = find_dir_separator(file);
-   *ptr = to_line(sep ? sep + 1 : file);
+   ffi_uarray_t *u = to_line(sep ? sep + 1 : file);
+
+   jit_write_barrier(ptr, sizeof(ffi_uarray_t *));
+   *ptr = u;
 }
 
 DLLEXPORT
@@ -626,10 +630,14 @@ void _std_env_file_path(ffi_uarray_t **ptr)
    const char *file = loc_file_str(&(stack->frames[1].loc));
    const char *sep = find_dir_separator(file);
 
+   ffi_uarray_t *u;
    if (sep == NULL)
-      *ptr = to_absolute_path(".", 1);
+      u = to_absolute_path(".", 1);
    else
-      *ptr = to_absolute_path(file, sep - file);
+      u = to_absolute_path(file, sep - file);
+
+   jit_write_barrier(ptr, sizeof(ffi_uarray_t *));
+   *ptr = u;
 }
 
 DLLEXPORT
@@ -34,6 +34,8 @@ typedef enum {
 
 typedef uint32_t wakeup_gen_t;
 
+typedef struct _rt_sens rt_sens_t;
+
 typedef enum {
    FUNC_TRIGGER, OR_TRIGGER, CMP_TRIGGER
 } trigger_kind_t;
@@ -55,17 +57,31 @@ typedef struct {
    unsigned        postponed : 1;
    unsigned        delayed : 1;
    unsigned        free_later : 1;
+   unsigned        serial : 1;
    rt_trigger_t   *trigger;
+   rt_sens_t      *sens;
+   rt_sens_t      *last_sens;
 } rt_wakeable_t;
 
+// Slot occupied by a wakeable in the pending list of a nexus
+typedef struct _rt_sens {
+   rt_sens_t     *next;
+   rt_nexus_t    *nexus;
+   rt_wakeable_t *wake;
+   unsigned       slot;
+} rt_sens_t;
+
 typedef struct _rt_proc {
    rt_wakeable_t  wakeable;
    tree_t         where;
    ident_t        name;
    jit_handle_t   handle;
+   uint32_t       prof_id;
    tlab_t         tlab;
    rt_scope_t    *scope;
    mptr_t         privdata;
+   ihash_t       *drivers;
+   rt_source_t   *last_driver;
 } rt_proc_t;
 
 STATIC_ASSERT(sizeof(rt_proc_t) <= 128);
@@ -99,7 +115,8 @@ STATIC_ASSERT(sizeof(waveform_t) <= 24);
 typedef struct {
    unsigned       count;
    unsigned       max;
-   rt_wakeable_t *wake[];
+   unsigned       holes;
+   rt_sens_t     *sens[];
 } rt_pending_t;
 
 typedef enum {
@@ -156,10 +173,21 @@ typedef struct _rt_source {
 
 STATIC_ASSERT(sizeof(rt_source_t) <= 64);
 
-typedef struct {
+typedef struct _res_memo res_memo_t;
+
+typedef void (*res_map_fn_t)(const res_memo_t *, int8_t *, const int8_t *,
+                             int);
+typedef void (*res_fold_fn_t)(const res_memo_t *, int8_t *, const int8_t *,
+                              int);
+
+typedef struct _res_memo {
    ffi_closure_t closure;
    res_flags_t   flags;
    int64_t       ileft;
+   int           nlits;
+   int           maxfold;
+   res_map_fn_t  map;
+   res_fold_fn_t fold;
    int8_t        tab2[16][16];
    int8_t        tab1[16];
 } res_memo_t;
@@ -191,9 +219,15 @@ typedef struct _sig_shared {
    uint8_t     data[0];
 } sig_shared_t;
 
+// Radix tree mapping element offsets to the nexus starting there
+typedef struct _rt_index_node {
+   uint64_t  mask;
+   void     *child[64];
+} rt_index_node_t;
+
 typedef struct {
-   int         how;
-   rt_nexus_t *nexus[0];
+   int              levels;
+   rt_index_node_t *root;
 } rt_index_t;
 
 typedef struct _rt_signal {
@@ -204,6 +238,7 @@ typedef struct _rt_signal {
    nvc_lock_t    lock;
    uint32_t      offset;
    uint32_t      n_nexus;
+   uint32_t      prof_id;
    rt_nexus_t    nexus;
    sig_shared_t  shared;
 } rt_signal_t;
@@ -122,6 +122,8 @@ void __nvc_sys_finish(void)
 DLLEXPORT
 void __nvc_sys_display(jit_scalar_t *args)
 {
+   model_serialise();
+
    verilog_printf(args + 2);
    fputc('\n', stdout);
    fflush(stdout);
@@ -130,6 +132,8 @@ void __nvc_sys_display(jit_scalar_t *args)
 DLLEXPORT
 void __nvc_sys_write(jit_scalar_t *args)
 {
+   model_serialise();
+
    verilog_printf(args + 2);
    fflush(stdout);
 }
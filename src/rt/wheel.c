@@ -0,0 +1,311 @@
+//
+//  Copyright (C) 2024  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "rt/heap.h"
+#include "rt/rt.h"
+#include "rt/wheel.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// Hierarchical timing wheel: level N holds events whose key differs
+// from the current base time first in byte N.  Events more than 2^32
+// units beyond the base are kept in an overflow heap until the base
+// catches up with them.
+//
+// Unlike the binary heap it replaces, events with equal keys on the
+// wheel are extracted in the order they were inserted.  The relative
+// order of equal keys that pass through the overflow heap is still
+// unspecified.
+
+#define WHEEL_BITS   8
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN   (WHEEL_BITS * WHEEL_LEVELS)
+#define WHEEL_WORDS  (WHEEL_SLOTS / 64)
+#define CHUNK_SIZE   256
+
+typedef struct _wheel_entry wheel_entry_t;
+typedef struct _wheel_chunk wheel_chunk_t;
+
+struct _wheel_entry {
+   wheel_entry_t *next;
+   void          *user;
+   uint64_t       key;
+};
+
+typedef struct {
+   wheel_entry_t *head;
+   wheel_entry_t *tail;
+} wheel_slot_t;
+
+typedef struct {
+   uint64_t     bitmap[WHEEL_WORDS];
+   wheel_slot_t slots[WHEEL_SLOTS];
+} wheel_level_t;
+
+struct _wheel_chunk {
+   wheel_chunk_t *next;
+   wheel_entry_t  entries[CHUNK_SIZE];
+};
+
+struct _wheel {
+   uint64_t       base;
+   size_t         count;
+   wheel_level_t  levels[WHEEL_LEVELS];
+   heap_t        *overflow;
+   wheel_entry_t *freelist;
+   wheel_chunk_t *chunks;
+   nvc_lock_t     lock;
+};
+
+static inline bool wheel_in_range(wheel_t *w, uint64_t key)
+{
+   return key >= w->base && ((key ^ w->base) >> WHEEL_SPAN) == 0;
+}
+
+static wheel_entry_t *wheel_alloc_entry(wheel_t *w)
+{
+   if (unlikely(w->freelist == NULL)) {
+      wheel_chunk_t *c = xmalloc(sizeof(wheel_chunk_t));
+      c->next = w->chunks;
+      w->chunks = c;
+
+      for (int i = 0; i < CHUNK_SIZE; i++) {
+         c->entries[i].next = w->freelist;
+         w->freelist = &(c->entries[i]);
+      }
+   }
+
+   wheel_entry_t *e = w->freelist;
+   w->freelist = e->next;
+   return e;
+}
+
+static inline void wheel_free_entry(wheel_t *w, wheel_entry_t *e)
+{
+   e->next = w->freelist;
+   w->freelist = e;
+}
+
+static void wheel_place(wheel_t *w, wheel_entry_t *e)
+{
+   assert(wheel_in_range(w, e->key));
+
+   const uint64_t diff = e->key ^ w->base;
+   const int level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+   const int slot = (e->key >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+
+   wheel_level_t *l = &(w->levels[level]);
+   wheel_slot_t *s = &(l->slots[slot]);
+
+   e->next = NULL;
+   if (s->tail == NULL) {
+      s->head = s->tail = e;
+      l->bitmap[slot / 64] |= UINT64_C(1) << (slot % 64);
+   }
+   else {
+      s->tail->next = e;
+      s->tail = e;
+   }
+}
+
+static inline int wheel_first_slot(wheel_level_t *l)
+{
+   for (int i = 0; i < WHEEL_WORDS; i++) {
+      if (l->bitmap[i] != 0)
+         return i * 64 + __builtin_ctzll(l->bitmap[i]);
+   }
+
+   return -1;
+}
+
+static wheel_slot_t *wheel_advance(wheel_t *w)
+{
+   // Return the level zero slot holding the earliest event, cascading
+   // entries down from the higher levels as required
+
+   for (int level = 0; level < WHEEL_LEVELS; level++) {
+      wheel_level_t *l = &(w->levels[level]);
+
+      const int slot = wheel_first_slot(l);
+      if (slot < 0)
+         continue;
+
+      wheel_slot_t *s = &(l->slots[slot]);
+      if (level == 0)
+         return s;
+
+      const int shift = level * WHEEL_BITS;
+      const uint64_t mask = (UINT64_C(1) << (shift + WHEEL_BITS)) - 1;
+      w->base = (w->base & ~mask) | ((uint64_t)slot << shift);
+
+      wheel_entry_t *list = s->head;
+      s->head = s->tail = NULL;
+      l->bitmap[slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+
+      for (wheel_entry_t *e = list, *next; e != NULL; e = next) {
+         next = e->next;
+         wheel_place(w, e);
+      }
+
+      level = -1;   // All entries are now on a lower level
+   }
+
+   return NULL;
+}
+
+static void wheel_rebase(wheel_t *w, uint64_t base)
+{
+   assert(w->count == 0);
+   w->base = base;
+
+   while (heap_size(w->overflow) > 0) {
+      const uint64_t key = heap_min_key(w->overflow);
+      if (!wheel_in_range(w, key))
+         break;
+
+      wheel_entry_t *e = wheel_alloc_entry(w);
+      e->key  = key;
+      e->user = heap_extract_min(w->overflow);
+
+      wheel_place(w, e);
+      w->count++;
+   }
+}
+
+wheel_t *wheel_new(void)
+{
+   wheel_t *w = xcalloc(sizeof(wheel_t));
+   w->overflow = heap_new(16);
+   return w;
+}
+
+void wheel_free(wheel_t *w)
+{
+   for (wheel_chunk_t *it = w->chunks, *next; it; it = next) {
+      next = it->next;
+      free(it);
+   }
+
+   heap_free(w->overflow);
+   free(w);
+}
+
+void *wheel_extract_min(wheel_t *w)
+{
+   RT_LOCK(w->lock);
+
+   wheel_slot_t *s = wheel_advance(w);
+   if (s == NULL) {
+      // Jump forward to the earliest far future event
+      const uint64_t key = heap_min_key(w->overflow);
+      void *user = heap_extract_min(w->overflow);
+      wheel_rebase(w, key);
+      return user;
+   }
+   else if (heap_size(w->overflow) > 0
+            && heap_min_key(w->overflow) < s->head->key)
+      return heap_extract_min(w->overflow);
+
+   wheel_entry_t *e = s->head;
+   if ((s->head = e->next) == NULL) {
+      const int slot = s - w->levels[0].slots;
+      s->tail = NULL;
+      w->levels[0].bitmap[slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+   }
+
+   w->base = e->key;
+   w->count--;
+
+   void *user = e->user;
+   wheel_free_entry(w, e);
+   return user;
+}
+
+uint64_t wheel_min_key(wheel_t *w)
+{
+   RT_LOCK(w->lock);
+
+   wheel_slot_t *s = wheel_advance(w);
+   if (heap_size(w->overflow) == 0) {
+      assert(s != NULL);
+      return s->head->key;
+   }
+
+   const uint64_t key = heap_min_key(w->overflow);
+   if (s == NULL || key < s->head->key)
+      return key;
+   else
+      return s->head->key;
+}
+
+void wheel_insert(wheel_t *w, uint64_t key, void *user)
+{
+   RT_LOCK(w->lock);
+
+   if (wheel_in_range(w, key)) {
+      wheel_entry_t *e = wheel_alloc_entry(w);
+      e->key  = key;
+      e->user = user;
+
+      wheel_place(w, e);
+      w->count++;
+   }
+   else
+      heap_insert(w->overflow, key, user);
+}
+
+bool wheel_delete(wheel_t *w, heap_delete_fn_t fn, void *context)
+{
+   RT_LOCK(w->lock);
+
+   for (int level = 0; level < WHEEL_LEVELS; level++) {
+      wheel_level_t *l = &(w->levels[level]);
+      for (int i = 0; i < WHEEL_WORDS; i++) {
+         for (uint64_t bits = l->bitmap[i]; bits != 0; bits &= bits - 1) {
+            const int slot = i * 64 + __builtin_ctzll(bits);
+            wheel_slot_t *s = &(l->slots[slot]);
+
+            for (wheel_entry_t **p = &(s->head), *prev = NULL;
+                 *p != NULL; prev = *p, p = &((*p)->next)) {
+               wheel_entry_t *e = *p;
+               if (!(*fn)(e->key, e->user, context))
+                  continue;
+
+               if ((*p = e->next) == NULL)
+                  s->tail = prev;
+
+               if (s->head == NULL)
+                  l->bitmap[i] &= ~(UINT64_C(1) << (slot % 64));
+
+               w->count--;
+               wheel_free_entry(w, e);
+               return true;
+            }
+         }
+      }
+   }
+
+   return heap_delete(w->overflow, fn, context);
+}
+
+size_t wheel_size(wheel_t *w)
+{
+   return atomic_load(&w->count) + heap_size(w->overflow);
+}
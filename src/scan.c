@@ -282,6 +282,17 @@ const char *pp_defines_get(const char *name)
    return shash_get(pp_defines, name);
 }
 
+void pp_defines_iter(pp_define_fn_t fn, void *ctx)
+{
+   pp_defines_init();
+
+   const char *name;
+   void *value;
+   for (hash_iter_t it = HASH_BEGIN;
+        shash_iter(pp_defines, &it, &name, &value); )
+      (*fn)(name, value, ctx);
+}
+
 static int pp_yylex(void)
 {
    const int tok = lookahead != -1 ? lookahead : yylex();
@@ -50,6 +50,9 @@ void free_token(token_t tok, yylval_t *lval);
 void pp_defines_add(const char *name, const char *value);
 const char *pp_defines_get(const char *name);
 
+typedef void (*pp_define_fn_t)(const char *, const char *, void *);
+void pp_defines_iter(pp_define_fn_t fn, void *ctx);
+
 void scan_as_psl(void);
 void scan_as_vhdl(void);
 void scan_as_verilog(void);
@@ -210,6 +210,7 @@ typedef enum {
    MAIN_THREAD,
    USER_THREAD,
    WORKER_THREAD,
+   HELPER_THREAD,
 } thread_kind_t;
 
 struct _nvc_thread {
@@ -222,6 +223,7 @@ struct _nvc_thread {
    void           *arg;
    int             victim;
    uint32_t        rngstate;
+   unsigned        taskdepth;
 #ifdef __MINGW32__
    HANDLE          handle;
    void           *retval;
@@ -266,13 +268,22 @@ static int              async_pending __attribute__((aligned(64))) = 0;
 static nvc_lock_t       stop_lock = 0;
 static stop_world_fn_t  stop_callback = NULL;
 static void            *stop_arg = NULL;
+static int              num_helpers = 0;
+static world_fn_t       world_fn = NULL;
+static void            *world_arg = NULL;
+static unsigned         world_epoch = 0;
+static int              world_pending = 0;
 
 #ifdef __MINGW32__
 static CONDITION_VARIABLE wake_workers = CONDITION_VARIABLE_INIT;
 static CRITICAL_SECTION   wakelock;
+static CONDITION_VARIABLE wake_helpers = CONDITION_VARIABLE_INIT;
+static CRITICAL_SECTION   helperlock;
 #else
 static pthread_cond_t     wake_workers = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t    wakelock = PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP;
+static pthread_cond_t     wake_helpers = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t    helperlock = PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP;
 #endif
 
 #ifdef POSIX_SUSPEND
@@ -388,11 +399,16 @@ static void join_worker_threads(void)
    }
    platform_mutex_unlock(&wakelock);
 
+   platform_mutex_lock(&helperlock);
+   platform_cond_broadcast(&wake_helpers);
+   platform_mutex_unlock(&helperlock);
+
    for (int i = 0; i < join_list.count; i++) {
       nvc_thread_t *t = join_list.items[i];
 
       switch (relaxed_load(&t->kind)) {
       case WORKER_THREAD:
+      case HELPER_THREAD:
          thread_join(t);
          continue;  // Freed thread struct
       case USER_THREAD:
@@ -441,7 +457,9 @@ static nvc_thread_t *thread_new(thread_fn_t fn, void *arg,
          break;
    }
 
-   atomic_add(&running_threads, 1);
+   if (kind != HELPER_THREAD)
+      atomic_add(&running_threads, 1);
+
    return thread;
 }
 
@@ -488,6 +506,8 @@ void thread_init(void)
 #ifdef __MINGW32__
    InitializeCriticalSectionAndSpinCount(&wakelock, LOCK_SPINS);
    InitializeConditionVariable(&wake_workers);
+   InitializeCriticalSectionAndSpinCount(&helperlock, LOCK_SPINS);
+   InitializeConditionVariable(&wake_helpers);
 
    for (int i = 0; i < PARKING_BAYS; i++) {
       parking_bay_t *bay = &(parking_bays[i]);
@@ -546,6 +566,16 @@ bool thread_attached(void)
    return my_thread != NULL;
 }
 
+bool thread_is_main(void)
+{
+   return my_thread != NULL && my_thread->kind == MAIN_THREAD;
+}
+
+bool thread_in_task(void)
+{
+   return my_thread != NULL && my_thread->taskdepth > 0;
+}
+
 void thread_sleep(int usec)
 {
    usleep(usec);
@@ -564,7 +594,9 @@ static void *thread_wrapper(void *arg)
    assert(threads[my_thread->id] == my_thread);
    atomic_store(&(threads[my_thread->id]),  NULL);
 
-   atomic_add(&running_threads, -1);
+   if (my_thread->kind != HELPER_THREAD)
+      atomic_add(&running_threads, -1);
+
    return result;
 }
 
@@ -887,7 +919,9 @@ static size_t globalq_take(globalq_t *gq, threadq_t *tq)
 
 static void execute_task(task_t *task)
 {
+   my_thread->taskdepth++;
    (*task->fn)(task->context, task->arg);
+   my_thread->taskdepth--;
 
    if (task->workq != NULL) {
       entryq_t *eq = &(task->workq->entryqs[my_thread->id]);
@@ -1055,7 +1089,7 @@ static bool steal_task(void)
    return false;
 }
 
-static void progressive_backoff(void)
+void progressive_backoff(void)
 {
    if (my_thread->spins++ < YIELD_SPINS)
       spin_wait();
@@ -1245,6 +1279,89 @@ void async_free(void *ptr)
    }
 }
 
+static inline bool should_suspend(nvc_thread_t *thread)
+{
+   // Helper threads keep running while the world is stopped
+   return thread != NULL && thread != my_thread
+      && thread->kind != HELPER_THREAD;
+}
+
+static void *helper_thread(void *arg)
+{
+   const int index = (intptr_t)arg;
+   unsigned epoch = 0;
+
+   for (;;) {
+      platform_mutex_lock(&helperlock);
+      {
+         while (!relaxed_load(&should_stop)
+                && load_acquire(&world_epoch) == epoch)
+            platform_cond_wait(&wake_helpers, &helperlock);
+      }
+      platform_mutex_unlock(&helperlock);
+
+      if (relaxed_load(&should_stop))
+         break;
+
+      epoch = load_acquire(&world_epoch);
+
+      (*world_fn)(index, num_helpers + 1, world_arg);
+
+      atomic_add(&world_pending, -1);
+   }
+
+   return NULL;
+}
+
+static void create_helpers(void)
+{
+   assert_lock_held(&stop_lock);
+
+   while (num_helpers < max_workers - 1 && !relaxed_load(&should_stop)) {
+      const int index = num_helpers + 1;
+      char *name = xasprintf("helper thread %d", index);
+      nvc_thread_t *thread = thread_new(helper_thread, (void *)(intptr_t)index,
+                                        HELPER_THREAD, name);
+
+#ifdef __MINGW32__
+      if ((thread->handle = CreateThread(NULL, 0, win32_thread_wrapper,
+                                         thread, 0, NULL)) == NULL)
+         fatal_errno("CreateThread");
+#else
+      PTHREAD_CHECK(pthread_create, &(thread->handle), NULL,
+                    thread_wrapper, thread);
+#endif
+
+      num_helpers++;
+   }
+}
+
+void world_parallel_do(world_fn_t fn, void *arg)
+{
+   assert_lock_held(&stop_lock);
+
+   if (num_helpers == 0) {
+      (*fn)(0, 1, arg);
+      return;
+   }
+
+   world_fn = fn;
+   world_arg = arg;
+   atomic_store(&world_pending, num_helpers);
+
+   platform_mutex_lock(&helperlock);
+   {
+      store_release(&world_epoch, world_epoch + 1);
+      platform_cond_broadcast(&wake_helpers);
+   }
+   platform_mutex_unlock(&helperlock);
+
+   (*fn)(0, num_helpers + 1, arg);
+
+   while (atomic_load(&world_pending) > 0)
+      progressive_backoff();
+}
+
 #ifdef POSIX_SUSPEND
 static void suspend_handler(int sig, siginfo_t *info, void *context)
 {
@@ -1284,6 +1401,8 @@ void stop_world(stop_world_fn_t callback, void *arg)
 {
    nvc_lock(&stop_lock);
 
+   create_helpers();
+
    atomic_store(&stop_callback, callback);
    atomic_store(&stop_arg, arg);
 
@@ -1291,7 +1410,7 @@ void stop_world(stop_world_fn_t callback, void *arg)
    const int maxthread = relaxed_load(&max_thread_id);
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       if (SuspendThread(thread->handle) != 0)
@@ -1311,7 +1430,7 @@ void stop_world(stop_world_fn_t callback, void *arg)
    const int maxthread = relaxed_load(&max_thread_id);
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       assert(thread->port != MACH_PORT_NULL);
@@ -1359,7 +1478,7 @@ void stop_world(stop_world_fn_t callback, void *arg)
    const int maxthread = relaxed_load(&max_thread_id);
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       PTHREAD_CHECK(pthread_kill, thread->handle, SIGSUSPEND);
@@ -1395,7 +1514,7 @@ void start_world(void)
 #ifdef __MINGW32__
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       if (ResumeThread(thread->handle) != 1)
@@ -1404,7 +1523,7 @@ void start_world(void)
 #elif defined __APPLE__
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       kern_return_t kern_result;
@@ -1421,7 +1540,7 @@ void start_world(void)
    int signalled = 0;
    for (int i = 0; i <= maxthread; i++) {
       nvc_thread_t *thread = atomic_load(&threads[i]);
-      if (thread == NULL || thread == my_thread)
+      if (!should_suspend(thread))
          continue;
 
       PTHREAD_CHECK(pthread_kill, thread->handle, SIGRESUME);
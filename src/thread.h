@@ -58,6 +58,8 @@ typedef struct _nvc_thread nvc_thread_t;
 void thread_init(void);
 int thread_id(void);
 bool thread_attached(void);
+bool thread_is_main(void);
+bool thread_in_task(void);
 void thread_sleep(int usec);
 
 typedef void *(*thread_fn_t)(void *);
@@ -69,6 +71,7 @@ void *thread_join(nvc_thread_t *thread);
 nvc_thread_t *get_thread(int id);
 
 void spin_wait(void);
+void progressive_backoff(void);
 
 typedef int8_t nvc_lock_t;
 
@@ -108,8 +111,11 @@ void async_free(void *ptr);
 struct cpu_state;
 typedef void (*stop_world_fn_t)(int, struct cpu_state *, void *);
 
+typedef void (*world_fn_t)(int, int, void *);
+
 void stop_world(stop_world_fn_t callback, void *arg);
 void start_world(void);
+void world_parallel_do(world_fn_t fn, void *arg);
 
 typedef enum { WX_WRITE, WX_EXECUTE } wx_mode_t;
 void thread_wx_mode(wx_mode_t mode);
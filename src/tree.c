@@ -534,6 +534,7 @@ tree_t tree_new(tree_kind_t kind)
 const loc_t *tree_loc(tree_t t)
 {
    assert(t != NULL);
+   object_materialise(&t->object);
    return &t->object.loc;
 }
 
@@ -1950,6 +1950,36 @@ void *map_file(int fd, size_t size)
    return ptr;
 }
 
+void *map_file_aligned(int fd, size_t size, size_t align)
+{
+   // Private writable mapping of the file starting on an ALIGN byte
+   // boundary where no other mapping shares the same ALIGN sized block.
+   // The tail of the last block past the end of the file stays
+   // anonymous memory and the whole block can be released with
+   // nvc_munmap(ptr, ALIGN_UP(size, align)) but not with unmap_file.
+   void *ptr = nvc_memalign(align, ALIGN_UP(size, align));
+
+#if defined __MINGW32__ || __SANITIZE_ADDRESS__
+   if (lseek(fd, 0, SEEK_SET) != 0)
+      fatal_errno("lseek");
+
+   for (size_t pos = 0; pos < size; ) {
+      const ssize_t nread = read(fd, ptr + pos, size - pos);
+      if (nread < 0)
+         fatal_errno("read");
+      else if (nread == 0)
+         fatal("unexpected end of file after %zu bytes", pos);
+      pos += nread;
+   }
+#else
+   if (mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            fd, 0) == MAP_FAILED)
+      fatal_errno("mmap failed to map %zu byte file", size);
+#endif
+
+   return ptr;
+}
+
 void unmap_file(void *ptr, size_t size)
 {
 #ifdef __MINGW32__
@@ -1999,6 +2029,26 @@ uint64_t get_timestamp_us(void)
    return get_timestamp_ns() / 1000;
 }
 
+uint64_t get_thread_cpu_ns(void)
+{
+#if defined __MINGW32__
+   FILETIME created, exited, kernel, user;
+   if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+      fatal_errno("GetThreadTimes");
+
+   // Times are in units of 100 nanoseconds
+   const uint64_t ticks =
+      (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+      + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+   return ticks * 100;
+#else
+   struct timespec ts;
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+      fatal_errno("clock_gettime");
+   return ts.tv_nsec + (ts.tv_sec * UINT64_C(1000000000));
+#endif
+}
+
 timestamp_t get_real_time(void)
 {
 #if defined __MINGW32__
@@ -330,6 +330,7 @@ typedef uint64_t timestamp_t;   // Nanoseconds
 
 uint64_t get_timestamp_ns(void);
 uint64_t get_timestamp_us(void);
+uint64_t get_thread_cpu_ns(void);
 timestamp_t get_real_time(void);
 unsigned nvc_nprocs(void);
 
@@ -365,6 +366,7 @@ void file_write_lock(int fd);
 void file_unlock(int fd);
 
 void *map_file(int fd, size_t size);
+void *map_file_aligned(int fd, size_t size, size_t align);
 void unmap_file(void *ptr, size_t size);
 void make_dir(const char *path);
 char *search_path(const char *name);
@@ -200,6 +200,7 @@ void vlog_set_ident2(vlog_node_t v, ident_t i)
 const loc_t *vlog_loc(vlog_node_t v)
 {
    assert(v != NULL);
+   object_materialise(&(v->object));
    return &(v->object.loc);
 }
 
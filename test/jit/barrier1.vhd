@@ -0,0 +1,27 @@
+package barrier1 is
+
+    type node;
+
+    type node_ptr is access node;
+
+    type node is record
+        value : integer;
+        next  : node_ptr;
+    end record;
+
+    procedure push (variable list : inout node_ptr; value : integer);
+
+end package;
+
+package body barrier1 is
+
+    procedure push (variable list : inout node_ptr; value : integer) is
+        variable n : node_ptr;
+    begin
+        n := new node;
+        n.value := value;
+        n.next := list;
+        list := n;
+    end procedure;
+
+end package body;
@@ -53,10 +53,8 @@ static void print_result(double ops_sec, double usec_op)
       printf("%.1f ops/s; %.1f us/op\n", ops_sec, usec_op);
 }
 
-static void run_benchmark(tree_t pack, tree_t proc, unit_registry_t *ur)
+static double run_benchmark(tree_t pack, tree_t proc, unit_registry_t *ur)
 {
-   color_printf("$!magenta$## %s$$\n\n", istr(tree_ident(proc)));
-
    ident_t name = tree_ident2(proc);
 
    jit_t *j = jit_new(ur);
@@ -111,15 +109,35 @@ static void run_benchmark(tree_t pack, tree_t proc, unit_registry_t *ur)
 
    tlab_release(&tlab);
 
+   const double usec_mean = mean(usec_op + 1, ITERATIONS);
+
    color_printf("\n$!green$--> ");
-   print_result(mean(ops_sec + 1, ITERATIONS), mean(usec_op + 1, ITERATIONS));
+   print_result(mean(ops_sec + 1, ITERATIONS), usec_mean);
    color_printf("$$\n");
 
    jit_free(j);
+   return usec_mean;
+}
+
+static void compare_interp(tree_t pack, tree_t proc, unit_registry_t *ur)
+{
+   // Run the benchmark with the plain switch dispatch loop and then
+   // with threaded dispatch over pre-decoded instructions
+
+   opt_set_int(OPT_JIT_DECODE, 0);
+   printf("Switch dispatch:\n\n");
+   const double usec_switch = run_benchmark(pack, proc, ur);
+
+   opt_set_int(OPT_JIT_DECODE, 1);
+   printf("Threaded dispatch:\n\n");
+   const double usec_threaded = run_benchmark(pack, proc, ur);
+
+   color_printf("$!green$--> %.2fx speedup$$\n\n",
+                usec_switch / usec_threaded);
 }
 
 static void find_benchmarks(tree_t pack, const char *filter,
-                            unit_registry_t *ur)
+                            unit_registry_t *ur, bool compare)
 {
    ident_t test_i = ident_new("TEST_");
 
@@ -131,8 +149,14 @@ static void find_benchmarks(tree_t pack, const char *filter,
 
       ident_t id = tree_ident(d);
       if (ident_starts_with(id, test_i)
-          && (filter == NULL || strcasestr(istr(id), filter) != NULL))
-         run_benchmark(pack, d, ur);
+          && (filter == NULL || strcasestr(istr(id), filter) != NULL)) {
+         color_printf("$!magenta$## %s$$\n\n", istr(id));
+
+         if (compare)
+            compare_interp(pack, d, ur);
+         else
+            run_benchmark(pack, d, ur);
+      }
    }
 }
 
@@ -171,6 +195,7 @@ static void usage(void)
 {
    printf("Usage: jitperf [OPTION]... [FILE]...\n"
           "\n"
+          " -c\t\t\tCompare interpreter dispatch loops\n"
           " -f PATTERN\t\t Only run tests matching PATTERN\n"
           " -L PATH\t\tAdd PATH to library search paths\n"
           "\n");
@@ -206,8 +231,9 @@ int main(int argc, char **argv)
    opterr = 0;
 
    const char *filter = NULL;
+   bool compare = false;
    int c, index = 0;
-   const char *spec = "L:hf:i";
+   const char *spec = "L:hf:ic";
    while ((c = getopt_long(argc, argv, spec, long_options, &index)) != -1) {
       switch (c) {
       case 0:
@@ -228,6 +254,10 @@ int main(int argc, char **argv)
       case 'i':
          opt_set_int(OPT_JIT_THRESHOLD, 0);
          break;
+      case 'c':
+         opt_set_int(OPT_JIT_THRESHOLD, 0);
+         compare = true;
+         break;
       default:
          if (optopt == 0)
             fatal("unrecognised option $bold$%s$$", argv[optind - 1]);
@@ -270,7 +300,7 @@ int main(int argc, char **argv)
       if (pack == NULL)
          fatal("no package found in %s", argv[i]);
 
-      find_benchmarks(pack, filter, ur);
+      find_benchmarks(pack, filter, ur, compare);
    }
 
    jit_free(jit);
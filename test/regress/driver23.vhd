@@ -0,0 +1,60 @@
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+entity driver23 is
+end entity;
+
+architecture test of driver23 is
+    constant N : positive := 16;
+
+    signal bus_s : std_logic_vector(7 downto 0);
+    signal sel   : natural range 0 to N := N;
+begin
+
+    g: for i in 0 to N - 1 generate
+        even: if i mod 2 = 0 generate
+            p: process (sel) is
+            begin
+                if sel = i then
+                    bus_s <= std_logic_vector(to_unsigned(i, 8));
+                else
+                    bus_s <= (others => 'Z');
+                end if;
+            end process;
+        end generate;
+
+        odd: if i mod 2 = 1 generate
+            -- Splits the nexus after the even processes created drivers
+            p: process (sel) is
+                constant value : std_logic_vector(7 downto 0) :=
+                    std_logic_vector(to_unsigned(i, 8));
+            begin
+                if sel = i then
+                    bus_s(7 downto 4) <= value(7 downto 4);
+                    bus_s(3 downto 0) <= value(3 downto 0);
+                else
+                    bus_s(7 downto 4) <= (others => 'Z');
+                    bus_s(3 downto 0) <= (others => 'Z');
+                end if;
+            end process;
+        end generate;
+    end generate;
+
+    check: process is
+    begin
+        wait for 1 ns;
+        assert bus_s = "ZZZZZZZZ";
+        for i in 0 to N - 1 loop
+            sel <= i;
+            wait for 1 ns;
+            assert bus_s = std_logic_vector(to_unsigned(i, 8))
+                report "bus_s = " & to_string(bus_s) & " for " & to_string(i);
+        end loop;
+        sel <= N;
+        wait for 1 ns;
+        assert bus_s = "ZZZZZZZZ";
+        wait;
+    end process;
+
+end architecture;
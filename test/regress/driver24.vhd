@@ -0,0 +1,109 @@
+library ieee;
+use ieee.std_logic_1164.all;
+
+package driver24_pack is
+    type tri is ('0', '1', 'X');
+    type tri_vector is array (natural range <>) of tri;
+
+    -- Majority vote cannot be computed pairwise
+    function majority (s : tri_vector) return tri;
+
+    subtype rtri is majority tri;
+    type rtri_vector is array (natural range <>) of rtri;
+end package;
+
+package body driver24_pack is
+    function majority (s : tri_vector) return tri is
+        variable ones, zeros : natural := 0;
+    begin
+        for i in s'range loop
+            if s(i) = '1' then
+                ones := ones + 1;
+            elsif s(i) = '0' then
+                zeros := zeros + 1;
+            end if;
+        end loop;
+        if ones > zeros then
+            return '1';
+        elsif zeros > ones then
+            return '0';
+        else
+            return 'X';
+        end if;
+    end function;
+end package body;
+
+-------------------------------------------------------------------------------
+
+library ieee;
+use ieee.std_logic_1164.all;
+
+use work.driver24_pack.all;
+
+entity driver24 is
+end entity;
+
+architecture test of driver24 is
+    constant W : positive := 81;
+
+    type slv_array is array (1 to 4) of std_logic_vector(1 to W);
+
+    constant values : std_logic_vector(1 to 9) := "UX01ZWLH-";
+
+    function pattern (n : natural) return std_logic_vector is
+        variable result : std_logic_vector(1 to W);
+    begin
+        for i in 1 to W loop
+            case n is
+                when 1 => result(i) := values(1 + (i - 1) mod 9);
+                when 2 => result(i) := values(1 + ((i - 1) / 9) mod 9);
+                when 3 => result(i) := values(1 + (i * 7) mod 9);
+                when others => result(i) := 'Z';
+            end case;
+        end loop;
+        return result;
+    end function;
+
+    signal bus_s  : std_logic_vector(1 to W);
+    signal drive  : slv_array := (others => (others => 'Z'));
+    signal vote   : rtri_vector(1 to 3);
+    signal inputs : tri_vector(1 to 3) := "000";
+begin
+
+    g: for i in 1 to 4 generate
+        bus_s <= drive(i);
+        vote <= (others => inputs(i)) when i < 4 else "XXX";
+    end generate;
+
+    check: process is
+        variable expect : std_logic_vector(1 to W);
+    begin
+        wait for 1 ns;
+        assert bus_s = (1 to W => 'Z');
+
+        for n in 1 to 4 loop
+            drive(n) <= pattern(n);
+            wait for 1 ns;
+
+            for i in 1 to W loop
+                expect(i) := resolved(
+                    (drive(1)(i), drive(2)(i), drive(3)(i), drive(4)(i)));
+                assert bus_s(i) = expect(i)
+                    report "bus_s(" & integer'image(i) & ") = "
+                    & std_logic'image(bus_s(i)) & " expected "
+                    & std_logic'image(expect(i));
+            end loop;
+        end loop;
+
+        assert vote = "000";
+        inputs <= "110";
+        wait for 1 ns;
+        assert vote = "111";
+        inputs <= "10X";
+        wait for 1 ns;
+        assert vote = "XXX";
+
+        wait;
+    end process;
+
+end architecture;
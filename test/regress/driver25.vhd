@@ -0,0 +1,88 @@
+package driver25_pack is
+    type tri is ('0', '1', 'X');
+    type tri_vector is array (natural range <>) of tri;
+
+    -- Wired-or for up to three drivers but not for more
+    function wor3 (s : tri_vector) return tri;
+
+    -- Wired-or that reports an error for an input never driven
+    function wor_check (s : tri_vector) return tri;
+
+    subtype rtri3 is wor3 tri;
+    subtype rtri_check is wor_check tri;
+end package;
+
+package body driver25_pack is
+    function wired_or (s : tri_vector) return tri is
+        variable result : tri := '0';
+    begin
+        for i in s'range loop
+            if s(i) = 'X' then
+                return 'X';
+            elsif s(i) = '1' then
+                result := '1';
+            end if;
+        end loop;
+        return result;
+    end function;
+
+    function wor3 (s : tri_vector) return tri is
+    begin
+        if s'length > 3 then
+            return 'X';
+        else
+            return wired_or(s);
+        end if;
+    end function;
+
+    function wor_check (s : tri_vector) return tri is
+    begin
+        assert s /= (s'range => 'X')
+            report "all drivers are X" severity error;
+        return wired_or(s);
+    end function;
+end package body;
+
+-------------------------------------------------------------------------------
+
+use work.driver25_pack.all;
+
+entity driver25 is
+end entity;
+
+architecture test of driver25 is
+    signal s3, s4 : rtri3;
+    signal c      : rtri_check;
+    signal inputs : tri_vector(1 to 4) := "0000";
+begin
+
+    g: for i in 1 to 4 generate
+        s4 <= inputs(i);
+        c <= inputs(i);
+        g3: if i < 4 generate
+            s3 <= inputs(i);
+        end generate;
+    end generate;
+
+    check: process is
+    begin
+        wait for 1 ns;
+        assert s3 = '0';
+        assert s4 = 'X';                -- Not a fold for four drivers
+        assert c = '0';
+
+        inputs <= "0100";
+        wait for 1 ns;
+        assert s3 = '1';
+        assert s4 = 'X';
+        assert c = '1';
+
+        inputs <= "00X0";
+        wait for 1 ns;
+        assert s3 = 'X';
+        assert c = 'X';
+
+        wait;
+    end process;
+
+end architecture;
@@ -0,0 +1,45 @@
+set -xe
+
+pwd
+which nvc
+
+# Many independent files so several worker processes save units to the
+# work library concurrently
+files=""
+sum=""
+for i in $(seq 1 16); do
+  cat > pack$i.vhd <<EOT
+package pack$i is
+  constant c : integer := $i;
+end package;
+EOT
+  files="$files pack$i.vhd"
+  sum="$sum + work.pack$i.c"
+done
+
+cat > jobs1.vhd <<EOT
+entity jobs1 is
+end entity;
+
+architecture test of jobs1 is
+begin
+  process is
+  begin
+    assert 0 $sum = 136;
+    wait;
+  end process;
+end architecture;
+EOT
+
+nvc -a --jobs=4 $files jobs1.vhd
+
+nvc --list > list
+cat list
+
+for i in $(seq 1 16); do
+  grep -q "^WORK.PACK$i  *: Package" list
+done
+
+grep -q "^WORK.JOBS1-TEST  *: Architecture" list
+
+nvc -e jobs1 -r
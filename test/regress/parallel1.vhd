@@ -0,0 +1,70 @@
+entity parallel1 is
+end entity;
+
+architecture test of parallel1 is
+    constant N : natural := 64;
+
+    type int_vector is array (natural range <>) of integer;
+
+    type t_order is protected
+        impure function get return natural;
+    end protected;
+
+    type t_order is protected body
+        variable count : natural;
+
+        impure function get return natural is
+        begin
+            count := count + 1;
+            return count - 1;
+        end function;
+    end protected body;
+
+    shared variable global : t_order;
+
+    signal s     : int_vector(0 to N - 1) := (others => 0);
+    signal clk   : bit := '0';
+    signal order : int_vector(0 to 3);
+begin
+
+    clk <= not clk after 5 ns when now < 200 ns;
+
+    g1: for i in 0 to N - 1 generate
+        p: process (clk) is
+        begin
+            if clk'event and clk = '1' then
+                s(i) <= s((i + 1) mod N) + i;
+            end if;
+        end process;
+    end generate;
+
+    g2: for i in 0 to 3 generate
+        p: process is
+        begin
+            wait until clk = '1';
+            order(i) <= global.get;     -- Must execute in process order
+            wait;
+        end process;
+    end generate;
+
+    check: process is
+        variable model, tmp : int_vector(0 to N - 1) := (others => 0);
+    begin
+        for cycle in 1 to 20 loop
+            wait until clk = '1';
+            for i in 0 to N - 1 loop
+                tmp(i) := model((i + 1) mod N) + i;
+            end loop;
+            model := tmp;
+            wait for 1 ns;
+            assert s = model;
+            if cycle = 1 then
+                for i in 0 to 3 loop
+                    assert order(i) = i;
+                end loop;
+            end if;
+        end loop;
+        wait;
+    end process;
+
+end architecture;
@@ -0,0 +1,59 @@
+package parallel2_pack is
+    type int_vector is array (natural range <>) of integer;
+
+    function sum (x : int_vector) return integer;
+
+    subtype rint is sum integer;
+    type rint_vector is array (natural range <>) of rint;
+end package;
+
+package body parallel2_pack is
+    function sum (x : int_vector) return integer is
+        variable result : integer := 0;
+    begin
+        for i in x'range loop
+            result := result + x(i);
+        end loop;
+        if result >= 1000 and (result mod 1000) mod 37 = 0 then
+            report "resolved " & integer'image(result);
+        end if;
+        return result;
+    end function;
+end package body;
+
+-------------------------------------------------------------------------------
+
+use work.parallel2_pack.all;
+
+entity parallel2 is
+end entity;
+
+architecture test of parallel2 is
+    constant N : natural := 256;
+
+    signal s  : rint_vector(0 to N - 1);
+    signal go : boolean := false;
+begin
+
+    g: for i in 0 to N - 1 generate
+        s(i) <= i;
+        s(i) <= 1000 when go else 0;
+    end generate;
+
+    check: process is
+    begin
+        wait for 1 ns;
+        for i in 0 to N - 1 loop
+            assert s(i) = i;
+        end loop;
+
+        go <= true;
+        wait for 1 ns;
+        for i in 0 to N - 1 loop
+            assert s(i) = 1000 + i;
+        end loop;
+
+        wait;
+    end process;
+
+end architecture;
@@ -0,0 +1,53 @@
+set -xe
+
+nvc -a - <<EOF
+entity profile1 is
+end entity;
+
+architecture test of profile1 is
+  signal clk   : bit := '0';
+  signal count : natural := 0;
+begin
+  clkgen: clk <= not clk after 5 ns when now < 100 ns;
+
+  counter: process (clk) is
+  begin
+    if clk'event and clk = '1' then
+      count <= count + 1;
+    end if;
+  end process;
+
+  check: process is
+  begin
+    wait for 200 ns;
+    assert count = 10;
+    wait;
+  end process;
+end architecture;
+EOF
+
+nvc -e profile1 -r --profile=profile1.json > out
+
+cat out
+
+# The report has a summary line followed by process and signal tables
+grep -q "^Simulation profile ([0-9]* cycles, [0-9]* delta cycles," out
+grep -q "Time (ms) .* Wakeups .* Deltas .* Transactions  Process" out
+grep -q "Events .* Wakeups .* Deltas .* Transactions  Signal" out
+grep -qi "counter$" out
+grep -qi "count$" out
+
+cat profile1.json
+
+grep -q '^{$' profile1.json
+grep -q '^  "cycles": [0-9][0-9]*,$' profile1.json
+grep -q '^  "deltas": [0-9][0-9]*,$' profile1.json
+grep -q '^  "time_ns": [0-9][0-9]*,$' profile1.json
+grep -q '^  "processes": \[$' profile1.json
+grep -q '^  "signals": \[$' profile1.json
+grep -q '^}$' profile1.json
+
+grep -qi '"name": "[^"]*counter", "time_ns": [0-9]*, "wakeups": [0-9]*,' \
+     profile1.json
+grep -qi '"name": "[^"]*count", "events": 10, "wakeups": [0-9]*,' \
+     profile1.json
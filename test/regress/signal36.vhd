@@ -0,0 +1,47 @@
+entity signal36 is
+end entity;
+
+architecture test of signal36 is
+    constant N : positive := 4096;
+
+    type int_vector is array (natural range <>) of integer;
+
+    signal mem : int_vector(0 to N - 1) := (others => -1);
+begin
+
+    update: process is
+        variable idx : natural;
+    begin
+        -- Write single elements in a scattered order so the signal is
+        -- split into many irregular nexuses
+        for i in 0 to N / 2 - 1 loop
+            idx := (i * 37) mod N;
+            mem(idx) <= idx;
+            wait for 0 ns;
+        end loop;
+
+        mem(100 to 163) <= (others => 5);
+        wait for 1 ns;
+
+        for i in 0 to N / 2 - 1 loop
+            idx := (i * 37) mod N;
+            if idx < 100 or idx > 163 then
+                assert mem(idx) = idx report integer'image(idx);
+            end if;
+        end loop;
+
+        for i in 100 to 163 loop
+            assert mem(i) = 5;
+        end loop;
+
+        mem <= (others => 0);
+        wait for 1 ns;
+
+        for i in mem'range loop
+            assert mem(i) = 0;
+        end loop;
+
+        wait;
+    end process;
+
+end architecture;
@@ -0,0 +1,39 @@
+library ieee;
+use ieee.std_logic_1164.all;
+
+entity signal37 is
+end entity;
+
+architecture test of signal37 is
+    constant DEPTH : positive := 2**16;
+
+    type ram_t is array (0 to DEPTH - 1) of std_logic_vector(63 downto 0);
+    type int_array is array (0 to DEPTH - 1) of integer;
+
+    signal ram  : ram_t;                -- Large enough to be mapped lazily
+    signal ints : int_array := (others => 42);
+begin
+
+    update: process is
+    begin
+        assert ram(0) = (63 downto 0 => 'U');
+        assert ram(DEPTH - 1) = (63 downto 0 => 'U');
+        assert ints(12345) = 42;
+
+        ram(5) <= (others => '1');
+        ram(DEPTH - 1) <= (others => '0');
+        ints(7) <= 5;
+        wait for 1 ns;
+
+        assert ram(4) = (63 downto 0 => 'U');
+        assert ram(5) = (63 downto 0 => '1');
+        assert ram(6) = (63 downto 0 => 'U');
+        assert ram(DEPTH - 1) = (63 downto 0 => '0');
+        assert ram(5)'last_value = (63 downto 0 => 'U');
+        assert ints(7) = 5;
+        assert ints(8) = 42;
+
+        wait;
+    end process;
+
+end architecture;
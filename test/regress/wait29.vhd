@@ -0,0 +1,63 @@
+entity wait29 is
+end entity;
+
+architecture test of wait29 is
+    constant N : positive := 64;
+
+    type int_vector is array (1 to N) of natural;
+
+    signal clk     : bit := '0';
+    signal other   : bit_vector(1 to 8) := (others => '0');
+    signal running : boolean := true;
+    signal counts  : int_vector := (others => 0);
+begin
+
+    clkgen: clk <= not clk after 5 ns when running;
+
+    g: for i in 1 to N generate
+        p: process is
+            variable n : natural := 0;
+        begin
+            -- Re-arms and clears the clock each time around the loop
+            if i mod 2 = 0 then
+                wait on clk;
+            else
+                wait on clk, other(i mod 8 + 1);
+            end if;
+            n := n + 1;
+            counts(i) <= n;
+        end process;
+    end generate;
+
+    check: process is
+    begin
+        wait for 52 ns;
+        for i in 1 to N loop
+            assert counts(i) = 10
+                report integer'image(i) & " " & integer'image(counts(i));
+        end loop;
+
+        other(4) <= '1';
+        running <= false;
+        wait for 1 ns;
+        for i in 1 to N loop
+            if i mod 8 = 3 then
+                assert counts(i) = 11;
+            else
+                assert counts(i) = 10;
+            end if;
+        end loop;
+
+        wait for 10 ns;
+        for i in 1 to N loop
+            if i mod 8 = 3 then
+                assert counts(i) = 12;
+            else
+                assert counts(i) = 11;
+            end if;
+        end loop;
+
+        wait;
+    end process;
+
+end architecture;
@@ -97,6 +97,7 @@
 #define F_SHUFFLE (1 << 24)
 #define F_NOTBSD  (1 << 25)
 #define F_ARRAYS  (1 << 26)
+#define F_PARALLEL (1 << 27)
 
 typedef struct test test_t;
 typedef struct param param_t;
@@ -410,6 +411,8 @@ static bool parse_test_list(int argc, char **argv)
             test->flags |= F_TCL;
          else if (strcmp(opt, "shuffle") == 0)
             test->flags |= F_SHUFFLE;
+         else if (strcmp(opt, "parallel") == 0)
+            test->flags |= F_PARALLEL;
          else if (strcmp(opt, "no-collapse") == 0)
             test->flags |= F_NOCOLL;
          else if (strcmp(opt, "dump-arrays") == 0)
@@ -938,6 +941,9 @@ static bool run_test(test_t *test)
       if (test->flags & F_SHUFFLE)
          push_arg(&args, "--shuffle");
 
+      if (test->flags & F_PARALLEL)
+         push_arg(&args, "--parallel");
+
       if (test->plusarg != NULL)
          push_arg(&args, "+%s", test->plusarg);
 
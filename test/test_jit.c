@@ -21,6 +21,7 @@
 #include "ident.h"
 #include "jit/jit-ffi.h"
 #include "jit/jit-layout.h"
+#include "jit/jit-llvm.h"
 #include "jit/jit-priv.h"
 #include "jit/jit.h"
 #include "mask.h"
@@ -2053,6 +2054,846 @@ START_TEST(test_mem2reg1)
 }
 END_TEST
 
+START_TEST(test_gvn1)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV    R0, #0      \n"
+      "    RECV    R1, #1      \n"
+      "    ADD     R2, R0, R1  \n"
+      "    CMP.EQ  R0, #0      \n"
+      "    JUMP.T  L1          \n"
+      "    ADD     R3, R1, R0  \n"
+      "    MUL     R4, R0, R1  \n"
+      "    SEND    #0, R3      \n"
+      "    RET                 \n"
+      "L1: MUL     R5, R0, R1  \n"
+      "    ADD     R6, R0, R1  \n"
+      "    ADD     R7, R6, R5  \n"
+      "    SEND    #0, R7      \n"
+      "    RET                 \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_gvn(f);
+
+   check_nullary(f, 5, J_NOP);
+   check_binary(f, 6, J_MUL, REG(0), REG(1));
+   check_binary(f, 7, J_SEND, CONST(0), REG(2));
+   check_binary(f, 9, J_MUL, REG(0), REG(1));   // Not dominated
+   check_nullary(f, 10, J_NOP);
+   check_binary(f, 11, J_ADD, REG(2), REG(5));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 0 }, p1 = { .integer = 5 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 5);
+
+   p0.integer = 3;
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 8);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_licm1)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    RECV     R1, #1        \n"
+      "    MOV      R2, #0        \n"
+      "    MOV      R3, #0        \n"
+      "L1: LOAD.64  R4, [R0+8]    \n"
+      "    ADD      R5, R4, #5    \n"
+      "    ADD      R3, R3, R5    \n"
+      "    ADD      R2, R2, #1    \n"
+      "    CMP.LT   R2, R1        \n"
+      "    JUMP.T   L1            \n"
+      "    SEND     #0, R3        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_licm(f);
+
+   ck_assert_int_eq(f->nirs, 14);
+   check_unary(f, 4, J_LOAD, ADDR(0, 8));
+   check_binary(f, 5, J_ADD, REG(4), CONST(5));
+   check_nullary(f, 6, J_NOP);
+   check_nullary(f, 7, J_NOP);
+   check_binary(f, 8, J_ADD, REG(3), REG(5));
+   check_unary(f, 11, J_JUMP, LABEL(6));
+
+   int64_t mem[2] = { 0, 37 };
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .pointer = mem }, p1 = { .integer = 10 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 420);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_licm2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    RECV     R1, #1        \n"
+      "    MOV      R2, #0        \n"
+      "L1: LOAD.64  R3, [R0]      \n"
+      "    MUL      R4, R1, #3    \n"
+      "    ADD      R5, R3, R4    \n"
+      "    STORE.64 R5, [R0]      \n"
+      "    ADD      R2, R2, #1    \n"
+      "    CMP.LT   R2, R1        \n"
+      "    JUMP.T   L1            \n"
+      "    LOAD.64  R6, [R0]      \n"
+      "    SEND     #0, R6        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_licm(f);
+
+   // Load cannot be moved past the store
+   ck_assert_int_eq(f->nirs, 14);
+   check_binary(f, 3, J_MUL, REG(1), CONST(3));
+   check_unary(f, 4, J_LOAD, ADDR(0, 0));
+   check_nullary(f, 5, J_NOP);
+   check_unary(f, 10, J_JUMP, LABEL(4));
+
+   int64_t mem = 1;
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .pointer = &mem }, p1 = { .integer = 4 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 49);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_licm3)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    RECV     R1, #1        \n"
+      "    MOV      R2, #0        \n"
+      "    MOV      R3, #0        \n"
+      "L1: CMP.GE   R0, #0        \n"
+      "    CCMP.LE  R0, #7        \n"
+      "    JUMP.T   L2            \n"
+      "    SEND     #0, R0        \n"
+      "    $EXIT    #0            \n"
+      "L2: ADD      R3, R3, R0    \n"
+      "    ADD      R2, R2, #1    \n"
+      "    CMP.LT   R2, R1        \n"
+      "    JUMP.T   L1            \n"
+      "    SEND     #0, R3        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_licm(f);
+
+   // Invariant index check is moved before the loop
+   ck_assert_int_eq(f->nirs, 20);
+   check_binary(f, 4, J_CMP, REG(0), CONST(0));
+   check_binary(f, 5, J_CCMP, REG(0), CONST(7));
+   check_unary(f, 6, J_JUMP, LABEL(9));
+   check_nullary(f, 9, J_NOP);
+   check_nullary(f, 13, J_NOP);
+   check_binary(f, 14, J_ADD, REG(3), REG(0));
+   check_unary(f, 17, J_JUMP, LABEL(9));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 3 }, p1 = { .integer = 4 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 12);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_licm4)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    RECV     R1, #1        \n"
+      "    MOV      R2, #0        \n"
+      "    MOV      R3, #0        \n"
+      "L1: ADD      R4, R2, #1    \n"
+      "    CMP.GE   R0, #0        \n"
+      "    CCMP.LE  R0, #7        \n"
+      "    JUMP.T   L2            \n"
+      "    SEND     #0, R0        \n"
+      "    $EXIT    #0            \n"
+      "L2: ADD      R3, R3, R4    \n"
+      "    ADD      R2, R2, #1    \n"
+      "    CMP.LT   R2, R1        \n"
+      "    JUMP.T   L1            \n"
+      "    SEND     #0, R3        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_licm(f);
+
+   // Check is moved but must continue into the rest of the header
+   ck_assert_int_eq(f->nirs, 21);
+   check_binary(f, 4, J_CMP, REG(0), CONST(0));
+   check_unary(f, 6, J_JUMP, LABEL(9));
+   check_binary(f, 9, J_ADD, REG(2), CONST(1));
+   check_nullary(f, 10, J_NOP);
+   check_binary(f, 15, J_ADD, REG(3), REG(4));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 3 }, p1 = { .integer = 4 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p1, &tlab));
+   ck_assert_int_eq(result.integer, 10);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_range2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    MOV      R1, #0        \n"
+      "    MOV      R2, #0        \n"
+      "L1: CMP.LT   R1, #8        \n"
+      "    JUMP.F   L3            \n"
+      "    CMP.GE   R1, #0        \n"
+      "    CCMP.LE  R1, #7        \n"
+      "    JUMP.T   L2            \n"
+      "    SEND     #0, R1        \n"
+      "    $EXIT    #0            \n"
+      "L2: ADD.O.32 R2, R2, R1    \n"
+      "    JUMP.F   L4            \n"
+      "    SEND     #0, R2        \n"
+      "    SEND     #1, R1        \n"
+      "    $EXIT    #1            \n"
+      "L4: ADD.O.32 R1, R1, #1    \n"
+      "    JUMP.F   L5            \n"
+      "    SEND     #0, R1        \n"
+      "    SEND     #1, #1        \n"
+      "    $EXIT    #1            \n"
+      "L5: JUMP     L1            \n"
+      "L3: SEND     #0, R2        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_range(f);
+
+   // Index check and loop counter overflow check are redundant
+   for (int i = 4; i <= 8; i++)
+      check_nullary(f, i, J_NOP);
+   check_binary(f, 9, J_ADD, REG(2), REG(1));
+   ck_assert_int_eq(f->irbuf[9].cc, JIT_CC_O);
+   check_unary(f, 10, J_JUMP, LABEL(14));
+   check_binary(f, 14, J_ADD, REG(1), CONST(1));
+   ck_assert_int_eq(f->irbuf[14].cc, JIT_CC_NONE);
+   for (int i = 15; i <= 18; i++)
+      check_nullary(f, i, J_NOP);
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 0 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 28);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_range3)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    CMP.GE   R0, #0        \n"
+      "    CCMP.LE  R0, #10       \n"
+      "    JUMP.T   L1            \n"
+      "    SEND     #0, R0        \n"
+      "    $EXIT    #0            \n"
+      "L1: CMP.GE   R0, #-5       \n"
+      "    CCMP.LE  R0, #20       \n"
+      "    JUMP.T   L2            \n"
+      "    SEND     #0, R0        \n"
+      "    $EXIT    #0            \n"
+      "L2: CMP.GT   R0, #5        \n"
+      "    CSET     R1            \n"
+      "    SEND     #0, R1        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_range(f);
+
+   // The first check may fail and must be kept
+   check_binary(f, 1, J_CMP, REG(0), CONST(0));
+   check_binary(f, 2, J_CCMP, REG(0), CONST(10));
+   check_unary(f, 3, J_JUMP, LABEL(6));
+   for (int i = 6; i <= 10; i++)
+      check_nullary(f, i, J_NOP);
+   check_binary(f, 11, J_CMP, REG(0), CONST(5));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 7 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 1);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_inline1)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    RECV     R1, #1        \n"
+      "    ADD      R2, R0, R1    \n"
+      "    MUL      R3, R2, #2    \n"
+      "    SEND     #0, R3        \n"
+      "    RET                    \n";
+
+   jit_assemble(j, ident_new("add2"), text1);
+
+   const char *text2 =
+      "    RECV     R0, #0        \n"
+      "    SEND     #0, R0        \n"
+      "    SEND     #1, #5        \n"
+      "    CALL     <add2>        \n"
+      "    RECV     R1, #0        \n"
+      "    ADD      R2, R1, #1    \n"
+      "    SEND     #0, R2        \n"
+      "    RET                    \n";
+
+   jit_handle_t h2 = jit_assemble(j, ident_new("myfunc1"), text2);
+
+   jit_func_t *f = jit_get_func(j, h2);
+   jit_do_inline(f);
+
+   ck_assert_int_eq(f->nirs, 12);
+   check_unary(f, 1, J_MOV, REG(0));
+   check_unary(f, 2, J_MOV, CONST(5));
+   check_unary(f, 3, J_MOV, REG(7));
+   check_binary(f, 5, J_ADD, REG(3), REG(4));
+   check_unary(f, 7, J_MOV, REG(6));
+   check_unary(f, 8, J_MOV, REG(7));
+   check_binary(f, 9, J_ADD, REG(1), CONST(1));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 10 };
+   fail_unless(jit_fastcall(j, h2, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 31);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_inline2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    CMP.LT   R0, #0        \n"
+      "    JUMP.F   L1            \n"
+      "    SEND     #0, #0        \n"
+      "    RET                    \n"
+      "L1: SEND     #0, R0        \n"
+      "    RET                    \n";
+
+   jit_assemble(j, ident_new("clamp0"), text1);
+
+   const char *text2 =
+      "    RECV     R0, #0        \n"
+      "    MOV      R1, #0        \n"
+      "    MOV      R2, #0        \n"
+      "L1: SUB      R3, R1, #5    \n"
+      "    SEND     #0, R3        \n"
+      "    CALL     <clamp0>      \n"
+      "    RECV     R4, #0        \n"
+      "    ADD      R2, R2, R4    \n"
+      "    ADD      R1, R1, #1    \n"
+      "    CMP.LT   R1, R0        \n"
+      "    JUMP.T   L1            \n"
+      "    SEND     #0, R2        \n"
+      "    RET                    \n";
+
+   jit_handle_t h2 = jit_assemble(j, ident_new("myfunc1"), text2);
+
+   jit_func_t *f = jit_get_func(j, h2);
+   jit_do_inline(f);
+
+   for (int i = 0; i < f->nirs; i++)
+      fail_unless(f->irbuf[i].op != J_CALL);
+
+   check_unary(f, 7, J_JUMP, LABEL(10));
+   check_unary(f, 9, J_JUMP, LABEL(11));
+   check_unary(f, 11, J_MOV, REG(6));
+   check_unary(f, 15, J_JUMP, LABEL(3));
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 10 };
+   fail_unless(jit_fastcall(j, h2, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 10);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_inline3)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    ADD      R1, R0, #1    \n"
+      "    SEND     #0, R1        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   const char *text2 =
+      "    RECV     R0, #0        \n"
+      "    SEND     #0, R0        \n"
+      "    CALL     <myfunc1>     \n"
+      "    RECV     R1, #0        \n"
+      "    SEND     #0, R1        \n"
+      "    RET                    \n";
+
+   jit_handle_t h2 = jit_assemble(j, ident_new("myfunc2"), text2);
+
+   const char *text3 =
+      "    RECV     R0, #0        \n"
+      "    SEND     #0, R0        \n"
+      "    CALL     <myfunc2>     \n"
+      "    RECV     R1, #0        \n"
+      "    SEND     #0, R1        \n"
+      "    RET                    \n";
+
+   jit_handle_t h3 = jit_assemble(j, ident_new("myfunc3"), text3);
+
+   // The call in myfunc2 cannot be inlined into myfunc3 as there is
+   // no debug information to reconstruct the stack trace
+   jit_func_t *f = jit_get_func(j, h3);
+   jit_do_inline(f);
+
+   ck_assert_int_eq(f->nirs, 6);
+   check_unary(f, 2, J_CALL, ((jit_value_t){
+            .kind = JIT_VALUE_HANDLE, .handle = h2 }));
+
+   jit_do_inline(jit_get_func(j, h2));
+   jit_do_inline(f);
+
+   for (int i = 0; i < f->nirs; i++)
+      fail_unless(f->irbuf[i].op != J_CALL);
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 5 };
+   fail_unless(jit_fastcall(j, h3, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 6);
+
+   (void)h1;
+   jit_free(j);
+}
+END_TEST
+
+static int trace_count;
+static int trace_lines[4];
+static ident_t trace_names[4];
+
+static void tracer_entry(jit_func_t *f, jit_anchor_t *caller,
+                         jit_scalar_t *args, tlab_t *tlab)
+{
+   // Record the stack trace seen by a callee of the inlined function
+   jit_thread_local()->anchor = caller;
+   jit_stack_trace_t *stack = jit_stack_trace();
+   trace_count = stack->count;
+   for (int i = 0; i < stack->count && i < 4; i++) {
+      trace_lines[i] = stack->frames[i].loc.first_line;
+      trace_names[i] = stack->frames[i].symbol;
+   }
+   free(stack);
+   args[0].integer = 42;
+}
+
+static void patch_debug(jit_func_t *f, int nth, int line)
+{
+   // The assembler has no syntax for debug info
+   jit_ir_t *ir = &(f->irbuf[nth]);
+   ir->op = J_DEBUG;
+   ir->arg1.kind = JIT_VALUE_LOC;
+   ir->arg1.loc = get_loc(line, 1, line, 5, loc_file_ref("x.vhd", NULL));
+   ir->arg2.kind = JIT_VALUE_INVALID;
+}
+
+START_TEST(test_inline4)
+{
+   jit_t *j = jit_new(NULL);
+
+   jit_handle_t h0 = jit_assemble(j, ident_new("tracer"), "    RET \n");
+   jit_get_func(j, h0)->entry = tracer_entry;
+
+   const char *text1 =
+      "    NOP                    \n"
+      "    CALL     <tracer>      \n"
+      "    RECV     R0, #0        \n"
+      "    ADD      R0, R0, #1    \n"
+      "    SEND     #0, R0        \n"
+      "    RET                    \n";
+   jit_handle_t h1 = jit_assemble(j, ident_new("inner"), text1);
+   patch_debug(jit_get_func(j, h1), 0, 20);
+
+   const char *text2 =
+      "    RECV     R0, #0        \n"
+      "    NOP                    \n"
+      "    CALL     <inner>       \n"
+      "    RECV     R1, #0        \n"
+      "    NOP                    \n"
+      "    CALL     <inner>       \n"
+      "    RECV     R2, #0        \n"
+      "    ADD      R1, R1, R2    \n"
+      "    SEND     #0, R1        \n"
+      "    RET                    \n";
+   jit_handle_t h2 = jit_assemble(j, ident_new("outer"), text2);
+   jit_func_t *f = jit_get_func(j, h2);
+   patch_debug(f, 1, 10);
+   patch_debug(f, 4, 11);
+
+   jit_do_inline(f);
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 10 };
+   fail_unless(jit_fastcall(j, h2, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 86);
+   ck_assert_int_eq(trace_count, 2);
+   ck_assert_int_eq(trace_lines[0], 20);
+   ck_assert_int_eq(trace_lines[1], 11);
+   fail_unless(trace_names[0] == ident_new("inner"));
+   fail_unless(trace_names[1] == ident_new("outer"));
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_escape1)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0        \n"
+      "    $GALLOC  R1, #16       \n"
+      "    STORE.64 R0, [R1]      \n"
+      "    LEA      R2, [R1+8]    \n"
+      "    STORE.64 #5, [R2]      \n"
+      "    $GALLOC  R3, #8        \n"
+      "    ADD      R4, R0, #8    \n"
+      "    MOV      R5, #0        \n"
+      "L1: $GALLOC  R6, R4        \n"
+      "    STORE.64 R5, [R6]      \n"
+      "    LOAD.64  R7, [R6]      \n"
+      "    ADD      R5, R7, #1    \n"
+      "    CMP.LT   R5, R0        \n"
+      "    JUMP.T   L1            \n"
+      "    $GALLOC  R8, R0        \n"
+      "    STORE.64 R8, [R3]      \n"
+      "    LOAD.64  R9, [R1]      \n"
+      "    LOAD.64  R10, [R2]     \n"
+      "    ADD      R9, R9, R10   \n"
+      "    ADD      R9, R9, R5    \n"
+      "    SEND     #0, R9        \n"
+      "    SEND     #1, R3        \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   ck_assert_int_eq(jit_do_escape(f), 2);
+
+   check_binary(f, 1, MACRO_SALLOC, CONST(0), CONST(16));
+   check_unary(f, 5, MACRO_GALLOC, CONST(8));    // Returned
+   check_unary(f, 8, MACRO_LALLOC, REG(4));      // Inside loop
+   check_unary(f, 14, MACRO_GALLOC, REG(0));     // Stored to memory
+
+   ck_assert_int_eq(f->framesz, 16);
+
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = 3 };
+   fail_unless(jit_fastcall(j, h1, &result, p0, p0, &tlab));
+   ck_assert_int_eq(result.integer, 11);
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_barrier1)
+{
+   input_from_file(TESTDIR "/jit/barrier1.vhd");
+
+   parse_check_and_simplify(T_PACKAGE, T_PACK_BODY);
+
+   jit_t *j = jit_new(get_registry());
+
+   jit_handle_t h1 =
+      compile_for_test(j, "WORK.BARRIER1.PUSH(22WORK.BARRIER1.NODE_PTRI)");
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_fill_irbuf(f);
+
+   // The new node escapes through the parameter so every pointer store
+   // must be preceded by a write barrier
+   int nbarriers = 0;
+   for (int i = 0; i < f->nirs; i++) {
+      if (f->irbuf[i].op != MACRO_BARRIER)
+         continue;
+
+      ck_assert_int_eq(f->irbuf[i].arg2.kind, JIT_VALUE_INT64);
+      ck_assert_int_eq(f->irbuf[i].arg2.int64, sizeof(void *));
+      nbarriers++;
+   }
+   ck_assert_int_ge(nbarriers, 2);
+
+   jit_free(j);
+   fail_if_errors();
+}
+END_TEST
+
+START_TEST(test_escape2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV      R0, #0       \n"
+      "    $GALLOC   R1, #16      \n"
+      "    $GALLOC   R2, #16      \n"
+      "    $BARRIER  [R1+8], #8   \n"
+      "    STORE.64  R2, [R1+8]   \n"
+      "    $BARRIER  [R2], #8     \n"
+      "    STORE.64  R0, [R2]     \n"
+      "    $BARRIER  [R0], #8     \n"
+      "    STORE.64  R2, [R0]     \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   ck_assert_int_eq(jit_do_escape(f), 1);
+
+   check_binary(f, 1, MACRO_SALLOC, CONST(0), CONST(16));
+   check_unary(f, 2, MACRO_GALLOC, CONST(16));   // Stored to memory
+   check_nullary(f, 3, J_NOP);
+   check_binary(f, 5, MACRO_BARRIER, ADDR(2, 0), CONST(8));
+   check_binary(f, 7, MACRO_BARRIER, ADDR(0, 0), CONST(8));
+
+   jit_free(j);
+}
+END_TEST
+
+START_TEST(test_mem2reg2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV      R0, #0       \n"
+      "    $SALLOC   R1, #0, #8   \n"
+      "    $BARRIER  [R1], #8     \n"
+      "    STORE.64  R0, [R1]     \n"
+      "    LOAD.64   R2, [R1]     \n"
+      "    $BARRIER  [R0], #8     \n"
+      "    STORE.64  R2, [R0]     \n"
+      "    RET                    \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("myfunc1"), text1);
+
+   jit_func_t *f = jit_get_func(j, h1);
+   jit_do_mem2reg(f);
+
+   check_nullary(f, 1, J_NOP);
+   check_nullary(f, 2, J_NOP);
+   check_unary(f, 3, J_MOV, REG(0));
+   check_unary(f, 4, J_MOV, REG(1));
+   check_binary(f, 5, MACRO_BARRIER, ADDR(0, 0), CONST(8));
+
+   ck_assert_int_eq(f->framesz, 0);
+
+   jit_free(j);
+}
+END_TEST
+
+static int64_t fastcall_int(jit_t *j, jit_handle_t handle, int64_t arg)
+{
+   tlab_t tlab = jit_null_tlab(j);
+   jit_scalar_t result, p0 = { .integer = arg };
+   fail_unless(jit_fastcall(j, handle, &result, p0, p0, &tlab));
+   return result.integer;
+}
+
+START_TEST(test_case2)
+{
+   jit_t *j = jit_new(NULL);
+
+   const char *text1 =
+      "    RECV     R0, #0          \n"
+      "    $CASE    R0, #1, L1      \n"
+      "    $CASE    R0, #2, L2      \n"
+      "    $CASE    R0, #3, L3      \n"
+      "    $CASE    R0, #3, L4      \n"
+      "    $CASE    R0, #4, L4      \n"
+      "    $CASE    R0, #5, L5      \n"
+      "    $CASE    R0, #7, L7      \n"
+      "    $CASE    R0, #8, L8      \n"
+      "    $CASE    R0, #9, L9      \n"
+      "    SEND     #0, #0          \n"
+      "    RET                      \n"
+      "L1: SEND     #0, #10         \n"
+      "    RET                      \n"
+      "L2: SEND     #0, #20         \n"
+      "    RET                      \n"
+      "L3: SEND     #0, #30         \n"
+      "    RET                      \n"
+      "L4: SEND     #0, #40         \n"
+      "    RET                      \n"
+      "L5: SEND     #0, #50         \n"
+      "    RET                      \n"
+      "L7: SEND     #0, #70         \n"
+      "    RET                      \n"
+      "L8: SEND     #0, #80         \n"
+      "    RET                      \n"
+      "L9: SEND     #0, #90         \n"
+      "    RET                      \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("case2_1"), text1);
+
+   jit_switch_t sw;
+   jit_get_switch(jit_get_func(j, h1), 1, &sw);
+   ck_assert_int_eq(sw.kind, JIT_SWITCH_TABLE);
+   ck_assert_int_eq(sw.length, 9);
+   ck_assert_int_eq(sw.count, 8);
+   free(sw.cases);
+
+   const int expect1[] = { 0, 0, 10, 20, 30, 40, 50, 0, 70, 80, 90, 0 };
+   for (int i = 0; i < ARRAY_LEN(expect1); i++)
+      ck_assert_int_eq(fastcall_int(j, h1, i - 1), expect1[i]);
+
+   const char *text2 =
+      "    RECV     R0, #0          \n"
+      "    $CASE    R0, #1000, L1   \n"
+      "    $CASE    R0, #-5, L2     \n"
+      "    $CASE    R0, #17, L3     \n"
+      "    $CASE    R0, #-1000000, L4   \n"
+      "    $CASE    R0, #65536, L5  \n"
+      "    $CASE    R0, #0x10000000000, L6  \n"
+      "    $CASE    R0, #0x7fffffffffffffff, L7  \n"
+      "    $CASE    R0, #123456789, L8  \n"
+      "    SEND     #0, #0          \n"
+      "    RET                      \n"
+      "L1: SEND     #0, #1          \n"
+      "    RET                      \n"
+      "L2: SEND     #0, #2          \n"
+      "    RET                      \n"
+      "L3: SEND     #0, #3          \n"
+      "    RET                      \n"
+      "L4: SEND     #0, #4          \n"
+      "    RET                      \n"
+      "L5: SEND     #0, #5          \n"
+      "    RET                      \n"
+      "L6: SEND     #0, #6          \n"
+      "    RET                      \n"
+      "L7: SEND     #0, #7          \n"
+      "    RET                      \n"
+      "L8: SEND     #0, #8          \n"
+      "    RET                      \n";
+
+   jit_handle_t h2 = jit_assemble(j, ident_new("case2_2"), text2);
+
+   jit_get_switch(jit_get_func(j, h2), 1, &sw);
+   ck_assert_int_eq(sw.kind, JIT_SWITCH_BSEARCH);
+   ck_assert_int_eq(sw.count, 8);
+   free(sw.cases);
+
+   const int64_t values2[] = {
+      1000, -5, 17, -1000000, 65536, INT64_C(0x10000000000), INT64_MAX,
+      123456789
+   };
+   for (int i = 0; i < ARRAY_LEN(values2); i++) {
+      ck_assert_int_eq(fastcall_int(j, h2, values2[i]), i + 1);
+      ck_assert_int_eq(fastcall_int(j, h2, values2[i] - 1), 0);
+   }
+   ck_assert_int_eq(fastcall_int(j, h2, INT64_MIN), 0);
+
+   jit_free(j);
+}
+END_TEST
+
+#ifdef HAVE_LLVM
+START_TEST(test_osr1)
+{
+   opt_set_int(OPT_JIT_THRESHOLD, 1000);
+   opt_set_int(OPT_JIT_ASYNC, 0);
+
+   jit_t *j = jit_new(NULL);
+   jit_register_llvm_plugin(j);
+
+   const char *text1 =
+      "    RECV     R0, #0          \n"
+      "    $SALLOC  R1, #0, #8      \n"
+      "    MOV      R2, #0          \n"
+      "    STORE.64 R2, [R1]        \n"
+      "L1: LOAD.64  R3, [R1]        \n"
+      "    ADD      R3, R3, R2      \n"
+      "    STORE.64 R3, [R1]        \n"
+      "    ADD      R2, R2, #1      \n"
+      "    CMP.LT   R2, R0          \n"
+      "    JUMP.T   L1              \n"
+      "    LOAD.64  R4, [R1]        \n"
+      "    SEND     #0, R4          \n"
+      "    RET                      \n";
+
+   jit_handle_t h1 = jit_assemble(j, ident_new("osr1"), text1);
+
+   // Not hot enough to compile the function but the loop should be
+   // continued in LLVM compiled code part way through the first call
+   ck_assert_int_eq(fastcall_int(j, h1, 100000), INT64_C(4999950000));
+
+   jit_func_t *f = jit_get_func(j, h1);
+   ck_assert_ptr_nonnull(f->osr);
+   ck_assert_ptr_nonnull(f->osr->func);
+   ck_assert_ptr_ne((void *)f->osr->func->entry, (void *)jit_interp);
+   ck_assert_ptr_ne((void *)f->entry, (void *)jit_interp);
+
+   ck_assert_int_eq(fastcall_int(j, h1, 10), 45);
+
+   jit_free(j);
+}
+END_TEST
+#endif
+
 START_TEST(test_lscan1)
 {
    jit_t *j = jit_new(NULL);
@@ -2144,6 +2985,25 @@ Suite *get_jit_tests(void)
    tcase_add_test(tc, test_cprop2);
    tcase_add_test(tc, test_mem2reg1);
    tcase_add_test(tc, test_lscan1);
+   tcase_add_test(tc, test_gvn1);
+   tcase_add_test(tc, test_licm1);
+   tcase_add_test(tc, test_licm2);
+   tcase_add_test(tc, test_licm3);
+   tcase_add_test(tc, test_licm4);
+   tcase_add_test(tc, test_range2);
+   tcase_add_test(tc, test_range3);
+   tcase_add_test(tc, test_inline1);
+   tcase_add_test(tc, test_inline2);
+   tcase_add_test(tc, test_inline3);
+   tcase_add_test(tc, test_inline4);
+   tcase_add_test(tc, test_escape1);
+   tcase_add_test(tc, test_barrier1);
+   tcase_add_test(tc, test_escape2);
+   tcase_add_test(tc, test_mem2reg2);
+   tcase_add_test(tc, test_case2);
+#ifdef HAVE_LLVM
+   tcase_add_test(tc, test_osr1);
+#endif
    suite_add_tcase(s, tc);
 
    return s;
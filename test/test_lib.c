@@ -19,11 +19,16 @@
 #include "common.h"
 #include "lib.h"
 #include "object.h"
+#include "option.h"
+#include "sha1.h"
 #include "tree.h"
 #include "type.h"
 #include "util.h"
+#include "vlog/vlog-node.h"
+#include "vlog/vlog-number.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 static lib_t work;
 static const char *tmp;
@@ -52,6 +57,17 @@ static void teardown(void)
    }
 }
 
+static void setup_mapped(void)
+{
+   setup();
+   opt_set_int(OPT_LIB_MAPPED, 1);
+}
+
+static void reset_mapped(void)
+{
+   opt_set_int(OPT_LIB_MAPPED, 0);
+}
+
 static type_t my_int_type(void)
 {
    static type_t type = NULL;
@@ -325,6 +341,380 @@ START_TEST(test_lib_save)
 }
 END_TEST
 
+START_TEST(test_lib_mapped)
+{
+   {
+      make_new_arena();
+
+      tree_t ent = tree_new(T_ENTITY);
+      tree_set_ident(ent, ident_new("TEST_LIB.name"));
+
+      type_t e = type_new(T_ENUM);
+      type_set_ident(e, ident_new("myenum"));
+      tree_t a = tree_new(T_ENUM_LIT);
+      tree_set_ident(a, ident_new("a"));
+      tree_set_type(a, e);
+      tree_set_pos(a, 55);
+      type_enum_add_literal(e, a);
+      tree_t b = tree_new(T_ENUM_LIT);
+      tree_set_ident(b, ident_new("b"));
+      tree_set_type(b, e);
+      type_enum_add_literal(e, b);
+
+      const loc_t loc =
+         get_loc(3, 4, 3, 10, loc_file_ref("test_lib.vhd", NULL));
+
+      tree_t p1 = tree_new(T_PORT_DECL);
+      tree_set_ident(p1, ident_new("foo"));
+      tree_set_subkind(p1, PORT_OUT);
+      tree_set_type(p1, my_int_type());
+      tree_set_loc(p1, &loc);
+      tree_add_port(ent, p1);
+
+      tree_t p2 = tree_new(T_PORT_DECL);
+      tree_set_ident(p2, ident_new("bar"));
+      tree_set_subkind(p2, PORT_IN);
+      tree_set_type(p2, e);
+      tree_add_port(ent, p2);
+
+      lib_put(work, ent);
+
+      make_new_arena();
+
+      tree_t ar = tree_new(T_ARCH);
+      tree_set_ident(ar, ident_new("TEST_LIB.arch"));
+      tree_set_ident2(ar, ident_new("foo"));
+
+      tree_t pr = tree_new(T_PROCESS);
+      tree_set_ident(pr, ident_new("proc"));
+      tree_add_stmt(ar, pr);
+
+      tree_t v1 = tree_new(T_VAR_DECL);
+      tree_set_ident(v1, ident_new("v1"));
+      tree_set_type(v1, e);
+
+      tree_t r = tree_new(T_REF);
+      tree_set_ident(r, ident_new("v1"));
+      tree_set_ref(r, v1);
+
+      tree_t s = tree_new(T_VAR_ASSIGN);
+      tree_set_ident(s, ident_new("var_assign"));
+      tree_set_target(s, r);
+      tree_set_value(s, r);
+      tree_add_stmt(pr, s);
+
+      tree_t c = tree_new(T_LITERAL);
+      tree_set_subkind(c, L_INT);
+      tree_set_ival(c, 53);
+
+      tree_t s2 = tree_new(T_VAR_ASSIGN);
+      tree_set_ident(s2, ident_new("var_assign"));
+      tree_set_target(s2, r);
+      tree_set_value(s2, c);
+      tree_add_stmt(pr, s2);
+
+      tree_t s3 = tree_new(T_VAR_ASSIGN);
+      tree_set_ident(s3, ident_new("var_assign"));
+      tree_set_target(s3, r);
+      tree_set_value(s3, str_to_agg("foobar", NULL));
+      tree_add_stmt(pr, s3);
+
+      tree_t s4 = tree_new(T_ASSERT);
+      tree_set_ident(s4, ident_new("assert"));
+      tree_set_value(s4, c);
+      tree_set_severity(s4, c);
+      tree_set_message(s4, str_to_agg("message", NULL));
+      tree_add_stmt(pr, s4);
+
+      lib_put(work, ar);
+   }
+
+   lib_save(work);
+   lib_free(work);
+
+   lib_add_search_path(tmp);
+   work = lib_find(ident_new("test_lib"));
+   fail_if(work == NULL);
+
+   FILE *f = lib_fopen(work, "TEST_LIB.arch", "rb");
+   fail_if(f == NULL);
+   char magic[4];
+   fail_unless(fread(magic, sizeof(magic), 1, f) == 1);
+   fail_if(memcmp(magic, "FBUF", 4) == 0);
+   fclose(f);
+
+   {
+      tree_t ent = lib_get(work, ident_new("TEST_LIB.name"));
+      fail_if(ent == NULL);
+      fail_unless(tree_kind(ent) == T_ENTITY);
+      fail_unless(tree_ident(ent) == ident_new("TEST_LIB.name"));
+      fail_unless(tree_ports(ent) == 2);
+
+      tree_t p1 = tree_port(ent, 0);
+      fail_unless(tree_kind(p1) == T_PORT_DECL);
+      fail_unless(tree_subkind(p1) == PORT_OUT);
+      fail_unless(type_kind(tree_type(p1)) == T_INTEGER);
+      fail_unless(tree_loc(p1)->first_line == 3);
+      fail_unless(tree_loc(p1)->first_column == 4);
+      fail_unless(strcmp(loc_file_str(tree_loc(p1)), "test_lib.vhd") == 0);
+
+      tree_t p2 = tree_port(ent, 1);
+      fail_unless(tree_kind(p2) == T_PORT_DECL);
+      fail_unless(tree_subkind(p2) == PORT_IN);
+
+      type_t e = tree_type(p2);
+      fail_unless(type_kind(e) == T_ENUM);
+      fail_unless(type_enum_literals(e) == 2);
+      tree_t a = type_enum_literal(e, 0);
+      fail_unless(tree_kind(a) == T_ENUM_LIT);
+      fail_unless(tree_ident(a) == ident_new("a"));
+      fail_unless(tree_type(a) == e);
+      fail_unless(tree_pos(a) == 55);
+      tree_t b = type_enum_literal(e, 1);
+      fail_unless(tree_kind(b) == T_ENUM_LIT);
+      fail_unless(tree_ident(b) == ident_new("b"));
+      fail_unless(tree_type(b) == e);
+
+      tree_t ar = lib_get(work, ident_new("TEST_LIB.arch"));
+      fail_if(ar == NULL);
+      fail_unless(tree_ident(ar) == ident_new("TEST_LIB.arch"));
+      fail_unless(tree_ident2(ar) == ident_new("foo"));
+
+      tree_t pr = tree_stmt(ar, 0);
+      fail_unless(tree_kind(pr) == T_PROCESS);
+      fail_unless(tree_ident(pr) == ident_new("proc"));
+
+      tree_t s = tree_stmt(pr, 0);
+      fail_unless(tree_kind(s) == T_VAR_ASSIGN);
+
+      tree_t r = tree_target(s);
+      fail_unless(tree_kind(r) == T_REF);
+      fail_unless(tree_value(s) == r);
+
+      tree_t s2 = tree_stmt(pr, 1);
+      fail_unless(tree_kind(s2) == T_VAR_ASSIGN);
+      fail_unless(tree_target(s2) == r);
+
+      tree_t s3 = tree_stmt(pr, 2);
+      fail_unless(tree_kind(s3) == T_VAR_ASSIGN);
+      fail_unless(tree_target(s3) == r);
+      fail_unless(tree_kind(tree_value(s3)) == T_AGGREGATE);
+
+      tree_t s4 = tree_stmt(pr, 3);
+      fail_unless(tree_kind(s4) == T_ASSERT);
+      fail_unless(tree_ident(s4) == ident_new("assert"));
+
+      tree_t c = tree_value(s2);
+      fail_unless(tree_kind(c) == T_LITERAL);
+      fail_unless(tree_subkind(c) == L_INT);
+      fail_unless(tree_ival(c) == 53);
+
+      // Type declaration and reference written to different units
+      // so two copies of the type declaration will be read back
+      // hence can't check for pointer equality here
+      fail_unless(type_eq(tree_type(tree_ref(r)), e));
+
+      fail_if(arena_checksum(object_arena(tree_to_object(ar))) == 0);
+   }
+}
+END_TEST
+
+START_TEST(test_lib_mapped_bignum)
+{
+   make_new_arena();
+
+   vlog_node_t m = vlog_new(V_MODULE);
+   vlog_set_ident(m, ident_new("TEST_LIB.BIGNUM"));
+   vlog_set_ident2(m, ident_new("bignum"));
+
+   vlog_node_t init = vlog_new(V_INITIAL);
+   vlog_set_ident(init, ident_new("init"));
+   vlog_add_stmt(m, init);
+
+   vlog_node_t t = vlog_new(V_SYSTASK);
+   vlog_set_ident(t, ident_new("$display"));
+   vlog_add_stmt(init, t);
+
+   uint8_t bits[100];
+   for (int i = 0; i < ARRAY_LEN(bits); i++)
+      bits[i] = LOGIC_1;
+
+   vlog_node_t n = vlog_new(V_NUMBER);
+   vlog_set_number(n, number_pack(bits, ARRAY_LEN(bits)));
+   vlog_add_param(t, n);
+
+   lib_put_vlog(work, m);
+
+   // Big numbers cannot be written to an image
+   lib_save(work);
+}
+END_TEST
+
+START_TEST(test_lib_reuse)
+{
+   char *file1 LOCAL = xasprintf("%s" DIR_SEP "reuse1.vhd", tmp);
+   char *file2 LOCAL = xasprintf("%s" DIR_SEP "reuse2.vhd", tmp);
+
+   const char *files[] = { file1, file2 };
+   for (size_t i = 0; i < ARRAY_LEN(files); i++) {
+      FILE *f = fopen(files[i], "w");
+      fail_if(f == NULL);
+      fprintf(f, "-- %s\n", files[i]);
+      fclose(f);
+   }
+
+   unsigned char digest[SHA1_LEN];
+   memset(digest, 0x42, sizeof(digest));
+
+   {
+      make_new_arena();
+
+      tree_t ent = tree_new(T_ENTITY);
+      tree_set_ident(ent, ident_new("TEST_LIB.ent"));
+
+      type_t e = type_new(T_ENUM);
+      type_set_ident(e, ident_new("myenum"));
+      tree_t a = tree_new(T_ENUM_LIT);
+      tree_set_ident(a, ident_new("a"));
+      tree_set_type(a, e);
+      type_enum_add_literal(e, a);
+
+      tree_t t = tree_new(T_TYPE_DECL);
+      tree_set_ident(t, ident_new("myenum"));
+      tree_set_type(t, e);
+      tree_add_decl(ent, t);
+
+      loc_t loc = get_loc(1, 0, 1, 0, loc_file_ref(file1, NULL));
+      tree_set_loc(ent, &loc);
+
+      lib_put(work, ent);
+
+      make_new_arena();
+
+      tree_t ar = tree_new(T_ARCH);
+      tree_set_ident(ar, ident_new("TEST_LIB.ent-arch"));
+      tree_set_ident2(ar, ident_new("arch"));
+
+      tree_t c = tree_new(T_CONST_DECL);
+      tree_set_ident(c, ident_new("c"));
+      tree_set_type(c, e);
+      tree_add_decl(ar, c);
+
+      loc = get_loc(1, 0, 1, 0, loc_file_ref(file2, NULL));
+      tree_set_loc(ar, &loc);
+
+      lib_put(work, ar);
+   }
+
+   fail_if(lib_reuse_source(work, file1, digest));
+   fail_if(lib_reuse_source(work, file2, digest));
+
+   lib_save(work);
+
+   fail_unless(lib_reuse_source(work, file1, digest));
+   fail_unless(lib_reuse_source(work, file2, digest));
+
+   digest[0] = 0x43;
+   fail_if(lib_reuse_source(work, file1, digest));
+   digest[0] = 0x42;
+
+   lib_free(work);
+
+   lib_add_search_path(tmp);
+   work = lib_find(ident_new("test_lib"));
+   fail_if(work == NULL);
+
+   fail_unless(lib_reuse_source(work, file1, digest));
+   fail_unless(lib_reuse_source(work, file2, digest));
+
+   {
+      make_new_arena();
+
+      tree_t ent = tree_new(T_ENTITY);
+      tree_set_ident(ent, ident_new("TEST_LIB.ent"));
+
+      loc_t loc = get_loc(2, 0, 2, 0, loc_file_ref(file1, NULL));
+      tree_set_loc(ent, &loc);
+
+      lib_put(work, ent);
+   }
+
+   // Architecture must be reanalysed when the entity changes
+   fail_if(lib_reuse_source(work, file2, digest));
+
+   remove(file1);
+   remove(file2);
+}
+END_TEST
+
+static void count_index_fn(lib_t lib, ident_t name, int kind, void *ctx)
+{
+   ident_t *last = ctx;
+   fail_unless(kind == T_PACKAGE);
+   fail_if(*last != NULL && ident_compare(*last, name) >= 0);
+   *last = name;
+}
+
+START_TEST(test_lib_index)
+{
+   // Save enough units across separate calls to lib_save to exercise
+   // both appending to the index journal and rewriting the table
+   for (int i = 0; i < 600; i++) {
+      make_new_arena();
+
+      char name[32];
+      checked_sprintf(name, sizeof(name), "TEST_LIB.PACK%d", i);
+
+      tree_t p = tree_new(T_PACKAGE);
+      tree_set_ident(p, ident_new(name));
+      lib_put(work, p);
+
+      if (i % 50 == 49)
+         lib_save(work);
+   }
+
+   lib_free(work);
+
+   // Simulate a partial record left by a process that crashed
+   char *path LOCAL = xasprintf("%s" DIR_SEP "test_lib" DIR_SEP "_index", tmp);
+   FILE *f = fopen(path, "ab");
+   fail_if(f == NULL);
+   fwrite("\x01\x02\x03\x04\x05\x06", 6, 1, f);
+   fclose(f);
+
+   lib_add_search_path(tmp);
+   work = lib_find(ident_new("test_lib"));
+   fail_if(work == NULL);
+
+   ck_assert_int_eq(lib_index_size(work), 600);
+
+   ident_t last = NULL;
+   lib_walk_index(work, count_index_fn, &last);
+   ck_assert_str_eq(istr(last), "TEST_LIB.PACK99");
+
+   tree_t p = lib_get(work, ident_new("TEST_LIB.PACK123"));
+   fail_if(p == NULL);
+   fail_unless(tree_kind(p) == T_PACKAGE);
+
+   fail_unless(lib_get(work, ident_new("TEST_LIB.PACK600")) == NULL);
+
+   make_new_arena();
+
+   tree_t p600 = tree_new(T_PACKAGE);
+   tree_set_ident(p600, ident_new("TEST_LIB.PACK600"));
+   lib_put(work, p600);
+
+   lib_save(work);
+   lib_free(work);
+
+   work = lib_find(ident_new("test_lib"));
+   fail_if(work == NULL);
+
+   ck_assert_int_eq(lib_index_size(work), 601);
+   fail_if(lib_get(work, ident_new("TEST_LIB.PACK600")) == NULL);
+}
+END_TEST
+
 Suite *get_lib_tests(void)
 {
    Suite *s = suite_create("lib");
@@ -334,7 +724,16 @@ Suite *get_lib_tests(void)
    tcase_add_test(tc_core, test_lib_new);
    tcase_add_test(tc_core, test_lib_fopen);
    tcase_add_test(tc_core, test_lib_save);
+   tcase_add_test(tc_core, test_lib_reuse);
+   tcase_add_test(tc_core, test_lib_index);
    suite_add_tcase(s, tc_core);
 
+   TCase *tc_mapped = nvc_unit_test();
+   tcase_add_checked_fixture(tc_mapped, setup_mapped, teardown);
+   tcase_add_unchecked_fixture(tc_mapped, NULL, reset_mapped);
+   tcase_add_test(tc_mapped, test_lib_mapped);
+   tcase_add_exit_test(tc_mapped, test_lib_mapped_bignum, 1);
+   suite_add_tcase(s, tc_mapped);
+
    return s;
 }
@@ -22,6 +22,7 @@
 #include "mask.h"
 #include "option.h"
 #include "rt/heap.h"
+#include "rt/wheel.h"
 #include "thread.h"
 
 #include <assert.h>
@@ -225,6 +226,12 @@ static int magnitude_compar(const void *a, const void *b)
    return *(const uintptr_t*)a - *(const uintptr_t*)b;
 }
 
+static int key_compar(const void *a, const void *b)
+{
+   const uintptr_t ka = *(const uintptr_t*)a, kb = *(const uintptr_t*)b;
+   return (ka > kb) - (ka < kb);
+}
+
 static void walk_fn(uint64_t key, void *user, void *context)
 {
    uint64_t *last = context;
@@ -336,6 +343,170 @@ START_TEST(test_heap_delete)
 }
 END_TEST
 
+START_TEST(test_wheel_basic)
+{
+   wheel_t *w = wheel_new();
+
+   wheel_insert(w, 5, (void*)5);
+   wheel_insert(w, 2, (void*)2);
+   wheel_insert(w, 62, (void*)62);
+   wheel_insert(w, 300, (void*)300);
+   wheel_insert(w, 70000, (void*)70000);
+
+   ck_assert_int_eq(wheel_size(w), 5);
+
+   ck_assert_int_eq(wheel_min_key(w), 2);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)2);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)5);
+   ck_assert_int_eq(wheel_min_key(w), 62);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)62);
+   ck_assert_int_eq(wheel_min_key(w), 300);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)300);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)70000);
+
+   ck_assert_int_eq(wheel_size(w), 0);
+
+   wheel_free(w);
+}
+END_TEST
+
+START_TEST(test_wheel_fifo)
+{
+   wheel_t *w = wheel_new();
+
+   // Events with equal keys come out in the order they were inserted
+   // including after being cascaded down from a higher level
+   wheel_insert(w, 10, (void*)1);
+   wheel_insert(w, 5, (void*)2);
+   wheel_insert(w, 10, (void*)3);
+   wheel_insert(w, 100000, (void*)4);
+   wheel_insert(w, 10, (void*)5);
+   wheel_insert(w, 5, (void*)6);
+   wheel_insert(w, 100000, (void*)7);
+
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)2);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)6);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)1);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)3);
+
+   wheel_insert(w, 100000, (void*)8);
+   wheel_insert(w, 10, (void*)9);
+
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)5);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)9);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)4);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)7);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)8);
+
+   ck_assert_int_eq(wheel_size(w), 0);
+
+   wheel_free(w);
+}
+END_TEST
+
+START_TEST(test_wheel_rand)
+{
+   wheel_t *w = wheel_new();
+
+   static const int N = 1024;
+   uintptr_t keys[N];
+
+   for (int i = 0; i < N; i++) {
+      // Spread over all levels and the overflow heap
+      keys[i] = (uintptr_t)rand() << (rand() % 16);
+      wheel_insert(w, keys[i], (void*)keys[i]);
+   }
+
+   qsort(keys, N, sizeof(uintptr_t), key_compar);
+
+   for (int i = 0; i < N; i++) {
+      ck_assert_int_eq(wheel_min_key(w), keys[i]);
+      ck_assert_ptr_eq(wheel_extract_min(w), (void*)keys[i]);
+   }
+
+   ck_assert_int_eq(wheel_size(w), 0);
+
+   wheel_free(w);
+}
+END_TEST
+
+START_TEST(test_wheel_delete)
+{
+   wheel_t *w = wheel_new();
+
+   static const int N = 1024;
+   uintptr_t keys[N];
+
+   for (int i = 0; i < N; i++) {
+      keys[i] = 1 + rand() % 10000;
+      if (i % 8 == 0)
+         keys[i] += UINT64_C(1) << 40;   // In the overflow heap
+      wheel_insert(w, keys[i], (void*)keys[i]);
+   }
+
+   int deleted = 0;
+   for (int i = 0; i < N; i++) {
+      if (rand() % 20 == 0 || i == 0) {
+         ck_assert(wheel_delete(w, heap_delete_cb, (void*)keys[i]));
+         keys[i] = 0;
+         deleted++;
+      }
+   }
+
+   ck_assert(!wheel_delete(w, heap_delete_cb, (void*)99999));
+   ck_assert_int_eq(wheel_size(w), N - deleted);
+
+   qsort(keys, N, sizeof(uintptr_t), key_compar);
+
+   for (int i = 0; i < deleted; i++)
+      ck_assert_int_eq(keys[i], 0);
+
+   for (int i = deleted; i < N; i++)
+      ck_assert_ptr_eq(wheel_extract_min(w), (void*)keys[i]);
+
+   ck_assert_int_eq(wheel_size(w), 0);
+
+   wheel_free(w);
+}
+END_TEST
+
+START_TEST(test_wheel_overflow)
+{
+   wheel_t *w = wheel_new();
+
+   const uint64_t far = UINT64_C(1) << 40;
+
+   wheel_insert(w, 3, (void*)1);
+   wheel_insert(w, far + 5, (void*)2);
+   wheel_insert(w, far, (void*)3);
+
+   ck_assert_int_eq(wheel_size(w), 3);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)1);
+   ck_assert_int_eq(wheel_min_key(w), far);
+
+   // Jumping forward to the earliest far future event moves the rest
+   // that are now in range from the overflow heap onto the wheel
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)3);
+   ck_assert_int_eq(wheel_size(w), 1);
+
+   wheel_insert(w, far + 5, (void*)4);
+   wheel_insert(w, far + 1, (void*)5);
+   wheel_insert(w, far * 2, (void*)6);
+
+   ck_assert_int_eq(wheel_size(w), 4);
+   ck_assert_int_eq(wheel_min_key(w), far + 1);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)5);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)2);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)4);
+   ck_assert_int_eq(wheel_min_key(w), far * 2);
+   ck_assert_ptr_eq(wheel_extract_min(w), (void*)6);
+
+   ck_assert_int_eq(wheel_size(w), 0);
+
+   wheel_free(w);
+}
+END_TEST
+
 START_TEST(test_color_printf)
 {
    setenv("NVC_COLORS", "always", 1);
@@ -498,6 +669,30 @@ START_TEST(test_scan_backwards)
 }
 END_TEST
 
+START_TEST(test_test_and_set)
+{
+   bit_mask_t m;
+   mask_init(&m, mask_size[_i]);
+
+   fail_if(mask_test_and_set(&m, 3));
+   fail_unless(mask_test_and_set(&m, 3));
+   fail_unless(mask_test(&m, 3));
+   ck_assert_int_eq(mask_popcount(&m), 1);
+
+   mask_set_range_atomic(&m, 5, mask_size[_i] - 6);
+   ck_assert_int_eq(mask_popcount(&m), mask_size[_i] - 5);
+   fail_if(mask_test(&m, 4));
+   fail_unless(mask_test(&m, 5));
+   fail_unless(mask_test(&m, mask_size[_i] - 2));
+   fail_if(mask_test(&m, mask_size[_i] - 1));
+
+   fail_if(mask_test_and_set(&m, mask_size[_i] - 1));
+   ck_assert_int_eq(mask_count_clear(&m, 0), 3);
+
+   mask_free(&m);
+}
+END_TEST
+
 START_TEST(test_subtract)
 {
    bit_mask_t m1, m2;
@@ -729,6 +924,47 @@ START_TEST(test_barrier)
 }
 END_TEST
 
+START_TEST(test_fbuf_chunks)
+{
+   // Large enough to be split into several independently compressed
+   // chunks which must still produce a single Adler-32 checksum
+   const int N = 1000000;
+
+   fbuf_t *f = fbuf_open("test.fbuf", FBUF_OUT, FBUF_CS_ADLER32);
+   fail_if(f == NULL);
+
+   uint32_t s1 = 1, s2 = 0;
+   for (int i = 0; i < N; i++) {
+      const uint32_t value = i * 7;
+      write_u32(value, f);
+
+      for (int j = 0; j < 4; j++) {
+         s1 = (s1 + ((value >> (j * 8)) & 0xff)) % 65521;
+         s2 = (s2 + s1) % 65521;
+      }
+   }
+
+   uint32_t wcs;
+   fbuf_close(f, &wcs);
+   ck_assert_int_eq(wcs, (s1 << 16) | s2);
+
+   f = fbuf_open("test.fbuf", FBUF_IN, FBUF_CS_ADLER32);
+   fail_if(f == NULL);
+
+   int nbad = 0;
+   for (int i = 0; i < N; i++)
+      nbad += (read_u32(f) != i * 7);
+
+   ck_assert_int_eq(nbad, 0);
+
+   uint32_t rcs;
+   fbuf_close(f, &rcs);
+   ck_assert_int_eq(rcs, wcs);
+
+   remove("test.fbuf");
+}
+END_TEST
+
 Suite *get_misc_tests(void)
 {
    Suite *s = suite_create("misc");
@@ -753,11 +989,17 @@ Suite *get_misc_tests(void)
    tcase_add_test(tc_heap, test_heap_rand);
    tcase_add_test(tc_heap, test_heap_walk);
    tcase_add_test(tc_heap, test_heap_delete);
+   tcase_add_test(tc_heap, test_wheel_basic);
+   tcase_add_test(tc_heap, test_wheel_fifo);
+   tcase_add_test(tc_heap, test_wheel_rand);
+   tcase_add_test(tc_heap, test_wheel_delete);
+   tcase_add_test(tc_heap, test_wheel_overflow);
    suite_add_tcase(s, tc_heap);
 
    TCase *tc_util = tcase_create("util");
    tcase_add_test(tc_util, test_color_printf);
    tcase_add_test(tc_util, test_strip);
+   tcase_add_test(tc_util, test_fbuf_chunks);
    suite_add_tcase(s, tc_util);
 
    TCase *tc_mask = tcase_create("mask");
@@ -765,6 +1007,7 @@ Suite *get_misc_tests(void)
    tcase_add_loop_test(tc_mask, test_set_clear_range, 0, ARRAY_LEN(mask_size));
    tcase_add_loop_test(tc_mask, test_count_clear, 0, ARRAY_LEN(mask_size));
    tcase_add_loop_test(tc_mask, test_scan_backwards, 0, ARRAY_LEN(mask_size));
+   tcase_add_loop_test(tc_mask, test_test_and_set, 0, ARRAY_LEN(mask_size));
    tcase_add_loop_test(tc_mask, test_subtract, 0, ARRAY_LEN(mask_size));
    tcase_add_test(tc_mask, test_empty_mask);
    tcase_add_test(tc_mask, test_mask_iter);
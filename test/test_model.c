@@ -105,18 +105,30 @@ START_TEST(test_index1)
    ck_assert_int_eq(ss1->n_nexus, 21);
    ck_assert_int_eq(ss1->nexus.width, 8);
    ck_assert_ptr_nonnull(ss1->index);
-   ck_assert_int_eq(ss1->index->how, 3);
-   ck_assert_ptr_eq(ss1->index->nexus[0], &(ss1->nexus));
-   ck_assert_ptr_nonnull(ss1->index->nexus[20]);
-   ck_assert_ptr_null(ss1->index->nexus[21]);
+   ck_assert_int_eq(ss1->index->levels, 2);
+   ck_assert_int_eq(ss1->index->root->mask, 0x7);
+
+   rt_index_node_t *n1 = ss1->index->root->child[0];
+   ck_assert_int_eq(n1->mask, 0x0101010101010101);
+   ck_assert_ptr_eq(n1->child[0], &(ss1->nexus));
+
+   rt_index_node_t *n2 = ss1->index->root->child[2];
+   ck_assert_int_eq(n2->mask, 0x101010101);
+   ck_assert_ptr_nonnull(n2->child[32]);
+   ck_assert_ptr_null(((rt_nexus_t *)n2->child[32])->chain);
 
    ck_assert_int_eq(ss2->n_nexus, 41);
    ck_assert_int_eq(ss2->nexus.width, 10);
    ck_assert_ptr_nonnull(ss2->index);
-   ck_assert_int_eq(ss2->index->how, -10);
-   ck_assert_ptr_eq(ss2->index->nexus[0], &(ss2->nexus));
-   ck_assert_ptr_nonnull(ss2->index->nexus[40]);
-   ck_assert_ptr_null(ss2->index->nexus[41]);
+   ck_assert_int_eq(ss2->index->levels, 2);
+   ck_assert_int_eq(ss2->index->root->mask, 0x7f);
+
+   rt_index_node_t *n3 = ss2->index->root->child[0];
+   ck_assert_ptr_eq(n3->child[0], &(ss2->nexus));
+
+   rt_index_node_t *n4 = ss2->index->root->child[6];
+   ck_assert_ptr_nonnull(n4->child[16]);
+   ck_assert_ptr_null(((rt_nexus_t *)n4->child[16])->chain);
 
    model_free(m);
    jit_free(j);
@@ -277,6 +277,115 @@ START_TEST(test_end_ptr)
 }
 END_TEST
 
+START_TEST(test_tree)
+{
+   struct tree {
+      struct tree *left;
+      struct tree *right;
+      int          value;
+   };
+
+   mspace_t *m = mspace_new(256 * 1024);
+
+   // Enough objects that marking is split between several threads when
+   // more than one is available
+   const int nnodes = 2047;
+   struct tree **nodes = xmalloc_array(nnodes, sizeof(struct tree *));
+
+   // The malloc heap is not scanned so the tree is only reachable
+   // through this root
+   mptr_t root = mptr_new(m, "tree");
+
+   for (int i = 0; i < nnodes; i++) {
+      struct tree *t = mspace_alloc(m, sizeof(struct tree));
+      t->left = t->right = NULL;
+      t->value = i;
+
+      if (i == 0)
+         *mptr_get(root) = t;
+      else if (i % 2 == 1)
+         nodes[(i - 1) / 2]->left = t;
+      else
+         nodes[(i - 1) / 2]->right = t;
+
+      nodes[i] = t;
+   }
+
+   free(nodes);
+
+   // Do enough allocations to trigger several GCs
+   generate_garbage(m, 20000, 5 * sizeof(int));
+
+   int sum = 0, count = 0;
+   struct tree *stack[64];
+   int sp = 0;
+   stack[sp++] = *mptr_get(root);
+   while (sp > 0) {
+      struct tree *t = stack[--sp];
+      sum += t->value;
+      count++;
+      if (t->left != NULL)
+         stack[sp++] = t->left;
+      if (t->right != NULL)
+         stack[sp++] = t->right;
+   }
+
+   ck_assert_int_eq(count, nnodes);
+   ck_assert_int_eq(sum, nnodes * (nnodes - 1) / 2);
+
+   mptr_free(m, &root);
+   mspace_destroy(m);
+}
+END_TEST
+
+START_TEST(test_barrier)
+{
+   struct list {
+      struct list *next;
+      int value;
+   };
+
+   mspace_t *m = mspace_new(64 * 1024);
+
+   // The head is promoted by the first minor collection and later
+   // nodes are only reachable through pointers stored into old objects
+   struct list *head = mspace_alloc_barrier(m, sizeof(struct list));
+   head->value = 0;
+   head->next = NULL;
+
+   mptr_t root = mptr_new(m, "list");
+   *mptr_get(root) = head;
+   head = NULL;
+
+   struct list *tail = *mptr_get(root);
+   for (int i = 1; i < 100; i++) {
+      generate_garbage(m, 100, 5 * sizeof(int));
+
+      struct list *l = mspace_alloc_barrier(m, sizeof(struct list));
+      l->value = i;
+      l->next = NULL;
+
+      mspace_write_barrier(m, &(tail->next), sizeof(struct list *));
+      tail->next = l;
+      tail = l;
+   }
+
+   tail = NULL;
+
+   // Do enough allocations to trigger several GCs
+   generate_garbage(m, 20000, 5 * sizeof(int));
+
+   struct list *it = *mptr_get(root);
+   for (int i = 0; i < 100; i++, it = it->next)
+      ck_assert_int_eq(it->value, i);
+
+   ck_assert_ptr_null(it);
+
+   mptr_free(m, &root);
+   mspace_destroy(m);
+}
+END_TEST
+
 Suite *get_mspace_tests(void)
 {
    Suite *s = suite_create("mspace");
@@ -291,6 +400,8 @@ Suite *get_mspace_tests(void)
    tcase_add_test(tc, test_linked_list);
    tcase_add_test(tc, test_tlab);
    tcase_add_test(tc, test_end_ptr);
+   tcase_add_test(tc, test_tree);
+   tcase_add_test(tc, test_barrier);
    suite_add_tcase(s, tc);
 
    return s;
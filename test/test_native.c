@@ -874,6 +874,103 @@ START_TEST(test_case)
 }
 END_TEST
 
+START_TEST(test_case2)
+{
+   jit_t *j = get_native_jit();
+
+   const char *text1 =
+      "    RECV     R0, #0          \n"
+      "    $CASE    R0, #1, L1      \n"
+      "    $CASE    R0, #2, L2      \n"
+      "    $CASE    R0, #3, L3      \n"
+      "    $CASE    R0, #3, L4      \n"
+      "    $CASE    R0, #4, L4      \n"
+      "    $CASE    R0, #5, L5      \n"
+      "    $CASE    R0, #7, L7      \n"
+      "    $CASE    R0, #8, L8      \n"
+      "    $CASE    R0, #9, L9      \n"
+      "    SEND     #0, #0          \n"
+      "    RET                      \n"
+      "L1: SEND     #0, #10         \n"
+      "    RET                      \n"
+      "L2: SEND     #0, #20         \n"
+      "    RET                      \n"
+      "L3: SEND     #0, #30         \n"
+      "    RET                      \n"
+      "L4: SEND     #0, #40         \n"
+      "    RET                      \n"
+      "L5: SEND     #0, #50         \n"
+      "    RET                      \n"
+      "L7: SEND     #0, #70         \n"
+      "    RET                      \n"
+      "L8: SEND     #0, #80         \n"
+      "    RET                      \n"
+      "L9: SEND     #0, #90         \n"
+      "    RET                      \n";
+
+   jit_handle_t h1 = assemble(j, text1, "case2_1", "I");
+
+   jit_switch_t sw;
+   jit_get_switch(jit_get_func(j, h1), 1, &sw);
+   ck_assert_int_eq(sw.kind, JIT_SWITCH_TABLE);
+   ck_assert_int_eq(sw.length, 9);
+   ck_assert_int_eq(sw.count, 8);
+   free(sw.cases);
+
+   const int expect1[] = { 0, 0, 10, 20, 30, 40, 50, 0, 70, 80, 90, 0 };
+   for (int i = 0; i < ARRAY_LEN(expect1); i++)
+      ck_assert_int_eq(jit_call(j, h1, (int64_t)i - 1).integer, expect1[i]);
+
+   const char *text2 =
+      "    RECV     R0, #0          \n"
+      "    $CASE    R0, #1000, L1   \n"
+      "    $CASE    R0, #-5, L2     \n"
+      "    $CASE    R0, #17, L3     \n"
+      "    $CASE    R0, #-1000000, L4   \n"
+      "    $CASE    R0, #65536, L5  \n"
+      "    $CASE    R0, #0x10000000000, L6  \n"
+      "    $CASE    R0, #0x7fffffffffffffff, L7  \n"
+      "    $CASE    R0, #123456789, L8  \n"
+      "    SEND     #0, #0          \n"
+      "    RET                      \n"
+      "L1: SEND     #0, #1          \n"
+      "    RET                      \n"
+      "L2: SEND     #0, #2          \n"
+      "    RET                      \n"
+      "L3: SEND     #0, #3          \n"
+      "    RET                      \n"
+      "L4: SEND     #0, #4          \n"
+      "    RET                      \n"
+      "L5: SEND     #0, #5          \n"
+      "    RET                      \n"
+      "L6: SEND     #0, #6          \n"
+      "    RET                      \n"
+      "L7: SEND     #0, #7          \n"
+      "    RET                      \n"
+      "L8: SEND     #0, #8          \n"
+      "    RET                      \n";
+
+   jit_handle_t h2 = assemble(j, text2, "case2_2", "I");
+
+   jit_get_switch(jit_get_func(j, h2), 1, &sw);
+   ck_assert_int_eq(sw.kind, JIT_SWITCH_BSEARCH);
+   ck_assert_int_eq(sw.count, 8);
+   free(sw.cases);
+
+   const int64_t values2[] = {
+      1000, -5, 17, -1000000, 65536, INT64_C(0x10000000000), INT64_MAX,
+      123456789
+   };
+   for (int i = 0; i < ARRAY_LEN(values2); i++) {
+      ck_assert_int_eq(jit_call(j, h2, values2[i]).integer, i + 1);
+      ck_assert_int_eq(jit_call(j, h2, values2[i] - 1).integer, 0);
+   }
+   ck_assert_int_eq(jit_call(j, h2, INT64_MIN).integer, 0);
+
+   jit_free(j);
+}
+END_TEST
+
 START_TEST(test_exp)
 {
    jit_t *j = get_native_jit();
@@ -1225,6 +1322,47 @@ START_TEST(test_sub)
 }
 END_TEST
 
+START_TEST(test_osr)
+{
+   opt_set_int(OPT_JIT_THRESHOLD, 1000);
+   opt_set_int(OPT_JIT_ASYNC, 0);
+
+   jit_t *j = jit_new(NULL);
+   jit_register_native_plugin(j);
+
+   const char *text1 =
+      "    RECV     R0, #0          \n"
+      "    $SALLOC  R1, #0, #8      \n"
+      "    MOV      R2, #0          \n"
+      "    STORE.64 R2, [R1]        \n"
+      "L1: LOAD.64  R3, [R1]        \n"
+      "    ADD      R3, R3, R2      \n"
+      "    STORE.64 R3, [R1]        \n"
+      "    ADD      R2, R2, #1      \n"
+      "    CMP.LT   R2, R0          \n"
+      "    JUMP.T   L1              \n"
+      "    LOAD.64  R4, [R1]        \n"
+      "    SEND     #0, R4          \n"
+      "    RET                      \n";
+
+   jit_handle_t h1 = assemble(j, text1, "osr1", "I");
+
+   // Not hot enough to compile the function but the loop should be
+   // continued in compiled code part way through the first call
+   ck_assert_int_eq(jit_call(j, h1, 100000).integer, INT64_C(4999950000));
+
+   jit_func_t *f = jit_get_func(j, h1);
+   ck_assert_ptr_nonnull(f->osr);
+   ck_assert_ptr_nonnull(f->osr->func);
+   ck_assert_ptr_ne((void *)f->osr->func->entry, (void *)jit_interp);
+   ck_assert_ptr_ne((void *)f->entry, (void *)jit_interp);
+
+   ck_assert_int_eq(jit_call(j, h1, 10).integer, 45);
+
+   jit_free(j);
+}
+END_TEST
+
 Suite *get_native_tests(void)
 {
    Suite *s = suite_create("native");
@@ -1247,12 +1385,14 @@ Suite *get_native_tests(void)
    tcase_add_test(tc, test_neg);
    tcase_add_test(tc, test_clamp);
    tcase_add_test(tc, test_case);
+   tcase_add_test(tc, test_case2);
    tcase_add_test(tc, test_exp);
    tcase_add_test(tc, test_float);
    tcase_add_test(tc, test_ccmp);
    tcase_add_test(tc, test_memset);
    tcase_add_test(tc, test_move);
    tcase_add_test(tc, test_sub);
+   tcase_add_test(tc, test_osr);
    suite_add_tcase(s, tc);
 
    return s;
@@ -0,0 +1,126 @@
+//
+//  Copyright (C) 2024  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "util.h"
+#include "option.h"
+#include "thread.h"
+#include "rt/heap.h"
+#include "rt/wheel.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#define NUM_EVENTS 10000
+#define NUM_STEPS  10000000
+#define NUM_DELAYS 8
+#define NS         UINT64_C(1000000)
+
+// Typical clock periods and gate delays in femtoseconds with the odd
+// far future timeout that lands in the overflow heap
+static const uint64_t delays[NUM_DELAYS] = {
+   1 * NS, 2 * NS, 5 * NS, 5 * NS, 10 * NS, 10 * NS, 20 * NS, 10000000 * NS
+};
+
+static uint64_t rng_state = 12345;
+
+static inline unsigned next_rand(void)
+{
+   rng_state = rng_state * UINT64_C(6364136223846793005) + 1;
+   return rng_state >> 33;
+}
+
+static uint64_t next_delay(void)
+{
+   const unsigned r = next_rand();
+   if (r % 1000 == 0)
+      return delays[NUM_DELAYS - 1];
+   else
+      return delays[r % (NUM_DELAYS - 1)] + r % 7;
+}
+
+static uint64_t run_heap(void)
+{
+   heap_t *h = heap_new(NUM_EVENTS);
+   rng_state = 12345;
+
+   for (intptr_t i = 0; i < NUM_EVENTS; i++)
+      heap_insert(h, next_delay(), (void *)i);
+
+   uint64_t now = 0, sum = 0;
+   for (int i = 0; i < NUM_STEPS; i++) {
+      now = heap_min_key(h);
+      sum += now;
+      (void)heap_extract_min(h);
+      heap_insert(h, now + next_delay(), (void *)(intptr_t)i);
+   }
+
+   heap_free(h);
+   return sum;
+}
+
+static uint64_t run_wheel(void)
+{
+   wheel_t *w = wheel_new();
+   rng_state = 12345;
+
+   for (intptr_t i = 0; i < NUM_EVENTS; i++)
+      wheel_insert(w, next_delay(), (void *)i);
+
+   uint64_t now = 0, sum = 0;
+   for (int i = 0; i < NUM_STEPS; i++) {
+      now = wheel_min_key(w);
+      sum += now;
+      (void)wheel_extract_min(w);
+      wheel_insert(w, now + next_delay(), (void *)(intptr_t)i);
+   }
+
+   wheel_free(w);
+   return sum;
+}
+
+int main(int argc, char **argv)
+{
+   term_init();
+   set_default_options();
+   thread_init();
+   register_signal_handlers();
+
+   const uint64_t heap_start = get_timestamp_us();
+   const uint64_t heap_sum = run_heap();
+   const uint64_t heap_us = get_timestamp_us() - heap_start;
+
+   const uint64_t wheel_start = get_timestamp_us();
+   const uint64_t wheel_sum = run_wheel();
+   const uint64_t wheel_us = get_timestamp_us() - wheel_start;
+
+   printf("heap:  %"PRIu64" ms (%.1f ns/event)\n", heap_us / 1000,
+          heap_us * 1000.0 / NUM_STEPS);
+   printf("wheel: %"PRIu64" ms (%.1f ns/event)\n", wheel_us / 1000,
+          wheel_us * 1000.0 / NUM_STEPS);
+
+   // Events with equal keys may be dequeued in a different order but
+   // the sequence of times must be identical
+   if (heap_sum != wheel_sum) {
+      fprintf(stderr, "checksum mismatch %"PRIu64" != %"PRIu64"\n",
+              heap_sum, wheel_sum);
+      return 1;
+   }
+
+   return 0;
+}